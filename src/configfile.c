@@ -111,10 +111,14 @@ static cf_global_option_t cf_global_options[] =
 	{"WriteThreads", NULL, "5"},
 	{"WriteQueueLimitHigh", NULL, NULL},
 	{"WriteQueueLimitLow", NULL, NULL},
+	{"NotificationRateLimit", NULL, NULL},
+	{"NotificationFlapThreshold", NULL, NULL},
+	{"NotificationFlapWindow", NULL, NULL},
 	{"Timeout",     NULL, "2"},
 	{"AutoLoadPlugin", NULL, "false"},
 	{"PreCacheChain",  NULL, "PreCache"},
-	{"PostCacheChain", NULL, "PostCache"}
+	{"PostCacheChain", NULL, "PostCache"},
+	{"RegexEngine", NULL, "POSIX"}
 };
 static int cf_global_options_num = STATIC_ARRAY_SIZE (cf_global_options);
 
@@ -293,6 +297,14 @@ static int dispatch_loadplugin (const oconfig_item_t *ci)
 
 			ctx.interval = DOUBLE_TO_CDTIME_T (interval);
 		}
+		else if (strcasecmp ("SampleInterval", ci->children[i].key) == 0) {
+			double interval = 0.0;
+
+			if (cf_util_get_double (ci->children + i, &interval) != 0)
+				continue;
+
+			ctx.sample_interval = DOUBLE_TO_CDTIME_T (interval);
+		}
 		else {
 			WARNING("Ignoring unknown LoadPlugin option \"%s\" "
 					"for plugin \"%s\"",
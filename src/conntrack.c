@@ -29,9 +29,79 @@
 # error "No applicable input method."
 #endif
 
+#if HAVE_CTNETLINK_STATS
+# include <asm/types.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <linux/netlink.h>
+# include <linux/netfilter/nfnetlink.h>
+# include <linux/netfilter/nfnetlink_conntrack.h>
+#endif
+
 #define CONNTRACK_FILE "/proc/sys/net/netfilter/nf_conntrack_count"
 #define CONNTRACK_MAX_FILE "/proc/sys/net/netfilter/nf_conntrack_max"
 
+static const char *config_keys[] =
+{
+	"Statistics",
+	"ReportByCpu"
+};
+static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+
+static _Bool report_statistics = 0;
+static _Bool report_by_cpu = 0;
+
+#if HAVE_CTNETLINK_STATS
+/* Per-CPU counters of the connection tracking subsystem, as reported by
+ * IPCTNL_MSG_CT_GET_STATS_CPU. Counters which the kernel no longer updates
+ * are not collected. */
+static const struct
+{
+	int attr;
+	const char *name;
+} conntrack_counters[] =
+{
+	{ CTA_STATS_FOUND,          "found" },
+	{ CTA_STATS_INVALID,        "invalid" },
+	{ CTA_STATS_INSERT,         "insert" },
+	{ CTA_STATS_INSERT_FAILED,  "insert_failed" },
+	{ CTA_STATS_DROP,           "drop" },
+	{ CTA_STATS_EARLY_DROP,     "early_drop" },
+	{ CTA_STATS_ERROR,          "error" },
+	{ CTA_STATS_SEARCH_RESTART, "search_restart" }
+};
+#define CONNTRACK_COUNTERS_NUM STATIC_ARRAY_SIZE (conntrack_counters)
+
+typedef struct
+{
+	uint32_t global[CTA_STATS_GLOBAL_MAX + 1];
+	_Bool    have_global[CTA_STATS_GLOBAL_MAX + 1];
+
+	derive_t counters[CONNTRACK_COUNTERS_NUM];
+} conntrack_nl_stats_t;
+
+/* The netlink socket is kept open between reads. If it can't be used, e.g.
+ * because nf_conntrack_netlink isn't available, the plugin falls back to the
+ * files in /proc. */
+static int nl_fd = -1;
+static uint32_t nl_seq = 0;
+static _Bool nl_disabled = 0;
+
+static char nl_buffer[8192];
+#endif /* HAVE_CTNETLINK_STATS */
+
+static int conntrack_config (const char *key, const char *value)
+{
+	if (strcasecmp (key, "Statistics") == 0)
+		report_statistics = IS_TRUE (value) ? 1 : 0;
+	else if (strcasecmp (key, "ReportByCpu") == 0)
+		report_by_cpu = IS_TRUE (value) ? 1 : 0;
+	else
+		return (-1);
+
+	return (0);
+} /* int conntrack_config */
+
 static void conntrack_submit (const char *type, const char *type_instance,
 			      value_t conntrack)
 {
@@ -49,14 +119,23 @@ static void conntrack_submit (const char *type, const char *type_instance,
 	plugin_dispatch_values (&vl);
 } /* static void conntrack_submit */
 
-static int conntrack_read (void)
+static void conntrack_submit_usage (value_t conntrack, value_t conntrack_max)
+{
+	value_t conntrack_pct;
+
+	conntrack_submit ("conntrack", NULL, conntrack);
+	conntrack_submit ("conntrack", "max", conntrack_max);
+	conntrack_pct.gauge = (conntrack.gauge / conntrack_max.gauge) * 100;
+	conntrack_submit ("percent", "used", conntrack_pct);
+} /* void conntrack_submit_usage */
+
+static int conntrack_read_file (const char *file, value_t *ret_value)
 {
-	value_t conntrack, conntrack_max, conntrack_pct;
 	FILE *fh;
 	char buffer[64];
 	size_t buffer_len;
 
-	fh = fopen (CONNTRACK_FILE, "r");
+	fh = fopen (file, "r");
 	if (fh == NULL)
 		return (-1);
 
@@ -76,43 +155,334 @@ static int conntrack_read (void)
 		buffer_len--;
 	}
 
-	if (parse_value (buffer, &conntrack, DS_TYPE_GAUGE) != 0)
+	if (parse_value (buffer, ret_value, DS_TYPE_GAUGE) != 0)
 		return (-1);
 
-	conntrack_submit ("conntrack", NULL, conntrack);
+	return (0);
+} /* int conntrack_read_file */
 
-	fh = fopen (CONNTRACK_MAX_FILE, "r");
-	if (fh == NULL)
-		return (-1);
+static int conntrack_read_proc (void)
+{
+	value_t conntrack, conntrack_max;
 
-	memset (buffer, 0, sizeof (buffer));
-	if (fgets (buffer, sizeof (buffer), fh) == NULL)
+	if (conntrack_read_file (CONNTRACK_FILE, &conntrack) != 0)
+		return (-1);
+	if (conntrack_read_file (CONNTRACK_MAX_FILE, &conntrack_max) != 0)
 	{
-		fclose (fh);
+		conntrack_submit ("conntrack", NULL, conntrack);
 		return (-1);
 	}
-	fclose (fh);
 
-	/* strip trailing newline. */
-	buffer_len = strlen (buffer);
-	while ((buffer_len > 0) && isspace ((int) buffer[buffer_len - 1]))
+	conntrack_submit_usage (conntrack, conntrack_max);
+	return (0);
+} /* int conntrack_read_proc */
+
+#if HAVE_CTNETLINK_STATS
+static int conntrack_nl_open (void)
+{
+	struct sockaddr_nl sa;
+
+	nl_fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+	if (nl_fd < 0)
+		return (errno);
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind (nl_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
 	{
-		buffer[buffer_len - 1] = 0;
-		buffer_len--;
+		int status = errno;
+		close (nl_fd);
+		nl_fd = -1;
+		return (status);
 	}
 
-	if (parse_value (buffer, &conntrack_max, DS_TYPE_GAUGE) != 0)
-		return (-1);
+	return (0);
+} /* int conntrack_nl_open */
 
-	conntrack_submit ("conntrack", "max", conntrack_max);
-	conntrack_pct.gauge = (conntrack.gauge / conntrack_max.gauge) * 100;
-	conntrack_submit ("percent", "used", conntrack_pct);
+/* Parses the attributes following the nfgenmsg header. All attributes used
+ * here are 32 bit values in network byte order. */
+static void conntrack_nl_parse (const struct nlmsghdr *nlh,
+		uint32_t *values, _Bool *have_values, int max_type)
+{
+	const struct nlattr *attr;
+	int len;
+
+	attr = (const struct nlattr *) (((const char *) NLMSG_DATA (nlh))
+			+ NLMSG_ALIGN (sizeof (struct nfgenmsg)));
+	len = (int) nlh->nlmsg_len - NLMSG_LENGTH (sizeof (struct nfgenmsg));
+
+	while ((len >= (int) sizeof (*attr))
+			&& (attr->nla_len >= sizeof (*attr))
+			&& (attr->nla_len <= len))
+	{
+		int type = attr->nla_type & NLA_TYPE_MASK;
+
+		if ((type <= max_type)
+				&& (attr->nla_len >= NLA_HDRLEN + sizeof (uint32_t)))
+		{
+			uint32_t tmp;
+
+			memcpy (&tmp, ((const char *) attr) + NLA_HDRLEN, sizeof (tmp));
+			values[type] = ntohl (tmp);
+			have_values[type] = 1;
+		}
+
+		len -= NLA_ALIGN (attr->nla_len);
+		attr = (const struct nlattr *) (((const char *) attr)
+				+ NLA_ALIGN (attr->nla_len));
+	}
+} /* void conntrack_nl_parse */
+
+static void conntrack_nl_handle_cpu (const struct nlmsghdr *nlh,
+		conntrack_nl_stats_t *stats)
+{
+	const struct nfgenmsg *nfg = NLMSG_DATA (nlh);
+	uint32_t values[CTA_STATS_MAX + 1];
+	_Bool have_values[CTA_STATS_MAX + 1];
+	size_t i;
 
+	memset (values, 0, sizeof (values));
+	memset (have_values, 0, sizeof (have_values));
+	conntrack_nl_parse (nlh, values, have_values, CTA_STATS_MAX);
+
+	for (i = 0; i < CONNTRACK_COUNTERS_NUM; i++)
+		stats->counters[i] += (derive_t) values[conntrack_counters[i].attr];
+
+	if (report_by_cpu)
+	{
+		value_list_t vl = VALUE_LIST_INIT;
+		value_t value;
+
+		vl.values = &value;
+		vl.values_len = 1;
+		sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+		sstrncpy (vl.plugin, "conntrack", sizeof (vl.plugin));
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"%i", (int) ntohs (nfg->res_id));
+		sstrncpy (vl.type, "operations", sizeof (vl.type));
+
+		for (i = 0; i < CONNTRACK_COUNTERS_NUM; i++)
+		{
+			if (!have_values[conntrack_counters[i].attr])
+				continue;
+
+			value.derive = (derive_t) values[conntrack_counters[i].attr];
+			sstrncpy (vl.type_instance, conntrack_counters[i].name,
+					sizeof (vl.type_instance));
+			plugin_dispatch_values (&vl);
+		}
+	}
+} /* void conntrack_nl_handle_cpu */
+
+/* Sends a ctnetlink request and processes the replies. Returns zero on
+ * success and an errno value otherwise. */
+static int conntrack_nl_query (int msg_type, _Bool dump,
+		conntrack_nl_stats_t *stats)
+{
+	struct
+	{
+		struct nlmsghdr nlh;
+		struct nfgenmsg nfg;
+	} req;
+	struct sockaddr_nl sa;
+	uint32_t seq;
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+
+	seq = ++nl_seq;
+
+	memset (&req, 0, sizeof (req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH (sizeof (req.nfg));
+	req.nlh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | msg_type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_DUMP : NLM_F_ACK);
+	req.nlh.nlmsg_seq = seq;
+	req.nfg.nfgen_family = AF_UNSPEC;
+	req.nfg.version = NFNETLINK_V0;
+
+	if (sendto (nl_fd, &req, req.nlh.nlmsg_len, /* flags = */ 0,
+				(struct sockaddr *) &sa, sizeof (sa)) < 0)
+		return (errno);
+
+	while (42)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv (nl_fd, nl_buffer, sizeof (nl_buffer), /* flags = */ 0);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+
+		for (nlh = (struct nlmsghdr *) nl_buffer;
+				NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			/* Left over from a request which has been aborted. */
+			if (nlh->nlmsg_seq != seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return (0);
+
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+				if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*err)))
+					return (EBADMSG);
+				/* An error code of zero acknowledges a request
+				 * which has been answered. */
+				return (-err->error);
+			}
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (struct nfgenmsg)))
+				continue;
+
+			if (msg_type == IPCTNL_MSG_CT_GET_STATS_CPU)
+				conntrack_nl_handle_cpu (nlh, stats);
+			else
+				conntrack_nl_parse (nlh, stats->global,
+						stats->have_global, CTA_STATS_GLOBAL_MAX);
+		}
+	} /* while (42) */
+
+	/* not reached */
+	return (0);
+} /* int conntrack_nl_query */
+#endif /* HAVE_CTNETLINK_STATS */
+
+#if HAVE_CTNETLINK_STATS
+static int conntrack_read_netlink (void)
+{
+	conntrack_nl_stats_t stats;
+	value_t conntrack, conntrack_max;
+	int status;
+
+	if (nl_fd < 0)
+	{
+		status = conntrack_nl_open ();
+		if (status != 0)
+			return (status);
+	}
+
+	memset (&stats, 0, sizeof (stats));
+
+	status = conntrack_nl_query (IPCTNL_MSG_CT_GET_STATS, /* dump = */ 0,
+			&stats);
+	if (status != 0)
+		return (status);
+	if (!stats.have_global[CTA_STATS_GLOBAL_ENTRIES])
+		return (EOPNOTSUPP);
+
+	conntrack.gauge = (gauge_t) stats.global[CTA_STATS_GLOBAL_ENTRIES];
+	if (stats.have_global[CTA_STATS_GLOBAL_MAX_ENTRIES])
+	{
+		conntrack_max.gauge =
+			(gauge_t) stats.global[CTA_STATS_GLOBAL_MAX_ENTRIES];
+		conntrack_submit_usage (conntrack, conntrack_max);
+	}
+	else if (conntrack_read_file (CONNTRACK_MAX_FILE, &conntrack_max) == 0)
+		conntrack_submit_usage (conntrack, conntrack_max);
+	else
+		conntrack_submit ("conntrack", NULL, conntrack);
+
+	if (!report_statistics)
+		return (0);
+
+	status = conntrack_nl_query (IPCTNL_MSG_CT_GET_STATS_CPU,
+			/* dump = */ 1, &stats);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		WARNING ("conntrack plugin: Reading the per-CPU statistics "
+				"failed: %s", sstrerror (status, errbuf, sizeof (errbuf)));
+		return (0);
+	}
+
+	if (!report_by_cpu)
+	{
+		size_t i;
+
+		for (i = 0; i < CONNTRACK_COUNTERS_NUM; i++)
+		{
+			value_t value;
+
+			value.derive = stats.counters[i];
+			conntrack_submit ("operations", conntrack_counters[i].name, value);
+		}
+	}
 
 	return (0);
+} /* int conntrack_read_netlink */
+#endif /* HAVE_CTNETLINK_STATS */
+
+static int conntrack_read (void)
+{
+#if HAVE_CTNETLINK_STATS
+	if (!nl_disabled)
+	{
+		char errbuf[1024];
+		int status;
+
+		status = conntrack_read_netlink ();
+		if (status == 0)
+			return (0);
+
+		if ((status == EPERM) || (status == EACCES)
+				|| (status == EPROTONOSUPPORT) || (status == EOPNOTSUPP)
+				|| (status == ENOENT) || (status == EINVAL))
+		{
+			/* ctnetlink isn't available, e.g. because the module isn't
+			 * loaded or the daemon lacks CAP_NET_ADMIN. Don't try again. */
+			NOTICE ("conntrack plugin: Reading the statistics using "
+					"netlink failed: %s. Falling back to %s.",
+					sstrerror (status, errbuf, sizeof (errbuf)),
+					CONNTRACK_FILE);
+			if (report_statistics)
+				WARNING ("conntrack plugin: The \"Statistics\" option "
+						"requires netlink and will be ignored.");
+			nl_disabled = 1;
+		}
+		else
+		{
+			WARNING ("conntrack plugin: Reading the statistics using "
+					"netlink failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+		}
+
+		/* Any replies still to come belong to the failed request. */
+		if (nl_fd >= 0)
+		{
+			close (nl_fd);
+			nl_fd = -1;
+		}
+	}
+#endif /* HAVE_CTNETLINK_STATS */
+
+	return (conntrack_read_proc ());
 } /* static int conntrack_read */
 
+static int conntrack_shutdown (void)
+{
+#if HAVE_CTNETLINK_STATS
+	if (nl_fd >= 0)
+	{
+		close (nl_fd);
+		nl_fd = -1;
+	}
+#endif
+
+	return (0);
+} /* int conntrack_shutdown */
+
 void module_register (void)
 {
+	plugin_register_config ("conntrack", conntrack_config,
+			config_keys, config_keys_num);
 	plugin_register_read ("conntrack", conntrack_read);
+	plugin_register_shutdown ("conntrack", conntrack_shutdown);
 } /* void module_register */
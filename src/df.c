@@ -27,6 +27,12 @@
 #include "configfile.h"
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
+#if KERNEL_LINUX
+# include <poll.h>
+#endif
 
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
@@ -46,6 +52,64 @@
 # error "No applicable input method."
 #endif
 
+#if HAVE_STATVFS
+typedef struct statvfs df_statbuf_t;
+#elif HAVE_STATFS
+typedef struct statfs df_statbuf_t;
+#endif
+
+#define DF_DEFAULT_WORKERS 2
+/* Maximum number of workers started in addition to "Threads" to replace
+ * workers stuck on hung file systems. */
+#define DF_MAX_EXTRA_WORKERS 8
+
+/* A file system statfs() is called on. Mount points showing the same file
+ * system, e.g. bind mounts, share one entry. */
+struct df_fs_s;
+typedef struct df_fs_s df_fs_t;
+struct df_fs_s
+{
+	char *key;
+	char *dir;
+
+	/* Number of entries in "df_mounts" referring to this file system. */
+	int refs;
+
+	/* Set while a request is queued or being processed by a worker. */
+	_Bool pending;
+	/* Set while a worker is processing the request. */
+	_Bool running;
+	/* Set if the last request didn't return in time. */
+	_Bool hung;
+	/* Set if the request timed out while a worker was processing it. The
+	 * worker has been replaced and is counted in "df_workers_stuck". */
+	_Bool stuck;
+
+	uint64_t request_round;
+	uint64_t result_round;
+	int status;
+	df_statbuf_t statbuf;
+
+	df_fs_t *next;
+};
+
+struct df_mount_s
+{
+	cu_mount_t *mnt;
+	df_fs_t *fs;
+};
+typedef struct df_mount_s df_mount_t;
+
+/* A result copied out of "df_fs_tree", so that it can be dispatched without
+ * holding "df_lock". */
+struct df_result_s
+{
+	cu_mount_t *mnt;
+	int status;
+	df_statbuf_t statbuf;
+};
+typedef struct df_result_s df_result_t;
+
 static const char *config_keys[] =
 {
 	"Device",
@@ -56,7 +120,9 @@ static const char *config_keys[] =
 	"ReportReserved",
 	"ReportInodes",
 	"ValuesAbsolute",
-	"ValuesPercentage"
+	"ValuesPercentage",
+	"Threads",
+	"Timeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -69,6 +135,37 @@ static _Bool report_inodes = 0;
 static _Bool values_absolute = 1;
 static _Bool values_percentage = 0;
 
+static int df_workers_num = DF_DEFAULT_WORKERS;
+/* If zero, half of the interval is used. */
+static cdtime_t df_timeout = 0;
+
+/* The mount table is only re-read when it has changed. "df_mounts" holds the
+ * mount points which aren't ignored. */
+static cu_mount_t *mnt_list = NULL;
+static df_mount_t *df_mounts = NULL;
+static size_t df_mounts_num = 0;
+#if KERNEL_LINUX
+static int mountinfo_fd = -1;
+#endif
+
+/* statfs() is called by worker threads, so that a hung file system (for
+ * example an unreachable NFS server) doesn't block the read thread. All of
+ * the following is protected by "df_lock". */
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static c_avl_tree_t *df_fs_tree = NULL;
+/* Set if file systems which are not mounted anymore couldn't be removed
+ * because a worker was still busy with them. */
+static _Bool df_fs_unused = 0;
+static df_fs_t *df_queue_head = NULL;
+static df_fs_t *df_queue_tail = NULL;
+static uint64_t df_round = 0;
+static size_t df_outstanding = 0;
+static int df_workers_running = 0;
+static int df_workers_stuck = 0;
+static _Bool df_shutdown_workers = 0;
+
 static int df_init (void)
 {
 	if (il_device == NULL)
@@ -153,6 +250,30 @@ static int df_config (const char *key, const char *value)
 
 		return (0);
 	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			ERROR ("df plugin: `Threads' must be at least 1.");
+			return (1);
+		}
+		df_workers_num = tmp;
+
+		return (0);
+	}
+	else if (strcasecmp (key, "Timeout") == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			ERROR ("df plugin: `Timeout' must be greater than zero.");
+			return (1);
+		}
+		df_timeout = DOUBLE_TO_CDTIME_T (tmp);
+
+		return (0);
+	}
 
 	return (-1);
 }
@@ -182,31 +303,394 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+/* Dispatches the values for one mount point. "statbuf" is modified. */
+static int df_submit_mount (cu_mount_t *mnt, df_statbuf_t *statbuf)
 {
+	unsigned long long blocksize;
+	char disk_name[256];
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
+
+	if (!statbuf->f_blocks)
+		return (0);
+
+	if (by_device)
+	{
+		/* eg, /dev/hda1  -- strip off the "/dev/" */
+		if (strncmp (mnt->spec_device, "/dev/", strlen ("/dev/")) == 0)
+			sstrncpy (disk_name, mnt->spec_device + strlen ("/dev/"), sizeof (disk_name));
+		else
+			sstrncpy (disk_name, mnt->spec_device, sizeof (disk_name));
+
+		if (strlen(disk_name) < 1)
+		{
+			DEBUG("df: no device name for mountpoint %s, skipping", mnt->dir);
+			return (0);
+		}
+	}
+	else
+	{
+		if (strcmp (mnt->dir, "/") == 0)
+		{
+			if (strcmp (mnt->type, "rootfs") == 0)
+				return (0);
+			sstrncpy (disk_name, "root", sizeof (disk_name));
+		}
+		else
+		{
+			int i, len;
+
+			sstrncpy (disk_name, mnt->dir + 1, sizeof (disk_name));
+			len = strlen (disk_name);
+
+			for (i = 0; i < len; i++)
+				if (disk_name[i] == '/')
+					disk_name[i] = '-';
+		}
+	}
+
+	blocksize = BLOCKSIZE (*statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
 #if HAVE_STATVFS
-	struct statvfs statbuf;
+	/* Cast and temporary variable are needed to avoid
+	 * compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	int64_t signed_bavail = (int64_t) statbuf->f_bavail;
+	if (signed_bavail < 0)
+		statbuf->f_bavail = 0;
 #elif HAVE_STATFS
-	struct statfs statbuf;
+	if (statbuf->f_bavail < 0)
+		statbuf->f_bavail = 0;
 #endif
-	/* struct STATANYFS statbuf; */
-	cu_mount_t *mnt_list;
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf->f_bfree < statbuf->f_bavail)
+		statbuf->f_bfree = statbuf->f_bavail;
+	if (statbuf->f_blocks < statbuf->f_bfree)
+		statbuf->f_blocks = statbuf->f_bfree;
+
+	blk_free     = (uint64_t) statbuf->f_bavail;
+	blk_reserved = (uint64_t) (statbuf->f_bfree - statbuf->f_bavail);
+	blk_used     = (uint64_t) (statbuf->f_blocks - statbuf->f_bfree);
+
+	if (values_absolute)
+	{
+		df_submit_one (disk_name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+		df_submit_one (disk_name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+		df_submit_one (disk_name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+	}
+
+	if (values_percentage)
+	{
+		if (statbuf->f_blocks > 0)
+			{
+			df_submit_one (disk_name, "percent_bytes", "free",
+				(gauge_t) ((float_t)(blk_free) / statbuf->f_blocks * 100));
+			df_submit_one (disk_name, "percent_bytes", "reserved",
+				(gauge_t) ((float_t)(blk_reserved) / statbuf->f_blocks * 100));
+			df_submit_one (disk_name, "percent_bytes", "used",
+				(gauge_t) ((float_t)(blk_used) / statbuf->f_blocks * 100));
+			}
+		else return (-1);
+	}
+
+	/* inode handling */
+	if (report_inodes)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf->f_ffree < statbuf->f_favail)
+			statbuf->f_ffree = statbuf->f_favail;
+		if (statbuf->f_files < statbuf->f_ffree)
+			statbuf->f_files = statbuf->f_ffree;
+
+		inode_free = (uint64_t) statbuf->f_favail;
+		inode_reserved = (uint64_t) (statbuf->f_ffree - statbuf->f_favail);
+		inode_used = (uint64_t) (statbuf->f_files - statbuf->f_ffree);
+
+		if (values_percentage)
+		{
+			if (statbuf->f_files > 0)
+			{
+				df_submit_one (disk_name, "percent_inodes", "free",
+					(gauge_t) ((float_t)(inode_free) / statbuf->f_files * 100));
+				df_submit_one (disk_name, "percent_inodes", "reserved",
+					(gauge_t) ((float_t)(inode_reserved) / statbuf->f_files * 100));
+				df_submit_one (disk_name, "percent_inodes", "used",
+					(gauge_t) ((float_t)(inode_used) / statbuf->f_files * 100));
+			}
+			else return (-1);
+		}
+		if (values_absolute)
+		{
+			df_submit_one (disk_name, "df_inodes", "free",
+					(gauge_t) inode_free);
+			df_submit_one (disk_name, "df_inodes", "reserved",
+					(gauge_t) inode_reserved);
+			df_submit_one (disk_name, "df_inodes", "used",
+					(gauge_t) inode_used);
+		}
+	}
+	return (0);
+} /* int df_submit_mount */
+
+#if KERNEL_LINUX
+/* Returns true if the mount table may have changed since the last call. The
+ * kernel reports changes as an exceptional condition on mountinfo. */
+static _Bool df_mounts_changed (void)
+{
+	struct pollfd pfd;
+
+	if (mountinfo_fd < 0)
+	{
+		mountinfo_fd = open ("/proc/self/mountinfo", O_RDONLY);
+		if (mountinfo_fd < 0)
+			return (1);
+	}
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = mountinfo_fd;
+	pfd.events = POLLPRI;
+
+	if (poll (&pfd, 1, /* timeout = */ 0) < 0)
+		return (1);
+
+	return ((pfd.revents & (POLLERR | POLLPRI)) != 0);
+} /* _Bool df_mounts_changed */
+
+/* Undoes the octal escaping of spaces etc. done by the kernel. */
+static void df_unescape (char *str)
+{
+	char *src = str;
+	char *dst = str;
+
+	while (*src != 0)
+	{
+		if ((src[0] == '\\')
+				&& (src[1] >= '0') && (src[1] <= '3')
+				&& (src[2] >= '0') && (src[2] <= '7')
+				&& (src[3] >= '0') && (src[3] <= '7'))
+		{
+			*dst = (char) (((src[1] - '0') << 6)
+					| ((src[2] - '0') << 3)
+					| (src[3] - '0'));
+			src += 4;
+		}
+		else
+		{
+			*dst = *src;
+			src++;
+		}
+		dst++;
+	}
+	*dst = 0;
+} /* void df_unescape */
+
+/* Returns a tree mapping mount points to the "major:minor" device ID of the
+ * mounted file system, or NULL on error. */
+static c_avl_tree_t *df_read_mountinfo (void)
+{
+	c_avl_tree_t *devices;
+	FILE *fh;
+	char buffer[4096];
+
+	fh = fopen ("/proc/self/mountinfo", "r");
+	if (fh == NULL)
+		return (NULL);
+
+	devices = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (devices == NULL)
+	{
+		fclose (fh);
+		return (NULL);
+	}
+
+	/* 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw */
+	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	{
+		char *fields[6];
+		char *dir;
+		char *device;
+		char *old_dir = NULL;
+		char *old_device = NULL;
+
+		if (strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields)) < 5)
+			continue;
+
+		df_unescape (fields[4]);
+		dir = strdup (fields[4]);
+		device = strdup (fields[2]);
+		if ((dir == NULL) || (device == NULL))
+		{
+			sfree (dir);
+			sfree (device);
+			continue;
+		}
+
+		/* If a directory has been mounted over, the last entry is the
+		 * visible one. */
+		if (c_avl_remove (devices, dir,
+					(void *) &old_dir, (void *) &old_device) == 0)
+		{
+			sfree (old_dir);
+			sfree (old_device);
+		}
+
+		if (c_avl_insert (devices, dir, device) != 0)
+		{
+			sfree (dir);
+			sfree (device);
+		}
+	}
+
+	fclose (fh);
+	return (devices);
+} /* c_avl_tree_t *df_read_mountinfo */
+#else
+static _Bool df_mounts_changed (void)
+{
+	return (1);
+} /* _Bool df_mounts_changed */
+#endif /* !KERNEL_LINUX */
+
+static void df_fs_free (df_fs_t *fs)
+{
+	if (fs == NULL)
+		return;
+
+	sfree (fs->key);
+	sfree (fs->dir);
+	sfree (fs);
+} /* void df_fs_free */
+
+/* Returns the entry for "key", creating it if necessary. You must hold
+ * "df_lock". */
+static df_fs_t *df_fs_get (const char *key, const char *dir)
+{
+	df_fs_t *fs = NULL;
+
+	if (c_avl_get (df_fs_tree, key, (void *) &fs) == 0)
+		return (fs);
+
+	fs = calloc (1, sizeof (*fs));
+	if (fs == NULL)
+		return (NULL);
+
+	fs->key = strdup (key);
+	fs->dir = strdup (dir);
+	if ((fs->key == NULL) || (fs->dir == NULL)
+			|| (c_avl_insert (df_fs_tree, fs->key, fs) != 0))
+	{
+		df_fs_free (fs);
+		return (NULL);
+	}
+
+	return (fs);
+} /* df_fs_t *df_fs_get */
+
+/* Removes file systems which are not mounted anymore. Entries a worker is
+ * still busy with are removed by a later read, once the worker has returned.
+ * You must hold "df_lock". */
+static void df_fs_prune (void)
+{
+	c_avl_iterator_t *iter;
+	df_fs_t **unused;
+	size_t unused_num = 0;
+	char *key;
+	df_fs_t *fs;
+	size_t i;
+
+	unused = calloc ((size_t) c_avl_size (df_fs_tree) + 1, sizeof (*unused));
+	if (unused == NULL)
+		return;
+
+	df_fs_unused = 0;
+	iter = c_avl_get_iterator (df_fs_tree);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &fs) == 0)
+	{
+		if (fs->refs != 0)
+			continue;
+		if (fs->pending)
+			df_fs_unused = 1;
+		else
+			unused[unused_num++] = fs;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < unused_num; i++)
+	{
+		c_avl_remove (df_fs_tree, unused[i]->key, NULL, NULL);
+		df_fs_free (unused[i]);
+	}
+
+	sfree (unused);
+} /* void df_fs_prune */
+
+/* Re-reads the mount table and builds the list of mount points to report.
+ * Mount points are filtered here once instead of on every read. */
+static int df_mounts_refresh (void)
+{
+	cu_mount_t *new_list = NULL;
 	cu_mount_t *mnt_ptr;
+	df_mount_t *new_mounts;
+	size_t new_mounts_num = 0;
+	c_avl_tree_t *devices = NULL;
+	size_t count = 0;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
+	if (cu_mount_getlist (&new_list) == NULL)
 	{
 		ERROR ("df plugin: cu_mount_getlist failed.");
 		return (-1);
 	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	for (mnt_ptr = new_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+		count++;
+
+	new_mounts = calloc (count + 1, sizeof (*new_mounts));
+	if (new_mounts == NULL)
+	{
+		ERROR ("df plugin: calloc failed.");
+		cu_mount_freelist (new_list);
+		return (-1);
+	}
+
+#if KERNEL_LINUX
+	devices = df_read_mountinfo ();
+#endif
+
+	pthread_mutex_lock (&df_lock);
+
+	if (df_fs_tree == NULL)
+		df_fs_tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (df_fs_tree == NULL)
+	{
+		pthread_mutex_unlock (&df_lock);
+		ERROR ("df plugin: c_avl_create failed.");
+		sfree (new_mounts);
+		cu_mount_freelist (new_list);
+		return (-1);
+	}
+
+	for (count = 0; count < df_mounts_num; count++)
+		df_mounts[count].fs->refs--;
+
+	for (mnt_ptr = new_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
 	{
-		unsigned long long blocksize;
-		char disk_name[256];
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		char key[4096];
+		char *device = NULL;
+		df_fs_t *fs;
 
 		if (ignorelist_match (il_device,
 					(mnt_ptr->spec_device != NULL)
@@ -218,158 +702,314 @@ static int df_read (void)
 		if (ignorelist_match (il_fstype, mnt_ptr->type))
 			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
+		/* Bind mounts of the same file system share one statfs()
+		 * call. */
+		if ((devices != NULL)
+				&& (c_avl_get (devices, mnt_ptr->dir,
+						(void *) &device) == 0))
+			ssnprintf (key, sizeof (key), "dev:%s", device);
+		else
+			ssnprintf (key, sizeof (key), "dir:%s", mnt_ptr->dir);
+
+		fs = df_fs_get (key, mnt_ptr->dir);
+		if (fs == NULL)
 		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			ERROR ("df plugin: Allocating memory for %s failed.",
+					mnt_ptr->dir);
 			continue;
 		}
 
-		if (!statbuf.f_blocks)
-			continue;
-
-		if (by_device)
+		/* The mount point the entry was created for may have been
+		 * unmounted while a bind mount of the same file system
+		 * remains, so query it through a current mount point. */
+		if ((fs->refs == 0) && (strcmp (fs->dir, mnt_ptr->dir) != 0))
 		{
-			/* eg, /dev/hda1  -- strip off the "/dev/" */
-			if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
-				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), sizeof (disk_name));
-			else
-				sstrncpy (disk_name, mnt_ptr->spec_device, sizeof (disk_name));
+			char *dir = strdup (mnt_ptr->dir);
 
-			if (strlen(disk_name) < 1)
+			if (dir != NULL)
 			{
-				DEBUG("df: no device name for mountpoint %s, skipping", mnt_ptr->dir);
-				continue;
+				sfree (fs->dir);
+				fs->dir = dir;
 			}
 		}
-		else
-		{
-			if (strcmp (mnt_ptr->dir, "/") == 0)
-			{
-				if (strcmp (mnt_ptr->type, "rootfs") == 0)
-					continue;
-				sstrncpy (disk_name, "root", sizeof (disk_name));
-			}
-			else
-			{
-				int i, len;
+		fs->refs++;
+
+		new_mounts[new_mounts_num].mnt = mnt_ptr;
+		new_mounts[new_mounts_num].fs = fs;
+		new_mounts_num++;
+	}
 
-				sstrncpy (disk_name, mnt_ptr->dir + 1, sizeof (disk_name));
-				len = strlen (disk_name);
+	df_fs_prune ();
 
-				for (i = 0; i < len; i++)
-					if (disk_name[i] == '/')
-						disk_name[i] = '-';
-			}
+	pthread_mutex_unlock (&df_lock);
+
+	if (devices != NULL)
+	{
+		char *dir;
+		char *device;
+
+		while (c_avl_pick (devices, (void *) &dir, (void *) &device) == 0)
+		{
+			sfree (dir);
+			sfree (device);
 		}
+		c_avl_destroy (devices);
+	}
 
-		blocksize = BLOCKSIZE(statbuf);
+	sfree (df_mounts);
+	cu_mount_freelist (mnt_list);
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
-#if HAVE_STATVFS
-		/* Cast and temporary variable are needed to avoid
-		 * compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		int64_t signed_bavail = (int64_t) statbuf.f_bavail;
-		if (signed_bavail < 0)
-			statbuf.f_bavail = 0;
-#elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
-#endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
+	df_mounts = new_mounts;
+	df_mounts_num = new_mounts_num;
+	mnt_list = new_list;
 
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+	return (0);
+} /* int df_mounts_refresh */
 
-		if (values_absolute)
+static void *df_worker (void __attribute__((unused)) *arg)
+{
+	pthread_mutex_lock (&df_lock);
+	while (!df_shutdown_workers)
+	{
+		df_statbuf_t statbuf;
+		char dir[4096];
+		df_fs_t *fs;
+		int status;
+
+		if (df_queue_head == NULL)
 		{
-			df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-			df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-			df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
+			pthread_cond_wait (&df_work_cond, &df_lock);
+			continue;
 		}
 
-		if (values_percentage)
+		fs = df_queue_head;
+		df_queue_head = fs->next;
+		if (df_queue_head == NULL)
+			df_queue_tail = NULL;
+		fs->next = NULL;
+		fs->running = 1;
+
+		/* "fs" is not freed while it's pending, but "fs->dir" may be
+		 * replaced when the mount table is re-read. This call may
+		 * block for a long time, e.g. if an NFS server is
+		 * unreachable. */
+		sstrncpy (dir, fs->dir, sizeof (dir));
+		pthread_mutex_unlock (&df_lock);
+		status = 0;
+		if (STATANYFS (dir, &statbuf) < 0)
+			status = (errno != 0) ? errno : -1;
+		pthread_mutex_lock (&df_lock);
+
+		fs->status = status;
+		if (status == 0)
+			memcpy (&fs->statbuf, &statbuf, sizeof (fs->statbuf));
+		fs->result_round = fs->request_round;
+		fs->pending = 0;
+		fs->running = 0;
+
+		if (fs->request_round == df_round)
 		{
-			if (statbuf.f_blocks > 0)
-				{
-				df_submit_one (disk_name, "percent_bytes", "free",
-					(gauge_t) ((float_t)(blk_free) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "reserved",
-					(gauge_t) ((float_t)(blk_reserved) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "used",
-					(gauge_t) ((float_t)(blk_used) / statbuf.f_blocks * 100));
-				}
-			else return (-1);
+			df_outstanding--;
+			pthread_cond_signal (&df_done_cond);
 		}
 
-		/* inode handling */
-		if (report_inodes)
+		/* This worker has been replaced while it was stuck. Exit if
+		 * the pool is larger than needed now. */
+		if (fs->stuck)
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
+			fs->stuck = 0;
+			df_workers_stuck--;
+			if (df_workers_running > df_workers_num + df_workers_stuck)
+				break;
+		}
+	}
+	df_workers_running--;
+	pthread_mutex_unlock (&df_lock);
+
+	return ((void *) 0);
+} /* void *df_worker */
+
+/* Starts workers until there are "Threads" workers which are not stuck.
+ * You must hold "df_lock". */
+static int df_start_workers (void)
+{
+	int stuck = df_workers_stuck;
+
+	if (stuck > DF_MAX_EXTRA_WORKERS)
+		stuck = DF_MAX_EXTRA_WORKERS;
+
+	while (df_workers_running < df_workers_num + stuck)
+	{
+		pthread_t tid;
+		int status;
+
+		status = plugin_thread_create (&tid, /* attr = */ NULL,
+				df_worker, /* arg = */ NULL);
+		if (status != 0)
+		{
+			ERROR ("df plugin: Starting a worker thread failed.");
+			break;
+		}
+
+		/* Workers stuck in statfs() can't be joined at shutdown. */
+		pthread_detach (tid);
+		df_workers_running++;
+	}
+
+	return ((df_workers_running > df_workers_stuck) ? 0 : -1);
+} /* int df_start_workers */
+
+static int df_read (void)
+{
+	df_result_t *results;
+	size_t results_num = 0;
+	cdtime_t timeout;
+	cdtime_t deadline;
+	size_t i;
+
+	if (df_mounts_changed () || (mnt_list == NULL))
+	{
+		if (df_mounts_refresh () != 0)
+			return (-1);
+	}
+
+	results = calloc (df_mounts_num + 1, sizeof (*results));
+	if (results == NULL)
+	{
+		ERROR ("df plugin: calloc failed.");
+		return (-1);
+	}
 
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
+	timeout = df_timeout;
+	if (timeout == 0)
+		timeout = plugin_get_interval () / 2;
+	deadline = cdtime () + timeout;
 
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+	pthread_mutex_lock (&df_lock);
 
-			if (values_percentage)
+	if (df_fs_unused)
+		df_fs_prune ();
+
+	if (df_start_workers () != 0)
+	{
+		pthread_mutex_unlock (&df_lock);
+		sfree (results);
+		return (-1);
+	}
+
+	/* Queue one request per file system, unless the previous request
+	 * hasn't returned yet. */
+	df_round++;
+	df_outstanding = 0;
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_fs_t *fs = df_mounts[i].fs;
+
+		if (fs->pending || (fs->request_round == df_round))
+			continue;
+
+		fs->pending = 1;
+		fs->request_round = df_round;
+		fs->next = NULL;
+		if (df_queue_tail == NULL)
+			df_queue_head = fs;
+		else
+			df_queue_tail->next = fs;
+		df_queue_tail = fs;
+		df_outstanding++;
+	}
+	pthread_cond_broadcast (&df_work_cond);
+
+	while (df_outstanding > 0)
+	{
+		struct timespec ts;
+
+		CDTIME_T_TO_TIMESPEC (deadline, &ts);
+		if (pthread_cond_timedwait (&df_done_cond, &df_lock, &ts)
+				== ETIMEDOUT)
+			break;
+	}
+
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_fs_t *fs = df_mounts[i].fs;
+
+		if (fs->result_round != df_round)
+		{
+			/* Start a replacement for the worker blocked by this
+			 * file system with the next read. */
+			if (fs->running && !fs->stuck)
 			{
-				if (statbuf.f_files > 0)
-				{
-					df_submit_one (disk_name, "percent_inodes", "free",
-						(gauge_t) ((float_t)(inode_free) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "reserved",
-						(gauge_t) ((float_t)(inode_reserved) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "used",
-						(gauge_t) ((float_t)(inode_used) / statbuf.f_files * 100));
-				}
-				else return (-1);
+				fs->stuck = 1;
+				df_workers_stuck++;
 			}
-			if (values_absolute)
+
+			if (!fs->hung)
 			{
-				df_submit_one (disk_name, "df_inodes", "free",
-						(gauge_t) inode_free);
-				df_submit_one (disk_name, "df_inodes", "reserved",
-						(gauge_t) inode_reserved);
-				df_submit_one (disk_name, "df_inodes", "used",
-						(gauge_t) inode_used);
+				WARNING ("df plugin: "STATANYFS_STR"(%s) did not "
+						"return within %.3f seconds. The "
+						"file system will be skipped "
+						"until it does.", fs->dir,
+						CDTIME_T_TO_DOUBLE (timeout));
+				fs->hung = 1;
 			}
+			continue;
+		}
+		else if (fs->hung)
+		{
+			INFO ("df plugin: "STATANYFS_STR"(%s) returned again.",
+					fs->dir);
+			fs->hung = 0;
 		}
+
+		results[results_num].mnt = df_mounts[i].mnt;
+		results[results_num].status = fs->status;
+		if (fs->status == 0)
+			memcpy (&results[results_num].statbuf, &fs->statbuf,
+					sizeof (results[results_num].statbuf));
+		results_num++;
 	}
 
-	cu_mount_freelist (mnt_list);
+	pthread_mutex_unlock (&df_lock);
 
+	/* "df_mounts" and "mnt_list" are only changed by this function, so
+	 * the mount entries stay valid. */
+	for (i = 0; i < results_num; i++)
+	{
+		if (results[i].status != 0)
+		{
+			char errbuf[1024];
+			ERROR (STATANYFS_STR"(%s) failed: %s",
+					results[i].mnt->dir,
+					sstrerror (results[i].status, errbuf,
+						sizeof (errbuf)));
+			continue;
+		}
+
+		df_submit_mount (results[i].mnt, &results[i].statbuf);
+	}
+
+	sfree (results);
 	return (0);
 } /* int df_read */
 
+static int df_shutdown (void)
+{
+	/* Workers blocked in statfs() may still use their file system entry
+	 * when they return, so nothing is freed here. */
+	pthread_mutex_lock (&df_lock);
+	df_shutdown_workers = 1;
+	pthread_cond_broadcast (&df_work_cond);
+	pthread_mutex_unlock (&df_lock);
+
+	return (0);
+} /* int df_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("df", df_config,
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown);
 } /* void module_register */
@@ -61,6 +61,12 @@
 #  define UINT_MAX 4294967295U
 #endif
 
+#if KERNEL_LINUX
+# include "utils_avltree.h"
+# include "utils_latency.h"
+# include <pthread.h>
+#endif
+
 #if HAVE_STATGRAB_H
 # include <statgrab.h>
 #endif
@@ -102,10 +108,38 @@ typedef struct diskstats
 	derive_t avg_read_time;
 	derive_t avg_write_time;
 
-	struct diskstats *next;
+	/* Result of the ignorelist lookup, done once when the device appears. */
+	_Bool ignored;
+	/* Number of the last read in which the device was found. */
+	unsigned int round;
+
+	/* Latency sampling: The statistics in /sys/class/block/<name>/stat are
+	 * read at a higher frequency than the read interval and the average
+	 * latency of each sampling period is added to these counters. */
+	int stat_fd;
+	_Bool sample_valid;
+	derive_t sample_read_ops;
+	derive_t sample_read_time;
+	derive_t sample_write_ops;
+	derive_t sample_write_time;
+	latency_counter_t *read_latency;
+	latency_counter_t *write_latency;
 } diskstats_t;
 
-static diskstats_t *disklist;
+/* Devices by name. The tree is shared with the latency sampling thread and
+ * protected by "disk_lock". */
+static c_avl_tree_t *disktree = NULL;
+static unsigned int disk_round = 0;
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static cdtime_t latency_interval = 0;
+static double *latency_percentiles = NULL;
+static size_t latency_percentiles_num = 0;
+
+static pthread_t latency_thread;
+static _Bool latency_thread_running = 0;
+static _Bool latency_thread_shutdown = 0;
+static pthread_cond_t latency_cond = PTHREAD_COND_INITIALIZER;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -132,7 +166,9 @@ static const char *config_keys[] =
 {
 	"Disk",
 	"UseBSDName",
-	"IgnoreSelected"
+	"IgnoreSelected",
+	"LatencySamplingInterval",
+	"LatencyPercentile"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -163,6 +199,48 @@ static int disk_config (const char *key, const char *value)
 #else
     WARNING ("disk plugin: The \"UseBSDName\" option is only supported "
         "on Mach / Mac OS X and will be ignored.");
+#endif
+  }
+  else if (strcasecmp ("LatencySamplingInterval", key) == 0)
+  {
+#if KERNEL_LINUX
+    double interval = atof (value);
+
+    if (interval < 0.0)
+    {
+      WARNING ("disk plugin: Invalid \"LatencySamplingInterval\": %s",
+          value);
+      return (1);
+    }
+    latency_interval = DOUBLE_TO_CDTIME_T (interval);
+#else
+    WARNING ("disk plugin: The \"LatencySamplingInterval\" option is only "
+        "supported on Linux and will be ignored.");
+#endif
+  }
+  else if (strcasecmp ("LatencyPercentile", key) == 0)
+  {
+#if KERNEL_LINUX
+    double percent = atof (value);
+    double *tmp;
+
+    if ((percent <= 0.0) || (percent >= 100.0))
+    {
+      WARNING ("disk plugin: \"LatencyPercentile\" must be between 0 and "
+          "100 (exclusive), got %s.", value);
+      return (1);
+    }
+
+    tmp = realloc (latency_percentiles,
+        (latency_percentiles_num + 1) * sizeof (*latency_percentiles));
+    if (tmp == NULL)
+      return (1);
+    latency_percentiles = tmp;
+    latency_percentiles[latency_percentiles_num] = percent;
+    latency_percentiles_num++;
+#else
+    WARNING ("disk plugin: The \"LatencyPercentile\" option is only "
+        "supported on Linux and will be ignored.");
 #endif
   }
   else
@@ -173,6 +251,293 @@ static int disk_config (const char *key, const char *value)
   return (0);
 } /* int disk_config */
 
+#if KERNEL_LINUX
+static diskstats_t *disk_create (const char *name)
+{
+	diskstats_t *ds;
+
+	ds = calloc (1, sizeof (*ds));
+	if (ds == NULL)
+		return (NULL);
+
+	ds->name = strdup (name);
+	if (ds->name == NULL)
+	{
+		sfree (ds);
+		return (NULL);
+	}
+
+	/* Both `ignorelist' and `name' may be NULL. */
+	ds->ignored = (ignorelist_match (ignorelist, name) != 0);
+	ds->stat_fd = -1;
+
+	if (!ds->ignored && (latency_interval > 0))
+	{
+		ds->read_latency = latency_counter_create ();
+		ds->write_latency = latency_counter_create ();
+	}
+
+	return (ds);
+} /* diskstats_t *disk_create */
+
+static void disk_free (diskstats_t *ds)
+{
+	if (ds == NULL)
+		return;
+
+	if (ds->stat_fd >= 0)
+		close (ds->stat_fd);
+	latency_counter_destroy (ds->read_latency);
+	latency_counter_destroy (ds->write_latency);
+	sfree (ds->name);
+	sfree (ds);
+} /* void disk_free */
+
+/* Removes the devices which weren't found in the last read. Must be called
+ * with "disk_lock" held. */
+static void disk_prune (void)
+{
+	c_avl_iterator_t *iter;
+	char **stale;
+	int stale_num = 0;
+	char *name;
+	diskstats_t *ds;
+	int i;
+
+	stale = malloc (c_avl_size (disktree) * sizeof (*stale));
+	if (stale == NULL)
+		return;
+
+	iter = c_avl_get_iterator (disktree);
+	while (c_avl_iterator_next (iter, (void *) &name, (void *) &ds) == 0)
+		if (ds->round != disk_round)
+			stale[stale_num++] = ds->name;
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < stale_num; i++)
+	{
+		if (c_avl_remove (disktree, stale[i], (void *) &name,
+					(void *) &ds) != 0)
+			continue;
+
+		DEBUG ("disk plugin: Device \"%s\" has disappeared.", ds->name);
+		disk_free (ds);
+	}
+
+	sfree (stale);
+} /* void disk_prune */
+
+/* Splits a line of /proc/diskstats (or /proc/partitions for Linux 2.4) in
+ * place: "head_num" numeric columns, the device name and up to "values_max"
+ * numeric columns. Returns the number of columns after the name or -1 if the
+ * line doesn't have this format. */
+static int disk_parse_line (char *line, derive_t *head, int head_num,
+		char **ret_name, derive_t *values, int values_max)
+{
+	char *ptr = line;
+	char *end;
+	int i;
+
+	for (i = 0; i < head_num; i++)
+	{
+		head[i] = (derive_t) strtoull (ptr, &end, 10);
+		if (end == ptr)
+			return (-1);
+		ptr = end;
+	}
+
+	while ((*ptr == ' ') || (*ptr == '\t'))
+		ptr++;
+	if ((*ptr == 0) || (*ptr == '\n'))
+		return (-1);
+
+	*ret_name = ptr;
+	while ((*ptr != 0) && !isspace ((int) *ptr))
+		ptr++;
+	if (*ptr != 0)
+	{
+		*ptr = 0;
+		ptr++;
+	}
+
+	for (i = 0; i < values_max; i++)
+	{
+		values[i] = (derive_t) strtoull (ptr, &end, 10);
+		if (end == ptr)
+			break;
+		ptr = end;
+	}
+
+	return (i);
+} /* int disk_parse_line */
+
+static void disk_latency_add (latency_counter_t *lc,
+		derive_t ops, derive_t *prev_ops,
+		derive_t time_ms, derive_t *prev_time_ms)
+{
+	derive_t diff_ops = ops - *prev_ops;
+	derive_t diff_time = time_ms - *prev_time_ms;
+	cdtime_t latency;
+
+	*prev_ops = ops;
+	*prev_time_ms = time_ms;
+
+	/* Counter reset or wrap-around: Skip this period. */
+	if ((diff_ops <= 0) || (diff_time < 0))
+		return;
+
+	latency = MS_TO_CDTIME_T (diff_time) / ((cdtime_t) diff_ops);
+	/* The time is only accounted in milliseconds. Requests which completed
+	 * faster still have to end up in the lowest bucket. */
+	if (latency == 0)
+		latency = 1;
+
+	latency_counter_add_n (lc, latency, (size_t) diff_ops);
+} /* void disk_latency_add */
+
+/* Must be called with "disk_lock" held. */
+static void disk_latency_sample (diskstats_t *ds)
+{
+	char buffer[256];
+	derive_t values[11];
+	char *ptr;
+	char *end;
+	ssize_t len;
+	int i;
+
+	if (ds->stat_fd == -1)
+	{
+		char name[PATH_MAX];
+		char path[PATH_MAX];
+		char *c;
+
+		/* Slashes in device names (e.g. "cciss/c0d0") are replaced by
+		 * exclamation marks in sysfs. */
+		sstrncpy (name, ds->name, sizeof (name));
+		for (c = name; *c != 0; c++)
+			if (*c == '/')
+				*c = '!';
+		ssnprintf (path, sizeof (path), "/sys/class/block/%s/stat", name);
+
+		ds->stat_fd = open (path, O_RDONLY);
+		if (ds->stat_fd < 0)
+		{
+			char errbuf[1024];
+			INFO ("disk plugin: Not sampling the latency of \"%s\": "
+					"open (%s) failed: %s", ds->name, path,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			/* Don't try again. */
+			ds->stat_fd = -2;
+			return;
+		}
+	}
+	else if (ds->stat_fd < 0)
+		return;
+
+	/* sysfs regenerates the content when reading from offset zero, so the
+	 * file can be kept open. */
+	len = pread (ds->stat_fd, buffer, sizeof (buffer) - 1, 0);
+	if (len <= 0)
+		return;
+	buffer[len] = 0;
+
+	ptr = buffer;
+	for (i = 0; i < (int) STATIC_ARRAY_SIZE (values); i++)
+	{
+		values[i] = (derive_t) strtoull (ptr, &end, 10);
+		if (end == ptr)
+			return;
+		ptr = end;
+	}
+
+	if (!ds->sample_valid)
+	{
+		ds->sample_read_ops = values[0];
+		ds->sample_read_time = values[3];
+		ds->sample_write_ops = values[4];
+		ds->sample_write_time = values[7];
+		ds->sample_valid = 1;
+		return;
+	}
+
+	disk_latency_add (ds->read_latency, values[0], &ds->sample_read_ops,
+			values[3], &ds->sample_read_time);
+	disk_latency_add (ds->write_latency, values[4], &ds->sample_write_ops,
+			values[7], &ds->sample_write_time);
+} /* void disk_latency_sample */
+
+static void *disk_latency_thread_main (void __attribute__((unused)) *arg)
+{
+	cdtime_t next = cdtime () + latency_interval;
+
+	pthread_mutex_lock (&disk_lock);
+	while (!latency_thread_shutdown)
+	{
+		cdtime_t now = cdtime ();
+		c_avl_iterator_t *iter;
+		char *name;
+		diskstats_t *ds;
+
+		if (now < next)
+		{
+			struct timespec ts;
+
+			CDTIME_T_TO_TIMESPEC (next, &ts);
+			pthread_cond_timedwait (&latency_cond, &disk_lock, &ts);
+			continue;
+		}
+
+		iter = c_avl_get_iterator (disktree);
+		while (c_avl_iterator_next (iter, (void *) &name, (void *) &ds) == 0)
+			if (ds->read_latency != NULL)
+				disk_latency_sample (ds);
+		c_avl_iterator_destroy (iter);
+
+		next += latency_interval;
+		if (next <= now)
+			next = now + latency_interval;
+	}
+	pthread_mutex_unlock (&disk_lock);
+
+	return ((void *) 0);
+} /* void *disk_latency_thread_main */
+
+static void disk_submit_latency (diskstats_t *ds)
+{
+	value_t values[2];
+	value_list_t vl = VALUE_LIST_INIT;
+	size_t i;
+
+	vl.values = values;
+	vl.values_len = 2;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "disk", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, ds->name, sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "disk_latency", sizeof (vl.type));
+
+	for (i = 0; i < latency_percentiles_num; i++)
+	{
+		double percent = latency_percentiles[i];
+
+		values[0].gauge = NAN;
+		values[1].gauge = NAN;
+		if (latency_counter_get_num (ds->read_latency) > 0)
+			values[0].gauge = CDTIME_T_TO_DOUBLE (
+					latency_counter_get_percentile (ds->read_latency, percent));
+		if (latency_counter_get_num (ds->write_latency) > 0)
+			values[1].gauge = CDTIME_T_TO_DOUBLE (
+					latency_counter_get_percentile (ds->write_latency, percent));
+
+		ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+				"percentile-%.0f", percent);
+		plugin_dispatch_values (&vl);
+	}
+
+	latency_counter_reset (ds->read_latency);
+	latency_counter_reset (ds->write_latency);
+} /* void disk_submit_latency */
+#endif /* KERNEL_LINUX */
+
 static int disk_init (void)
 {
 #if HAVE_IOKIT_IOKITLIB_H
@@ -196,7 +561,46 @@ static int disk_init (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	/* do nothing */
+	int status;
+
+	if (disktree == NULL)
+	{
+		disktree = c_avl_create ((void *) strcmp);
+		if (disktree == NULL)
+		{
+			ERROR ("disk plugin: c_avl_create failed.");
+			return (-1);
+		}
+	}
+
+	if ((latency_interval > 0) && !latency_thread_running)
+	{
+		if (latency_percentiles_num == 0)
+		{
+			static double default_percentiles[] = { 50.0, 95.0, 99.0 };
+
+			latency_percentiles = malloc (sizeof (default_percentiles));
+			if (latency_percentiles == NULL)
+				return (-1);
+			memcpy (latency_percentiles, default_percentiles,
+					sizeof (default_percentiles));
+			latency_percentiles_num =
+				STATIC_ARRAY_SIZE (default_percentiles);
+		}
+
+		latency_thread_shutdown = 0;
+		status = plugin_thread_create (&latency_thread, /* attr = */ NULL,
+				disk_latency_thread_main, /* arg = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("disk plugin: Starting the latency sampling thread "
+					"failed: %s", sstrerror (status, errbuf, sizeof (errbuf)));
+			latency_interval = 0;
+		}
+		else
+			latency_thread_running = 1;
+	}
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -223,17 +627,13 @@ static int disk_init (void)
 	return (0);
 } /* int disk_init */
 
-static void disk_submit (const char *plugin_instance,
+static void disk_dispatch (const char *plugin_instance,
 		const char *type,
 		derive_t read, derive_t write)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	/* Both `ignorelist' and `plugin_instance' may be NULL. */
-	if (ignorelist_match (ignorelist, plugin_instance) != 0)
-	  return;
-
 	values[0].derive = read;
 	values[1].derive = write;
 
@@ -246,7 +646,22 @@ static void disk_submit (const char *plugin_instance,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void disk_dispatch */
+
+#if !KERNEL_LINUX
+/* On Linux the ignorelist is checked only once per device, see
+ * disk_create(). */
+static void disk_submit (const char *plugin_instance,
+		const char *type,
+		derive_t read, derive_t write)
+{
+	/* Both `ignorelist' and `plugin_instance' may be NULL. */
+	if (ignorelist_match (ignorelist, plugin_instance) != 0)
+	  return;
+
+	disk_dispatch (plugin_instance, type, read, write);
 } /* void disk_submit */
+#endif /* !KERNEL_LINUX */
 
 #if KERNEL_LINUX
 static counter_t disk_calc_time_incr (counter_t delta_time, counter_t delta_ops)
@@ -472,8 +887,9 @@ static int disk_read (void)
 #elif KERNEL_LINUX
 	FILE *fh;
 	char buffer[1024];
-	
-	char *fields[32];
+
+	derive_t head[3];
+	derive_t fields[32];
 	int numfields;
 	int fieldshift = 0;
 
@@ -490,7 +906,7 @@ static int disk_read (void)
 	derive_t write_time    = 0;
 	int is_disk = 0;
 
-	diskstats_t *ds, *pre_ds;
+	diskstats_t *ds;
 
 	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
 	{
@@ -505,71 +921,66 @@ static int disk_read (void)
 		fieldshift = 1;
 	}
 
+	pthread_mutex_lock (&disk_lock);
+	disk_round++;
+
 	while (fgets (buffer, sizeof (buffer), fh) != NULL)
 	{
 		char *disk_name;
 
-		numfields = strsplit (buffer, fields, 32);
+		/* Columns after the device name. Newer kernels append discard and
+		 * flush statistics to the eleven columns handled here. */
+		numfields = disk_parse_line (buffer, head, 2 + fieldshift,
+				&disk_name, fields, STATIC_ARRAY_SIZE (fields));
 
-		if ((numfields != (14 + fieldshift)) && (numfields != 7))
+		if ((numfields < 11) && (numfields != 4))
 			continue;
 
-		minor = atoll (fields[1]);
-
-		disk_name = fields[2 + fieldshift];
-
-		for (ds = disklist, pre_ds = disklist; ds != NULL; pre_ds = ds, ds = ds->next)
-			if (strcmp (disk_name, ds->name) == 0)
-				break;
+		minor = (int) head[1];
 
-		if (ds == NULL)
+		if (c_avl_get (disktree, disk_name, (void *) &ds) != 0)
 		{
-			if ((ds = (diskstats_t *) calloc (1, sizeof (diskstats_t))) == NULL)
+			ds = disk_create (disk_name);
+			if (ds == NULL)
 				continue;
 
-			if ((ds->name = strdup (disk_name)) == NULL)
+			if (c_avl_insert (disktree, ds->name, ds) != 0)
 			{
-				free (ds);
+				disk_free (ds);
 				continue;
 			}
-
-			if (pre_ds == NULL)
-				disklist = ds;
-			else
-				pre_ds->next = ds;
 		}
 
+		ds->round = disk_round;
+		if (ds->ignored)
+			continue;
+
 		is_disk = 0;
-		if (numfields == 7)
+		if (numfields == 4)
 		{
 			/* Kernel 2.6, Partition */
-			read_ops      = atoll (fields[3]);
-			read_sectors  = atoll (fields[4]);
-			write_ops     = atoll (fields[5]);
-			write_sectors = atoll (fields[6]);
+			read_ops      = fields[0];
+			read_sectors  = fields[1];
+			write_ops     = fields[2];
+			write_sectors = fields[3];
 		}
-		else if (numfields == (14 + fieldshift))
+		else
 		{
-			read_ops  =  atoll (fields[3 + fieldshift]);
-			write_ops =  atoll (fields[7 + fieldshift]);
+			read_ops  = fields[0];
+			write_ops = fields[4];
 
-			read_sectors  = atoll (fields[5 + fieldshift]);
-			write_sectors = atoll (fields[9 + fieldshift]);
+			read_sectors  = fields[2];
+			write_sectors = fields[6];
 
 			if ((fieldshift == 0) || (minor == 0))
 			{
 				is_disk = 1;
-				read_merged  = atoll (fields[4 + fieldshift]);
-				read_time    = atoll (fields[6 + fieldshift]);
-				write_merged = atoll (fields[8 + fieldshift]);
-				write_time   = atoll (fields[10+ fieldshift]);
+				read_merged  = fields[1];
+				read_time    = fields[3];
+				write_merged = fields[5];
+				write_time   = fields[7];
 			}
 		}
-		else
-		{
-			DEBUG ("numfields = %i; => unknown file format.", numfields);
-			continue;
-		}
 
 		{
 			derive_t diff_read_sectors;
@@ -660,24 +1071,30 @@ static int disk_read (void)
 		}
 
 		if ((ds->read_bytes != 0) || (ds->write_bytes != 0))
-			disk_submit (disk_name, "disk_octets",
+			disk_dispatch (disk_name, "disk_octets",
 					ds->read_bytes, ds->write_bytes);
 
 		if ((ds->read_ops != 0) || (ds->write_ops != 0))
-			disk_submit (disk_name, "disk_ops",
+			disk_dispatch (disk_name, "disk_ops",
 					read_ops, write_ops);
 
 		if ((ds->avg_read_time != 0) || (ds->avg_write_time != 0))
-			disk_submit (disk_name, "disk_time",
+			disk_dispatch (disk_name, "disk_time",
 					ds->avg_read_time, ds->avg_write_time);
 
 		if (is_disk)
 		{
-			disk_submit (disk_name, "disk_merged",
+			disk_dispatch (disk_name, "disk_merged",
 					read_merged, write_merged);
 		} /* if (is_disk) */
+
+		if (ds->read_latency != NULL)
+			disk_submit_latency (ds);
 	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
 
+	disk_prune ();
+	pthread_mutex_unlock (&disk_lock);
+
 	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
@@ -802,10 +1219,43 @@ static int disk_read (void)
 	return (0);
 } /* int disk_read */
 
+static int disk_shutdown (void)
+{
+#if KERNEL_LINUX
+	if (latency_thread_running)
+	{
+		pthread_mutex_lock (&disk_lock);
+		latency_thread_shutdown = 1;
+		pthread_cond_broadcast (&latency_cond);
+		pthread_mutex_unlock (&disk_lock);
+
+		pthread_join (latency_thread, /* retval = */ NULL);
+		latency_thread_running = 0;
+	}
+
+	if (disktree != NULL)
+	{
+		char *name;
+		diskstats_t *ds;
+
+		while (c_avl_pick (disktree, (void *) &name, (void *) &ds) == 0)
+			disk_free (ds);
+		c_avl_destroy (disktree);
+		disktree = NULL;
+	}
+
+	sfree (latency_percentiles);
+	latency_percentiles_num = 0;
+#endif /* KERNEL_LINUX */
+
+	return (0);
+} /* int disk_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("disk", disk_config,
       config_keys, config_keys_num);
   plugin_register_init ("disk", disk_init);
   plugin_register_read ("disk", disk_read);
+  plugin_register_shutdown ("disk", disk_shutdown);
 } /* void module_register */
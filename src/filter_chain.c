@@ -617,12 +617,21 @@ static int fc_bit_return_invoke (const data_set_t __attribute__((unused)) *ds, /
   return (FC_TARGET_RETURN);
 } /* }}} int fc_bit_return_invoke */
 
+/* The plugins of the `write' target are resolved when the target is
+ * created. The list is terminated by an entry with `handle' set to NULL. */
+struct fc_writer_s
+{
+  char *plugin;
+  plugin_write_handle_t *handle;
+};
+typedef struct fc_writer_s fc_writer_t;
+
 static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
     void **user_data)
 {
   int i;
 
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   size_t plugin_list_len;
 
   plugin_list = NULL;
@@ -631,7 +640,6 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
   for (i = 0; i < ci->children_num; i++)
   {
     oconfig_item_t *child = ci->children + i;
-    char **temp;
     int j;
 
     if (strcasecmp ("Plugin", child->key) != 0)
@@ -644,6 +652,8 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
 
     for (j = 0; j < child->values_num; j++)
     {
+      fc_writer_t *temp;
+
       if (child->values[j].type != OCONFIG_TYPE_STRING)
       {
         ERROR ("Filter subsystem: Built-in target `write': "
@@ -651,7 +661,7 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
         continue;
       }
 
-      temp = (char **) realloc (plugin_list, (plugin_list_len + 2)
+      temp = (fc_writer_t *) realloc (plugin_list, (plugin_list_len + 2)
           * (sizeof (*plugin_list)));
       if (temp == NULL)
       {
@@ -659,15 +669,27 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
         continue;
       }
       plugin_list = temp;
+      memset (plugin_list + plugin_list_len, 0, 2 * sizeof (*plugin_list));
 
-      plugin_list[plugin_list_len] = fc_strdup (child->values[j].value.string);
-      if (plugin_list[plugin_list_len] == NULL)
+      plugin_list[plugin_list_len].plugin =
+        fc_strdup (child->values[j].value.string);
+      if (plugin_list[plugin_list_len].plugin == NULL)
       {
         ERROR ("fc_bit_write_create: fc_strdup failed.");
         continue;
       }
+
+      /* The write plugin may not have been loaded yet; the handle is
+       * updated when it registers its callback. */
+      plugin_list[plugin_list_len].handle =
+        plugin_write_handle_get (plugin_list[plugin_list_len].plugin);
+      if (plugin_list[plugin_list_len].handle == NULL)
+      {
+        free (plugin_list[plugin_list_len].plugin);
+        plugin_list[plugin_list_len].plugin = NULL;
+        continue;
+      }
       plugin_list_len++;
-      plugin_list[plugin_list_len] = NULL;
     } /* for (j = 0; j < child->values_num; j++) */
   } /* for (i = 0; i < ci->children_num; i++) */
 
@@ -678,7 +700,7 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
 
 static int fc_bit_write_destroy (void **user_data) /* {{{ */
 {
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   size_t i;
 
   if ((user_data == NULL) || (*user_data == NULL))
@@ -686,8 +708,8 @@ static int fc_bit_write_destroy (void **user_data) /* {{{ */
 
   plugin_list = *user_data;
 
-  for (i = 0; plugin_list[i] != NULL; i++)
-    free (plugin_list[i]);
+  for (i = 0; plugin_list[i].handle != NULL; i++)
+    free (plugin_list[i].plugin);
   free (plugin_list);
 
   return (0);
@@ -697,14 +719,14 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
     value_list_t *vl, notification_meta_t __attribute__((unused)) **meta,
     void **user_data)
 {
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   int status;
 
   plugin_list = NULL;
   if (user_data != NULL)
     plugin_list = *user_data;
 
-  if ((plugin_list == NULL) || (plugin_list[0] == NULL))
+  if ((plugin_list == NULL) || (plugin_list[0].handle == NULL))
   {
     static c_complain_t enoent_complaint = C_COMPLAIN_INIT_STATIC;
 
@@ -736,15 +758,16 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
   {
     size_t i;
 
-    for (i = 0; plugin_list[i] != NULL; i++)
+    for (i = 0; plugin_list[i].handle != NULL; i++)
     {
-      status = plugin_write (plugin_list[i], ds, vl);
+      status = plugin_write_handle (plugin_list[i].handle, ds, vl);
       if (status != 0)
       {
         INFO ("Filter subsystem: Built-in target `write': Dispatching value to "
-            "the `%s' plugin failed with status %i.", plugin_list[i], status);
+            "the `%s' plugin failed with status %i.",
+            plugin_list[i].plugin, status);
       }
-    } /* for (i = 0; plugin_list[i] != NULL; i++) */
+    } /* for (i = 0; plugin_list[i].handle != NULL; i++) */
   }
 
   return (FC_TARGET_CONTINUE);
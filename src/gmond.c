@@ -23,7 +23,6 @@
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -60,21 +59,40 @@
 # define BUFF_SIZE 1400
 #endif
 
+#define GMOND_HASH_INIT 2166136261U
+
 struct socket_entry_s
 {
   int                     fd;
   struct sockaddr_storage addr;
   socklen_t               addrlen;
+  _Bool                   multicast;
 };
 typedef struct socket_entry_s socket_entry_t;
 
+struct staging_entry_s;
+typedef struct staging_entry_s staging_entry_t;
 struct staging_entry_s
 {
-  char key[2 * DATA_MAX_NAME_LEN];
+  uint32_t hash;
   value_list_t vl;
   int flags;
+
+  staging_entry_t *next;
 };
-typedef struct staging_entry_s staging_entry_t;
+
+/* The staging table is split into shards with their own lock, so that the
+ * receive threads rarely wait for each other. Each shard is a chained hash
+ * table keyed by host, type and type instance. */
+#define STAGING_SHARDS_NUM 16
+struct staging_shard_s
+{
+  pthread_mutex_t lock;
+  staging_entry_t **buckets;
+  size_t buckets_num; /* always a power of two */
+  size_t entries_num;
+};
+typedef struct staging_shard_s staging_shard_t;
 
 struct metric_map_s
 {
@@ -84,24 +102,35 @@ struct metric_map_s
   char *ds_name;
   int   ds_type;
   int   ds_index;
+  int   ds_num;
+  /* Hash of type and type instance, see staging_hash(). */
+  uint32_t staging_hash;
 };
 typedef struct metric_map_s metric_map_t;
 
+struct mc_receive_thread_s
+{
+  pthread_t      id;
+  struct pollfd *sockets;
+  size_t         sockets_num;
+  /* Multicast sockets are shared by all threads and closed by the first. */
+  _Bool          own_sockets;
+};
+typedef struct mc_receive_thread_s mc_receive_thread_t;
+
 #define MC_RECEIVE_GROUP_DEFAULT "239.2.11.71"
 static char          *mc_receive_group = NULL;
 #define MC_RECEIVE_PORT_DEFAULT "8649"
 static char          *mc_receive_port = NULL;
 
-static struct pollfd *mc_receive_sockets = NULL;
-static size_t         mc_receive_sockets_num = 0;
-
 static socket_entry_t  *mc_send_sockets = NULL;
 static size_t           mc_send_sockets_num = 0;
 static pthread_mutex_t  mc_send_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int            mc_receive_thread_loop    = 0;
-static int            mc_receive_thread_running = 0;
-static pthread_t      mc_receive_thread_id;
+static int                  mc_receive_thread_loop    = 0;
+static int                  mc_receive_thread_running = 0;
+static mc_receive_thread_t *mc_receive_threads = NULL;
+static size_t               mc_receive_threads_num = 1;
 
 static metric_map_t metric_map_default[] =
 { /*---------------+-------------+-----------+-------------+------+-----*
@@ -130,82 +159,149 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE (metric_map_default);
 static metric_map_t *metric_map = NULL;
 static size_t        metric_map_len = 0;
 
-static c_avl_tree_t   *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Open addressing hash table of pointers into both of the above. */
+static metric_map_t **metric_table = NULL;
+static size_t         metric_table_size = 0; /* always a power of two */
 
-static metric_map_t *metric_lookup (const char *key) /* {{{ */
+static staging_shard_t staging_shards[STAGING_SHARDS_NUM];
+
+/* 32 bit FNV-1a, continuing from "hash". */
+static uint32_t gmond_hash (uint32_t hash, const char *str) /* {{{ */
 {
-  metric_map_t *map;
-  size_t map_len;
-  size_t i;
+  for (; *str != 0; str++)
+  {
+    hash ^= (uint8_t) *str;
+    hash *= 16777619U;
+  }
 
-  /* Search the user-supplied table first.. */
-  map = metric_map;
-  map_len = metric_map_len;
-  for (i = 0; i < map_len; i++)
-    if (strcmp (map[i].ganglia_name, key) == 0)
-      break;
+  return (hash);
+} /* }}} uint32_t gmond_hash */
 
-  /* .. and fall back to the built-in table if nothing is found. */
-  if (i >= map_len)
-  {
-    map = metric_map_default;
-    map_len = metric_map_len_default;
+/* Looks up the data set of a mapping. Done once, when the table is built, so
+ * that neither a name lookup nor a type lookup is needed per value. */
+static int metric_resolve (metric_map_t *map) /* {{{ */
+{
+  const data_set_t *ds;
 
-    for (i = 0; i < map_len; i++)
-      if (strcmp (map[i].ganglia_name, key) == 0)
-        break;
+  ds = plugin_get_ds (map->type);
+  if (ds == NULL)
+  {
+    WARNING ("gmond plugin: Type not defined: %s", map->type);
+    return (-1);
   }
 
-  if (i >= map_len)
-    return (NULL);
+  if ((map->ds_name == NULL) && (ds->ds_num != 1))
+  {
+    WARNING ("gmond plugin: No data source name defined for metric %s, "
+        "but type %s has more than one data source.",
+        map->ganglia_name, map->type);
+    return (-1);
+  }
 
-  /* Look up the DS type and ds_index. */
-  if ((map[i].ds_type < 0) || (map[i].ds_index < 0)) /* {{{ */
+  if (map->ds_name == NULL)
+  {
+    map->ds_index = 0;
+  }
+  else
   {
-    const data_set_t *ds;
+    int j;
 
-    ds = plugin_get_ds (map[i].type);
-    if (ds == NULL)
-    {
-      WARNING ("gmond plugin: Type not defined: %s", map[i].type);
-      return (NULL);
-    }
+    for (j = 0; j < ds->ds_num; j++)
+      if (strcasecmp (ds->ds[j].name, map->ds_name) == 0)
+        break;
 
-    if ((map[i].ds_name == NULL) && (ds->ds_num != 1))
+    if (j >= ds->ds_num)
     {
-      WARNING ("gmond plugin: No data source name defined for metric %s, "
-          "but type %s has more than one data source.",
-          map[i].ganglia_name, map[i].type);
-      return (NULL);
+      WARNING ("gmond plugin: There is no data source "
+          "named `%s' in type `%s'.",
+          map->ds_name, ds->type);
+      return (-1);
     }
+    map->ds_index = j;
+  }
 
-    if (map[i].ds_name == NULL)
-    {
-      map[i].ds_index = 0;
-    }
+  /* "staging_entry_t.flags" has one bit per data source. */
+  if (ds->ds_num > (int) (8 * sizeof (int) - 1))
+  {
+    WARNING ("gmond plugin: Type %s has too many data sources.", ds->type);
+    return (-1);
+  }
+
+  map->ds_type = ds->ds[map->ds_index].type;
+  map->ds_num = ds->ds_num;
+
+  map->staging_hash = gmond_hash (GMOND_HASH_INIT, map->type);
+  map->staging_hash = gmond_hash (map->staging_hash, "/");
+  map->staging_hash = gmond_hash (map->staging_hash,
+      (map->type_instance != NULL) ? map->type_instance : "");
+
+  return (0);
+} /* }}} int metric_resolve */
+
+static metric_map_t **metric_table_slot (const char *key) /* {{{ */
+{
+  size_t mask = metric_table_size - 1;
+  size_t i;
+
+  for (i = gmond_hash (GMOND_HASH_INIT, key) & mask;
+      metric_table[i] != NULL;
+      i = (i + 1) & mask)
+  {
+    if (strcmp (metric_table[i]->ganglia_name, key) == 0)
+      break;
+  }
+
+  return (metric_table + i);
+} /* }}} metric_map_t **metric_table_slot */
+
+/* Builds the lookup table from the user-supplied and the built-in mappings.
+ * The former take precedence. */
+static int metric_table_build (void) /* {{{ */
+{
+  size_t size;
+  size_t i;
+
+  size = 16;
+  while (size < 2 * (metric_map_len + metric_map_len_default))
+    size *= 2;
+
+  metric_table = calloc (size, sizeof (*metric_table));
+  if (metric_table == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    return (-1);
+  }
+  metric_table_size = size;
+
+  for (i = 0; i < metric_map_len + metric_map_len_default; i++)
+  {
+    metric_map_t *map;
+    metric_map_t **slot;
+
+    if (i < metric_map_len)
+      map = metric_map + i;
     else
-    {
-      int j;
+      map = metric_map_default + (i - metric_map_len);
 
-      for (j = 0; j < ds->ds_num; j++)
-        if (strcasecmp (ds->ds[j].name, map[i].ds_name) == 0)
-          break;
+    slot = metric_table_slot (map->ganglia_name);
+    if (*slot != NULL)
+      continue;
 
-      if (j >= ds->ds_num)
-      {
-        WARNING ("gmond plugin: There is no data source "
-            "named `%s' in type `%s'.",
-            map[i].ds_name, ds->type);
-        return (NULL);
-      }
-      map[i].ds_index = j;
-    }
+    if (metric_resolve (map) != 0)
+      continue;
+
+    *slot = map;
+  }
+
+  return (0);
+} /* }}} int metric_table_build */
 
-    map[i].ds_type = ds->ds[map[i].ds_index].type;
-  } /* }}} if ((map[i].ds_type < 0) || (map[i].ds_index < 0)) */
+static metric_map_t *metric_lookup (const char *key) /* {{{ */
+{
+  if (metric_table == NULL)
+    return (NULL);
 
-  return (map + i);
+  return (*metric_table_slot (key));
 } /* }}} metric_map_t *metric_lookup */
 
 static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
@@ -275,6 +371,7 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
     assert (sizeof (sockets[sockets_num].addr) >= ai_ptr->ai_addrlen);
     memcpy (&sockets[sockets_num].addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     sockets[sockets_num].addrlen = ai_ptr->ai_addrlen;
+    sockets[sockets_num].multicast = 0;
 
     /* Sending socket: Open only one socket and don't bind it. */
     if (listen == 0)
@@ -288,6 +385,13 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
 
       setsockopt (sockets[sockets_num].fd, SOL_SOCKET, SO_REUSEADDR,
           (void *) &yes, sizeof (yes));
+#ifdef SO_REUSEPORT
+      /* Lets each receive thread bind its own socket to the port. The
+       * kernel then spreads unicast packets over these sockets. */
+      if (mc_receive_threads_num > 1)
+        setsockopt (sockets[sockets_num].fd, SOL_SOCKET, SO_REUSEPORT,
+            (void *) &yes, sizeof (yes));
+#endif
     }
 
     status = bind (sockets[sockets_num].fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
@@ -323,6 +427,7 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
       mreq.imr_interface.s_addr = htonl (INADDR_ANY);
       setsockopt (sockets[sockets_num].fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
           (void *) &mreq, sizeof (mreq));
+      sockets[sockets_num].multicast = 1;
     } /* if (ai_ptr->ai_family == AF_INET) */
     else if (ai_ptr->ai_family == AF_INET6)
     {
@@ -348,6 +453,7 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
       mreq.ipv6mr_interface = 0; /* any */
       setsockopt (sockets[sockets_num].fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP,
           (void *) &mreq, sizeof (mreq));
+      sockets[sockets_num].multicast = 1;
     } /* if (ai_ptr->ai_family == AF_INET6) */
 
     sockets_num++;
@@ -413,25 +519,76 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
   return (0);
 } /* }}} int request_meta_data */
 
-static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
-    const char *name,
-    const char *type, const char *type_instance,
-    int values_len)
+static uint32_t staging_hash (const char *host, /* {{{ */
+    const metric_map_t *map)
+{
+  uint32_t hash = gmond_hash (GMOND_HASH_INIT, host);
+
+  return (hash ^ (map->staging_hash + 0x9e3779b9U
+        + (hash << 6) + (hash >> 2)));
+} /* }}} uint32_t staging_hash */
+
+static staging_shard_t *staging_shard_get (uint32_t hash) /* {{{ */
+{
+  return (staging_shards + (hash % STAGING_SHARDS_NUM));
+} /* }}} staging_shard_t *staging_shard_get */
+
+static int staging_shard_grow (staging_shard_t *shard) /* {{{ */
+{
+  staging_entry_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  buckets_num = (shard->buckets_num > 0) ? 2 * shard->buckets_num : 64;
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+    return (-1);
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    while (shard->buckets[i] != NULL)
+    {
+      staging_entry_t *se = shard->buckets[i];
+      size_t idx = (se->hash / STAGING_SHARDS_NUM) & (buckets_num - 1);
+
+      shard->buckets[i] = se->next;
+      se->next = buckets[idx];
+      buckets[idx] = se;
+    }
+  }
+
+  sfree (shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+  return (0);
+} /* }}} int staging_shard_grow */
+
+/* Must be called with "shard->lock" held. */
+static staging_entry_t *staging_entry_get (staging_shard_t *shard, /* {{{ */
+    uint32_t hash, const char *host, const metric_map_t *map)
 {
-  char key[2 * DATA_MAX_NAME_LEN];
+  const char *type_instance;
   staging_entry_t *se;
-  int status;
+  size_t idx;
 
-  if (staging_tree == NULL)
-    return (NULL);
+  type_instance = (map->type_instance != NULL) ? map->type_instance : "";
 
-  ssnprintf (key, sizeof (key), "%s/%s/%s", host, type,
-      (type_instance != NULL) ? type_instance : "");
+  if (shard->buckets_num > 0)
+  {
+    idx = (hash / STAGING_SHARDS_NUM) & (shard->buckets_num - 1);
+    for (se = shard->buckets[idx]; se != NULL; se = se->next)
+    {
+      if ((se->hash == hash)
+          && (strncmp (se->vl.host, host, sizeof (se->vl.host) - 1) == 0)
+          && (strcmp (se->vl.type, map->type) == 0)
+          && (strcmp (se->vl.type_instance, type_instance) == 0))
+        return (se);
+    }
+  }
 
-  se = NULL;
-  status = c_avl_get (staging_tree, key, (void *) &se);
-  if (status == 0)
-    return (se);
+  if ((shard->entries_num >= shard->buckets_num)
+      && (staging_shard_grow (shard) != 0))
+    return (NULL);
 
   /* insert new entry */
   se = (staging_entry_t *) malloc (sizeof (*se));
@@ -439,40 +596,63 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     return (NULL);
   memset (se, 0, sizeof (*se));
 
-  sstrncpy (se->key, key, sizeof (se->key));
+  se->hash = hash;
   se->flags = 0;
 
-  se->vl.values = (value_t *) calloc (values_len, sizeof (*se->vl.values));
+  se->vl.values = (value_t *) calloc (map->ds_num, sizeof (*se->vl.values));
   if (se->vl.values == NULL)
   {
     sfree (se);
     return (NULL);
   }
-  se->vl.values_len = values_len;
+  se->vl.values_len = map->ds_num;
 
   se->vl.time = 0;
   se->vl.interval = 0;
   sstrncpy (se->vl.host, host, sizeof (se->vl.host));
   sstrncpy (se->vl.plugin, "gmond", sizeof (se->vl.plugin));
-  sstrncpy (se->vl.type, type, sizeof (se->vl.type));
-  if (type_instance != NULL)
-    sstrncpy (se->vl.type_instance, type_instance,
-        sizeof (se->vl.type_instance));
+  sstrncpy (se->vl.type, map->type, sizeof (se->vl.type));
+  sstrncpy (se->vl.type_instance, type_instance,
+      sizeof (se->vl.type_instance));
 
-  status = c_avl_insert (staging_tree, se->key, se);
-  if (status != 0)
-  {
-    ERROR ("gmond plugin: c_avl_insert failed.");
-    sfree (se->vl.values);
-    sfree (se);
-    return (NULL);
-  }
+  idx = (hash / STAGING_SHARDS_NUM) & (shard->buckets_num - 1);
+  se->next = shard->buckets[idx];
+  shard->buckets[idx] = se;
+  shard->entries_num++;
 
   return (se);
 } /* }}} staging_entry_t *staging_entry_get */
 
-static int staging_entry_submit (const char *host, const char *name, /* {{{ */
-    staging_entry_t *se)
+static void staging_free (void) /* {{{ */
+{
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < STAGING_SHARDS_NUM; i++)
+  {
+    staging_shard_t *shard = staging_shards + i;
+
+    pthread_mutex_lock (&shard->lock);
+    for (j = 0; j < shard->buckets_num; j++)
+    {
+      while (shard->buckets[j] != NULL)
+      {
+        staging_entry_t *se = shard->buckets[j];
+
+        shard->buckets[j] = se->next;
+        sfree (se->vl.values);
+        sfree (se);
+      }
+    }
+    sfree (shard->buckets);
+    shard->buckets_num = 0;
+    shard->entries_num = 0;
+    pthread_mutex_unlock (&shard->lock);
+  }
+} /* }}} void staging_free */
+
+static int staging_entry_submit (staging_shard_t *shard, /* {{{ */
+    const char *host, const char *name, staging_entry_t *se)
 {
   value_list_t vl;
   value_t values[se->vl.values_len];
@@ -481,7 +661,7 @@ static int staging_entry_submit (const char *host, const char *name, /* {{{ */
   {
     /* No meta data has been received for this metric yet. */
     se->flags = 0;
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     request_meta_data (host, name);
     return (0);
   }
@@ -492,7 +672,7 @@ static int staging_entry_submit (const char *host, const char *name, /* {{{ */
   memcpy (&vl, &se->vl, sizeof (vl));
 
   /* Unlock before calling `plugin_dispatch_values'.. */
-  pthread_mutex_unlock (&staging_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   vl.values = values;
 
@@ -502,48 +682,38 @@ static int staging_entry_submit (const char *host, const char *name, /* {{{ */
 } /* }}} int staging_entry_submit */
 
 static int staging_entry_update (const char *host, const char *name, /* {{{ */
-    const char *type, const char *type_instance,
-    int ds_index, int ds_type, value_t value)
+    const metric_map_t *map, value_t value)
 {
-  const data_set_t *ds;
+  staging_shard_t *shard;
   staging_entry_t *se;
+  uint32_t hash;
+  int ds_index = map->ds_index;
 
-  ds = plugin_get_ds (type);
-  if (ds == NULL)
-  {
-    ERROR ("gmond plugin: Looking up type %s failed.", type);
-    return (-1);
-  }
+  hash = staging_hash (host, map);
+  shard = staging_shard_get (hash);
 
-  if (ds->ds_num <= ds_index)
-  {
-    ERROR ("gmond plugin: Invalid index %i: %s has only %i data source(s).",
-        ds_index, ds->type, ds->ds_num);
-    return (-1);
-  }
+  pthread_mutex_lock (&shard->lock);
 
-  pthread_mutex_lock (&staging_lock);
-
-  se = staging_entry_get (host, name, type, type_instance, ds->ds_num);
+  se = staging_entry_get (shard, hash, host, map);
   if (se == NULL)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     ERROR ("gmond plugin: staging_entry_get failed.");
     return (-1);
   }
-  if (se->vl.values_len != ds->ds_num)
+  if (se->vl.values_len != map->ds_num)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
-  if (ds_type == DS_TYPE_COUNTER)
+  if (map->ds_type == DS_TYPE_COUNTER)
     se->vl.values[ds_index].counter += value.counter;
-  else if (ds_type == DS_TYPE_GAUGE)
+  else if (map->ds_type == DS_TYPE_GAUGE)
     se->vl.values[ds_index].gauge = value.gauge;
-  else if (ds_type == DS_TYPE_DERIVE)
+  else if (map->ds_type == DS_TYPE_DERIVE)
     se->vl.values[ds_index].derive += value.derive;
-  else if (ds_type == DS_TYPE_ABSOLUTE)
+  else if (map->ds_type == DS_TYPE_ABSOLUTE)
     se->vl.values[ds_index].absolute = value.absolute;
   else
     assert (23 == 42);
@@ -553,12 +723,12 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   /* Check if all values have been set and submit if so. */
   if (se->flags == ((0x01 << se->vl.values_len) - 1))
   {
-    /* `staging_lock' is unlocked in `staging_entry_submit'. */
-    staging_entry_submit (host, name, se);
+    /* `shard->lock' is unlocked in `staging_entry_submit'. */
+    staging_entry_submit (shard, host, name, se);
   }
   else
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
   }
 
   return (0);
@@ -660,17 +830,14 @@ static int mc_handle_value_msg (Ganglia_value_msg *msg) /* {{{ */
     if ((map->ds_type == DS_TYPE_COUNTER)
         || (map->ds_type == DS_TYPE_ABSOLUTE))
       val_copy = value_counter;
-    if (map->ds_type == DS_TYPE_GAUGE)
+    else if (map->ds_type == DS_TYPE_GAUGE)
       val_copy = value_gauge;
     else if (map->ds_type == DS_TYPE_DERIVE)
       val_copy = value_derive;
     else
       assert (23 == 42);
 
-    return (staging_entry_update (host, name,
-          map->type, map->type_instance,
-          map->ds_index, map->ds_type,
-          val_copy));
+    return (staging_entry_update (host, name, map, val_copy));
   }
 
   DEBUG ("gmond plugin: Cannot find a translation for %s.", name);
@@ -684,9 +851,10 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
     case gmetadata_full:
     {
       Ganglia_metadatadef msg_meta;
+      staging_shard_t *shard;
       staging_entry_t *se;
-      const data_set_t *ds;
       metric_map_t *map;
+      uint32_t hash;
 
       msg_meta = msg->Ganglia_metadata_msg_u.gfull;
 
@@ -701,24 +869,17 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
         return (0);
       }
 
-      ds = plugin_get_ds (map->type);
-      if (ds == NULL)
-      {
-        WARNING ("gmond plugin: Could not find data set %s.", map->type);
-        return (-1);
-      }
-
       DEBUG ("gmond plugin: Received meta data for %s/%s.",
           msg_meta.metric_id.host, msg_meta.metric_id.name);
 
-      pthread_mutex_lock (&staging_lock);
-      se = staging_entry_get (msg_meta.metric_id.host,
-          msg_meta.metric_id.name,
-          map->type, map->type_instance,
-          ds->ds_num);
+      hash = staging_hash (msg_meta.metric_id.host, map);
+      shard = staging_shard_get (hash);
+
+      pthread_mutex_lock (&shard->lock);
+      se = staging_entry_get (shard, hash, msg_meta.metric_id.host, map);
       if (se != NULL)
         se->vl.interval = TIME_T_TO_CDTIME_T (msg_meta.metric.tmax);
-      pthread_mutex_unlock (&staging_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       if (se == NULL)
       {
@@ -763,6 +924,7 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
       memset (&msg, 0, sizeof (msg));
       if (xdr_Ganglia_value_msg (&xdr, &msg))
         mc_handle_value_msg (&msg);
+      xdr_free ((xdrproc_t) xdr_Ganglia_value_msg, (void *) &msg);
       break;
     }
 
@@ -773,6 +935,7 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
       memset (&msg, 0, sizeof (msg));
       if (xdr_Ganglia_metadata_msg (&xdr, &msg))
         mc_handle_metadata_msg (&msg);
+      xdr_free ((xdrproc_t) xdr_Ganglia_metadata_msg, (void *) &msg);
       break;
     }
 
@@ -796,8 +959,15 @@ static int mc_handle_socket (struct pollfd *p) /* {{{ */
     return (-1);
   }
 
-  buffer_size = recv (p->fd, buffer, sizeof (buffer), /* flags = */ 0);
-  if (buffer_size <= 0)
+  /* Multicast sockets are shared between the receive threads, so another
+   * thread may have read the packet already. */
+  buffer_size = recv (p->fd, buffer, sizeof (buffer), MSG_DONTWAIT);
+  if ((buffer_size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    p->revents = 0;
+    return (0);
+  }
+  else if (buffer_size <= 0)
   {
     char errbuf[1024];
     ERROR ("gmond plugin: recv failed: %s",
@@ -812,44 +982,13 @@ static int mc_handle_socket (struct pollfd *p) /* {{{ */
 
 static void *mc_receive_thread (void *arg) /* {{{ */
 {
-  socket_entry_t *mc_receive_socket_entries;
+  mc_receive_thread_t *thread = arg;
   int status;
   size_t i;
 
-  mc_receive_socket_entries = NULL;
-  status = create_sockets (&mc_receive_socket_entries, &mc_receive_sockets_num,
-      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
-      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 1);
-  if (status != 0)
-  {
-    ERROR ("gmond plugin: create_sockets failed.");
-    return ((void *) -1);
-  }
-
-  mc_receive_sockets = (struct pollfd *) calloc (mc_receive_sockets_num,
-      sizeof (*mc_receive_sockets));
-  if (mc_receive_sockets == NULL)
-  {
-    ERROR ("gmond plugin: calloc failed.");
-    for (i = 0; i < mc_receive_sockets_num; i++)
-      close (mc_receive_socket_entries[i].fd);
-    free (mc_receive_socket_entries);
-    mc_receive_socket_entries = NULL;
-    mc_receive_sockets_num = 0;
-    return ((void *) -1);
-  }
-
-  for (i = 0; i < mc_receive_sockets_num; i++)
-  {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
-    mc_receive_sockets[i].events = POLLIN | POLLPRI;
-    mc_receive_sockets[i].revents = 0;
-  }
-
   while (mc_receive_thread_loop != 0)
   {
-    status = poll (mc_receive_sockets, mc_receive_sockets_num, -1);
+    status = poll (thread->sockets, thread->sockets_num, -1);
     if (status <= 0)
     {
       char errbuf[1024];
@@ -860,49 +999,183 @@ static void *mc_receive_thread (void *arg) /* {{{ */
       break;
     }
 
-    for (i = 0; i < mc_receive_sockets_num; i++)
+    for (i = 0; i < thread->sockets_num; i++)
     {
-      if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket (mc_receive_sockets + i);
+      if (thread->sockets[i].revents != 0)
+        mc_handle_socket (thread->sockets + i);
     }
   } /* while (mc_receive_thread_loop != 0) */
 
   return ((void *) 0);
 } /* }}} void *mc_receive_thread */
 
+static void mc_receive_sockets_close (mc_receive_thread_t *thread) /* {{{ */
+{
+  size_t i;
+
+  if (thread->own_sockets)
+    for (i = 0; i < thread->sockets_num; i++)
+      close (thread->sockets[i].fd);
+
+  sfree (thread->sockets);
+  thread->sockets_num = 0;
+} /* }}} void mc_receive_sockets_close */
+
+/* Opens the receive sockets for one thread. Sets "*ret_multicast" if any of
+ * the sockets has joined a multicast group. */
+static int mc_receive_sockets_open (mc_receive_thread_t *thread, /* {{{ */
+    _Bool *ret_multicast)
+{
+  socket_entry_t *entries = NULL;
+  size_t entries_num = 0;
+  int status;
+  size_t i;
+
+  status = create_sockets (&entries, &entries_num,
+      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
+      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
+      /* listen = */ 1);
+  if (status != 0)
+  {
+    ERROR ("gmond plugin: create_sockets failed.");
+    return (-1);
+  }
+
+  thread->sockets = calloc (entries_num, sizeof (*thread->sockets));
+  if (thread->sockets == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    for (i = 0; i < entries_num; i++)
+      close (entries[i].fd);
+    sfree (entries);
+    return (-1);
+  }
+  thread->sockets_num = entries_num;
+  thread->own_sockets = 1;
+
+  *ret_multicast = 0;
+  for (i = 0; i < entries_num; i++)
+  {
+    thread->sockets[i].fd = entries[i].fd;
+    thread->sockets[i].events = POLLIN | POLLPRI;
+    thread->sockets[i].revents = 0;
+    if (entries[i].multicast)
+      *ret_multicast = 1;
+  }
+
+  sfree (entries);
+  return (0);
+} /* }}} int mc_receive_sockets_open */
+
+/* Every thread polls its own copy of the first thread's sockets. */
+static int mc_receive_sockets_share (mc_receive_thread_t *thread) /* {{{ */
+{
+  mc_receive_thread_t *first = mc_receive_threads;
+
+  thread->sockets = calloc (first->sockets_num, sizeof (*thread->sockets));
+  if (thread->sockets == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    return (-1);
+  }
+  memcpy (thread->sockets, first->sockets,
+      first->sockets_num * sizeof (*thread->sockets));
+  thread->sockets_num = first->sockets_num;
+  thread->own_sockets = 0;
+
+  return (0);
+} /* }}} int mc_receive_sockets_share */
+
 static int mc_receive_thread_start (void) /* {{{ */
 {
+  _Bool share_sockets = 0;
+  size_t started = 0;
+  size_t i;
   int status;
 
   if (mc_receive_thread_running != 0)
     return (-1);
 
+  mc_receive_threads = calloc (mc_receive_threads_num,
+      sizeof (*mc_receive_threads));
+  if (mc_receive_threads == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    return (-1);
+  }
+
   mc_receive_thread_loop = 1;
 
-  status = plugin_thread_create (&mc_receive_thread_id, /* attr = */ NULL,
-      mc_receive_thread, /* args = */ NULL);
-  if (status != 0)
+  for (i = 0; i < mc_receive_threads_num; i++)
+  {
+    mc_receive_thread_t *thread = mc_receive_threads + i;
+
+    if ((i == 0) || !share_sockets)
+    {
+      _Bool multicast = 0;
+
+      status = mc_receive_sockets_open (thread, &multicast);
+      if (status != 0)
+        break;
+
+#ifdef SO_REUSEPORT
+      /* Each socket subscribed to a group receives a copy of every packet,
+       * so multicast sockets can't be used to spread the load. */
+      share_sockets = multicast;
+#else
+      share_sockets = 1;
+#endif
+    }
+    else
+    {
+      status = mc_receive_sockets_share (thread);
+      if (status != 0)
+        break;
+    }
+
+    status = plugin_thread_create (&thread->id, /* attr = */ NULL,
+        mc_receive_thread, /* args = */ thread);
+    if (status != 0)
+    {
+      ERROR ("gmond plugin: Starting receive thread failed.");
+      mc_receive_sockets_close (thread);
+      break;
+    }
+    started++;
+  }
+
+  if (started == 0)
   {
-    ERROR ("gmond plugin: Starting receive thread failed.");
     mc_receive_thread_loop = 0;
+    sfree (mc_receive_threads);
     return (-1);
   }
 
+  mc_receive_threads_num = started;
   mc_receive_thread_running = 1;
   return (0);
 } /* }}} int start_receive_thread */
 
 static int mc_receive_thread_stop (void) /* {{{ */
 {
+  size_t i;
+
   if (mc_receive_thread_running == 0)
     return (-1);
 
   mc_receive_thread_loop = 0;
 
-  INFO ("gmond plugin: Stopping receive thread.");
-  pthread_kill (mc_receive_thread_id, SIGTERM);
-  pthread_join (mc_receive_thread_id, /* return value = */ NULL);
-  memset (&mc_receive_thread_id, 0, sizeof (mc_receive_thread_id));
+  INFO ("gmond plugin: Stopping receive threads.");
+  for (i = 0; i < mc_receive_threads_num; i++)
+  {
+    pthread_kill (mc_receive_threads[i].id, SIGTERM);
+    pthread_join (mc_receive_threads[i].id, /* return value = */ NULL);
+  }
+
+  /* Close the shared sockets last. */
+  for (i = mc_receive_threads_num; i > 0; i--)
+    mc_receive_sockets_close (mc_receive_threads + (i - 1));
+  sfree (mc_receive_threads);
 
   mc_receive_thread_running = 0;
 
@@ -914,6 +1187,7 @@ static int mc_receive_thread_stop (void) /* {{{ */
  *
  * <Plugin gmond>
  *   MCReceiveFrom "239.2.11.71" "8649"
+ *   ReceiveThreads 4
  *   <Metric "load_one">
  *     Type "load"
  *     [TypeInstance "foo"]
@@ -1054,6 +1328,20 @@ static int gmond_config_set_address (oconfig_item_t *ci, /* {{{ */
   return (0);
 } /* }}} int gmond_config_set_address */
 
+static int gmond_config_set_threads (oconfig_item_t *ci) /* {{{ */
+{
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_NUMBER)
+      || (ci->values[0].value.number < 1.0))
+  {
+    WARNING ("gmond plugin: The `%s' option needs "
+        "exactly one positive numeric argument.", ci->key);
+    return (-1);
+  }
+
+  mc_receive_threads_num = (size_t) ci->values[0].value.number;
+  return (0);
+} /* }}} int gmond_config_set_threads */
+
 static int gmond_config (oconfig_item_t *ci) /* {{{ */
 {
   int i;
@@ -1063,6 +1351,8 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("MCReceiveFrom", child->key) == 0)
       gmond_config_set_address (child, &mc_receive_group, &mc_receive_port);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      gmond_config_set_threads (child);
     else if (strcasecmp ("Metric", child->key) == 0)
       gmond_config_add_metric (child);
     else
@@ -1077,17 +1367,18 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
 
 static int gmond_init (void) /* {{{ */
 {
+  size_t i;
+
   create_sockets (&mc_send_sockets, &mc_send_sockets_num,
       (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
       /* listen = */ 0);
 
-  staging_tree = c_avl_create ((void *) strcmp);
-  if (staging_tree == NULL)
-  {
-    ERROR ("gmond plugin: c_avl_create failed.");
+  for (i = 0; i < STAGING_SHARDS_NUM; i++)
+    pthread_mutex_init (&staging_shards[i].lock, /* attr = */ NULL);
+
+  if (metric_table_build () != 0)
     return (-1);
-  }
 
   mc_receive_thread_start ();
 
@@ -1110,6 +1401,9 @@ static int gmond_shutdown (void) /* {{{ */
   mc_send_sockets_num = 0;
   pthread_mutex_unlock (&mc_send_sockets_lock);
 
+  staging_free ();
+  sfree (metric_table);
+  metric_table_size = 0;
 
   return (0);
 } /* }}} int gmond_shutdown */
@@ -0,0 +1,982 @@
+/**
+ * collectd - src/http_exposition.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Serves the current contents of the value cache over HTTP, in the text
+ * exposition format used by Prometheus-style scrapers. Nothing is formatted
+ * until a client asks for it. The cache is read in chunks of "ChunkSize"
+ * entries using uc_iterate(), so a scrape of a large cache delays
+ * uc_update() by at most one chunk at a time. Each chunk is compressed (if
+ * the client accepts gzip) and sent before the next one is read.
+ *
+ *   GET /metrics?prefix=<identifier prefix>&prefix=...
+ *
+ * A single thread accepts connections and answers them one after another.
+ * Each request, including the response, has to be completed within
+ * "Timeout", so a slow client cannot hold up other scrapes or shutdown.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#define HE_DEFAULT_NODE "localhost"
+#define HE_DEFAULT_PORT "9103"
+#define HE_MAX_LISTEN 16
+#define HE_MAX_PREFIXES 16
+#define HE_REQUEST_SIZE 8192
+#define HE_BUFFER_SIZE (64 * 1024)
+
+#define HE_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/*
+ * Private data types
+ */
+struct he_listen_s
+{
+  char *node;
+  char *service;
+};
+typedef struct he_listen_s he_listen_t;
+
+struct he_client_s
+{
+  int fd;
+  /* time by which the response has to be sent */
+  cdtime_t deadline;
+  _Bool gzip;
+#if HAVE_ZLIB
+  z_stream z;
+#endif
+
+  /* formatted text of the current chunk */
+  char text[HE_BUFFER_SIZE];
+  size_t text_len;
+  _Bool text_full;
+
+  /* last name passed to he_format_entry() */
+  char last[6 * DATA_MAX_NAME_LEN];
+
+  /* compressed output */
+  char out[HE_BUFFER_SIZE];
+};
+typedef struct he_client_s he_client_t;
+
+/*
+ * Private variables
+ */
+static he_listen_t he_listen[HE_MAX_LISTEN];
+static size_t he_listen_num = 0;
+
+static size_t he_chunk_size = 1000;
+static int he_timeout_ms = 10000;
+
+static struct pollfd he_fds[HE_MAX_LISTEN * 4];
+static size_t he_fds_num = 0;
+
+static pthread_t he_thread;
+static _Bool he_thread_running = 0;
+static int he_loop = 0;
+
+/* Used by a single thread only. */
+static he_client_t he_client;
+
+/*
+ * Formatting
+ */
+/* Appends "src" to the metric name, replacing characters other than
+ * [a-zA-Z0-9_] with underscores. */
+static size_t he_metric_name (char *dst, size_t dst_size, /* {{{ */
+    const char *src)
+{
+  size_t i;
+
+  for (i = 0; (src[i] != 0) && (i + 1 < dst_size); i++)
+  {
+    char c = src[i];
+
+    if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+        || ((c >= '0') && (c <= '9')))
+      dst[i] = c;
+    else
+      dst[i] = '_';
+  }
+  if (dst_size > 0)
+    dst[i] = 0;
+
+  return (i);
+} /* }}} size_t he_metric_name */
+
+/* Appends a label unless "value" is empty. Returns -1 if the label does not
+ * fit into "buffer". */
+static int he_label_add (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, const char *key, const char *value)
+{
+  size_t o = *offset;
+  size_t i;
+  int status;
+
+  if (value[0] == 0)
+    return (0);
+
+  status = ssnprintf (buffer + o, buffer_size - o, "%s%s=\"",
+      (o == 0) ? "{" : ",", key);
+  if ((status < 0) || ((size_t) status >= buffer_size - o))
+    return (-1);
+  o += (size_t) status;
+
+  for (i = 0; value[i] != 0; i++)
+  {
+    char c = value[i];
+
+    if (o + 3 >= buffer_size)
+      return (-1);
+
+    if ((c == '\\') || (c == '"'))
+    {
+      buffer[o++] = '\\';
+      buffer[o++] = c;
+    }
+    else if (c == '\n')
+    {
+      buffer[o++] = '\\';
+      buffer[o++] = 'n';
+    }
+    else
+      buffer[o++] = c;
+  }
+
+  if (o + 2 >= buffer_size)
+    return (-1);
+  buffer[o++] = '"';
+  buffer[o] = 0;
+
+  *offset = o;
+  return (0);
+} /* }}} int he_label_add */
+
+static int he_format_value (char *buffer, size_t buffer_size, /* {{{ */
+    int ds_type, value_t value)
+{
+  switch (ds_type)
+  {
+    case DS_TYPE_COUNTER:
+      return (ssnprintf (buffer, buffer_size, "%llu", value.counter));
+    case DS_TYPE_DERIVE:
+      return (ssnprintf (buffer, buffer_size, "%"PRIi64, value.derive));
+    case DS_TYPE_ABSOLUTE:
+      return (ssnprintf (buffer, buffer_size, "%"PRIu64, value.absolute));
+    case DS_TYPE_GAUGE:
+      if (isnan (value.gauge))
+        return (ssnprintf (buffer, buffer_size, "NaN"));
+      else if (isinf (value.gauge))
+        return (ssnprintf (buffer, buffer_size, "%sInf",
+              (value.gauge < 0.0) ? "-" : "+"));
+      return (ssnprintf (buffer, buffer_size, "%.15g", value.gauge));
+  }
+
+  return (-1);
+} /* }}} int he_format_value */
+
+/* Called by uc_iterate() with the cache locked. Formats one line per data
+ * source into the client's text buffer. Returns non-zero if the buffer is
+ * too full. */
+static int he_format_entry (const char *name, /* {{{ */
+    const value_t *values, const gauge_t __attribute__((unused)) *rates,
+    size_t values_num, cdtime_t time,
+    cdtime_t __attribute__((unused)) interval, void *user_data)
+{
+  he_client_t *c = user_data;
+  char name_copy[6 * DATA_MAX_NAME_LEN];
+  char *host, *plugin, *plugin_instance, *type, *type_instance;
+  const data_set_t *ds;
+  char prefix[3 * DATA_MAX_NAME_LEN];
+  char labels[8 * DATA_MAX_NAME_LEN];
+  size_t prefix_len;
+  size_t labels_len = 0;
+  size_t offset = c->text_len;
+  size_t i;
+  int status;
+
+  sstrncpy (name_copy, name, sizeof (name_copy));
+  status = parse_identifier (name_copy, &host, &plugin, &plugin_instance,
+      &type, &type_instance);
+  if (status != 0)
+    goto skip;
+  if (plugin_instance == NULL)
+    plugin_instance = "";
+  if (type_instance == NULL)
+    type_instance = "";
+
+  ds = plugin_get_ds (type);
+  if ((ds == NULL) || ((size_t) ds->ds_num != values_num))
+    goto skip;
+
+  prefix_len = he_metric_name (prefix, sizeof (prefix), "collectd_");
+  prefix_len += he_metric_name (prefix + prefix_len,
+      sizeof (prefix) - prefix_len, plugin);
+  prefix_len += he_metric_name (prefix + prefix_len,
+      sizeof (prefix) - prefix_len, "_");
+  prefix_len += he_metric_name (prefix + prefix_len,
+      sizeof (prefix) - prefix_len, type);
+
+  labels[0] = 0;
+  if ((he_label_add (labels, sizeof (labels), &labels_len,
+          "host", host) != 0)
+      || (he_label_add (labels, sizeof (labels), &labels_len,
+          "plugin_instance", plugin_instance) != 0)
+      || (he_label_add (labels, sizeof (labels), &labels_len,
+          "type_instance", type_instance) != 0))
+    goto skip;
+  if (labels_len > 0)
+    sstrncpy (labels + labels_len, "}", sizeof (labels) - labels_len);
+
+  for (i = 0; i < values_num; i++)
+  {
+    char ds_name[DATA_MAX_NAME_LEN + 1] = "";
+    char value[64];
+    int ds_type = ds->ds[i].type;
+
+    if ((values_num > 1) || (strcmp ("value", ds->ds[i].name) != 0))
+    {
+      ds_name[0] = '_';
+      he_metric_name (ds_name + 1, sizeof (ds_name) - 1, ds->ds[i].name);
+    }
+
+    if (he_format_value (value, sizeof (value), ds_type, values[i]) < 0)
+      goto skip;
+
+    status = ssnprintf (c->text + offset, sizeof (c->text) - offset,
+        "%s%s%s%s %s %li\n", prefix, ds_name,
+        ((ds_type == DS_TYPE_COUNTER) || (ds_type == DS_TYPE_DERIVE))
+        ? "_total" : "", labels, value, CDTIME_T_TO_MS (time));
+    if ((status < 0) || ((size_t) status >= sizeof (c->text) - offset))
+    {
+      /* If the entry does not fit into an empty buffer, it never will. */
+      if (c->text_len == 0)
+        goto skip;
+      c->text[c->text_len] = 0;
+      c->text_full = 1;
+      return (-1);
+    }
+    offset += (size_t) status;
+  }
+
+  c->text_len = offset;
+  sstrncpy (c->last, name, sizeof (c->last));
+  return (0);
+
+skip:
+  c->text[c->text_len] = 0;
+  sstrncpy (c->last, name, sizeof (c->last));
+  return (0);
+} /* }}} int he_format_entry */
+
+/*
+ * Output
+ */
+/* Waits until "fd" is ready for "events". Fails with ETIMEDOUT once
+ * "deadline" has passed. */
+static int he_wait (int fd, short events, cdtime_t deadline) /* {{{ */
+{
+  while (42)
+  {
+    struct pollfd pfd = { fd, events, 0 };
+    cdtime_t now = cdtime ();
+    int status;
+
+    if (now >= deadline)
+    {
+      errno = ETIMEDOUT;
+      return (-1);
+    }
+
+    /* Round up, so a remaining time below one millisecond does not turn
+     * into a busy loop. */
+    status = poll (&pfd, 1, (int) CDTIME_T_TO_MS (deadline - now) + 1);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if (status < 0)
+      return (-1);
+    else if (status > 0)
+      return (0);
+  }
+} /* }}} int he_wait */
+
+/* Sends all of "data" on the non-blocking socket "fd" before "deadline". */
+static int he_send_fd (int fd, const char *data, size_t len, /* {{{ */
+    cdtime_t deadline)
+{
+  while (len > 0)
+  {
+    ssize_t status;
+
+    if (he_wait (fd, POLLOUT, deadline) != 0)
+      return (-1);
+
+    status = send (fd, data, len, 0);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      return (-1);
+    }
+
+    data += status;
+    len -= (size_t) status;
+  }
+
+  return (0);
+} /* }}} int he_send_fd */
+
+static int he_send_raw (he_client_t *c, const char *data, size_t len) /* {{{ */
+{
+  return (he_send_fd (c->fd, data, len, c->deadline));
+} /* }}} int he_send_raw */
+
+/* Sends the formatted text, compressing it if the client accepts gzip.
+ * "finish" terminates the compressed stream. */
+static int he_send_text (he_client_t *c, _Bool finish) /* {{{ */
+{
+  int status;
+
+  if (!c->gzip)
+  {
+    status = he_send_raw (c, c->text, c->text_len);
+    c->text_len = 0;
+    return (status);
+  }
+
+#if HAVE_ZLIB
+  c->z.next_in = (void *) c->text;
+  c->z.avail_in = (uInt) c->text_len;
+  do
+  {
+    size_t have;
+
+    c->z.next_out = (void *) c->out;
+    c->z.avail_out = (uInt) sizeof (c->out);
+
+    status = deflate (&c->z, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (status == Z_STREAM_ERROR)
+      return (-1);
+
+    have = sizeof (c->out) - c->z.avail_out;
+    if ((have > 0) && (he_send_raw (c, c->out, have) != 0))
+      return (-1);
+  } while (c->z.avail_out == 0);
+#endif
+
+  c->text_len = 0;
+  return (0);
+} /* }}} int he_send_text */
+
+static int he_send_prefix (he_client_t *c, const char *prefix) /* {{{ */
+{
+  c->last[0] = 0;
+
+  while (42)
+  {
+    int status;
+
+    c->text_full = 0;
+    status = uc_iterate (prefix, (c->last[0] != 0) ? c->last : NULL,
+        he_chunk_size, he_format_entry, c);
+    if (status < 0)
+      return (-1);
+
+    if (he_send_text (c, /* finish = */ 0) != 0)
+      return (-1);
+
+    /* Done if uc_iterate() stopped for a reason other than the chunk size
+     * or the buffer size. */
+    if (!c->text_full && ((size_t) status < he_chunk_size))
+      break;
+  }
+
+  return (0);
+} /* }}} int he_send_prefix */
+
+static int he_send_status (int fd, const char *status, /* {{{ */
+    cdtime_t deadline)
+{
+  char buffer[256];
+
+  ssnprintf (buffer, sizeof (buffer), "HTTP/1.1 %s\r\n"
+      "Content-Type: text/plain\r\n"
+      "Connection: close\r\n"
+      "\r\n"
+      "%s\n", status, status);
+  return (he_send_fd (fd, buffer, strlen (buffer), deadline));
+} /* }}} int he_send_status */
+
+/*
+ * Requests
+ */
+static int he_unhex (char c) /* {{{ */
+{
+  if ((c >= '0') && (c <= '9'))
+    return (c - '0');
+  else if ((c >= 'a') && (c <= 'f'))
+    return (c - 'a' + 10);
+  else if ((c >= 'A') && (c <= 'F'))
+    return (c - 'A' + 10);
+  return (-1);
+} /* }}} int he_unhex */
+
+/* Decodes "%XX" and "+" in place. */
+static int he_url_decode (char *str) /* {{{ */
+{
+  char *in = str;
+  char *out = str;
+
+  while (*in != 0)
+  {
+    if (*in == '+')
+    {
+      *out++ = ' ';
+      in++;
+    }
+    else if (*in == '%')
+    {
+      int hi, lo;
+
+      if ((in[1] == 0) || (in[2] == 0))
+        return (-1);
+      hi = he_unhex (in[1]);
+      lo = he_unhex (in[2]);
+      if ((hi < 0) || (lo < 0) || ((hi == 0) && (lo == 0)))
+        return (-1);
+      *out++ = (char) (16 * hi + lo);
+      in += 3;
+    }
+    else
+      *out++ = *in++;
+  }
+  *out = 0;
+
+  return (0);
+} /* }}} int he_url_decode */
+
+static int he_compare_string (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp (*((char * const *) a), *((char * const *) b)));
+} /* }}} int he_compare_string */
+
+/* Parses the "prefix" parameters of the query string into a sorted list of
+ * prefixes. Prefixes covered by another prefix are removed, so no entry is
+ * sent twice. */
+static int he_parse_query (char *query, char **prefixes, /* {{{ */
+    size_t *prefixes_num)
+{
+  char *saveptr = NULL;
+  char *param;
+  size_t num = 0;
+  size_t i;
+
+  for (param = strtok_r (query, "&", &saveptr); param != NULL;
+      param = strtok_r (NULL, "&", &saveptr))
+  {
+    if (strncmp ("prefix=", param, strlen ("prefix=")) != 0)
+      continue;
+    param += strlen ("prefix=");
+
+    if (he_url_decode (param) != 0)
+      return (-1);
+    if (num >= HE_MAX_PREFIXES)
+      return (-1);
+    prefixes[num++] = param;
+  }
+
+  qsort (prefixes, num, sizeof (*prefixes), he_compare_string);
+
+  *prefixes_num = 0;
+  for (i = 0; i < num; i++)
+  {
+    size_t n = *prefixes_num;
+
+    if ((n > 0) && (strncmp (prefixes[i], prefixes[n - 1],
+            strlen (prefixes[n - 1])) == 0))
+      continue;
+    prefixes[n] = prefixes[i];
+    *prefixes_num = n + 1;
+  }
+
+  return (0);
+} /* }}} int he_parse_query */
+
+/* Reads the request header before "deadline". Returns the number of bytes
+ * read or -1. */
+static ssize_t he_read_request (int fd, char *buffer, /* {{{ */
+    size_t buffer_size, cdtime_t deadline)
+{
+  size_t len = 0;
+
+  while (len + 1 < buffer_size)
+  {
+    ssize_t status;
+
+    if (he_wait (fd, POLLIN, deadline) != 0)
+      return (-1);
+
+    status = recv (fd, buffer + len, buffer_size - len - 1, 0);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      return (-1);
+    }
+    else if (status == 0)
+      return (-1);
+
+    len += (size_t) status;
+    buffer[len] = 0;
+    if (strstr (buffer, "\r\n\r\n") != NULL)
+      return ((ssize_t) len);
+  }
+
+  return (-1);
+} /* }}} ssize_t he_read_request */
+
+#if HAVE_ZLIB
+/* Returns true if the header lines in "headers" contain an Accept-Encoding
+ * header listing gzip. */
+static _Bool he_accepts_gzip (char *headers) /* {{{ */
+{
+  char *saveptr = NULL;
+  char *line;
+
+  for (line = strtok_r (headers, "\r\n", &saveptr); line != NULL;
+      line = strtok_r (NULL, "\r\n", &saveptr))
+  {
+    if (strncasecmp ("Accept-Encoding:", line,
+          strlen ("Accept-Encoding:")) != 0)
+      continue;
+
+    if (strstr (line + strlen ("Accept-Encoding:"), "gzip") != NULL)
+      return (1);
+  }
+
+  return (0);
+} /* }}} _Bool he_accepts_gzip */
+#endif /* HAVE_ZLIB */
+
+static void he_handle_client (int fd) /* {{{ */
+{
+  he_client_t *c = &he_client;
+  char request[HE_REQUEST_SIZE];
+  char *prefixes[HE_MAX_PREFIXES];
+  size_t prefixes_num = 0;
+  char *method, *target, *version, *headers, *query;
+  char *saveptr = NULL;
+  char response[256];
+  cdtime_t deadline;
+  size_t i;
+  int status = 0;
+
+  /* The whole request has to be completed in time, not only each read or
+   * write: otherwise a client sending or reading a byte at a time could
+   * block the server for as long as it likes. */
+  deadline = cdtime () + MS_TO_CDTIME_T (he_timeout_ms);
+
+  status = fcntl (fd, F_GETFL);
+  if ((status < 0) || (fcntl (fd, F_SETFL, status | O_NONBLOCK) != 0))
+  {
+    char errbuf[1024];
+    ERROR ("http_exposition plugin: fcntl failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return;
+  }
+  status = 0;
+
+  if (he_read_request (fd, request, sizeof (request), deadline) < 0)
+    return;
+
+  headers = strstr (request, "\r\n");
+  *headers = 0;
+  headers += 2;
+
+  method = strtok_r (request, " ", &saveptr);
+  target = strtok_r (NULL, " ", &saveptr);
+  version = strtok_r (NULL, " ", &saveptr);
+  if ((method == NULL) || (target == NULL) || (version == NULL)
+      || (strncmp ("HTTP/", version, strlen ("HTTP/")) != 0))
+  {
+    he_send_status (fd, "400 Bad Request", deadline);
+    return;
+  }
+
+  if (strcmp ("GET", method) != 0)
+  {
+    he_send_status (fd, "405 Method Not Allowed", deadline);
+    return;
+  }
+
+  query = strchr (target, '?');
+  if (query != NULL)
+    *query++ = 0;
+
+  if (strcmp ("/metrics", target) != 0)
+  {
+    he_send_status (fd, "404 Not Found", deadline);
+    return;
+  }
+
+  if ((query != NULL)
+      && (he_parse_query (query, prefixes, &prefixes_num) != 0))
+  {
+    he_send_status (fd, "400 Bad Request", deadline);
+    return;
+  }
+  if (prefixes_num == 0)
+  {
+    prefixes[0] = "";
+    prefixes_num = 1;
+  }
+
+  memset (c, 0, sizeof (*c));
+  c->fd = fd;
+  c->deadline = deadline;
+#if HAVE_ZLIB
+  c->gzip = he_accepts_gzip (headers);
+  if (c->gzip)
+  {
+    /* 16 + MAX_WBITS selects the gzip format. */
+    status = deflateInit2 (&c->z, Z_BEST_SPEED, Z_DEFLATED,
+        16 + MAX_WBITS, /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+    if (status != Z_OK)
+    {
+      ERROR ("http_exposition plugin: deflateInit2 failed with status %i.",
+          status);
+      he_send_status (fd, "500 Internal Server Error", deadline);
+      return;
+    }
+  }
+#else
+  (void) headers;
+#endif
+
+  ssnprintf (response, sizeof (response), "HTTP/1.1 200 OK\r\n"
+      "Content-Type: " HE_CONTENT_TYPE "\r\n"
+      "%s"
+      "Connection: close\r\n"
+      "\r\n",
+      c->gzip ? "Content-Encoding: gzip\r\n" : "");
+  status = he_send_raw (c, response, strlen (response));
+
+  for (i = 0; (status == 0) && (i < prefixes_num); i++)
+    status = he_send_prefix (c, prefixes[i]);
+
+  if ((status == 0) && c->gzip)
+    status = he_send_text (c, /* finish = */ 1);
+
+#if HAVE_ZLIB
+  if (c->gzip)
+    deflateEnd (&c->z);
+#endif
+
+  if (status != 0)
+  {
+    char errbuf[1024];
+    NOTICE ("http_exposition plugin: Sending to client failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+} /* }}} void he_handle_client */
+
+/*
+ * Server
+ */
+static int he_open_listen (const he_listen_t *l) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_flags = AI_PASSIVE;
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+  ai_hints.ai_protocol = IPPROTO_TCP;
+
+  status = getaddrinfo (l->node,
+      (l->service != NULL) ? l->service : HE_DEFAULT_PORT,
+      &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("http_exposition plugin: getaddrinfo (%s) failed: %s",
+        (l->node != NULL) ? l->node : "any", gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    int fd;
+    int yes = 1;
+
+    if (he_fds_num >= STATIC_ARRAY_SIZE (he_fds))
+      break;
+
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes));
+#ifdef IPV6_V6ONLY
+    /* Otherwise binding "::" conflicts with binding "0.0.0.0". */
+    if (ai_ptr->ai_family == AF_INET6)
+      setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof (yes));
+#endif
+
+    if ((bind (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) != 0)
+        || (listen (fd, /* backlog = */ 8) != 0))
+    {
+      char errbuf[1024];
+      ERROR ("http_exposition plugin: Listening on %s port %s failed: %s",
+          (l->node != NULL) ? l->node : "any",
+          (l->service != NULL) ? l->service : HE_DEFAULT_PORT,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (fd);
+      continue;
+    }
+
+    he_fds[he_fds_num].fd = fd;
+    he_fds[he_fds_num].events = POLLIN;
+    he_fds_num++;
+  }
+
+  freeaddrinfo (ai_list);
+  return (0);
+} /* }}} int he_open_listen */
+
+static void *he_server_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (he_loop)
+  {
+    size_t i;
+    int status;
+
+    /* Wake up regularly to check "he_loop". */
+    status = poll (he_fds, (nfds_t) he_fds_num, /* timeout = */ 1000);
+    if (status <= 0)
+      continue;
+
+    for (i = 0; i < he_fds_num; i++)
+    {
+      int fd;
+
+      if ((he_fds[i].revents & POLLIN) == 0)
+        continue;
+
+      fd = accept (he_fds[i].fd, NULL, NULL);
+      if (fd < 0)
+        continue;
+
+      he_handle_client (fd);
+      close (fd);
+    }
+  }
+
+  return ((void *) 0);
+} /* }}} void *he_server_thread */
+
+/*
+ * Callbacks
+ */
+static int he_config_listen (oconfig_item_t *ci) /* {{{ */
+{
+  he_listen_t *l;
+
+  if ((ci->values_num < 1) || (ci->values_num > 2)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING)
+      || ((ci->values_num == 2)
+        && (ci->values[1].type != OCONFIG_TYPE_STRING)))
+  {
+    ERROR ("http_exposition plugin: The \"%s\" option needs one or two "
+        "string arguments.", ci->key);
+    return (-1);
+  }
+
+  if (he_listen_num >= HE_MAX_LISTEN)
+  {
+    ERROR ("http_exposition plugin: At most %i \"%s\" options are "
+        "supported.", HE_MAX_LISTEN, ci->key);
+    return (-1);
+  }
+
+  l = he_listen + he_listen_num;
+  l->node = strdup (ci->values[0].value.string);
+  l->service = NULL;
+  if (ci->values_num == 2)
+    l->service = strdup (ci->values[1].value.string);
+  if ((l->node == NULL) || ((ci->values_num == 2) && (l->service == NULL)))
+  {
+    sfree (l->node);
+    sfree (l->service);
+    return (-1);
+  }
+
+  he_listen_num++;
+  return (0);
+} /* }}} int he_config_listen */
+
+static int he_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("Listen", child->key) == 0)
+      status = he_config_listen (child);
+    else if (strcasecmp ("ChunkSize", child->key) == 0)
+    {
+      int tmp = (int) he_chunk_size;
+
+      status = cf_util_get_int (child, &tmp);
+      if ((status == 0) && (tmp < 1))
+      {
+        ERROR ("http_exposition plugin: \"ChunkSize\" must be positive.");
+        status = -1;
+      }
+      if (status == 0)
+        he_chunk_size = (size_t) tmp;
+    }
+    else if (strcasecmp ("Timeout", child->key) == 0)
+    {
+      cdtime_t tmp = 0;
+
+      status = cf_util_get_cdtime (child, &tmp);
+      if ((status == 0) && (CDTIME_T_TO_MS (tmp) < 1))
+      {
+        ERROR ("http_exposition plugin: \"Timeout\" must be positive.");
+        status = -1;
+      }
+      if (status == 0)
+        he_timeout_ms = (int) CDTIME_T_TO_MS (tmp);
+    }
+    else
+    {
+      WARNING ("http_exposition plugin: Ignoring unknown config option "
+          "\"%s\".", child->key);
+    }
+
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int he_config */
+
+static int he_init (void) /* {{{ */
+{
+  size_t i;
+  int status;
+
+  if (he_thread_running)
+    return (0);
+
+  /* Only local clients by default: the values may be confidential and
+   * there is no access control. */
+  if (he_listen_num == 0)
+  {
+    he_listen[0].node = strdup (HE_DEFAULT_NODE);
+    he_listen[0].service = NULL;
+    if (he_listen[0].node == NULL)
+      return (-1);
+    he_listen_num = 1;
+  }
+
+  for (i = 0; i < he_listen_num; i++)
+    he_open_listen (he_listen + i);
+
+  if (he_fds_num == 0)
+  {
+    ERROR ("http_exposition plugin: Not listening on any address.");
+    return (-1);
+  }
+
+  he_loop = 1;
+  status = plugin_thread_create (&he_thread, /* attr = */ NULL,
+      he_server_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("http_exposition plugin: plugin_thread_create failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  he_thread_running = 1;
+
+  return (0);
+} /* }}} int he_init */
+
+static int he_shutdown (void) /* {{{ */
+{
+  size_t i;
+
+  if (he_thread_running)
+  {
+    he_loop = 0;
+    pthread_join (he_thread, /* retval = */ NULL);
+    he_thread_running = 0;
+  }
+
+  for (i = 0; i < he_fds_num; i++)
+    close (he_fds[i].fd);
+  he_fds_num = 0;
+
+  for (i = 0; i < he_listen_num; i++)
+  {
+    sfree (he_listen[i].node);
+    sfree (he_listen[i].service);
+  }
+  he_listen_num = 0;
+
+  return (0);
+} /* }}} int he_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("http_exposition", he_config);
+  plugin_register_init ("http_exposition", he_init);
+  plugin_register_shutdown ("http_exposition", he_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -70,6 +70,11 @@
 # endif /* !COLLECT_GETIFADDRS */
 #endif /* KERNEL_LINUX */
 
+#if KERNEL_LINUX && !HAVE_GETIFADDRS
+# define HAVE_IFTABLE 1
+# include "utils_iftable.h"
+#endif
+
 #if HAVE_PERFSTAT
 static perfstat_netinterface_t *ifstat;
 static int nif;
@@ -100,6 +105,10 @@ static kstat_t *ksp[MAX_NUMIF];
 static int numif = 0;
 #endif /* HAVE_LIBKSTAT */
 
+#if HAVE_IFTABLE
+static iftable_t *iftable = NULL;
+#endif
+
 static int interface_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
@@ -154,16 +163,13 @@ static int interface_init (void)
 } /* int interface_init */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit (const char *dev, const char *type,
+static void if_dispatch (const char *dev, const char *type,
 		derive_t rx,
 		derive_t tx)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, dev) != 0)
-		return;
-
 	values[0].derive = rx;
 	values[1].derive = tx;
 
@@ -175,8 +181,58 @@ static void if_submit (const char *dev, const char *type,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void if_dispatch */
+
+static void if_submit (const char *dev, const char *type,
+		derive_t rx,
+		derive_t tx)
+{
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	if_dispatch (dev, type, rx, tx);
 } /* void if_submit */
 
+#if HAVE_IFTABLE
+/* The ignorelist is only consulted when an interface appears or is renamed,
+ * not for every interface on every read. */
+static int if_iftable_filter (const char *dev,
+		void *user_data __attribute__((unused)))
+{
+	return (ignorelist_match (ignorelist, dev) == 0);
+} /* int if_iftable_filter */
+
+static int if_iftable_submit (int ifindex __attribute__((unused)),
+		const char *dev, int flags __attribute__((unused)),
+		const iftable_stats_t *stats,
+		void *user_data __attribute__((unused)))
+{
+	if_dispatch (dev, "if_octets", stats->rx_bytes, stats->tx_bytes);
+	if_dispatch (dev, "if_packets", stats->rx_packets, stats->tx_packets);
+	if_dispatch (dev, "if_errors", stats->rx_errors, stats->tx_errors);
+
+	return (0);
+} /* int if_iftable_submit */
+
+static int interface_init (void)
+{
+	iftable = iftable_create (if_iftable_filter, /* user_data = */ NULL);
+	if (iftable == NULL)
+		NOTICE ("interface plugin: Unable to read the interface statistics "
+				"using netlink. Falling back to /proc/net/dev.");
+
+	return (0);
+} /* int interface_init */
+
+static int interface_shutdown (void)
+{
+	iftable_destroy (iftable);
+	iftable = NULL;
+
+	return (0);
+} /* int interface_shutdown */
+#endif /* HAVE_IFTABLE */
+
 static int interface_read (void)
 {
 #if HAVE_GETIFADDRS
@@ -241,6 +297,26 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
+#if HAVE_IFTABLE
+	if (iftable != NULL)
+	{
+		int status;
+
+		status = iftable_read (iftable, if_iftable_submit,
+				/* user_data = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			WARNING ("interface plugin: Reading the interface statistics "
+					"using netlink failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		return (0);
+	}
+#endif /* HAVE_IFTABLE */
+
 	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
 	{
 		char errbuf[1024];
@@ -381,8 +457,11 @@ void module_register (void)
 {
 	plugin_register_config ("interface", interface_config,
 			config_keys, config_keys_num);
-#if HAVE_LIBKSTAT
+#if HAVE_LIBKSTAT || HAVE_IFTABLE
 	plugin_register_init ("interface", interface_init);
+#endif
+#if HAVE_IFTABLE
+	plugin_register_shutdown ("interface", interface_shutdown);
 #endif
 	plugin_register_read ("interface", interface_read);
 } /* void module_register */
@@ -424,22 +424,55 @@ static void submit_chain( iptc_handle_t *handle, ip_chain_t *chain )
 }
 
 
+static int iptables_chain_compare (const void *a, const void *b)
+{
+    const ip_chain_t *ca = *((ip_chain_t * const *) a);
+    const ip_chain_t *cb = *((ip_chain_t * const *) b);
+
+    if (ca->ip_version != cb->ip_version)
+	return ((ca->ip_version < cb->ip_version) ? -1 : 1);
+    return (strcmp (ca->table, cb->table));
+} /* int iptables_chain_compare */
+
+static int iptables_init (void)
+{
+    /* The kernel hands out a table only as a whole, so all chains of one
+     * table are read from the same snapshot. Sort the list once so that
+     * those chains are next to each other. */
+    if (chain_num > 1)
+	qsort (chain_list, (size_t) chain_num, sizeof (*chain_list),
+		iptables_chain_compare);
+
+    return (0);
+} /* int iptables_init */
+
+/* Returns the number of chains, starting at index `first', which are in the
+ * same table as the first one. */
+static int iptables_group_size (int first)
+{
+    int i;
+
+    for (i = first + 1; i < chain_num; i++)
+	if (iptables_chain_compare (&chain_list[first], &chain_list[i]) != 0)
+	    break;
+
+    return (i - first);
+} /* int iptables_group_size */
+
 static int iptables_read (void)
 {
     int i;
+    int j;
+    int group_size;
     int num_failures = 0;
     ip_chain_t *chain;
 
-    /* Init the iptc handle structure and query the correct table */    
-    for (i = 0; i < chain_num; i++)
+    /* Init the iptc handle structure and query the correct table, once for
+     * all chains in that table. */
+    for (i = 0; i < chain_num; i += group_size)
     {
+	group_size = iptables_group_size (i);
 	chain = chain_list[i];
-	
-	if (!chain)
-	{
-	    DEBUG ("iptables plugin: chain == NULL");
-	    continue;
-	}
 
 	if ( chain->ip_version == IPV4 )
         {
@@ -457,11 +490,12 @@ static int iptables_read (void)
                 {
                         ERROR ("iptables plugin: iptc_init (%s) failed: %s",
                                 chain->table, iptc_strerror (errno));
-                        num_failures++;
+                        num_failures += group_size;
                         continue;
                 }
 
-                submit_chain (handle, chain);
+                for (j = i; j < i + group_size; j++)
+                        submit_chain (handle, chain_list[j]);
                 iptc_free (handle);
         }
         else if ( chain->ip_version == IPV6 )
@@ -480,14 +514,15 @@ static int iptables_read (void)
                 {
                         ERROR ("iptables plugin: ip6tc_init (%s) failed: %s",
                                 chain->table, ip6tc_strerror (errno));
-                        num_failures++;
+                        num_failures += group_size;
                         continue;
                 }
 
-                submit6_chain (handle, chain);
+                for (j = i; j < i + group_size; j++)
+                        submit6_chain (handle, chain_list[j]);
                 ip6tc_free (handle);
         }
-        else num_failures++;
+        else num_failures += group_size;
 
     } /* for (i = 0 .. chain_num) */
 
@@ -515,6 +550,7 @@ void module_register (void)
 {
     plugin_register_config ("iptables", iptables_config,
 	    config_keys, config_keys_num);
+    plugin_register_init ("iptables", iptables_init);
     plugin_register_read ("iptables", iptables_read);
     plugin_register_shutdown ("iptables", iptables_shutdown);
 } /* void module_register */
@@ -0,0 +1,69 @@
+/**
+ * libcollectdclient - src/libcollectdclient/collectd/shm.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_SHM_H
+#define LIBCOLLECTDCLIENT_SHM_H 1
+
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "client.h"
+
+/*
+ * Passes value lists to the "shm_ingest" plugin of a daemon running on the
+ * same host through a ring buffer in shared memory. Sending a value list
+ * copies it into the ring and does not involve any system calls. If the
+ * ring is full because the daemon does not keep up, the value list is
+ * dropped.
+ *
+ * A ring has exactly one producer: callers must not use the same
+ * lcc_shm_t from several threads concurrently. Use one ring per thread
+ * instead.
+ */
+
+#define LCC_SHM_SIZE_DEFAULT (4 * 1024 * 1024)
+
+struct lcc_shm_s;
+typedef struct lcc_shm_s lcc_shm_t;
+
+/* Creates a new ring of at least "size" bytes in "directory", which must be
+ * the "Directory" of the daemon's shm_ingest plugin. Returns NULL and sets
+ * errno on failure. */
+lcc_shm_t *lcc_shm_create (const char *directory, size_t size);
+
+/* Closes the ring. The daemon removes it after reading the remaining value
+ * lists. */
+void lcc_shm_destroy (lcc_shm_t *s);
+
+/* Appends a value list to the ring. Unset host names, times and intervals
+ * are filled in by the daemon. Returns ENOBUFS if the ring is full. */
+int lcc_shm_values_send (lcc_shm_t *s, const lcc_value_list_t *vl);
+
+/* Returns the number of value lists dropped because the ring was full. */
+uint64_t lcc_shm_dropped (const lcc_shm_t *s);
+
+/* vim: set sw=2 sts=2 et : */
+#endif /* LIBCOLLECTDCLIENT_SHM_H */
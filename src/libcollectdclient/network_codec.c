@@ -0,0 +1,342 @@
+/**
+ * collectd - src/libcollectdclient/network_codec.c
+ * Copyright (C) 2010-2013  Florian octo Forster
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <arpa/inet.h> /* htons */
+
+#if defined(__SSSE3__)
+# include <tmmintrin.h>
+#endif
+
+#include "network_codec.h"
+
+/* Below this number of values the setup cost of the vector path is not worth
+ * it. Most value lists have only one or two values. */
+#define NC_VECTOR_THRESHOLD 4
+
+/* The network protocol transmits integers in network byte order (big endian)
+ * and doubles in x86 representation (little endian). */
+#define NC_HOST_IS_BIG_ENDIAN (htons (0x1234) == 0x1234)
+
+#if !FP_LAYOUT_NEED_NOTHING
+/* NAN in x86 byte order */
+static const uint8_t nc_nan_x86[8] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf8, 0x7f
+};
+#endif
+
+/*
+ * Private functions
+ */
+static uint64_t nc_bswap64 (uint64_t n) /* {{{ */
+{
+#if defined(__GNUC__)
+  return (__builtin_bswap64 (n));
+#else
+  return (((n & 0xff00000000000000ULL) >> 56)
+      | ((n & 0x00ff000000000000ULL) >> 40)
+      | ((n & 0x0000ff0000000000ULL) >> 24)
+      | ((n & 0x000000ff00000000ULL) >>  8)
+      | ((n & 0x00000000ff000000ULL) <<  8)
+      | ((n & 0x0000000000ff0000ULL) << 24)
+      | ((n & 0x000000000000ff00ULL) << 40)
+      | ((n & 0x00000000000000ffULL) << 56));
+#endif
+} /* }}} uint64_t nc_bswap64 */
+
+static uint64_t nc_convert_integer (uint64_t n) /* {{{ */
+{
+  if (NC_HOST_IS_BIG_ENDIAN)
+    return (n);
+  return (nc_bswap64 (n));
+} /* }}} uint64_t nc_convert_integer */
+
+static uint64_t nc_convert_double (uint64_t n, _Bool decode) /* {{{ */
+{
+#if FP_LAYOUT_NEED_NOTHING
+  (void) decode;
+  return (n);
+#else
+  if (decode)
+  {
+    if (memcmp (&n, nc_nan_x86, sizeof (n)) == 0)
+    {
+      double d = NAN;
+      memcpy (&n, &d, sizeof (n));
+      return (n);
+    }
+  }
+  else
+  {
+    double d;
+
+    memcpy (&d, &n, sizeof (d));
+    if (isnan (d))
+    {
+      memcpy (&n, nc_nan_x86, sizeof (n));
+      return (n);
+    }
+  }
+
+# if FP_LAYOUT_NEED_ENDIANFLIP
+  return (nc_bswap64 (n));
+# elif FP_LAYOUT_NEED_INTSWAP
+  return ((n >> 32) | (n << 32));
+# else
+#  error "Don't know how to convert doubles to the network representation."
+# endif
+#endif
+} /* }}} uint64_t nc_convert_double */
+
+#if defined(__SSSE3__) && FP_LAYOUT_NEED_NOTHING
+/* Converts two values at a time: all lanes are byte-swapped with one
+ * shuffle, then gauge lanes are restored from the input. Returns the number
+ * of values converted or -1 if an invalid type was found. */
+static ssize_t nc_convert_vector (uint8_t *out, const uint8_t *in, /* {{{ */
+    const uint8_t *types, uint8_t *types_out, size_t values_num)
+{
+  const __m128i shuffle = _mm_set_epi8 (8, 9, 10, 11, 12, 13, 14, 15,
+      0, 1, 2, 3, 4, 5, 6, 7);
+  size_t i;
+
+  if (NC_HOST_IS_BIG_ENDIAN)
+    return (0);
+
+  for (i = 0; (i + 2) <= values_num; i += 2)
+  {
+    __m128i v;
+    __m128i swapped;
+    __m128i is_gauge;
+
+    if ((types[i] > LCC_NETWORK_TYPE_ABSOLUTE)
+        || (types[i + 1] > LCC_NETWORK_TYPE_ABSOLUTE))
+      return (-1);
+
+    if (types_out != NULL)
+    {
+      types_out[i] = types[i];
+      types_out[i + 1] = types[i + 1];
+    }
+
+    v = _mm_loadu_si128 ((const __m128i *) (in + 8 * i));
+    swapped = _mm_shuffle_epi8 (v, shuffle);
+    is_gauge = _mm_set_epi64x (
+        (types[i + 1] == LCC_NETWORK_TYPE_GAUGE) ? -1 : 0,
+        (types[i] == LCC_NETWORK_TYPE_GAUGE) ? -1 : 0);
+
+    _mm_storeu_si128 ((__m128i *) (out + 8 * i),
+        _mm_or_si128 (_mm_and_si128 (is_gauge, v),
+          _mm_andnot_si128 (is_gauge, swapped)));
+  }
+
+  return ((ssize_t) i);
+} /* }}} ssize_t nc_convert_vector */
+#endif
+
+/* Converts values between host and network representation. If "types_out"
+ * is not NULL, the type codes are copied there in the same pass. */
+static int nc_convert (void *out, const void *in, /* {{{ */
+    const uint8_t *types, uint8_t *types_out, size_t values_num,
+    _Bool decode)
+{
+  uint8_t *out_ptr = out;
+  const uint8_t *in_ptr = in;
+  size_t i = 0;
+
+#if defined(__SSSE3__) && FP_LAYOUT_NEED_NOTHING
+  if (values_num >= NC_VECTOR_THRESHOLD)
+  {
+    ssize_t status = nc_convert_vector (out_ptr, in_ptr,
+        types, types_out, values_num);
+    if (status < 0)
+      return (EINVAL);
+    i = (size_t) status;
+  }
+#endif
+
+  for (; i < values_num; i++)
+  {
+    uint64_t tmp;
+
+    /* Use `memcpy' to access the values, because the pointers may be
+     * unaligned and some architectures, such as SPARC, can't handle that. */
+    memcpy (&tmp, in_ptr + 8 * i, sizeof (tmp));
+
+    switch (types[i])
+    {
+      case LCC_NETWORK_TYPE_GAUGE:
+        tmp = nc_convert_double (tmp, decode);
+        break;
+
+      case LCC_NETWORK_TYPE_COUNTER:
+      case LCC_NETWORK_TYPE_DERIVE:
+      case LCC_NETWORK_TYPE_ABSOLUTE:
+        tmp = nc_convert_integer (tmp);
+        break;
+
+      default:
+        return (EINVAL);
+    }
+
+    memcpy (out_ptr + 8 * i, &tmp, sizeof (tmp));
+    if (types_out != NULL)
+      types_out[i] = types[i];
+  }
+
+  return (0);
+} /* }}} int nc_convert */
+
+static void nc_write_header (char *buffer, /* {{{ */
+    uint16_t part_type, uint16_t part_length)
+{
+  uint16_t header[2];
+
+  header[0] = htons (part_type);
+  header[1] = htons (part_length);
+  memcpy (buffer, header, sizeof (header));
+} /* }}} void nc_write_header */
+
+/*
+ * Public functions
+ */
+int lcc_network_decode_values (void *out, const void *in, /* {{{ */
+    const uint8_t *types, size_t values_num)
+{
+  return (nc_convert (out, in, types, /* types_out = */ NULL, values_num,
+        /* decode = */ 1));
+} /* }}} int lcc_network_decode_values */
+
+int lcc_network_encode_values (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len, uint16_t part_type,
+    const uint8_t *types, const void *values, size_t values_num)
+{
+  char *buffer = *ret_buffer;
+  size_t part_len = LCC_NETWORK_VALUES_PART_SIZE (values_num);
+  uint16_t num_values;
+  int status;
+
+  if ((values_num > UINT16_MAX) || (part_len > UINT16_MAX))
+    return (EINVAL);
+  if (*ret_buffer_len < part_len)
+    return (ENOMEM);
+
+  nc_write_header (buffer, part_type, (uint16_t) part_len);
+  num_values = htons ((uint16_t) values_num);
+  memcpy (buffer + LCC_NETWORK_PART_HEADER_SIZE,
+      &num_values, sizeof (num_values));
+
+  status = nc_convert (
+      buffer + LCC_NETWORK_PART_HEADER_SIZE + sizeof (num_values) + values_num,
+      values, types,
+      (uint8_t *) (buffer + LCC_NETWORK_PART_HEADER_SIZE + sizeof (num_values)),
+      values_num, /* decode = */ 0);
+  if (status != 0)
+    return (status);
+
+  *ret_buffer = buffer + part_len;
+  *ret_buffer_len -= part_len;
+  return (0);
+} /* }}} int lcc_network_encode_values */
+
+int lcc_network_encode_number (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len, uint16_t part_type, uint64_t value)
+{
+  char *buffer = *ret_buffer;
+  size_t part_len = LCC_NETWORK_PART_HEADER_SIZE + sizeof (value);
+
+  if (*ret_buffer_len < part_len)
+    return (ENOMEM);
+
+  nc_write_header (buffer, part_type, (uint16_t) part_len);
+  value = nc_convert_integer (value);
+  memcpy (buffer + LCC_NETWORK_PART_HEADER_SIZE, &value, sizeof (value));
+
+  *ret_buffer = buffer + part_len;
+  *ret_buffer_len -= part_len;
+  return (0);
+} /* }}} int lcc_network_encode_number */
+
+int lcc_network_encode_string (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len, uint16_t part_type,
+    const char *str, size_t str_len)
+{
+  char *buffer = *ret_buffer;
+  size_t part_len = LCC_NETWORK_PART_HEADER_SIZE + str_len + 1;
+
+  if (part_len > UINT16_MAX)
+    return (EINVAL);
+  if (*ret_buffer_len < part_len)
+    return (ENOMEM);
+
+  nc_write_header (buffer, part_type, (uint16_t) part_len);
+  memcpy (buffer + LCC_NETWORK_PART_HEADER_SIZE, str, str_len);
+  buffer[part_len - 1] = 0;
+
+  *ret_buffer = buffer + part_len;
+  *ret_buffer_len -= part_len;
+  return (0);
+} /* }}} int lcc_network_encode_string */
+
+int lcc_network_encode_ident (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len, uint16_t part_type,
+    const char *str, char *state, size_t state_size)
+{
+  size_t str_len;
+  int status;
+
+  /* Skip the common prefix. If we reach the end of both strings, the cached
+   * part is still valid. */
+  for (str_len = 0; str[str_len] == state[str_len]; str_len++)
+    if (str[str_len] == 0)
+      return (0);
+
+  str_len += strlen (str + str_len);
+
+  status = lcc_network_encode_string (ret_buffer, ret_buffer_len,
+      part_type, str, str_len);
+  if (status != 0)
+    return (status);
+
+  if (str_len >= state_size)
+  {
+    memcpy (state, str, state_size - 1);
+    state[state_size - 1] = 0;
+  }
+  else
+  {
+    memcpy (state, str, str_len + 1);
+  }
+
+  return (0);
+} /* }}} int lcc_network_encode_ident */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
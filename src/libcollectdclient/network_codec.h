@@ -0,0 +1,88 @@
+/**
+ * collectd - src/libcollectdclient/network_codec.h
+ * Copyright (C) 2010-2013  Florian octo Forster
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+/*
+ * Encoder / decoder for the parts of the binary network protocol. This file
+ * is private: it is compiled into both, libcollectdclient and the daemon's
+ * network plugin, so that both sides share one implementation of the wire
+ * format. It must therefore not depend on either "collectd.h" or "client.h".
+ *
+ * Values are passed as arrays of 8 byte wide unions, i.e. "value_t" of the
+ * daemon or the client library. Types use the common numbering of
+ * DS_TYPE_* and LCC_TYPE_*.
+ */
+
+#ifndef LIBCOLLECTDCLIENT_NETWORK_CODEC_H
+#define LIBCOLLECTDCLIENT_NETWORK_CODEC_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LCC_NETWORK_PART_HEADER_SIZE 4
+
+#define LCC_NETWORK_TYPE_COUNTER  0
+#define LCC_NETWORK_TYPE_GAUGE    1
+#define LCC_NETWORK_TYPE_DERIVE   2
+#define LCC_NETWORK_TYPE_ABSOLUTE 3
+
+/* Returns the size of a "values" part holding "values_num" values. */
+#define LCC_NETWORK_VALUES_PART_SIZE(values_num) \
+  (LCC_NETWORK_PART_HEADER_SIZE + sizeof (uint16_t) \
+   + (values_num) * (sizeof (uint8_t) + sizeof (uint64_t)))
+
+/* Converts "values_num" values from network to host representation. "in"
+ * may be unaligned and may point to the same memory as "out". Returns EINVAL
+ * if an unknown type is encountered. */
+int lcc_network_decode_values (void *out, const void *in,
+    const uint8_t *types, size_t values_num);
+
+/* Appends a "values" part to the buffer pointed to by "ret_buffer". Type
+ * codes and values are written in one pass over the input; "types" may not
+ * contain anything but LCC_NETWORK_TYPE_*. Returns ENOMEM if the buffer is
+ * too small and EINVAL on unknown types. */
+int lcc_network_encode_values (char **ret_buffer, size_t *ret_buffer_len,
+    uint16_t part_type,
+    const uint8_t *types, const void *values, size_t values_num);
+
+/* Appends a 64 bit number part. */
+int lcc_network_encode_number (char **ret_buffer, size_t *ret_buffer_len,
+    uint16_t part_type, uint64_t value);
+
+/* Appends a string part. "str_len" excludes the terminating null byte, which
+ * is written, too. */
+int lcc_network_encode_string (char **ret_buffer, size_t *ret_buffer_len,
+    uint16_t part_type, const char *str, size_t str_len);
+
+/* Appends a string part for an identifier field, unless "str" is equal to
+ * the cached value in "state", which is updated on success. This compares,
+ * measures and copies the string in one pass, instead of strcmp(3), strlen(3)
+ * and strncpy(3) each walking the string. Returns zero if the part was added
+ * or wasn't needed and ENOMEM if the buffer is too small. */
+int lcc_network_encode_ident (char **ret_buffer, size_t *ret_buffer_len,
+    uint16_t part_type, const char *str, char *state, size_t state_size);
+
+#endif /* LIBCOLLECTDCLIENT_NETWORK_CODEC_H */
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,225 @@
+/**
+ * collectd - src/libcollectdclient/network_codec_test.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Checks that values survive an encode/decode round trip and reports the
+ * time per value for a couple of value list sizes. Run with the number of
+ * iterations as the only (optional) argument.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "network_codec.h"
+
+#define TEST_VALUES_MAX 64
+
+union test_value_u
+{
+  uint64_t integer;
+  double   floating;
+};
+typedef union test_value_u test_value_t;
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static void fill_values (uint8_t *types, test_value_t *values, /* {{{ */
+    size_t values_num)
+{
+  size_t i;
+
+  for (i = 0; i < values_num; i++)
+  {
+    types[i] = (uint8_t) (i % 4);
+    if (types[i] == LCC_NETWORK_TYPE_GAUGE)
+      values[i].floating = (i % 8 == 1) ? NAN : 1.5 * ((double) i);
+    else
+      values[i].integer = 0x0102030405060708ULL * (i + 1);
+  }
+} /* }}} void fill_values */
+
+static void check_round_trip (size_t values_num) /* {{{ */
+{
+  uint8_t types[TEST_VALUES_MAX];
+  test_value_t values[TEST_VALUES_MAX];
+  test_value_t decoded[TEST_VALUES_MAX];
+  char buffer[LCC_NETWORK_VALUES_PART_SIZE (TEST_VALUES_MAX)];
+  char *ptr = buffer;
+  size_t free_size = sizeof (buffer);
+  uint16_t tmp16;
+  size_t i;
+  int status;
+
+  fill_values (types, values, values_num);
+
+  status = lcc_network_encode_values (&ptr, &free_size, 0x0006,
+      types, values, values_num);
+  assert (status == 0);
+  assert ((size_t) (ptr - buffer) == LCC_NETWORK_VALUES_PART_SIZE (values_num));
+
+  memcpy (&tmp16, buffer + 2, sizeof (tmp16));
+  assert (ntohs (tmp16) == LCC_NETWORK_VALUES_PART_SIZE (values_num));
+  memcpy (&tmp16, buffer + 4, sizeof (tmp16));
+  assert (ntohs (tmp16) == values_num);
+  assert (memcmp (buffer + 6, types, values_num) == 0);
+
+  /* Integers are sent in network byte order. */
+  if (values_num > 0)
+    assert (((uint8_t) buffer[6 + values_num]) == 0x01);
+
+  status = lcc_network_decode_values (decoded, buffer + 6 + values_num,
+      types, values_num);
+  assert (status == 0);
+
+  for (i = 0; i < values_num; i++)
+  {
+    if (types[i] != LCC_NETWORK_TYPE_GAUGE)
+      assert (decoded[i].integer == values[i].integer);
+    else if (isnan (values[i].floating))
+      assert (isnan (decoded[i].floating));
+    else
+      assert (decoded[i].floating == values[i].floating);
+  }
+
+  /* Unknown types must be rejected. */
+  if (values_num > 0)
+  {
+    types[values_num - 1] = 42;
+    ptr = buffer;
+    free_size = sizeof (buffer);
+    status = lcc_network_encode_values (&ptr, &free_size, 0x0006,
+        types, values, values_num);
+    assert (status == EINVAL);
+  }
+} /* }}} void check_round_trip */
+
+static void check_ident (void) /* {{{ */
+{
+  char state[8] = "";
+  char buffer[64];
+  char *ptr = buffer;
+  size_t free_size = sizeof (buffer);
+  int status;
+
+  status = lcc_network_encode_ident (&ptr, &free_size, 0x0002,
+      "cpu", state, sizeof (state));
+  assert (status == 0);
+  assert (ptr == buffer + 8);
+  assert (strcmp (state, "cpu") == 0);
+  assert (memcmp (buffer + 4, "cpu", 4) == 0);
+
+  /* Unchanged: nothing is written. */
+  status = lcc_network_encode_ident (&ptr, &free_size, 0x0002,
+      "cpu", state, sizeof (state));
+  assert (status == 0);
+  assert (ptr == buffer + 8);
+
+  /* Common prefix, different length. */
+  status = lcc_network_encode_ident (&ptr, &free_size, 0x0002,
+      "cpufreq", state, sizeof (state));
+  assert (status == 0);
+  assert (ptr == buffer + 20);
+  assert (strcmp (state, "cpufreq") == 0);
+
+  status = lcc_network_encode_ident (&ptr, &free_size, 0x0002,
+      "", state, sizeof (state));
+  assert (status == 0);
+  assert (ptr == buffer + 25);
+  assert (state[0] == 0);
+
+  free_size = 4;
+  status = lcc_network_encode_ident (&ptr, &free_size, 0x0002,
+      "cpu", state, sizeof (state));
+  assert (status == ENOMEM);
+  assert (state[0] == 0);
+} /* }}} void check_ident */
+
+static void benchmark (size_t values_num, long iterations) /* {{{ */
+{
+  uint8_t types[TEST_VALUES_MAX];
+  test_value_t values[TEST_VALUES_MAX];
+  test_value_t decoded[TEST_VALUES_MAX];
+  char buffer[LCC_NETWORK_VALUES_PART_SIZE (TEST_VALUES_MAX)];
+  double t0, t1, t2;
+  long i;
+
+  fill_values (types, values, values_num);
+
+  t0 = now ();
+  for (i = 0; i < iterations; i++)
+  {
+    char *ptr = buffer;
+    size_t free_size = sizeof (buffer);
+
+    lcc_network_encode_values (&ptr, &free_size, 0x0006,
+        types, values, values_num);
+  }
+  t1 = now ();
+  for (i = 0; i < iterations; i++)
+    lcc_network_decode_values (decoded, buffer + 6 + values_num,
+        types, values_num);
+  t2 = now ();
+
+  printf ("%3zu values: encode %6.2f ns/value, decode %6.2f ns/value\n",
+      values_num,
+      1e9 * (t1 - t0) / ((double) (iterations * values_num)),
+      1e9 * (t2 - t1) / ((double) (iterations * values_num)));
+} /* }}} void benchmark */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t sizes[] = { 1, 2, 3, 4, 8, 17, TEST_VALUES_MAX };
+  long iterations = 1000000;
+  size_t i;
+
+  if (argc > 1)
+    iterations = atol (argv[1]);
+
+  check_ident ();
+  for (i = 0; i <= TEST_VALUES_MAX; i++)
+    check_round_trip (i);
+
+  for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+    benchmark (sizes[i], iterations);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
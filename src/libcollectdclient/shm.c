@@ -0,0 +1,357 @@
+/**
+ * libcollectdclient - src/libcollectdclient/shm.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "collectd/shm.h"
+#include "network_codec.h"
+#include "shm_ring.h"
+
+#define TYPE_HOST            0x0000
+#define TYPE_TIME_HR         0x0008
+#define TYPE_PLUGIN          0x0002
+#define TYPE_PLUGIN_INSTANCE 0x0003
+#define TYPE_TYPE            0x0004
+#define TYPE_TYPE_INSTANCE   0x0005
+#define TYPE_VALUES          0x0006
+#define TYPE_INTERVAL_HR     0x0009
+
+#define SHM_SIZE_MIN (64 * 1024)
+#define SHM_SIZE_MAX (1024 * 1024 * 1024)
+
+/* Largest record for a value list of "values_num" values: all parts of the
+ * identifier with names of maximum length, the time and the interval. */
+#define SHM_RECORD_SIZE_MAX(values_num) LCC_SHM_ALIGN ( \
+    sizeof (lcc_shm_record_t) \
+    + 5 * (LCC_NETWORK_PART_HEADER_SIZE + LCC_NAME_LEN) \
+    + 2 * (LCC_NETWORK_PART_HEADER_SIZE + sizeof (uint64_t)) \
+    + LCC_NETWORK_VALUES_PART_SIZE (values_num))
+
+/*
+ * Private data types
+ */
+struct lcc_shm_s
+{
+  char *path;
+  lcc_shm_header_t *header;
+  char *data;
+  uint64_t data_size;
+  size_t map_size;
+
+  /* Private copies of the positions. "tail" is only re-read from the shared
+   * header when the ring appears to be full. */
+  uint64_t head;
+  uint64_t tail;
+  uint64_t dropped;
+
+  /* Identifier, time and interval of the previous record. */
+  lcc_value_list_t state;
+};
+
+/*
+ * Private functions
+ */
+/* Forces the next record to include the whole identifier, the time and the
+ * interval. Used when a record was not written, because the daemon's state
+ * then differs from ours. 0xff does not occur in UTF-8 strings. */
+static void shm_reset_state (lcc_shm_t *s) /* {{{ */
+{
+  lcc_identifier_t *ident = &s->state.identifier;
+
+  ident->host[0] = ident->plugin[0] = ident->plugin_instance[0]
+    = ident->type[0] = ident->type_instance[0] = (char) 0xff;
+  ident->host[1] = ident->plugin[1] = ident->plugin_instance[1]
+    = ident->type[1] = ident->type_instance[1] = 0;
+  s->state.time = -1.0;
+  s->state.interval = -1.0;
+} /* }}} void shm_reset_state */
+
+static int shm_add_time (char **ret_buffer, size_t *ret_buffer_len, /* {{{ */
+    uint16_t type, double value)
+{
+  /* Convert to collectd's "cdtime" representation. */
+  uint64_t cdtime_value = (uint64_t) (value * 1073741824.0);
+  return (lcc_network_encode_number (ret_buffer, ret_buffer_len,
+        type, cdtime_value));
+} /* }}} int shm_add_time */
+
+/* Encodes the value list into "buffer" in the same way as
+ * "nb_add_value_list" in network_buffer.c does. */
+static int shm_encode (lcc_shm_t *s, /* {{{ */
+    char **ret_buffer, size_t *ret_buffer_len, const lcc_value_list_t *vl)
+{
+  const lcc_identifier_t *ident_src = &vl->identifier;
+  lcc_identifier_t *ident_dst = &s->state.identifier;
+  uint8_t types[vl->values_len];
+  size_t i;
+  int status;
+
+#define SHM_ADD_IDENT(type,field) do {                                  \
+  status = lcc_network_encode_ident (ret_buffer, ret_buffer_len, (type), \
+        ident_src->field, ident_dst->field, sizeof (ident_dst->field));  \
+  if (status != 0)                                                       \
+    return (status);                                                     \
+} while (0)
+
+  SHM_ADD_IDENT (TYPE_HOST,            host);
+  SHM_ADD_IDENT (TYPE_PLUGIN,          plugin);
+  SHM_ADD_IDENT (TYPE_PLUGIN_INSTANCE, plugin_instance);
+  SHM_ADD_IDENT (TYPE_TYPE,            type);
+  SHM_ADD_IDENT (TYPE_TYPE_INSTANCE,   type_instance);
+
+#undef SHM_ADD_IDENT
+
+  if (s->state.time != vl->time)
+  {
+    status = shm_add_time (ret_buffer, ret_buffer_len, TYPE_TIME_HR, vl->time);
+    if (status != 0)
+      return (status);
+    s->state.time = vl->time;
+  }
+
+  if (s->state.interval != vl->interval)
+  {
+    status = shm_add_time (ret_buffer, ret_buffer_len, TYPE_INTERVAL_HR,
+        vl->interval);
+    if (status != 0)
+      return (status);
+    s->state.interval = vl->interval;
+  }
+
+  for (i = 0; i < vl->values_len; i++)
+    types[i] = (uint8_t) vl->values_types[i];
+
+  return (lcc_network_encode_values (ret_buffer, ret_buffer_len,
+        TYPE_VALUES, types, vl->values, vl->values_len));
+} /* }}} int shm_encode */
+
+/*
+ * Public functions
+ */
+lcc_shm_t *lcc_shm_create (const char *directory, size_t size) /* {{{ */
+{
+  static uint32_t counter = 0;
+
+  lcc_shm_t *s;
+  char tmp_path[1024];
+  char path[1024];
+  uint64_t data_size;
+  int fd;
+  int status;
+
+  /* Record sizes, including those of padding records, are 32 bit wide. */
+  if ((directory == NULL) || (size > SHM_SIZE_MAX))
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  /* Round up to a power of two. */
+  for (data_size = SHM_SIZE_MIN; data_size < (uint64_t) size; data_size *= 2)
+    /* nop */;
+
+  status = snprintf (path, sizeof (path), "%s/%ld-%"PRIu32 LCC_SHM_SUFFIX,
+      directory, (long) getpid (), __sync_fetch_and_add (&counter, 1));
+  if ((status < 0) || ((size_t) status >= sizeof (path)))
+  {
+    errno = ENAMETOOLONG;
+    return (NULL);
+  }
+  snprintf (tmp_path, sizeof (tmp_path), "%.*s" LCC_SHM_TMP_SUFFIX,
+      (int) (strlen (path) - strlen (LCC_SHM_SUFFIX)), path);
+
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
+  {
+    errno = ENOMEM;
+    return (NULL);
+  }
+  s->path = strdup (path);
+  s->data_size = data_size;
+  s->map_size = (size_t) (LCC_SHM_HEADER_SIZE + data_size);
+  if (s->path == NULL)
+  {
+    free (s);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  fd = open (tmp_path, O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (fd < 0)
+  {
+    status = errno;
+    free (s->path);
+    free (s);
+    errno = status;
+    return (NULL);
+  }
+
+  status = ftruncate (fd, (off_t) s->map_size);
+  if (status == 0)
+  {
+    s->header = mmap (/* addr = */ NULL, s->map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, /* offset = */ 0);
+    if (s->header == MAP_FAILED)
+    {
+      s->header = NULL;
+      status = -1;
+    }
+  }
+  if (status != 0)
+  {
+    status = errno;
+    close (fd);
+    unlink (tmp_path);
+    free (s->path);
+    free (s);
+    errno = status;
+    return (NULL);
+  }
+  close (fd);
+
+  s->data = ((char *) s->header) + LCC_SHM_HEADER_SIZE;
+
+  s->header->version = LCC_SHM_VERSION;
+  s->header->data_size = data_size;
+  s->header->pid = (uint64_t) getpid ();
+  LCC_SHM_STORE (&s->header->magic, LCC_SHM_MAGIC);
+
+  if (rename (tmp_path, path) != 0)
+  {
+    status = errno;
+    munmap (s->header, s->map_size);
+    unlink (tmp_path);
+    free (s->path);
+    free (s);
+    errno = status;
+    return (NULL);
+  }
+
+  return (s);
+} /* }}} lcc_shm_t *lcc_shm_create */
+
+void lcc_shm_destroy (lcc_shm_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  __sync_fetch_and_or (&s->header->flags, LCC_SHM_FLAG_CLOSED);
+  munmap (s->header, s->map_size);
+
+  free (s->path);
+  free (s);
+} /* }}} void lcc_shm_destroy */
+
+int lcc_shm_values_send (lcc_shm_t *s, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  lcc_shm_record_t *record;
+  char *buffer;
+  size_t buffer_size;
+  uint64_t offset;
+  uint64_t contiguous;
+  uint64_t required;
+  uint64_t record_size;
+  int status;
+
+  if ((s == NULL) || (vl == NULL) || (vl->values_len < 1)
+      || (vl->values_len > UINT16_MAX))
+    return (EINVAL);
+
+  record_size = SHM_RECORD_SIZE_MAX (vl->values_len);
+  if (record_size > (s->data_size / 2))
+    return (EINVAL);
+
+  /* A record which does not fit in front of the end of the data area is
+   * preceded by a padding record, which skips to the beginning. */
+  offset = s->head & (s->data_size - 1);
+  contiguous = s->data_size - offset;
+  required = (contiguous < record_size) ? (contiguous + record_size)
+    : record_size;
+
+  if ((s->data_size - (s->head - s->tail)) < required)
+  {
+    s->tail = LCC_SHM_LOAD (&s->header->tail);
+    if ((s->data_size - (s->head - s->tail)) < required)
+    {
+      s->dropped++;
+      *((volatile uint64_t *) &s->header->dropped) = s->dropped;
+      return (ENOBUFS);
+    }
+  }
+
+  if (contiguous < record_size)
+  {
+    record = (lcc_shm_record_t *) (s->data + offset);
+    record->size = (uint32_t) contiguous;
+    record->type = LCC_SHM_RECORD_PADDING;
+    s->head += contiguous;
+    offset = 0;
+  }
+
+  record = (lcc_shm_record_t *) (s->data + offset);
+  buffer = (char *) (record + 1);
+  buffer_size = (size_t) (record_size - sizeof (*record));
+
+  status = shm_encode (s, &buffer, &buffer_size, vl);
+  if (status != 0)
+  {
+    /* The padding record, if any, will be published with the next record. */
+    shm_reset_state (s);
+    return (status);
+  }
+
+  /* Zero the alignment padding, which the daemon reads as the end of the
+   * record. */
+  record->size = (uint32_t) LCC_SHM_ALIGN (buffer - ((char *) record));
+  record->type = LCC_SHM_RECORD_VALUES;
+  memset (buffer, 0, (size_t) ((((char *) record) + record->size) - buffer));
+
+  s->head += record->size;
+  LCC_SHM_STORE (&s->header->head, s->head);
+
+  return (0);
+} /* }}} int lcc_shm_values_send */
+
+uint64_t lcc_shm_dropped (const lcc_shm_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return (0);
+  return (s->dropped);
+} /* }}} uint64_t lcc_shm_dropped */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,133 @@
+/**
+ * collectd - src/libcollectdclient/shm_ring.h
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Layout of the shared memory rings used by the client library's
+ * "lcc_shm_*" functions and the daemon's shm_ingest plugin. Like
+ * "network_codec.h", this file is private to both and must not depend on
+ * either "collectd.h" or "client.h".
+ *
+ * Every producer owns one file of LCC_SHM_HEADER_SIZE + data_size bytes in
+ * the plugin's directory, which both processes map into memory. The ring is
+ * a single-producer, single-consumer queue: "head" is only written by the
+ * producer, "tail" and "state" only by the consumer. Both count bytes since
+ * the ring was created; the offset in the data area is the count modulo
+ * "data_size", which is a power of two.
+ *
+ * Records start at offsets aligned to LCC_SHM_ALIGN and never wrap around
+ * the end of the data area. If a record does not fit in front of the end, a
+ * padding record fills up the rest. The body of a value list record consists
+ * of parts of the binary network protocol, followed by zero bytes up to the
+ * alignment. As in network packets, parts of the identifier, time and
+ * interval are omitted if they did not change since the previous record. The
+ * consumer stores what it has seen so far in "state", so it can continue
+ * where it left off after a restart.
+ */
+
+#ifndef LIBCOLLECTDCLIENT_SHM_RING_H
+#define LIBCOLLECTDCLIENT_SHM_RING_H 1
+
+#include <stdint.h>
+
+#define LCC_SHM_MAGIC   UINT64_C(0x314e52484d534443) /* "CDSHMRN1" */
+#define LCC_SHM_VERSION 1
+
+/* Files are created with this suffix appended to the name after the header
+ * has been initialized, so that the daemon never sees half-initialized
+ * rings. */
+#define LCC_SHM_SUFFIX     ".ring"
+#define LCC_SHM_TMP_SUFFIX ".tmp"
+
+#define LCC_SHM_HEADER_SIZE 4096
+#define LCC_SHM_ALIGN(n) (((n) + 7) & ~((uint64_t) 7))
+
+/* Set in "flags" by the producer when it closes the ring. The daemon removes
+ * the file once all records have been read. */
+#define LCC_SHM_FLAG_CLOSED 0x0001
+
+#define LCC_SHM_RECORD_VALUES  1
+#define LCC_SHM_RECORD_PADDING 2
+
+#define LCC_SHM_NAME_LEN 64
+
+/* Loads and stores of the positions shared between the processes. The
+ * barriers order the accesses to the data area with respect to the
+ * position. */
+#define LCC_SHM_LOAD(ptr) \
+  __extension__ ({ uint64_t __v = *((volatile uint64_t *) (ptr)); \
+     __sync_synchronize (); __v; })
+#define LCC_SHM_STORE(ptr, value) do { \
+  __sync_synchronize (); \
+  *((volatile uint64_t *) (ptr)) = (value); \
+} while (0)
+
+struct lcc_shm_record_s
+{
+  uint32_t size; /* including this header, multiple of LCC_SHM_ALIGN */
+  uint32_t type; /* LCC_SHM_RECORD_* */
+};
+typedef struct lcc_shm_record_s lcc_shm_record_t;
+
+/* Decoder state of the consumer. "time" and "interval" use the cdtime_t
+ * representation of the network protocol. */
+struct lcc_shm_state_s
+{
+  char host[LCC_SHM_NAME_LEN];
+  char plugin[LCC_SHM_NAME_LEN];
+  char plugin_instance[LCC_SHM_NAME_LEN];
+  char type[LCC_SHM_NAME_LEN];
+  char type_instance[LCC_SHM_NAME_LEN];
+  uint64_t time;
+  uint64_t interval;
+};
+typedef struct lcc_shm_state_s lcc_shm_state_t;
+
+/* The fields written by either process are kept in cache lines of their
+ * own. */
+struct lcc_shm_header_s
+{
+  /* written once by the producer */
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint64_t data_size;
+  uint64_t pid;
+  char pad0[32];
+
+  /* written by the producer */
+  uint64_t head;
+  uint64_t dropped;
+  char pad1[48];
+
+  /* written by the consumer */
+  uint64_t tail;
+  char pad2[56];
+  lcc_shm_state_t state;
+};
+typedef struct lcc_shm_header_s lcc_shm_header_t;
+
+#endif /* LIBCOLLECTDCLIENT_SHM_RING_H */
+/* vim: set sw=2 sts=2 et : */
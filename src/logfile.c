@@ -37,6 +37,11 @@ static int log_level = LOG_INFO;
 
 static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* The file is kept open while more log messages are pending, so a burst of
+ * messages results in one open, one flush and one close. */
+static FILE *log_fh = NULL;
+static _Bool log_fh_close = 0;
+
 static char *log_file = NULL;
 static int print_timestamp = 1;
 static int print_severity = 0;
@@ -57,8 +62,10 @@ static int logfile_config (const char *key, const char *value)
 		if (log_level == -1) return 1; /* to keep previous behaviour */
 	}
 	else if (0 == strcasecmp (key, "File")) {
+		pthread_mutex_lock (&file_lock);
 		sfree (log_file);
 		log_file = strdup (value);
+		pthread_mutex_unlock (&file_lock);
 	}
 	else if (0 == strcasecmp (key, "Timestamp")) {
 		if (IS_FALSE (value))
@@ -77,11 +84,22 @@ static int logfile_config (const char *key, const char *value)
 	return 0;
 } /* int logfile_config (const char *, const char *) */
 
+/* Must be called with "file_lock" held. */
+static void logfile_close_locked (void)
+{
+	if (log_fh == NULL)
+		return;
+
+	if (log_fh_close)
+		fclose (log_fh);
+	else
+		fflush (log_fh);
+	log_fh = NULL;
+} /* void logfile_close_locked */
+
 static void logfile_print (const char *msg, int severity,
 	   	cdtime_t timestamp_time)
 {
-	FILE *fh;
-	_Bool do_close = 0;
 	struct tm timestamp_tm;
 	char timestamp_str[64];
 	char level_str[16] = "";
@@ -122,22 +140,31 @@ static void logfile_print (const char *msg, int severity,
 
 	pthread_mutex_lock (&file_lock);
 
-	if (log_file == NULL)
+	if (log_fh == NULL)
 	{
-		fh = fopen (DEFAULT_LOGFILE, "a");
-		do_close = 1;
-	}
-	else if (strcasecmp (log_file, "stderr") == 0)
-		fh = stderr;
-	else if (strcasecmp (log_file, "stdout") == 0)
-		fh = stdout;
-	else
-	{
-		fh = fopen (log_file, "a");
-		do_close = 1;
+		if (log_file == NULL)
+		{
+			log_fh = fopen (DEFAULT_LOGFILE, "a");
+			log_fh_close = 1;
+		}
+		else if (strcasecmp (log_file, "stderr") == 0)
+		{
+			log_fh = stderr;
+			log_fh_close = 0;
+		}
+		else if (strcasecmp (log_file, "stdout") == 0)
+		{
+			log_fh = stdout;
+			log_fh_close = 0;
+		}
+		else
+		{
+			log_fh = fopen (log_file, "a");
+			log_fh_close = 1;
+		}
 	}
 
-	if (fh == NULL)
+	if (log_fh == NULL)
 	{
 			char errbuf[1024];
 			fprintf (stderr, "logfile plugin: fopen (%s) failed: %s\n",
@@ -147,15 +174,15 @@ static void logfile_print (const char *msg, int severity,
 	else
 	{
 		if (print_timestamp)
-			fprintf (fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
+			fprintf (log_fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
 		else
-			fprintf (fh, "%s%s\n", level_str, msg);
+			fprintf (log_fh, "%s%s\n", level_str, msg);
 
-		if (do_close) {
-			fclose (fh);
-		} else {
-			fflush(fh);
-		}
+		/* Write the batch out once the last queued message has been
+		 * written. The file is reopened for the next batch, so log
+		 * rotation keeps working. */
+		if (plugin_log_pending () == 0)
+			logfile_close_locked ();
 	}
 
 	pthread_mutex_unlock (&file_lock);
@@ -167,7 +194,17 @@ static void logfile_log (int severity, const char *msg,
 		user_data_t __attribute__((unused)) *user_data)
 {
 	if (severity > log_level)
+	{
+		/* The file may still be open if this is the last message of a
+		 * batch. */
+		if (plugin_log_pending () == 0)
+		{
+			pthread_mutex_lock (&file_lock);
+			logfile_close_locked ();
+			pthread_mutex_unlock (&file_lock);
+		}
 		return;
+	}
 
 	logfile_print (msg, severity, cdtime ());
 } /* void logfile_log (int, const char *) */
@@ -28,9 +28,7 @@
 
 #include "collectd.h"
 #include "filter_chain.h"
-
-#include <sys/types.h>
-#include <regex.h>
+#include "utils_match.h"
 
 #define log_err(...) ERROR ("`regex' match: " __VA_ARGS__)
 #define log_warn(...) WARNING ("`regex' match: " __VA_ARGS__)
@@ -43,8 +41,7 @@ struct mr_regex_s;
 typedef struct mr_regex_s mr_regex_t;
 struct mr_regex_s
 {
-	regex_t re;
-	char *re_str;
+	cu_regex_t *re;
 
 	mr_regex_t *next;
 };
@@ -69,9 +66,8 @@ static void mr_free_regex (mr_regex_t *r) /* {{{ */
 	if (r == NULL)
 		return;
 
-	regfree (&r->re);
-	memset (&r->re, 0, sizeof (r->re));
-	free (r->re_str);
+	cu_regex_destroy (r->re);
+	r->re = NULL;
 
 	if (r->next != NULL)
 		mr_free_regex (r->next);
@@ -101,20 +97,15 @@ static int mr_match_regexen (mr_regex_t *re_head, /* {{{ */
 
 	for (re = re_head; re != NULL; re = re->next)
 	{
-		int status;
-
-		status = regexec (&re->re, string,
-				/* nmatch = */ 0, /* pmatch = */ NULL,
-				/* eflags = */ 0);
-		if (status == 0)
+		if (cu_regex_match (re->re, string))
 		{
 			DEBUG ("regex match: Regular expression `%s' matches `%s'.",
-					re->re_str, string);
+					cu_regex_pattern (re->re), string);
 		}
 		else
 		{
 			DEBUG ("regex match: Regular expression `%s' does not match `%s'.",
-					re->re_str, string);
+					cu_regex_pattern (re->re), string);
 			return (FC_MATCH_NO_MATCH);
 		}
 
@@ -127,7 +118,7 @@ static int mr_config_add_regex (mr_regex_t **re_head, /* {{{ */
 		oconfig_item_t *ci)
 {
 	mr_regex_t *re;
-	int status;
+	char errmsg[1024];
 
 	if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
 	{
@@ -144,23 +135,12 @@ static int mr_config_add_regex (mr_regex_t **re_head, /* {{{ */
 	memset (re, 0, sizeof (*re));
 	re->next = NULL;
 
-	re->re_str = strdup (ci->values[0].value.string);
-	if (re->re_str == NULL)
-	{
-		free (re);
-		log_err ("mr_config_add_regex: strdup failed.");
-		return (-1);
-	}
-
-	status = regcomp (&re->re, re->re_str, REG_EXTENDED | REG_NOSUB);
-	if (status != 0)
+	re->re = cu_regex_create (ci->values[0].value.string, CU_REGEX_NOSUB,
+			errmsg, sizeof (errmsg));
+	if (re->re == NULL)
 	{
-		char errmsg[1024];
-		regerror (status, &re->re, errmsg, sizeof (errmsg));
-		errmsg[sizeof (errmsg) - 1] = 0;
 		log_err ("Compiling regex `%s' for `%s' failed: %s.", 
-				re->re_str, ci->key, errmsg);
-		free (re->re_str);
+				ci->values[0].value.string, ci->key, errmsg);
 		free (re);
 		return (-1);
 	}
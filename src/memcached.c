@@ -38,6 +38,7 @@
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 
 #define MEMCACHED_DEF_HOST "127.0.0.1"
 #define MEMCACHED_DEF_PORT "11211"
@@ -48,6 +49,9 @@ struct memcached_s
   char *socket;
   char *host;
   char *port;
+
+  /* The connection is kept open between reads. */
+  int fd;
 };
 typedef struct memcached_s memcached_t;
 
@@ -58,10 +62,18 @@ static void memcached_free (memcached_t *st)
   if (st == NULL)
     return;
 
+  if (st->fd >= 0)
+  {
+    shutdown (st->fd, SHUT_RDWR);
+    close (st->fd);
+    st->fd = -1;
+  }
+
   sfree (st->name);
   sfree (st->socket);
   sfree (st->host);
   sfree (st->port);
+  sfree (st);
 }
 
 static int memcached_connect_unix (memcached_t *st)
@@ -171,38 +183,98 @@ static int memcached_connect (memcached_t *st)
     return (memcached_connect_inet (st));
 }
 
-static int memcached_query_daemon (char *buffer, size_t buffer_size, memcached_t *st)
+static void memcached_disconnect (memcached_t *st)
 {
-  int fd = -1;
+  if (st->fd < 0)
+    return;
+
+  shutdown (st->fd, SHUT_RDWR);
+  close (st->fd);
+  st->fd = -1;
+}
+
+/* Nothing is supposed to arrive between two requests. If the socket is
+ * readable anyway, the daemon has closed the connection (or sent garbage). */
+static _Bool memcached_connection_ok (memcached_t *st)
+{
+  struct pollfd pfd;
   int status;
-  size_t buffer_fill;
 
-  fd = memcached_connect (st);
-  if (fd < 0) {
-    ERROR ("memcached plugin: Instance \"%s\" could not connect to daemon.",
-        st->name);
-    return -1;
-  }
+  memset (&pfd, 0, sizeof (pfd));
+  pfd.fd = st->fd;
+  pfd.events = POLLIN;
 
-  status = (int) swrite (fd, "stats\r\n", strlen ("stats\r\n"));
+  status = poll (&pfd, 1, /* timeout = */ 0);
+  return (status == 0);
+}
+
+/* Sends the "stats" command and reads the response, which is terminated by
+ * "END". Returns zero on success, less than zero if the connection is not
+ * usable anymore. A response taking longer than the read interval is given
+ * up on, so that a half-open connection cannot block the read thread. */
+static int memcached_send_stats (char *buffer, size_t buffer_size,
+    memcached_t *st)
+{
+  char const end_token[5] = {'E', 'N', 'D', '\r', '\n'};
+  cdtime_t deadline;
+  size_t buffer_fill;
+  int status;
+
+  status = (int) swrite (st->fd, "stats\r\n", strlen ("stats\r\n"));
   if (status != 0)
   {
     char errbuf[1024];
-    ERROR ("memcached plugin: write(2) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    shutdown(fd, SHUT_RDWR);
-    close (fd);
+    ERROR ("memcached plugin: Instance \"%s\": write(2) failed: %s",
+        st->name, sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   /* receive data from the memcached daemon */
   memset (buffer, 0, buffer_size);
 
+  deadline = cdtime () + plugin_get_interval ();
   buffer_fill = 0;
-  while ((status = (int) recv (fd, buffer + buffer_fill,
-          buffer_size - buffer_fill, /* flags = */ 0)) != 0)
+  while (42)
   {
-    char const end_token[5] = {'E', 'N', 'D', '\r', '\n'};
+    struct pollfd pfd;
+    cdtime_t now;
+
+    if (buffer_fill >= (buffer_size - 1))
+    {
+      /* The rest of the response would be read as the answer to the next
+       * request, so the connection can't be used anymore. */
+      WARNING ("memcached plugin: Instance \"%s\": Message was truncated.",
+          st->name);
+      return (-1);
+    }
+
+    now = cdtime ();
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = st->fd;
+    pfd.events = POLLIN;
+
+    status = (now < deadline)
+      ? poll (&pfd, 1, (int) CDTIME_T_TO_MS (deadline - now) + 1) : 0;
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR ("memcached plugin: Instance \"%s\": poll(2) failed: %s",
+          st->name, sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      WARNING ("memcached plugin: Instance \"%s\": Timed out waiting for "
+          "the response.", st->name);
+      return (-1);
+    }
+
+    status = (int) recv (st->fd, buffer + buffer_fill,
+        buffer_size - 1 - buffer_fill, /* flags = */ 0);
     if (status < 0)
     {
       char errbuf[1024];
@@ -210,37 +282,84 @@ static int memcached_query_daemon (char *buffer, size_t buffer_size, memcached_t
       if ((errno == EAGAIN) || (errno == EINTR))
           continue;
 
-      ERROR ("memcached: Error reading from socket: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      shutdown(fd, SHUT_RDWR);
-      close (fd);
+      ERROR ("memcached plugin: Instance \"%s\": "
+          "Error reading from socket: %s",
+          st->name, sstrerror (errno, errbuf, sizeof (errbuf)));
       return (-1);
     }
-
-    buffer_fill += (size_t) status;
-    if (buffer_fill > buffer_size)
+    else if (status == 0)
     {
-      buffer_fill = buffer_size;
-      WARNING ("memcached plugin: Message was truncated.");
-      break;
+      if (buffer_fill == 0)
+        WARNING ("memcached plugin: Instance \"%s\": "
+            "No data returned by memcached.", st->name);
+      else
+        WARNING ("memcached plugin: Instance \"%s\": "
+            "Connection closed before the end of the response.",
+            st->name);
+      return (-1);
     }
 
+    buffer_fill += (size_t) status;
+
     /* If buffer ends in end_token, we have all the data. */
-    if (memcmp (buffer + buffer_fill - sizeof (end_token),
-          end_token, sizeof (end_token)) == 0)
+    if ((buffer_fill >= sizeof (end_token))
+        && (memcmp (buffer + buffer_fill - sizeof (end_token),
+            end_token, sizeof (end_token)) == 0))
       break;
-  } /* while (recv) */
+  } /* while (42) */
+
+  return (0);
+} /* int memcached_send_stats */
 
-  status = 0;
-  if (buffer_fill == 0)
+static int memcached_query_daemon (char *buffer, size_t buffer_size, memcached_t *st)
+{
+  _Bool reused = 0;
+  int status;
+
+  if ((st->fd >= 0) && !memcached_connection_ok (st))
   {
-    WARNING ("memcached plugin: No data returned by memcached.");
-    status = -1;
+    DEBUG ("memcached plugin: Instance \"%s\": Connection has been closed "
+        "by the daemon.", st->name);
+    memcached_disconnect (st);
   }
 
-  shutdown(fd, SHUT_RDWR);
-  close(fd);
-  return (status);
+  if (st->fd >= 0)
+    reused = 1;
+  else
+  {
+    st->fd = memcached_connect (st);
+    if (st->fd < 0)
+    {
+      /* The read callback failing makes the daemon back off. */
+      ERROR ("memcached plugin: Instance \"%s\" could not connect to daemon.",
+          st->name);
+      return (-1);
+    }
+  }
+
+  status = memcached_send_stats (buffer, buffer_size, st);
+  if ((status != 0) && reused)
+  {
+    /* The daemon may have been restarted since the last read. Try once more
+     * using a new connection before giving up. */
+    memcached_disconnect (st);
+    st->fd = memcached_connect (st);
+    if (st->fd < 0)
+    {
+      ERROR ("memcached plugin: Instance \"%s\" could not connect to daemon.",
+          st->name);
+      return (-1);
+    }
+    status = memcached_send_stats (buffer, buffer_size, st);
+  }
+
+  if (status != 0)
+  {
+    memcached_disconnect (st);
+    return (-1);
+  }
+
+  return (0);
 } /* int memcached_query_daemon */
 
 static void memcached_init_vl (value_list_t *vl, memcached_t const *st)
@@ -595,6 +714,7 @@ static int config_add_instance(oconfig_item_t *ci)
   st->socket = NULL;
   st->host = NULL;
   st->port = NULL;
+  st->fd = -1;
 
   if (strcasecmp (ci->key, "Plugin") == 0) /* default instance */
     st->name = sstrdup ("__legacy__");
@@ -689,6 +809,7 @@ static int memcached_init (void)
   st->socket = NULL;
   st->host = NULL;
   st->port = NULL;
+  st->fd = -1;
 
   status = memcached_add_read_callback (st);
   if (status == 0)
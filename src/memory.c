@@ -27,6 +27,10 @@
 #include "common.h"
 #include "plugin.h"
 
+#if KERNEL_LINUX
+# include "utils_procfile.h"
+#endif
+
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
 #endif
@@ -272,11 +276,8 @@ static int memory_read_internal (value_list_t *vl)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
-
-	char *fields[8];
-	int numfields;
+	procfile_t *pf;
+	procfile_entry_t const *e;
 
 	gauge_t mem_total = 0;
 	gauge_t mem_used = 0;
@@ -284,42 +285,25 @@ static int memory_read_internal (value_list_t *vl)
 	gauge_t mem_cached = 0;
 	gauge_t mem_free = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if ((pf = procfile_get ("/proc/meminfo")) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
+		WARNING ("memory: Reading /proc/meminfo failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
-	{
-		gauge_t *val = NULL;
-
-		if (strncasecmp (buffer, "MemTotal:", 9) == 0)
-			val = &mem_total;
-		else if (strncasecmp (buffer, "MemFree:", 8) == 0)
-			val = &mem_free;
-		else if (strncasecmp (buffer, "Buffers:", 8) == 0)
-			val = &mem_buffered;
-		else if (strncasecmp (buffer, "Cached:", 7) == 0)
-			val = &mem_cached;
-		else
-			continue;
-
-		numfields = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
-		if (numfields < 2)
-			continue;
-
-		*val = 1024.0 * atof (fields[1]);
-	}
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	/* Values are given in kibibytes. */
+	if (((e = procfile_lookup (pf, "MemTotal")) != NULL) && e->numeric)
+		mem_total = 1024.0 * e->gauge;
+	if (((e = procfile_lookup (pf, "MemFree")) != NULL) && e->numeric)
+		mem_free = 1024.0 * e->gauge;
+	if (((e = procfile_lookup (pf, "Buffers")) != NULL) && e->numeric)
+		mem_buffered = 1024.0 * e->gauge;
+	if (((e = procfile_lookup (pf, "Cached")) != NULL) && e->numeric)
+		mem_cached = 1024.0 * e->gauge;
+
+	procfile_release (pf);
 
 	if (mem_total < (mem_free + mem_buffered + mem_cached))
 		return (-1);
@@ -28,6 +28,7 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_iftable.h"
 
 #include <asm/types.h>
 #include <sys/socket.h>
@@ -43,41 +44,6 @@
 
 #include <libmnl/libmnl.h>
 
-struct ir_link_stats_storage_s {
-
-  uint64_t rx_packets;
-  uint64_t tx_packets;
-  uint64_t rx_bytes;
-  uint64_t tx_bytes;
-  uint64_t rx_errors;
-  uint64_t tx_errors;
-
-  uint64_t rx_dropped;
-  uint64_t tx_dropped;
-  uint64_t multicast;
-  uint64_t collisions;
-
-  uint64_t rx_length_errors;
-  uint64_t rx_over_errors;
-  uint64_t rx_crc_errors;
-  uint64_t rx_frame_errors;
-  uint64_t rx_fifo_errors;
-  uint64_t rx_missed_errors;
-
-  uint64_t tx_aborted_errors;
-  uint64_t tx_carrier_errors;
-  uint64_t tx_fifo_errors;
-  uint64_t tx_heartbeat_errors;
-  uint64_t tx_window_errors;
-};
-
-union ir_link_stats_u {
-  struct rtnl_link_stats *stats32;
-#ifdef HAVE_RTNL_LINK_STATS64
-  struct rtnl_link_stats64 *stats64;
-#endif
-};
-
 typedef struct ir_ignorelist_s
 {
   char *device;
@@ -89,10 +55,23 @@ typedef struct ir_ignorelist_s
 static int ir_ignorelist_invert = 1;
 static ir_ignorelist_t *ir_ignorelist_head = NULL;
 
-static struct mnl_socket *nl;
+/* Bits of the flags stored with each interface in the interface table. They
+ * tell which of the statistics are not ignored for that interface. */
+#define IR_WANT_INTERFACE 0x01
+#define IR_WANT_IF_DETAIL 0x02
+#define IR_WANT_QDISC     0x04
+#define IR_WANT_CLASS     0x08
+#define IR_WANT_FILTER    0x10
 
-static char **iflist = NULL;
-static size_t iflist_len = 0;
+struct ir_qos_query_s
+{
+  int ifindex;
+  const char *dev;
+};
+typedef struct ir_qos_query_s ir_qos_query_t;
+
+static struct mnl_socket *nl;
+static iftable_t *iftable = NULL;
 
 static const char *config_keys[] =
 {
@@ -239,41 +218,34 @@ static void submit_two (const char *dev, const char *type,
   plugin_dispatch_values (&vl);
 } /* void submit_two */
 
-static int update_iflist (struct ifinfomsg *msg, const char *dev)
+/* Returns the IR_WANT_* flags for an interface. Called by the interface table
+ * when an interface appears or is renamed. Type instances in the ignore list
+ * can only be checked once the qdiscs, classes and filters are known, so
+ * these are checked again in `qos_filter_cb'. */
+static int ir_iftable_filter (const char *dev,
+    void *user_data __attribute__((unused)))
 {
-  /* Update the `iflist'. It's used to know which interfaces exist and query
-   * them later for qdiscs and classes. */
-  if ((msg->ifi_index >= 0) && ((size_t) msg->ifi_index >= iflist_len))
-  {
-    char **temp;
-
-    temp = (char **) realloc (iflist, (msg->ifi_index + 1) * sizeof (char *));
-    if (temp == NULL)
-    {
-      ERROR ("netlink plugin: update_iflist: realloc failed.");
-      return (-1);
-    }
-
-    memset (temp + iflist_len, '\0',
-        (msg->ifi_index + 1 - iflist_len) * sizeof (char *));
-    iflist = temp;
-    iflist_len = msg->ifi_index + 1;
-  }
-  if ((iflist[msg->ifi_index] == NULL)
-      || (strcmp (iflist[msg->ifi_index], dev) != 0))
-  {
-    sfree (iflist[msg->ifi_index]);
-    iflist[msg->ifi_index] = strdup (dev);
-  }
-
-  return (0);
-} /* int update_iflist */
+  int flags = 0;
 
-static void check_ignorelist_and_submit (const char *dev,
-    struct ir_link_stats_storage_s *stats)
+  if (check_ignorelist (dev, "interface", NULL) == 0)
+    flags |= IR_WANT_INTERFACE;
+  if (check_ignorelist (dev, "if_detail", NULL) == 0)
+    flags |= IR_WANT_IF_DETAIL;
+  if (check_ignorelist (dev, "qdisc", NULL) == 0)
+    flags |= IR_WANT_QDISC;
+  if (check_ignorelist (dev, "class", NULL) == 0)
+    flags |= IR_WANT_CLASS;
+  if (check_ignorelist (dev, "filter", NULL) == 0)
+    flags |= IR_WANT_FILTER;
+
+  return (flags);
+} /* int ir_iftable_filter */
+
+static void ir_submit_link (const char *dev, int flags,
+    const iftable_stats_t *stats)
 {
 
-  if (check_ignorelist (dev, "interface", NULL) == 0)
+  if ((flags & IR_WANT_INTERFACE) != 0)
   {
     submit_two (dev, "if_octets", NULL, stats->rx_bytes, stats->tx_bytes);
     submit_two (dev, "if_packets", NULL, stats->rx_packets, stats->tx_packets);
@@ -284,7 +256,7 @@ static void check_ignorelist_and_submit (const char *dev,
     DEBUG ("netlink plugin: Ignoring %s/interface.", dev);
   }
 
-  if (check_ignorelist (dev, "if_detail", NULL) == 0)
+  if ((flags & IR_WANT_IF_DETAIL) != 0)
   {
     submit_two (dev, "if_dropped", NULL, stats->rx_dropped, stats->tx_dropped);
     submit_one (dev, "if_multicast", NULL, stats->multicast);
@@ -308,133 +280,7 @@ static void check_ignorelist_and_submit (const char *dev,
     DEBUG ("netlink plugin: Ignoring %s/if_detail.", dev);
   }
 
-} /* void check_ignorelist_and_submit */
-
-#define COPY_RTNL_LINK_VALUE (dst_stats, src_stats, value_name) \
-  (dst_stats)->value_name = (src_stats)->value_name
-
-#define COPY_RTNL_LINK_STATS (dst_stats, src_stats) \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_packets); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_packets); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_bytes); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_bytes); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_dropped); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_dropped); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, multicast); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, collisions); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_length_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_over_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_crc_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_frame_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_fifo_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, rx_missed_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_aborted_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_carrier_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_fifo_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_heartbeat_errors); \
-  COPY_RTNL_LINK_VALUE (dst_stats, src_stats, tx_window_errors)
-
-#ifdef HAVE_RTNL_LINK_STATS64
-static void check_ignorelist_and_submit64 (const char *dev,
-    struct rtnl_link_stats64 *stats)
-{
-  struct ir_link_stats_storage_s s;
-
-  COPY_RTNL_LINK_STATS (&s, stats);
-
-  check_ignorelist_and_submit (dev, &s);
-}
-#endif
-
-static void check_ignorelist_and_submit32 (const char *dev,
-    struct rtnl_link_stats *stats)
-{
-  struct ir_link_stats_storage_s s;
-
-  COPY_RTNL_LINK_STATS(&s, stats);
-
-  check_ignorelist_and_submit (dev, &s);
-}
-
-static int link_filter_cb (const struct nlmsghdr *nlh,
-    void *args __attribute__((unused)))
-{
-  struct ifinfomsg *ifm = mnl_nlmsg_get_payload (nlh);
-  struct nlattr *attr;
-  const char *dev = NULL;
-  union ir_link_stats_u stats;
-
-  if (nlh->nlmsg_type != RTM_NEWLINK)
-  {
-    ERROR ("netlink plugin: link_filter_cb: Don't know how to handle type %i.",
-        nlh->nlmsg_type);
-    return MNL_CB_ERROR;
-  }
-
-  /* Scan attribute list for device name. */
-  mnl_attr_for_each (attr, nlh, sizeof (*ifm))
-  {
-    if (mnl_attr_get_type (attr) != IFLA_IFNAME)
-      continue;
-
-    if (mnl_attr_validate (attr, MNL_TYPE_STRING) < 0)
-    {
-      ERROR ("netlink plugin: link_filter_cb: IFLA_IFNAME mnl_attr_validate failed.");
-      return MNL_CB_ERROR;
-    }
-
-    dev = mnl_attr_get_str (attr);
-    if (update_iflist (ifm, dev) < 0)
-      return MNL_CB_ERROR;
-    break;
-  }
-
-  if (dev == NULL)
-  {
-    ERROR ("netlink plugin: link_filter_cb: dev == NULL");
-    return MNL_CB_ERROR;
-  }
-#ifdef HAVE_RTNL_LINK_STATS64
-  mnl_attr_for_each (attr, nlh, sizeof (*ifm))
-  {
-    if (mnl_attr_get_type (attr) != IFLA_STATS64)
-      continue;
-
-    if (mnl_attr_validate2 (attr, MNL_TYPE_UNSPEC, sizeof (*stats.stats64)) < 0)
-    {
-      ERROR ("netlink plugin: link_filter_cb: IFLA_STATS64 mnl_attr_validate2 failed.");
-      return MNL_CB_ERROR;
-    }
-    stats.stats64 = mnl_attr_get_payload (attr);
-
-    check_ignorelist_and_submit64 (dev, stats.stats64);
-
-    return MNL_CB_OK;
-  }
-#endif
-  mnl_attr_for_each (attr, nlh, sizeof (*ifm))
-  {
-    if (mnl_attr_get_type (attr) != IFLA_STATS)
-      continue;
-
-    if (mnl_attr_validate2 (attr, MNL_TYPE_UNSPEC, sizeof (*stats.stats32)) < 0)
-    {
-      ERROR ("netlink plugin: link_filter_cb: IFLA_STATS mnl_attr_validate2 failed.");
-      return MNL_CB_ERROR;
-    }
-    stats.stats32 = mnl_attr_get_payload (attr);
-
-    check_ignorelist_and_submit32 (dev, stats.stats32);
-
-    return MNL_CB_OK;
-  }
-
-  DEBUG ("netlink plugin: link_filter: No statistics for interface %s.", dev);
-  return MNL_CB_OK;
-
-} /* int link_filter_cb */
+} /* void ir_submit_link */
 
 #if HAVE_TCA_STATS2
 static int qos_attr_cb (const struct nlattr *attr, void *data)
@@ -465,9 +311,8 @@ static int qos_filter_cb (const struct nlmsghdr *nlh, void *args)
   struct tcmsg *tm = mnl_nlmsg_get_payload (nlh);
   struct nlattr *attr;
 
-  int wanted_ifindex = *((int *) args);
-
-  const char *dev;
+  ir_qos_query_t *q = args;
+  const char *dev = q->dev;
   const char *kind = NULL;
 
   /* char *type_instance; */
@@ -489,31 +334,14 @@ static int qos_filter_cb (const struct nlmsghdr *nlh, void *args)
     return MNL_CB_ERROR;
   }
 
-  if (tm->tcm_ifindex != wanted_ifindex)
+  if (tm->tcm_ifindex != q->ifindex)
   {
     DEBUG ("netlink plugin: qos_filter_cb: Got %s for interface #%i, "
         "but expected #%i.",
-        tc_type, tm->tcm_ifindex, wanted_ifindex);
+        tc_type, tm->tcm_ifindex, q->ifindex);
     return MNL_CB_OK;
   }
 
-  if ((tm->tcm_ifindex >= 0)
-      && ((size_t) tm->tcm_ifindex >= iflist_len))
-  {
-    ERROR ("netlink plugin: qos_filter_cb: tm->tcm_ifindex = %i "
-        ">= iflist_len = %zu",
-        tm->tcm_ifindex, iflist_len);
-    return MNL_CB_ERROR;
-  }
-
-  dev = iflist[tm->tcm_ifindex];
-  if (dev == NULL)
-  {
-    ERROR ("netlink plugin: qos_filter_cb: iflist[%i] == NULL",
-        tm->tcm_ifindex);
-    return MNL_CB_ERROR;
-  }
-
   mnl_attr_for_each (attr, nlh, sizeof (*tm))
   {
     if (mnl_attr_get_type (attr) != TCA_KIND)
@@ -716,103 +544,101 @@ static int ir_init (void)
     return (-1);
   }
 
+  iftable = iftable_create (ir_iftable_filter, /* user_data = */ NULL);
+  if (iftable == NULL)
+  {
+    ERROR ("netlink plugin: ir_init: iftable_create failed.");
+    return (-1);
+  }
+
   return (0);
 } /* int ir_init */
 
-static int ir_read (void)
+static void ir_query_qos (int ifindex, const char *dev, int flags)
 {
   char buf[MNL_SOCKET_BUFFER_SIZE];
   struct nlmsghdr *nlh;
-  struct rtgenmsg *rt;
   int ret;
   unsigned int seq, portid;
+  ir_qos_query_t query = { ifindex, dev };
 
-  size_t ifindex;
+  size_t type_index;
 
   static const int type_id[] = { RTM_GETQDISC, RTM_GETTCLASS, RTM_GETTFILTER };
+  static const int type_flag[] = { IR_WANT_QDISC, IR_WANT_CLASS, IR_WANT_FILTER };
   static const char *type_name[] = { "qdisc", "class", "filter" };
 
   portid = mnl_socket_get_portid (nl);
 
-  nlh = mnl_nlmsg_put_header (buf);
-  nlh->nlmsg_type = RTM_GETLINK;
-  nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-  nlh->nlmsg_seq = seq = time (NULL);
-  rt = mnl_nlmsg_put_extra_header (nlh, sizeof (*rt));
-  rt->rtgen_family = AF_PACKET;
-
-  if (mnl_socket_sendto (nl, nlh, nlh->nlmsg_len) < 0)
-  {
-    ERROR ("netlink plugin: ir_read: rtnl_wilddump_request failed.");
-    return (-1);
-  }
-
-  ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
-  while (ret > 0)
-  {
-    ret = mnl_cb_run (buf, ret, seq, portid, link_filter_cb, NULL);
-    if (ret <= MNL_CB_STOP)
-      break;
-    ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
-  }
-  if (ret < 0)
-  {
-    ERROR ("netlink plugin: ir_read: mnl_socket_recvfrom failed.");
-    return (-1);
-  }
-
-  /* `link_filter_cb' will update `iflist' which is used here to iterate
-   * over all interfaces. */
-  for (ifindex = 1; ifindex < iflist_len; ifindex++)
+  for (type_index = 0; type_index < STATIC_ARRAY_SIZE (type_id); type_index++)
   {
     struct tcmsg *tm;
-    size_t type_index;
 
-    if (iflist[ifindex] == NULL)
+    if ((flags & type_flag[type_index]) == 0)
+    {
+      DEBUG ("netlink plugin: ir_query_qos: check_ignorelist (%s, %s, (nil)) "
+          "== TRUE", dev, type_name[type_index]);
       continue;
+    }
+
+    DEBUG ("netlink plugin: ir_query_qos: querying %s from %s (%i).",
+        type_name[type_index], dev, ifindex);
 
-    for (type_index = 0; type_index < STATIC_ARRAY_SIZE (type_id); type_index++)
+    nlh = mnl_nlmsg_put_header (buf);
+    nlh->nlmsg_type = type_id[type_index];
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    nlh->nlmsg_seq = seq = time (NULL);
+    tm = mnl_nlmsg_put_extra_header (nlh, sizeof (*tm));
+    tm->tcm_family = AF_PACKET;
+    tm->tcm_ifindex = ifindex;
+
+    if (mnl_socket_sendto (nl, nlh, nlh->nlmsg_len) < 0)
     {
-      if (check_ignorelist (iflist[ifindex], type_name[type_index], NULL))
-      {
-        DEBUG ("netlink plugin: ir_read: check_ignorelist (%s, %s, (nil)) "
-            "== TRUE", iflist[ifindex], type_name[type_index]);
-        continue;
-      }
-
-      DEBUG ("netlink plugin: ir_read: querying %s from %s (%lu).",
-          type_name[type_index], iflist[ifindex], ifindex);
-
-      nlh = mnl_nlmsg_put_header (buf);
-      nlh->nlmsg_type = type_id[type_index];
-      nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-      nlh->nlmsg_seq = seq = time (NULL);
-      tm = mnl_nlmsg_put_extra_header (nlh, sizeof (*tm));
-      tm->tcm_family = AF_PACKET;
-      tm->tcm_ifindex = ifindex;
-
-      if (mnl_socket_sendto (nl, nlh, nlh->nlmsg_len) < 0)
-      {
-        ERROR ("netlink plugin: ir_read: mnl_socket_sendto failed.");
-        continue;
-      }
+      ERROR ("netlink plugin: ir_query_qos: mnl_socket_sendto (%s, %s) failed.",
+          dev, type_name[type_index]);
+      continue;
+    }
 
+    ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
+    while (ret > 0)
+    {
+      ret = mnl_cb_run (buf, ret, seq, portid, qos_filter_cb, &query);
+      if (ret <= MNL_CB_STOP)
+        break;
       ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
-      while (ret > 0)
-      {
-        ret = mnl_cb_run (buf, ret, seq, portid, qos_filter_cb, &ifindex);
-        if (ret <= MNL_CB_STOP)
-          break;
-        ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
-      }
-      if (ret < 0)
-      {
-        ERROR ("netlink plugin: ir_read:mnl_socket_recvfrom failed.");
-        continue;
-      }
-
-    } /* for (type_index) */
-  } /* for (if_index) */
+    }
+    if (ret < 0)
+    {
+      ERROR ("netlink plugin: ir_query_qos: mnl_socket_recvfrom failed.");
+      continue;
+    }
+  } /* for (type_index) */
+} /* void ir_query_qos */
+
+static int ir_iftable_cb (int ifindex, const char *dev, int flags,
+    const iftable_stats_t *stats, void *user_data __attribute__((unused)))
+{
+  ir_submit_link (dev, flags, stats);
+
+  /* The traffic control objects are queried using a separate socket, so
+   * this doesn't interfere with the link dump that's still in progress. */
+  ir_query_qos (ifindex, dev, flags);
+
+  return (0);
+} /* int ir_iftable_cb */
+
+static int ir_read (void)
+{
+  int status;
+
+  status = iftable_read (iftable, ir_iftable_cb, /* user_data = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("netlink plugin: ir_read: Reading the link statistics failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
 
   return (0);
 } /* int ir_read */
@@ -825,6 +651,9 @@ static int ir_shutdown (void)
     nl = NULL;
   }
 
+  iftable_destroy (iftable);
+  iftable = NULL;
+
   return (0);
 } /* int ir_shutdown */
 
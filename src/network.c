@@ -34,6 +34,7 @@
 #include "utils_complain.h"
 
 #include "network.h"
+#include "libcollectdclient/network_codec.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -77,6 +78,17 @@
 #  pragma GCC diagnostic warning "-Wdeprecated-declarations"
 # endif
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
+/* AES-GCM is available since libgcrypt 1.6. */
+# if GCRYPT_VERSION_NUMBER >= 0x010600
+#  define NETWORK_HAVE_GCM 1
+# endif
+#endif
+#ifndef NETWORK_HAVE_GCM
+# define NETWORK_HAVE_GCM 0
+#endif
+
+#if HAVE_LIBLZ4
+# include <lz4.h>
 #endif
 
 #ifndef IPV6_ADD_MEMBERSHIP
@@ -104,6 +116,24 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #if HAVE_LIBGCRYPT
 # define SECURITY_LEVEL_SIGN    1
 # define SECURITY_LEVEL_ENCRYPT 2
+
+# define ENCRYPTION_MODE_OFB 0
+# define ENCRYPTION_MODE_GCM 1
+
+/* Per-user state of a server socket: The keys derived from the user's
+ * password are only computed once and the handles are kept around with the
+ * key already set, so that a packet only costs a reset and setting the IV.
+ * These are kept next to the password in the user DB and are discarded
+ * when the password file is re-read. */
+struct network_user_s
+{
+	gcry_md_hd_t hmac;
+	gcry_cipher_hd_t cypher;
+# if NETWORK_HAVE_GCM
+	gcry_cipher_hd_t gcm;
+# endif
+};
+typedef struct network_user_s network_user_t;
 #endif
 struct sockent_client
 {
@@ -114,9 +144,15 @@ struct sockent_client
 	int security_level;
 	char *username;
 	char *password;
+	int encryption_mode;
 	gcry_cipher_hd_t cypher;
 	unsigned char password_hash[32];
+	gcry_md_hd_t hmac;
+# if NETWORK_HAVE_GCM
+	gcry_cipher_hd_t gcm;
+# endif
 #endif
+	int compress;
 };
 
 struct sockent_server
@@ -126,9 +162,9 @@ struct sockent_server
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *auth_file;
-	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
+	fbhash_t *userdb; /* name -> password, network_user_t */
 #endif
+	int compress;
 };
 
 typedef struct sockent
@@ -263,6 +299,71 @@ struct part_encryption_aes256_s
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Username length               ! Username (variable length)    :
+ * +-------------------------------+-------------------------------+
+ * ! Nonce (Bits   0 -  31)                                        !
+ * : :                                                             :
+ * ! Nonce (Bits  64 -  95)                                        !
+ * +---------------------------------------------------------------+
+ * : Encrypted payload (variable length)                           :
+ * +---------------------------------------------------------------+
+ * ! Tag (Bits   0 -  31)                                          !
+ * : :                                                             :
+ * ! Tag (Bits  96 - 127)                                          !
+ * +---------------------------------------------------------------+
+ *
+ * Everything up to and including the nonce is authenticated, but not
+ * encrypted, so the tag covers the entire part.
+ */
+/* Minimum size */
+#define PART_ENCRYPTION_AES256_GCM_SIZE 34
+struct part_encryption_aes256_gcm_s
+{
+  part_header_t head;
+  uint16_t username_length;
+  char *username;
+  unsigned char nonce[12];
+  /* <encrypted> */
+  /*   <payload /> */
+  /* </encrypted> */
+  unsigned char tag[16];
+};
+typedef struct part_encryption_aes256_gcm_s part_encryption_aes256_gcm_t;
+
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Original length               ! LZ4 block                     !
+ * +-------------------------------+                               !
+ * :                                                               :
+ * +---------------------------------------------------------------+
+ *
+ * All parts of a packet are wrapped into one compressed part, which a
+ * receiver that doesn't know it skips as a whole, losing the data. Receivers
+ * whose parse_packet() doesn't subtract the length of unknown parts misparse
+ * the rest of the packet instead. The protocol is one-way, so this can't be
+ * negotiated: "Compress" must only be enabled for servers known to support
+ * compressed parts.
+ */
+/* Minimum size */
+#define PART_COMPRESSION_LZ4_SIZE 6
+struct part_compression_lz4_s
+{
+  part_header_t head;
+  uint16_t orig_length;
+  /* <compressed> */
+  /*   <payload /> */
+  /* </compressed> */
+};
+typedef struct part_compression_lz4_s part_compression_lz4_t;
+
 struct receive_list_entry_s
 {
   char *data;
@@ -322,6 +423,14 @@ static derive_t stats_values_dispatched = 0;
 static derive_t stats_values_not_dispatched = 0;
 static derive_t stats_values_sent = 0;
 static derive_t stats_values_not_sent = 0;
+#if HAVE_LIBLZ4
+static derive_t stats_compress_octets_in = 0;
+static derive_t stats_compress_octets_out = 0;
+static cdtime_t stats_compress_time = 0;
+static derive_t stats_decompress_octets_in = 0;
+static derive_t stats_decompress_octets_out = 0;
+static cdtime_t stats_decompress_time = 0;
+#endif
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
@@ -507,254 +616,256 @@ static void network_init_gcrypt (void) /* {{{ */
   gcry_control (GCRYCTL_INITIALIZATION_FINISHED);
 } /* }}} void network_init_gcrypt */
 
-static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
-    const void *iv, size_t iv_size, const char *username)
+static gcry_cipher_hd_t network_open_cypher (int mode, /* {{{ */
+    const unsigned char *key, size_t key_size)
 {
+  gcry_cipher_hd_t cypher = NULL;
   gcry_error_t err;
-  gcry_cipher_hd_t *cyper_ptr;
-  unsigned char password_hash[32];
 
-  if (se->type == SOCKENT_TYPE_CLIENT)
+  err = gcry_cipher_open (&cypher, GCRY_CIPHER_AES256, mode, /* flags = */ 0);
+  if (err != 0)
   {
-	  cyper_ptr = &se->data.client.cypher;
-	  memcpy (password_hash, se->data.client.password_hash,
-			  sizeof (password_hash));
+    ERROR ("network plugin: gcry_cipher_open returned: %s",
+        gcry_strerror (err));
+    return (NULL);
   }
-  else
-  {
-	  char *secret;
-
-	  cyper_ptr = &se->data.server.cypher;
 
-	  if (username == NULL)
-		  return (NULL);
+  err = gcry_cipher_setkey (cypher, key, key_size);
+  if (err != 0)
+  {
+    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+        gcry_strerror (err));
+    gcry_cipher_close (cypher);
+    return (NULL);
+  }
 
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
-		  return (NULL);
+  return (cypher);
+} /* }}} gcry_cipher_hd_t network_open_cypher */
 
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
+/* Prepares a handle returned by "network_open_cypher" for the next packet.
+ * The key stays set, so this is cheap. */
+static int network_reset_cypher (gcry_cipher_hd_t cypher, /* {{{ */
+    const void *iv, size_t iv_size)
+{
+  gcry_error_t err;
 
-	  sfree (secret);
-  }
+  gcry_cipher_reset (cypher);
 
-  if (*cyper_ptr == NULL)
-  {
-    err = gcry_cipher_open (cyper_ptr,
-        GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
-    if (err != 0)
-    {
-      ERROR ("network plugin: gcry_cipher_open returned: %s",
-          gcry_strerror (err));
-      *cyper_ptr = NULL;
-      return (NULL);
-    }
-  }
-  else
+  err = gcry_cipher_setiv (cypher, iv, iv_size);
+  if (err != 0)
   {
-    gcry_cipher_reset (*cyper_ptr);
+    ERROR ("network plugin: gcry_cipher_setiv returned: %s",
+        gcry_strerror (err));
+    return (-1);
   }
-  assert (*cyper_ptr != NULL);
 
-  err = gcry_cipher_setkey (*cyper_ptr,
-      password_hash, sizeof (password_hash));
+  return (0);
+} /* }}} int network_reset_cypher */
+
+/* Returns a HMAC-SHA-256 handle keyed with "secret". Use "gcry_md_reset" to
+ * start a new message; this keeps the key. */
+static gcry_md_hd_t network_open_hmac (const char *secret) /* {{{ */
+{
+  gcry_md_hd_t hd = NULL;
+  gcry_error_t err;
+
+  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
   if (err != 0)
   {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
         gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
     return (NULL);
   }
 
-  err = gcry_cipher_setiv (*cyper_ptr, iv, iv_size);
+  err = gcry_md_setkey (hd, secret, strlen (secret));
   if (err != 0)
   {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
-        gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
+    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
+    gcry_md_close (hd);
     return (NULL);
   }
 
-  return (*cyper_ptr);
-} /* }}} int network_get_aes256_cypher */
-#endif /* HAVE_LIBGCRYPT */
+  return (hd);
+} /* }}} gcry_md_hd_t network_open_hmac */
 
-static int write_part_values (char **ret_buffer, int *ret_buffer_len,
-		const data_set_t *ds, const value_list_t *vl)
+#if NETWORK_HAVE_GCM
+/* The GCM key is HMAC-SHA-256 (secret, label), so that it differs from the
+ * SHA-256 (secret) key used in OFB mode. */
+static int network_derive_gcm_key (unsigned char *key, /* {{{ */
+    size_t key_size, const char *secret)
 {
-	char *packet_ptr;
-	int packet_len;
-	int num_values;
+  static const char label[] = "collectd AES-256-GCM";
+  gcry_md_hd_t hd;
+  unsigned char *hash;
 
-	part_header_t pkg_ph;
-	uint16_t      pkg_num_values;
-	uint8_t      *pkg_values_types;
-	value_t      *pkg_values;
+  assert (key_size == 32);
 
-	int offset;
-	int i;
+  hd = network_open_hmac (secret);
+  if (hd == NULL)
+    return (-1);
 
-	num_values = vl->values_len;
-	packet_len = sizeof (part_header_t) + sizeof (uint16_t)
-		+ (num_values * sizeof (uint8_t))
-		+ (num_values * sizeof (value_t));
+  gcry_md_write (hd, label, strlen (label));
+  hash = gcry_md_read (hd, GCRY_MD_SHA256);
+  if (hash == NULL)
+  {
+    ERROR ("network plugin: gcry_md_read failed.");
+    gcry_md_close (hd);
+    return (-1);
+  }
+  memcpy (key, hash, key_size);
 
-	if (*ret_buffer_len < packet_len)
-		return (-1);
+  gcry_md_close (hd);
+  return (0);
+} /* }}} int network_derive_gcm_key */
+#endif /* NETWORK_HAVE_GCM */
 
-	pkg_values_types = (uint8_t *) malloc (num_values * sizeof (uint8_t));
-	if (pkg_values_types == NULL)
-	{
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
+static void network_user_destroy (void *arg) /* {{{ */
+{
+  network_user_t *u = arg;
 
-	pkg_values = (value_t *) malloc (num_values * sizeof (value_t));
-	if (pkg_values == NULL)
-	{
-		free (pkg_values_types);
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
+  if (u == NULL)
+    return;
 
-	pkg_ph.type = htons (TYPE_VALUES);
-	pkg_ph.length = htons (packet_len);
+  if (u->hmac != NULL)
+    gcry_md_close (u->hmac);
+  if (u->cypher != NULL)
+    gcry_cipher_close (u->cypher);
+#if NETWORK_HAVE_GCM
+  if (u->gcm != NULL)
+    gcry_cipher_close (u->gcm);
+#endif
 
-	pkg_num_values = htons ((uint16_t) vl->values_len);
+  sfree (u);
+} /* }}} void network_user_destroy */
 
-	for (i = 0; i < num_values; i++)
-	{
-		pkg_values_types[i] = (uint8_t) ds->ds[i].type;
-		switch (ds->ds[i].type)
-		{
-			case DS_TYPE_COUNTER:
-				pkg_values[i].counter = htonll (vl->values[i].counter);
-				break;
+/* Called by the user DB the first time "name" is looked up. */
+static void *network_user_create ( /* {{{ */
+    __attribute__((unused)) const char *name, const char *secret)
+{
+  network_user_t *u;
+  unsigned char key[32];
 
-			case DS_TYPE_GAUGE:
-				pkg_values[i].gauge = htond (vl->values[i].gauge);
-				break;
+  u = calloc (1, sizeof (*u));
+  if (u == NULL)
+    return (NULL);
 
-			case DS_TYPE_DERIVE:
-				pkg_values[i].derive = htonll (vl->values[i].derive);
-				break;
+  u->hmac = network_open_hmac (secret);
 
-			case DS_TYPE_ABSOLUTE:
-				pkg_values[i].absolute = htonll (vl->values[i].absolute);
-				break;
+  gcry_md_hash_buffer (GCRY_MD_SHA256, key, secret, strlen (secret));
+  u->cypher = network_open_cypher (GCRY_CIPHER_MODE_OFB, key, sizeof (key));
 
-			default:
-				free (pkg_values_types);
-				free (pkg_values);
-				ERROR ("network plugin: write_part_values: "
-						"Unknown data source type: %i",
-						ds->ds[i].type);
-				return (-1);
-		} /* switch (ds->ds[i].type) */
-	} /* for (num_values) */
-
-	/*
-	 * Use `memcpy' to write everything to the buffer, because the pointer
-	 * may be unaligned and some architectures, such as SPARC, can't handle
-	 * that.
-	 */
-	packet_ptr = *ret_buffer;
-	offset = 0;
-	memcpy (packet_ptr + offset, &pkg_ph, sizeof (pkg_ph));
-	offset += sizeof (pkg_ph);
-	memcpy (packet_ptr + offset, &pkg_num_values, sizeof (pkg_num_values));
-	offset += sizeof (pkg_num_values);
-	memcpy (packet_ptr + offset, pkg_values_types, num_values * sizeof (uint8_t));
-	offset += num_values * sizeof (uint8_t);
-	memcpy (packet_ptr + offset, pkg_values, num_values * sizeof (value_t));
-	offset += num_values * sizeof (value_t);
-
-	assert (offset == packet_len);
-
-	*ret_buffer = packet_ptr + packet_len;
-	*ret_buffer_len -= packet_len;
-
-	free (pkg_values_types);
-	free (pkg_values);
+#if NETWORK_HAVE_GCM
+  if (network_derive_gcm_key (key, sizeof (key), secret) == 0)
+    u->gcm = network_open_cypher (GCRY_CIPHER_MODE_GCM, key, sizeof (key));
+#endif
+  memset (key, 0, sizeof (key));
 
-	return (0);
-} /* int write_part_values */
+  if ((u->hmac == NULL) || (u->cypher == NULL)
+#if NETWORK_HAVE_GCM
+      || (u->gcm == NULL)
+#endif
+     )
+  {
+    network_user_destroy (u);
+    return (NULL);
+  }
 
-static int write_part_number (char **ret_buffer, int *ret_buffer_len,
-		int type, uint64_t value)
+  return (u);
+} /* }}} void *network_user_create */
+
+/* Returns the state for "username" or NULL for unknown users. This is only
+ * called from the dispatch thread, so the handles don't need locking. */
+static network_user_t *network_get_user (sockent_t *se, /* {{{ */
+    const char *username)
 {
-	char *packet_ptr;
-	int packet_len;
+  return (fbh_get_data (se->data.server.userdb, username));
+} /* }}} network_user_t *network_get_user */
+#endif /* HAVE_LIBGCRYPT */
 
-	part_header_t pkg_head;
-	uint64_t pkg_value;
+static int write_part_values (char **ret_buffer, int *ret_buffer_len,
+		const data_set_t *ds, const value_list_t *vl)
+{
+	uint8_t pkg_values_types[vl->values_len];
+	size_t buffer_len;
+	int status;
+	int i;
 
-	int offset;
+	if (*ret_buffer_len < 0)
+		return (-1);
+	buffer_len = (size_t) *ret_buffer_len;
 
-	packet_len = sizeof (pkg_head) + sizeof (pkg_value);
+	for (i = 0; i < vl->values_len; i++)
+		pkg_values_types[i] = (uint8_t) ds->ds[i].type;
 
-	if (*ret_buffer_len < packet_len)
+	status = lcc_network_encode_values (ret_buffer, &buffer_len,
+			TYPE_VALUES, pkg_values_types, vl->values,
+			(size_t) vl->values_len);
+	if (status == EINVAL)
+	{
+		ERROR ("network plugin: write_part_values: "
+				"Unknown data source type in data set \"%s\".",
+				ds->type);
+		return (-1);
+	}
+	else if (status != 0)
 		return (-1);
 
-	pkg_head.type = htons (type);
-	pkg_head.length = htons (packet_len);
-	pkg_value = htonll (value);
+	*ret_buffer_len = (int) buffer_len;
+	return (0);
+} /* int write_part_values */
 
-	packet_ptr = *ret_buffer;
-	offset = 0;
-	memcpy (packet_ptr + offset, &pkg_head, sizeof (pkg_head));
-	offset += sizeof (pkg_head);
-	memcpy (packet_ptr + offset, &pkg_value, sizeof (pkg_value));
-	offset += sizeof (pkg_value);
+static int write_part_number (char **ret_buffer, int *ret_buffer_len,
+		int type, uint64_t value)
+{
+	size_t buffer_len;
 
-	assert (offset == packet_len);
+	if (*ret_buffer_len < 0)
+		return (-1);
+	buffer_len = (size_t) *ret_buffer_len;
 
-	*ret_buffer = packet_ptr + packet_len;
-	*ret_buffer_len -= packet_len;
+	if (lcc_network_encode_number (ret_buffer, &buffer_len,
+				(uint16_t) type, value) != 0)
+		return (-1);
 
+	*ret_buffer_len = (int) buffer_len;
 	return (0);
 } /* int write_part_number */
 
 static int write_part_string (char **ret_buffer, int *ret_buffer_len,
 		int type, const char *str, int str_len)
 {
-	char *buffer;
-	int buffer_len;
-
-	uint16_t pkg_type;
-	uint16_t pkg_length;
+	size_t buffer_len;
 
-	int offset;
+	if ((*ret_buffer_len < 0) || (str_len < 0))
+		return (-1);
+	buffer_len = (size_t) *ret_buffer_len;
 
-	buffer_len = 2 * sizeof (uint16_t) + str_len + 1;
-	if (*ret_buffer_len < buffer_len)
+	if (lcc_network_encode_string (ret_buffer, &buffer_len,
+				(uint16_t) type, str, (size_t) str_len) != 0)
 		return (-1);
 
-	pkg_type = htons (type);
-	pkg_length = htons (buffer_len);
+	*ret_buffer_len = (int) buffer_len;
+	return (0);
+} /* int write_part_string */
 
-	buffer = *ret_buffer;
-	offset = 0;
-	memcpy (buffer + offset, (void *) &pkg_type, sizeof (pkg_type));
-	offset += sizeof (pkg_type);
-	memcpy (buffer + offset, (void *) &pkg_length, sizeof (pkg_length));
-	offset += sizeof (pkg_length);
-	memcpy (buffer + offset, str, str_len);
-	offset += str_len;
-	memset (buffer + offset, '\0', 1);
-	offset += 1;
+/* Writes a string part unless "str" equals "state", i.e. the value the
+ * receiver already knows from a previous part in the same packet. */
+static int write_part_ident (char **ret_buffer, int *ret_buffer_len,
+		int type, const char *str, char *state, size_t state_size)
+{
+	size_t buffer_len;
 
-	assert (offset == buffer_len);
+	if (*ret_buffer_len < 0)
+		return (-1);
+	buffer_len = (size_t) *ret_buffer_len;
 
-	*ret_buffer = buffer + buffer_len;
-	*ret_buffer_len -= buffer_len;
+	if (lcc_network_encode_ident (ret_buffer, &buffer_len,
+				(uint16_t) type, str, state, state_size) != 0)
+		return (-1);
 
+	*ret_buffer_len = (int) buffer_len;
 	return (0);
-} /* int write_part_string */
+} /* int write_part_ident */
 
 static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		value_t **ret_values, int *ret_num_values)
@@ -814,58 +925,35 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		return (-1);
 	}
 
-	pkg_types = (uint8_t *) malloc (pkg_numval * sizeof (uint8_t));
+	pkg_types = (uint8_t *) buffer;
+	buffer += pkg_numval * sizeof (uint8_t);
+
 	pkg_values = (value_t *) malloc (pkg_numval * sizeof (value_t));
-	if ((pkg_types == NULL) || (pkg_values == NULL))
+	if (pkg_values == NULL)
 	{
-		sfree (pkg_types);
-		sfree (pkg_values);
 		ERROR ("network plugin: parse_part_values: malloc failed.");
 		return (-1);
 	}
 
-	memcpy ((void *) pkg_types, (void *) buffer, pkg_numval * sizeof (uint8_t));
-	buffer += pkg_numval * sizeof (uint8_t);
-	memcpy ((void *) pkg_values, (void *) buffer, pkg_numval * sizeof (value_t));
-	buffer += pkg_numval * sizeof (value_t);
-
-	for (i = 0; i < pkg_numval; i++)
+	if (lcc_network_decode_values (pkg_values, buffer,
+				pkg_types, pkg_numval) != 0)
 	{
-		switch (pkg_types[i])
-		{
-		  case DS_TYPE_COUNTER:
-		    pkg_values[i].counter = (counter_t) ntohll (pkg_values[i].counter);
-		    break;
-
-		  case DS_TYPE_GAUGE:
-		    pkg_values[i].gauge = (gauge_t) ntohd (pkg_values[i].gauge);
-		    break;
-
-		  case DS_TYPE_DERIVE:
-		    pkg_values[i].derive = (derive_t) ntohll (pkg_values[i].derive);
-		    break;
-
-		  case DS_TYPE_ABSOLUTE:
-		    pkg_values[i].absolute = (absolute_t) ntohll (pkg_values[i].absolute);
-		    break;
-
-		  default:
-		    NOTICE ("network plugin: parse_part_values: "
-			"Don't know how to handle data source type %"PRIu8,
-			pkg_types[i]);
-		    sfree (pkg_types);
-		    sfree (pkg_values);
-		    return (-1);
-		} /* switch (pkg_types[i]) */
+		for (i = 0; i < pkg_numval; i++)
+			if (pkg_types[i] > DS_TYPE_ABSOLUTE)
+				break;
+		NOTICE ("network plugin: parse_part_values: "
+				"Don't know how to handle data source type %"PRIu8,
+				(i < pkg_numval) ? pkg_types[i] : 0);
+		sfree (pkg_values);
+		return (-1);
 	}
+	buffer += pkg_numval * sizeof (value_t);
 
 	*ret_buffer     = buffer;
 	*ret_buffer_len = buffer_len - pkg_length;
 	*ret_num_values = pkg_numval;
 	*ret_values     = pkg_values;
 
-	sfree (pkg_types);
-
 	return (0);
 } /* int parse_part_values */
 
@@ -993,8 +1081,9 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
 
 /* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
  * parse_packet and vice versa. */
-#define PP_SIGNED    0x01
-#define PP_ENCRYPTED 0x02
+#define PP_SIGNED     0x01
+#define PP_ENCRYPTED  0x02
+#define PP_COMPRESSED 0x04
 static int parse_packet (sockent_t *se,
 		void *buffer, size_t buffer_size, int flags,
 		const char *username);
@@ -1015,14 +1104,12 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
+  network_user_t *user;
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof (pss.hash)];
 
-  gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -1069,55 +1156,29 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == pss_head_length);
 
-  /* Query the password */
-  secret = fbh_get (se->data.server.userdb, pss.username);
-  if (secret == NULL)
+  /* Look up the user's HMAC object */
+  user = network_get_user (se, pss.username);
+  if (user == NULL)
   {
     ERROR ("network plugin: Unknown user: %s", pss.username);
     sfree (pss.username);
     return (-ENOENT);
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
-        gcry_strerror (err));
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  err = gcry_md_setkey (hd, secret, strlen (secret));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
-    gcry_md_close (hd);
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  gcry_md_write (hd,
+  /* Check the HMAC */
+  gcry_md_reset (user->hmac);
+  gcry_md_write (user->hmac,
       buffer     + PART_SIGNATURE_SHA256_SIZE,
       buffer_len - PART_SIGNATURE_SHA256_SIZE);
-  hash_ptr = gcry_md_read (hd, GCRY_MD_SHA256);
+  hash_ptr = gcry_md_read (user->hmac, GCRY_MD_SHA256);
   if (hash_ptr == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
   memcpy (hash, hash_ptr, sizeof (hash));
 
-  /* Clean up */
-  gcry_md_close (hd);
-  hd = NULL;
-
   if (memcmp (pss.hash, hash, sizeof (pss.hash)) != 0)
   {
     WARNING ("network plugin: Verifying HMAC-SHA-256 signature failed: "
@@ -1129,7 +1190,6 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
         flags | PP_SIGNED, pss.username);
   }
 
-  sfree (secret);
   sfree (pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1199,7 +1259,7 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   part_encryption_aes256_t pea;
   unsigned char hash[sizeof (pea.hash)];
 
-  gcry_cipher_hd_t cypher;
+  network_user_t *user;
   gcry_error_t err;
 
   /* Make sure at least the header if available. */
@@ -1216,102 +1276,371 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   BUFFER_READ (&pea.head.type, sizeof (pea.head.type));
   BUFFER_READ (&pea.head.length, sizeof (pea.head.length));
 
-  /* Check the `part size'. */
-  part_size = ntohs (pea.head.length);
-  if ((part_size <= PART_ENCRYPTION_AES256_SIZE)
-      || (part_size > buffer_len))
+  /* Check the `part size'. */
+  part_size = ntohs (pea.head.length);
+  if ((part_size <= PART_ENCRYPTION_AES256_SIZE)
+      || (part_size > buffer_len))
+  {
+    NOTICE ("network plugin: parse_part_encr_aes256: "
+        "Discarding part with invalid size.");
+    return (-1);
+  }
+
+  /* Read the username */
+  BUFFER_READ (&username_len, sizeof (username_len));
+  username_len = ntohs (username_len);
+
+  if ((username_len <= 0)
+      || (username_len > (part_size - (PART_ENCRYPTION_AES256_SIZE + 1))))
+  {
+    NOTICE ("network plugin: parse_part_encr_aes256: "
+        "Discarding part with invalid username length.");
+    return (-1);
+  }
+
+  assert (username_len > 0);
+  pea.username = malloc (username_len + 1);
+  if (pea.username == NULL)
+    return (-ENOMEM);
+  BUFFER_READ (pea.username, username_len);
+  pea.username[username_len] = 0;
+
+  /* Last but not least, the initialization vector */
+  BUFFER_READ (pea.iv, sizeof (pea.iv));
+
+  /* Make sure we are at the right position */
+  assert (buffer_offset == (username_len +
+        PART_ENCRYPTION_AES256_SIZE - sizeof (pea.hash)));
+
+  user = network_get_user (se, pea.username);
+  if ((user == NULL)
+      || (network_reset_cypher (user->cypher, pea.iv, sizeof (pea.iv)) != 0))
+  {
+    sfree (pea.username);
+    return (-1);
+  }
+
+  payload_len = part_size - (PART_ENCRYPTION_AES256_SIZE + username_len);
+  assert (payload_len > 0);
+
+  /* Decrypt the packet in-place */
+  err = gcry_cipher_decrypt (user->cypher,
+      buffer    + buffer_offset,
+      part_size - buffer_offset,
+      /* in = */ NULL, /* in len = */ 0);
+  if (err != 0)
+  {
+    sfree (pea.username);
+    ERROR ("network plugin: gcry_cipher_decrypt returned: %s",
+        gcry_strerror (err));
+    return (-1);
+  }
+
+  /* Read the hash */
+  BUFFER_READ (pea.hash, sizeof (pea.hash));
+
+  /* Make sure we're at the right position - again */
+  assert (buffer_offset == (username_len + PART_ENCRYPTION_AES256_SIZE));
+  assert (buffer_offset == (part_size - payload_len));
+
+  /* Check hash sum */
+  memset (hash, 0, sizeof (hash));
+  gcry_md_hash_buffer (GCRY_MD_SHA1, hash,
+      buffer + buffer_offset, payload_len);
+  if (memcmp (hash, pea.hash, sizeof (hash)) != 0)
+  {
+    sfree (pea.username);
+    ERROR ("network plugin: Decryption failed: Checksum mismatch.");
+    return (-1);
+  }
+
+  parse_packet (se, buffer + buffer_offset, payload_len,
+      flags | PP_ENCRYPTED, pea.username);
+
+  /* XXX: Free pea.username?!? */
+
+  /* Update return values */
+  *ret_buffer =     buffer     + part_size;
+  *ret_buffer_len = buffer_len - part_size;
+
+  sfree (pea.username);
+
+  return (0);
+} /* }}} int parse_part_encr_aes256 */
+/* #endif HAVE_LIBGCRYPT */
+
+#else /* if !HAVE_LIBGCRYPT */
+static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_size, int flags)
+{
+  static int warning_has_been_printed = 0;
+
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_offset;
+
+  part_header_t ph;
+  size_t ph_length;
+
+  buffer = *ret_buffer;
+  buffer_size = *ret_buffer_size;
+  buffer_offset = 0;
+
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (sizeof (ph.type) + sizeof (ph.length)));
+
+  BUFFER_READ (&ph.type, sizeof (ph.type));
+  BUFFER_READ (&ph.length, sizeof (ph.length));
+  ph_length = ntohs (ph.length);
+
+  if ((ph_length <= PART_ENCRYPTION_AES256_SIZE)
+      || (ph_length > buffer_size))
+  {
+    ERROR ("network plugin: AES-256 encrypted part "
+        "with invalid length received.");
+    return (-1);
+  }
+
+  if (warning_has_been_printed == 0)
+  {
+    WARNING ("network plugin: Received encrypted packet, but the network "
+        "plugin was not linked with libgcrypt, so I cannot "
+        "decrypt it. The part will be discarded.");
+    warning_has_been_printed = 1;
+  }
+
+  *ret_buffer += ph_length;
+  *ret_buffer_size -= ph_length;
+
+  return (0);
+} /* }}} int parse_part_encr_aes256 */
+#endif /* !HAVE_LIBGCRYPT */
+
+#if NETWORK_HAVE_GCM
+static int parse_part_encr_aes256_gcm (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_len, int flags)
+{
+  char  *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
+  size_t payload_len;
+  size_t part_size;
+  size_t buffer_offset;
+  uint16_t username_len;
+  part_encryption_aes256_gcm_t peg;
+
+  network_user_t *user;
+  gcry_error_t err;
+
+  if (buffer_len <= PART_ENCRYPTION_AES256_GCM_SIZE)
+  {
+    NOTICE ("network plugin: parse_part_encr_aes256_gcm: "
+        "Discarding short packet.");
+    return (-1);
+  }
+
+  buffer_offset = 0;
+
+  BUFFER_READ (&peg.head.type, sizeof (peg.head.type));
+  BUFFER_READ (&peg.head.length, sizeof (peg.head.length));
+
+  part_size = ntohs (peg.head.length);
+  if ((part_size <= PART_ENCRYPTION_AES256_GCM_SIZE)
+      || (part_size > buffer_len))
+  {
+    NOTICE ("network plugin: parse_part_encr_aes256_gcm: "
+        "Discarding part with invalid size.");
+    return (-1);
+  }
+
+  BUFFER_READ (&username_len, sizeof (username_len));
+  username_len = ntohs (username_len);
+
+  if ((username_len <= 0)
+      || (username_len > (part_size - (PART_ENCRYPTION_AES256_GCM_SIZE + 1))))
+  {
+    NOTICE ("network plugin: parse_part_encr_aes256_gcm: "
+        "Discarding part with invalid username length.");
+    return (-1);
+  }
+
+  peg.username = malloc (username_len + 1);
+  if (peg.username == NULL)
+    return (-ENOMEM);
+  BUFFER_READ (peg.username, username_len);
+  peg.username[username_len] = 0;
+
+  BUFFER_READ (peg.nonce, sizeof (peg.nonce));
+
+  assert (buffer_offset == (username_len +
+        PART_ENCRYPTION_AES256_GCM_SIZE - sizeof (peg.tag)));
+
+  payload_len = part_size - (PART_ENCRYPTION_AES256_GCM_SIZE + username_len);
+  assert (payload_len > 0);
+
+  user = network_get_user (se, peg.username);
+  if ((user == NULL)
+      || (network_reset_cypher (user->gcm, peg.nonce, sizeof (peg.nonce)) != 0))
+  {
+    sfree (peg.username);
+    return (-1);
+  }
+
+  /* Authenticate the header, then decrypt the payload in-place and check
+   * the tag in the same pass. */
+  err = gcry_cipher_authenticate (user->gcm, buffer, buffer_offset);
+  if (err == 0)
+    err = gcry_cipher_decrypt (user->gcm,
+        buffer + buffer_offset, payload_len,
+        /* in = */ NULL, /* in len = */ 0);
+  if (err == 0)
+    err = gcry_cipher_checktag (user->gcm,
+        buffer + buffer_offset + payload_len, sizeof (peg.tag));
+  if (err != 0)
+  {
+    ERROR ("network plugin: Decryption failed: %s", gcry_strerror (err));
+    sfree (peg.username);
+    return (-1);
+  }
+
+  parse_packet (se, buffer + buffer_offset, payload_len,
+      flags | PP_ENCRYPTED, peg.username);
+
+  *ret_buffer =     buffer     + part_size;
+  *ret_buffer_len = buffer_len - part_size;
+
+  sfree (peg.username);
+
+  return (0);
+} /* }}} int parse_part_encr_aes256_gcm */
+/* #endif NETWORK_HAVE_GCM */
+
+#else /* if !NETWORK_HAVE_GCM */
+static int parse_part_encr_aes256_gcm (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_size, int flags)
+{
+  static int warning_has_been_printed = 0;
+
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_offset;
+
+  part_header_t ph;
+  size_t ph_length;
+
+  buffer = *ret_buffer;
+  buffer_size = *ret_buffer_size;
+  buffer_offset = 0;
+
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (sizeof (ph.type) + sizeof (ph.length)));
+
+  BUFFER_READ (&ph.type, sizeof (ph.type));
+  BUFFER_READ (&ph.length, sizeof (ph.length));
+  ph_length = ntohs (ph.length);
+
+  if ((ph_length <= PART_ENCRYPTION_AES256_GCM_SIZE)
+      || (ph_length > buffer_size))
   {
-    NOTICE ("network plugin: parse_part_encr_aes256: "
-        "Discarding part with invalid size.");
+    ERROR ("network plugin: AES-256-GCM encrypted part "
+        "with invalid length received.");
     return (-1);
   }
 
-  /* Read the username */
-  BUFFER_READ (&username_len, sizeof (username_len));
-  username_len = ntohs (username_len);
-
-  if ((username_len <= 0)
-      || (username_len > (part_size - (PART_ENCRYPTION_AES256_SIZE + 1))))
+  if (warning_has_been_printed == 0)
   {
-    NOTICE ("network plugin: parse_part_encr_aes256: "
-        "Discarding part with invalid username length.");
-    return (-1);
+    WARNING ("network plugin: Received an AES-256-GCM encrypted packet, but "
+        "the network plugin was not linked with libgcrypt 1.6 or later, so "
+        "I cannot decrypt it. The part will be discarded.");
+    warning_has_been_printed = 1;
   }
 
-  assert (username_len > 0);
-  pea.username = malloc (username_len + 1);
-  if (pea.username == NULL)
-    return (-ENOMEM);
-  BUFFER_READ (pea.username, username_len);
-  pea.username[username_len] = 0;
+  *ret_buffer += ph_length;
+  *ret_buffer_size -= ph_length;
 
-  /* Last but not least, the initialization vector */
-  BUFFER_READ (pea.iv, sizeof (pea.iv));
+  return (0);
+} /* }}} int parse_part_encr_aes256_gcm */
+#endif /* !NETWORK_HAVE_GCM */
 
-  /* Make sure we are at the right position */
-  assert (buffer_offset == (username_len +
-        PART_ENCRYPTION_AES256_SIZE - sizeof (pea.hash)));
+#if HAVE_LIBLZ4
+static int parse_part_compr_lz4 (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_size,
+    int flags, const char *username)
+{
+  static c_complain_t complain_nested = C_COMPLAIN_INIT_STATIC;
 
-  cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
-      pea.username);
-  if (cypher == NULL)
-  {
-    sfree (pea.username);
-    return (-1);
-  }
+  char  *buffer = *ret_buffer;
+  size_t buffer_size = *ret_buffer_size;
+  size_t buffer_offset;
+  size_t part_size;
 
-  payload_len = part_size - (PART_ENCRYPTION_AES256_SIZE + username_len);
-  assert (payload_len > 0);
+  part_compression_lz4_t pcl;
+  cdtime_t t_start;
+  int status;
 
-  /* Decrypt the packet in-place */
-  err = gcry_cipher_decrypt (cypher,
-      buffer    + buffer_offset,
-      part_size - buffer_offset,
-      /* in = */ NULL, /* in len = */ 0);
-  if (err != 0)
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (sizeof (pcl.head.type) + sizeof (pcl.head.length)));
+
+  buffer_offset = 0;
+  BUFFER_READ (&pcl.head.type, sizeof (pcl.head.type));
+  BUFFER_READ (&pcl.head.length, sizeof (pcl.head.length));
+  part_size = ntohs (pcl.head.length);
+
+  if ((part_size <= PART_COMPRESSION_LZ4_SIZE)
+      || (part_size > buffer_size))
   {
-    sfree (pea.username);
-    ERROR ("network plugin: gcry_cipher_decrypt returned: %s",
-        gcry_strerror (err));
+    NOTICE ("network plugin: LZ4 compressed part "
+        "with invalid length received.");
     return (-1);
   }
 
-  /* Read the hash */
-  BUFFER_READ (pea.hash, sizeof (pea.hash));
-
-  /* Make sure we're at the right position - again */
-  assert (buffer_offset == (username_len + PART_ENCRYPTION_AES256_SIZE));
-  assert (buffer_offset == (part_size - payload_len));
+  BUFFER_READ (&pcl.orig_length, sizeof (pcl.orig_length));
+  pcl.orig_length = ntohs (pcl.orig_length);
 
-  /* Check hash sum */
-  memset (hash, 0, sizeof (hash));
-  gcry_md_hash_buffer (GCRY_MD_SHA1, hash,
-      buffer + buffer_offset, payload_len);
-  if (memcmp (hash, pea.hash, sizeof (hash)) != 0)
+  if (!se->data.server.compress || (pcl.orig_length == 0))
   {
-    sfree (pea.username);
-    ERROR ("network plugin: Decryption failed: Checksum mismatch.");
-    return (-1);
+    DEBUG ("network plugin: Ignoring compressed part.");
+  }
+  else if ((flags & PP_COMPRESSED) != 0)
+  {
+    /* A compressed part within a compressed part can only be an attempt to
+     * make us decompress a lot of data from a tiny packet. */
+    c_complain (LOG_NOTICE, &complain_nested,
+        "network plugin: Ignoring nested compressed part.");
   }
+  else
+  {
+    char orig[pcl.orig_length];
 
-  parse_packet (se, buffer + buffer_offset, payload_len,
-      flags | PP_ENCRYPTED, pea.username);
+    t_start = cdtime ();
+    status = LZ4_decompress_safe (buffer + buffer_offset, orig,
+        (int) (part_size - buffer_offset), (int) pcl.orig_length);
+    if (status != (int) pcl.orig_length)
+    {
+      NOTICE ("network plugin: Decompressing LZ4 part failed "
+          "(status %i, expected %"PRIu16" bytes).",
+          status, pcl.orig_length);
+      return (-1);
+    }
 
-  /* XXX: Free pea.username?!? */
+    /* Only the dispatch thread gets here, so no locking is required. */
+    stats_decompress_octets_in += (derive_t) part_size;
+    stats_decompress_octets_out += (derive_t) pcl.orig_length;
+    stats_decompress_time += cdtime () - t_start;
 
-  /* Update return values */
-  *ret_buffer =     buffer     + part_size;
-  *ret_buffer_len = buffer_len - part_size;
+    parse_packet (se, orig, sizeof (orig), flags | PP_COMPRESSED, username);
+  }
 
-  sfree (pea.username);
+  *ret_buffer = buffer + part_size;
+  *ret_buffer_size = buffer_size - part_size;
 
   return (0);
-} /* }}} int parse_part_encr_aes256 */
-/* #endif HAVE_LIBGCRYPT */
+} /* }}} int parse_part_compr_lz4 */
+/* #endif HAVE_LIBLZ4 */
 
-#else /* if !HAVE_LIBGCRYPT */
-static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
-    void **ret_buffer, size_t *ret_buffer_size, int flags)
+#else /* if !HAVE_LIBLZ4 */
+static int parse_part_compr_lz4 (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_size,
+    int flags, const char *username)
 {
   static int warning_has_been_printed = 0;
 
@@ -1333,19 +1662,19 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   BUFFER_READ (&ph.length, sizeof (ph.length));
   ph_length = ntohs (ph.length);
 
-  if ((ph_length <= PART_ENCRYPTION_AES256_SIZE)
+  if ((ph_length <= PART_COMPRESSION_LZ4_SIZE)
       || (ph_length > buffer_size))
   {
-    ERROR ("network plugin: AES-256 encrypted part "
+    NOTICE ("network plugin: LZ4 compressed part "
         "with invalid length received.");
     return (-1);
   }
 
   if (warning_has_been_printed == 0)
   {
-    WARNING ("network plugin: Received encrypted packet, but the network "
-        "plugin was not linked with libgcrypt, so I cannot "
-        "decrypt it. The part will be discarded.");
+    WARNING ("network plugin: Received compressed packet, but the network "
+        "plugin was not linked with liblz4, so I cannot "
+        "decompress it. The part will be discarded.");
     warning_has_been_printed = 1;
   }
 
@@ -1353,8 +1682,8 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
   *ret_buffer_size -= ph_length;
 
   return (0);
-} /* }}} int parse_part_encr_aes256 */
-#endif /* !HAVE_LIBGCRYPT */
+} /* }}} int parse_part_compr_lz4 */
+#endif /* !HAVE_LIBLZ4 */
 
 #undef BUFFER_READ
 
@@ -1412,6 +1741,18 @@ static int parse_packet (sockent_t *se, /* {{{ */
 				break;
 			}
 		}
+		else if (pkg_type == TYPE_ENCR_AES256_GCM)
+		{
+			status = parse_part_encr_aes256_gcm (se,
+					&buffer, &buffer_size, flags);
+			if (status != 0)
+			{
+				ERROR ("network plugin: Decrypting AES256-GCM "
+						"part failed "
+						"with status %i.", status);
+				break;
+			}
+		}
 #if HAVE_LIBGCRYPT
 		else if ((se->data.server.security_level == SECURITY_LEVEL_ENCRYPT)
 				&& (packet_was_encrypted == 0))
@@ -1423,6 +1764,7 @@ static int parse_packet (sockent_t *se, /* {{{ */
 				printed_ignore_warning = 1;
 			}
 			buffer = ((char *) buffer) + pkg_length;
+			buffer_size -= (size_t) pkg_length;
 			continue;
 		}
 #endif /* HAVE_LIBGCRYPT */
@@ -1450,9 +1792,17 @@ static int parse_packet (sockent_t *se, /* {{{ */
 				printed_ignore_warning = 1;
 			}
 			buffer = ((char *) buffer) + pkg_length;
+			buffer_size -= (size_t) pkg_length;
 			continue;
 		}
 #endif /* HAVE_LIBGCRYPT */
+		else if (pkg_type == TYPE_COMPR_LZ4)
+		{
+			status = parse_part_compr_lz4 (se,
+					&buffer, &buffer_size, flags, username);
+			if (status != 0)
+				break;
+		}
 		else if (pkg_type == TYPE_VALUES)
 		{
 			status = parse_part_values (&buffer, &buffer_size,
@@ -1591,6 +1941,7 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			DEBUG ("network plugin: parse_packet: Unknown part"
 					" type: 0x%04hx", pkg_type);
 			buffer = ((char *) buffer) + pkg_length;
+			buffer_size -= (size_t) pkg_length;
 		}
 	} /* while (buffer_size > sizeof (part_header_t)) */
 
@@ -1614,6 +1965,12 @@ static void free_sockent_client (struct sockent_client *sec) /* {{{ */
   sfree (sec->password);
   if (sec->cypher != NULL)
     gcry_cipher_close (sec->cypher);
+  if (sec->hmac != NULL)
+    gcry_md_close (sec->hmac);
+# if NETWORK_HAVE_GCM
+  if (sec->gcm != NULL)
+    gcry_cipher_close (sec->gcm);
+# endif
 #endif
 } /* }}} void free_sockent_client */
 
@@ -1634,8 +1991,6 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -2006,8 +2361,8 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
 #endif
+		se->data.server.compress = 1;
 	}
 	else
 	{
@@ -2017,8 +2372,14 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.client.security_level = SECURITY_LEVEL_NONE;
 		se->data.client.username = NULL;
 		se->data.client.password = NULL;
+		se->data.client.encryption_mode = ENCRYPTION_MODE_OFB;
 		se->data.client.cypher = NULL;
+		se->data.client.hmac = NULL;
+# if NETWORK_HAVE_GCM
+		se->data.client.gcm = NULL;
+# endif
 #endif
+		se->data.client.compress = 0;
 	}
 
 	return (0);
@@ -2075,7 +2436,8 @@ static int sockent_open (sockent_t *se) /* {{{ */
 		}
 		if (se->data.server.auth_file != NULL)
 		{
-			se->data.server.userdb = fbh_create (se->data.server.auth_file);
+			se->data.server.userdb = fbh_create_data (se->data.server.auth_file,
+					network_user_create, network_user_destroy);
 			if (se->data.server.userdb == NULL)
 			{
 				ERROR ("network plugin: Reading password file "
@@ -2505,13 +2867,16 @@ static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
 	} /* while (42) */
 } /* }}} void networt_send_buffer_plain */
 
-#if HAVE_LIBGCRYPT
 #define BUFFER_ADD(p,s) do { \
   memcpy (buffer + buffer_offset, (p), (s)); \
   buffer_offset += (s); \
 } while (0)
 
-static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
+#if HAVE_LIBGCRYPT
+
+/* The send functions below are called with "send_buffer_lock" held, which
+ * protects the cached cipher and HMAC handles of the client sockets. */
+static void networt_send_buffer_signed (sockent_t *se, /* {{{ */
 		const char *in_buffer, size_t in_buffer_size)
 {
   part_signature_sha256_t ps;
@@ -2520,27 +2885,16 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   size_t username_len;
 
   gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash;
 
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC object failed: %s",
-        gcry_strerror (err));
-    return;
-  }
-
-  err = gcry_md_setkey (hd, se->data.client.password,
-      strlen (se->data.client.password));
-  if (err != 0)
+  if (se->data.client.hmac == NULL)
   {
-    ERROR ("network plugin: gcry_md_setkey failed: %s",
-        gcry_strerror (err));
-    gcry_md_close (hd);
-    return;
+    se->data.client.hmac = network_open_hmac (se->data.client.password);
+    if (se->data.client.hmac == NULL)
+      return;
   }
+  hd = se->data.client.hmac;
+  gcry_md_reset (hd);
 
   username_len = strlen (se->data.client.username);
   if (username_len > (BUFF_SIG_SIZE - PART_SIGNATURE_SHA256_SIZE))
@@ -2567,7 +2921,6 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   if (hash == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
     return;
   }
   memcpy (ps.hash, hash, sizeof (ps.hash));
@@ -2581,9 +2934,6 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
 
   assert (buffer_offset == PART_SIGNATURE_SHA256_SIZE);
 
-  gcry_md_close (hd);
-  hd = NULL;
-
   buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
   networt_send_buffer_plain (se, buffer, buffer_offset);
 } /* }}} void networt_send_buffer_signed */
@@ -2598,7 +2948,6 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   size_t header_size;
   size_t username_len;
   gcry_error_t err;
-  gcry_cipher_hd_t cypher;
 
   /* Initialize the header fields */
   memset (&pea, 0, sizeof (pea));
@@ -2647,13 +2996,21 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == buffer_size);
 
-  cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
-      se->data.client.password);
-  if (cypher == NULL)
+  if (se->data.client.cypher == NULL)
+  {
+    se->data.client.cypher = network_open_cypher (GCRY_CIPHER_MODE_OFB,
+        se->data.client.password_hash,
+        sizeof (se->data.client.password_hash));
+    if (se->data.client.cypher == NULL)
+      return;
+  }
+
+  if (network_reset_cypher (se->data.client.cypher,
+        pea.iv, sizeof (pea.iv)) != 0)
     return;
 
   /* Encrypt the buffer in-place */
-  err = gcry_cipher_encrypt (cypher,
+  err = gcry_cipher_encrypt (se->data.client.cypher,
       buffer      + header_size,
       buffer_size - header_size,
       /* in = */ NULL, /* in len = */ 0);
@@ -2667,25 +3024,195 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   /* Send it out without further modifications */
   networt_send_buffer_plain (se, buffer, buffer_size);
 } /* }}} void networt_send_buffer_encrypted */
-#undef BUFFER_ADD
+
+#if NETWORK_HAVE_GCM
+static void networt_send_buffer_encrypted_gcm (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size)
+{
+  part_encryption_aes256_gcm_t peg;
+  char buffer[BUFF_SIG_SIZE + in_buffer_size];
+  size_t buffer_size;
+  size_t buffer_offset;
+  size_t header_size;
+  size_t username_len;
+  gcry_error_t err;
+
+  memset (&peg, 0, sizeof (peg));
+  peg.head.type = htons (TYPE_ENCR_AES256_GCM);
+
+  peg.username = se->data.client.username;
+
+  username_len = strlen (peg.username);
+  if ((PART_ENCRYPTION_AES256_GCM_SIZE + username_len) > BUFF_SIG_SIZE)
+  {
+    ERROR ("network plugin: Username too long: %s", peg.username);
+    return;
+  }
+
+  buffer_size = PART_ENCRYPTION_AES256_GCM_SIZE + username_len
+    + in_buffer_size;
+  header_size = PART_ENCRYPTION_AES256_GCM_SIZE + username_len
+    - sizeof (peg.tag);
+
+  assert (buffer_size <= sizeof (buffer));
+
+  peg.head.length = htons ((uint16_t) buffer_size);
+  peg.username_length = htons ((uint16_t) username_len);
+
+  /* The key only depends on the password and is shared by all clients
+   * using it, including restarted ones, so a per-client counter would
+   * repeat nonces. A random 96 bit nonce per packet keeps the probability
+   * of a collision negligible for up to 2^32 packets per password. */
+  gcry_create_nonce (peg.nonce, sizeof (peg.nonce));
+
+  buffer_offset = 0;
+  BUFFER_ADD (&peg.head.type, sizeof (peg.head.type));
+  BUFFER_ADD (&peg.head.length, sizeof (peg.head.length));
+  BUFFER_ADD (&peg.username_length, sizeof (peg.username_length));
+  BUFFER_ADD (peg.username, username_len);
+  BUFFER_ADD (peg.nonce, sizeof (peg.nonce));
+  assert (buffer_offset == header_size);
+
+  if (se->data.client.gcm == NULL)
+  {
+    unsigned char key[32];
+
+    if (network_derive_gcm_key (key, sizeof (key),
+          se->data.client.password) != 0)
+      return;
+    se->data.client.gcm = network_open_cypher (GCRY_CIPHER_MODE_GCM,
+        key, sizeof (key));
+    memset (key, 0, sizeof (key));
+    if (se->data.client.gcm == NULL)
+      return;
+  }
+
+  if (network_reset_cypher (se->data.client.gcm,
+        peg.nonce, sizeof (peg.nonce)) != 0)
+    return;
+
+  /* Encrypt directly into the packet and append the tag. */
+  err = gcry_cipher_authenticate (se->data.client.gcm, buffer, header_size);
+  if (err == 0)
+    err = gcry_cipher_encrypt (se->data.client.gcm,
+        buffer + header_size, in_buffer_size,
+        in_buffer, in_buffer_size);
+  if (err == 0)
+    err = gcry_cipher_gettag (se->data.client.gcm,
+        buffer + header_size + in_buffer_size, sizeof (peg.tag));
+  if (err != 0)
+  {
+    ERROR ("network plugin: Encrypting with AES-256-GCM failed: %s",
+        gcry_strerror (err));
+    return;
+  }
+
+  networt_send_buffer_plain (se, buffer, buffer_size);
+} /* }}} void networt_send_buffer_encrypted_gcm */
+#endif /* NETWORK_HAVE_GCM */
 #endif /* HAVE_LIBGCRYPT */
 
+#if HAVE_LIBLZ4
+/* Wraps all parts in "in_buffer" into one LZ4 compressed part. Returns the
+ * size of the compressed part or zero if compressing doesn't save space. */
+static size_t network_compress_buffer (char *buffer, /* {{{ */
+    size_t buffer_size, const char *in_buffer, size_t in_buffer_size)
+{
+  part_compression_lz4_t pcl;
+  size_t buffer_offset;
+  cdtime_t t_start;
+  int status;
+
+  if (buffer_size <= PART_COMPRESSION_LZ4_SIZE)
+    return (0);
+
+  t_start = cdtime ();
+  status = LZ4_compress_default (in_buffer,
+      buffer + PART_COMPRESSION_LZ4_SIZE,
+      (int) in_buffer_size,
+      (int) (buffer_size - PART_COMPRESSION_LZ4_SIZE));
+
+  pthread_mutex_lock (&stats_lock);
+  stats_compress_time += cdtime () - t_start;
+  pthread_mutex_unlock (&stats_lock);
+
+  /* Zero means the data did not fit into the buffer, i.e. it's not
+   * compressible enough. */
+  if (status <= 0)
+    return (0);
+
+  memset (&pcl, 0, sizeof (pcl));
+  pcl.head.type = htons (TYPE_COMPR_LZ4);
+  pcl.head.length = htons ((uint16_t) (PART_COMPRESSION_LZ4_SIZE + status));
+  pcl.orig_length = htons ((uint16_t) in_buffer_size);
+
+  buffer_offset = 0;
+  BUFFER_ADD (&pcl.head.type, sizeof (pcl.head.type));
+  BUFFER_ADD (&pcl.head.length, sizeof (pcl.head.length));
+  BUFFER_ADD (&pcl.orig_length, sizeof (pcl.orig_length));
+  assert (buffer_offset == PART_COMPRESSION_LZ4_SIZE);
+
+  pthread_mutex_lock (&stats_lock);
+  stats_compress_octets_in += (derive_t) in_buffer_size;
+  stats_compress_octets_out += (derive_t) (buffer_offset + status);
+  pthread_mutex_unlock (&stats_lock);
+
+  return (buffer_offset + (size_t) status);
+} /* }}} size_t network_compress_buffer */
+#endif /* HAVE_LIBLZ4 */
+#undef BUFFER_ADD
+
 static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
 {
   sockent_t *se;
+#if HAVE_LIBLZ4
+  /* The compressed part must be smaller than the original to be of any use,
+   * so a buffer of the same size is sufficient. */
+  char compr_buffer[buffer_len];
+  size_t compr_buffer_len = 0;
+  _Bool compr_done = 0;
+#endif
 
   DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
 
   for (se = sending_sockets; se != NULL; se = se->next)
   {
+    char *payload = buffer;
+    size_t payload_len = buffer_len;
+
+#if HAVE_LIBLZ4
+    if (se->data.client.compress)
+    {
+      /* Compress at most once per packet, no matter how many servers. */
+      if (!compr_done)
+      {
+        compr_buffer_len = network_compress_buffer (compr_buffer,
+            sizeof (compr_buffer), buffer, buffer_len);
+        compr_done = 1;
+      }
+
+      if (compr_buffer_len > 0)
+      {
+        payload = compr_buffer;
+        payload_len = compr_buffer_len;
+      }
+    }
+#endif /* HAVE_LIBLZ4 */
+
 #if HAVE_LIBGCRYPT
+# if NETWORK_HAVE_GCM
+    if ((se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+        && (se->data.client.encryption_mode == ENCRYPTION_MODE_GCM))
+      networt_send_buffer_encrypted_gcm (se, payload, payload_len);
+    else
+# endif
     if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      networt_send_buffer_encrypted (se, buffer, buffer_len);
+      networt_send_buffer_encrypted (se, payload, payload_len);
     else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      networt_send_buffer_signed (se, buffer, buffer_len);
+      networt_send_buffer_signed (se, payload, payload_len);
     else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
 #endif /* HAVE_LIBGCRYPT */
-      networt_send_buffer_plain (se, buffer, buffer_len);
+      networt_send_buffer_plain (se, payload, payload_len);
   } /* for (sending_sockets) */
 } /* }}} void network_send_buffer */
 
@@ -2695,13 +3222,9 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 {
 	char *buffer_orig = buffer;
 
-	if (strcmp (vl_def->host, vl->host) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_HOST,
-					vl->host, strlen (vl->host)) != 0)
-			return (-1);
-		sstrncpy (vl_def->host, vl->host, sizeof (vl_def->host));
-	}
+	if (write_part_ident (&buffer, &buffer_size, TYPE_HOST,
+				vl->host, vl_def->host, sizeof (vl_def->host)) != 0)
+		return (-1);
 
 	if (vl_def->time != vl->time)
 	{
@@ -2719,39 +3242,24 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 		vl_def->interval = vl->interval;
 	}
 
-	if (strcmp (vl_def->plugin, vl->plugin) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN,
-					vl->plugin, strlen (vl->plugin)) != 0)
-			return (-1);
-		sstrncpy (vl_def->plugin, vl->plugin, sizeof (vl_def->plugin));
-	}
+	if (write_part_ident (&buffer, &buffer_size, TYPE_PLUGIN,
+				vl->plugin, vl_def->plugin,
+				sizeof (vl_def->plugin)) != 0)
+		return (-1);
 
-	if (strcmp (vl_def->plugin_instance, vl->plugin_instance) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN_INSTANCE,
-					vl->plugin_instance,
-					strlen (vl->plugin_instance)) != 0)
-			return (-1);
-		sstrncpy (vl_def->plugin_instance, vl->plugin_instance, sizeof (vl_def->plugin_instance));
-	}
+	if (write_part_ident (&buffer, &buffer_size, TYPE_PLUGIN_INSTANCE,
+				vl->plugin_instance, vl_def->plugin_instance,
+				sizeof (vl_def->plugin_instance)) != 0)
+		return (-1);
 
-	if (strcmp (vl_def->type, vl->type) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE,
-					vl->type, strlen (vl->type)) != 0)
-			return (-1);
-		sstrncpy (vl_def->type, ds->type, sizeof (vl_def->type));
-	}
+	if (write_part_ident (&buffer, &buffer_size, TYPE_TYPE,
+				vl->type, vl_def->type, sizeof (vl_def->type)) != 0)
+		return (-1);
 
-	if (strcmp (vl_def->type_instance, vl->type_instance) != 0)
-	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE_INSTANCE,
-					vl->type_instance,
-					strlen (vl->type_instance)) != 0)
-			return (-1);
-		sstrncpy (vl_def->type_instance, vl->type_instance, sizeof (vl_def->type_instance));
-	}
+	if (write_part_ident (&buffer, &buffer_size, TYPE_TYPE_INSTANCE,
+				vl->type_instance, vl_def->type_instance,
+				sizeof (vl_def->type_instance)) != 0)
+		return (-1);
 
 	if (write_part_values (&buffer, &buffer_size, ds, vl) != 0)
 		return (-1);
@@ -2990,6 +3498,40 @@ static int network_config_set_security_level (oconfig_item_t *ci, /* {{{ */
 
   return (0);
 } /* }}} int network_config_set_security_level */
+
+static int network_config_set_encryption_mode (oconfig_item_t *ci, /* {{{ */
+    int *retval)
+{
+  char *str;
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("network plugin: The `EncryptionMode' config option needs "
+        "exactly one string argument.");
+    return (-1);
+  }
+
+  str = ci->values[0].value.string;
+  if (strcasecmp ("OFB", str) == 0)
+    *retval = ENCRYPTION_MODE_OFB;
+  else if (strcasecmp ("GCM", str) == 0)
+  {
+#if NETWORK_HAVE_GCM
+    *retval = ENCRYPTION_MODE_GCM;
+#else
+    WARNING ("network plugin: The GCM encryption mode requires libgcrypt 1.6 "
+        "or later. Falling back to OFB.");
+    *retval = ENCRYPTION_MODE_OFB;
+#endif
+  }
+  else
+  {
+    WARNING ("network plugin: Unknown encryption mode: %s.", str);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_encryption_mode */
 #endif /* HAVE_LIBGCRYPT */
 
 static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
@@ -3034,6 +3576,8 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child,
           &se->interface);
+    else if (strcasecmp ("Compress", child->key) == 0)
+      network_config_set_boolean (child, &se->data.server.compress);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3111,11 +3655,16 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     else if (strcasecmp ("SecurityLevel", child->key) == 0)
       network_config_set_security_level (child,
           &se->data.client.security_level);
+    else if (strcasecmp ("EncryptionMode", child->key) == 0)
+      network_config_set_encryption_mode (child,
+          &se->data.client.encryption_mode);
     else
 #endif /* HAVE_LIBGCRYPT */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child,
           &se->interface);
+    else if (strcasecmp ("Compress", child->key) == 0)
+      network_config_set_boolean (child, &se->data.client.compress);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3123,6 +3672,16 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     }
   }
 
+#if !HAVE_LIBLZ4
+  if (se->data.client.compress)
+  {
+    WARNING ("network plugin: Compression was requested for server \"%s\", "
+        "but the network plugin was not linked with liblz4. "
+        "Data will be sent uncompressed.", se->node);
+    se->data.client.compress = 0;
+  }
+#endif
+
 #if HAVE_LIBGCRYPT
   if ((se->data.client.security_level > SECURITY_LEVEL_NONE)
       && ((se->data.client.username == NULL)
@@ -3254,7 +3813,10 @@ static int network_notification (const notification_t *n,
   if (status != 0)
     return (-1);
 
+  /* The lock protects the client sockets' cipher handles. */
+  pthread_mutex_lock (&send_buffer_lock);
   network_send_buffer (buffer, sizeof (buffer) - buffer_free);
+  pthread_mutex_unlock (&send_buffer_lock);
 
   return (0);
 } /* int network_notification */
@@ -3312,6 +3874,14 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_values_sent;
 	derive_t copy_values_not_sent;
 	derive_t copy_receive_list_length;
+#if HAVE_LIBLZ4
+	derive_t copy_compress_octets_in;
+	derive_t copy_compress_octets_out;
+	cdtime_t copy_compress_time;
+	derive_t copy_decompress_octets_in;
+	derive_t copy_decompress_octets_out;
+	cdtime_t copy_decompress_time;
+#endif
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
 
@@ -3324,6 +3894,16 @@ static int network_stats_read (void) /* {{{ */
 	copy_values_sent = stats_values_sent;
 	copy_values_not_sent = stats_values_not_sent;
 	copy_receive_list_length = receive_list_length;
+#if HAVE_LIBLZ4
+	pthread_mutex_lock (&stats_lock);
+	copy_compress_octets_in = stats_compress_octets_in;
+	copy_compress_octets_out = stats_compress_octets_out;
+	copy_compress_time = stats_compress_time;
+	pthread_mutex_unlock (&stats_lock);
+	copy_decompress_octets_in = stats_decompress_octets_in;
+	copy_decompress_octets_out = stats_decompress_octets_out;
+	copy_decompress_time = stats_decompress_time;
+#endif
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3368,6 +3948,39 @@ static int network_stats_read (void) /* {{{ */
 			sizeof (vl.type_instance));
 	plugin_dispatch_values (&vl);
 
+#if HAVE_LIBLZ4
+	/* Compression: Octets before / after and time spent, so that the
+	 * compression ratio and the CPU cost can be graphed. */
+	sstrncpy (vl.type, "total_bytes", sizeof (vl.type));
+
+	vl.values[0].derive = copy_compress_octets_in;
+	sstrncpy (vl.type_instance, "compress-in", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = copy_compress_octets_out;
+	sstrncpy (vl.type_instance, "compress-out", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = copy_decompress_octets_in;
+	sstrncpy (vl.type_instance, "decompress-in", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = copy_decompress_octets_out;
+	sstrncpy (vl.type_instance, "decompress-out",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type, "total_time_in_ms", sizeof (vl.type));
+
+	vl.values[0].derive = (derive_t) CDTIME_T_TO_MS (copy_compress_time);
+	sstrncpy (vl.type_instance, "compress", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = (derive_t) CDTIME_T_TO_MS (copy_decompress_time);
+	sstrncpy (vl.type_instance, "decompress", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+#endif /* HAVE_LIBLZ4 */
+
 	/* Receive queue length */
 	vl.values[0].gauge = (gauge_t) copy_receive_list_length;
 	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
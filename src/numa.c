@@ -27,6 +27,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfile.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -58,46 +59,42 @@ static void numa_dispatch_value (int node, /* {{{ */
 static int numa_read_node (int node) /* {{{ */
 {
   char path[PATH_MAX];
-  FILE *fh;
-  char buffer[128];
-  int status;
+  procfile_t *pf;
+  procfile_entry_t const *entries;
+  size_t entries_num;
+  size_t i;
   int success;
 
   ssnprintf (path, sizeof (path), NUMA_ROOT_DIR "/node%i/numastat", node);
 
-  fh = fopen (path, "r");
-  if (fh == NULL)
+  pf = procfile_get (path);
+  if (pf == NULL)
   {
     char errbuf[1024];
-    ERROR ("numa plugin: Reading node %i failed: open(%s): %s",
+    ERROR ("numa plugin: Reading node %i failed: %s: %s",
         node, path, sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   success = 0;
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  entries_num = procfile_entries (pf, &entries);
+  for (i = 0; i < entries_num; i++)
   {
-    char *fields[4];
     value_t v;
 
-    status = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
-    if (status != 2)
+    if (!entries[i].numeric)
     {
-      WARNING ("numa plugin: Ignoring line with unexpected "
-          "number of fields (node %i).", node);
+      WARNING ("numa plugin: Ignoring line with non-numeric "
+          "value (node %i).", node);
       continue;
     }
 
-    v.derive = 0;
-    status = parse_value (fields[1], &v, DS_TYPE_DERIVE);
-    if (status != 0)
-      continue;
-
-    numa_dispatch_value (node, fields[0], v);
+    v.derive = entries[i].derive;
+    numa_dispatch_value (node, entries[i].key, v);
     success++;
   }
 
-  fclose (fh);
+  procfile_release (pf);
   return (success ? 0 : -1);
 } /* }}} int numa_read_node */
 
@@ -115,9 +115,13 @@ static XS (Collectd_call_by_name);
  */
 
 typedef struct c_ithread_s {
-	/* the thread's Perl interpreter */
+	/* the Perl interpreter */
 	PerlInterpreter *interp;
 
+	/* number of (nested) c_ithread_acquire() calls of the thread currently
+	 * using the interpreter; zero if the interpreter is available */
+	int depth;
+
 	/* double linked list of threads */
 	struct c_ithread_s *prev;
 	struct c_ithread_s *next;
@@ -127,14 +131,23 @@ typedef struct {
 	c_ithread_t *head;
 	c_ithread_t *tail;
 
-#if COLLECT_DEBUG
-	/* some usage stats */
+	/* number of interpreters, including the base interpreter */
 	int number_of_threads;
-#endif /* COLLECT_DEBUG */
+
+	/* set by perl_init(); afterwards, the base interpreter is only used to
+	 * clone new interpreters */
+	_Bool started;
 
 	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
 } c_ithread_list_t;
 
+/* value list queued for the write thread */
+typedef struct c_write_s {
+	value_list_t vl;
+	struct c_write_s *next;
+} c_write_t;
+
 /* name / user_data for Perl matches / targets */
 typedef struct {
 	char *name;
@@ -162,9 +175,27 @@ extern char **environ;
  * point to the "base" thread */
 static c_ithread_list_t *perl_threads = NULL;
 
-/* the key used to store each pthread's ithread */
+/* the key used to store the ithread currently used by each pthread */
 static pthread_key_t perl_thr_key;
 
+/* maximum number of interpreters cloned from the base interpreter */
+static int perl_interpreters = 4;
+
+/* value lists are passed to the Perl write callbacks by a separate thread,
+ * in batches */
+#define WRITE_QUEUE_LIMIT 1024
+
+static c_write_t *write_queue_head = NULL;
+static c_write_t *write_queue_tail = NULL;
+static int        write_queue_length = 0;
+static _Bool      write_busy = 0;
+
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  write_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       write_thread;
+static _Bool           write_thread_running = 0;
+static _Bool           write_thread_loop = 0;
+
 static int    perl_argc = 0;
 static char **perl_argv = NULL;
 
@@ -1055,17 +1086,27 @@ static int pplugin_call_all (pTHX_ int type, ...)
 		data_set_t   *ds;
 		value_list_t *vl;
 
-		AV *pds = newAV ();
+		AV *pds;
 		HV *pvl = newHV ();
 
-		ds = va_arg (ap, data_set_t *);
-		vl = va_arg (ap, value_list_t *);
+		ds  = va_arg (ap, data_set_t *);
+		pds = va_arg (ap, AV *);
+		vl  = va_arg (ap, value_list_t *);
 
-		if (-1 == data_set2av (aTHX_ ds, pds)) {
-			av_clear (pds);
-			av_undef (pds);
-			pds = (AV *)&PL_sv_undef;
-			ret = -1;
+		/* The data set may have been converted already, e.g. for the
+		 * previous value list of a batch. */
+		if (NULL != pds) {
+			SvREFCNT_inc_simple_void_NN ((SV *)pds);
+		}
+		else {
+			pds = newAV ();
+
+			if (-1 == data_set2av (aTHX_ ds, pds)) {
+				av_clear (pds);
+				av_undef (pds);
+				pds = (AV *)&PL_sv_undef;
+				ret = -1;
+			}
 		}
 
 		if (-1 == value_list2hv (aTHX_ vl, ds, pvl)) {
@@ -1166,9 +1207,9 @@ static void c_ithread_destroy (c_ithread_t *ithread)
 
 #if COLLECT_DEBUG
 	sv_report_used ();
+#endif /* COLLECT_DEBUG */
 
 	--perl_threads->number_of_threads;
-#endif /* COLLECT_DEBUG */
 
 	perl_destruct (aTHX);
 	perl_free (aTHX);
@@ -1187,30 +1228,6 @@ static void c_ithread_destroy (c_ithread_t *ithread)
 	return;
 } /* static void c_ithread_destroy (c_ithread_t *) */
 
-static void c_ithread_destructor (void *arg)
-{
-	c_ithread_t *ithread = (c_ithread_t *)arg;
-	c_ithread_t *t = NULL;
-
-	if (NULL == perl_threads)
-		return;
-
-	pthread_mutex_lock (&perl_threads->mutex);
-
-	for (t = perl_threads->head; NULL != t; t = t->next)
-		if (t == ithread)
-			break;
-
-	/* the ithread no longer exists */
-	if (NULL == t)
-		return;
-
-	c_ithread_destroy (ithread);
-
-	pthread_mutex_unlock (&perl_threads->mutex);
-	return;
-} /* static void c_ithread_destructor (void *) */
-
 /* must be called with perl_threads->mutex locked */
 static c_ithread_t *c_ithread_create (PerlInterpreter *base)
 {
@@ -1234,9 +1251,7 @@ static c_ithread_t *c_ithread_create (PerlInterpreter *base)
 		PL_endav = Nullav;
 	}
 
-#if COLLECT_DEBUG
 	++perl_threads->number_of_threads;
-#endif /* COLLECT_DEBUG */
 
 	t->next = NULL;
 
@@ -1250,10 +1265,281 @@ static c_ithread_t *c_ithread_create (PerlInterpreter *base)
 	}
 
 	perl_threads->tail = t;
+	return t;
+} /* static c_ithread_t *c_ithread_create (PerlInterpreter *) */
+
+/*
+ * Returns an interpreter for the exclusive use by the calling thread. The
+ * interpreters are shared by all threads: at most "perl_interpreters"
+ * interpreters are cloned from the base interpreter and the calling thread
+ * blocks until one of them is available. If the thread is already using an
+ * interpreter, e.g. because a Perl read callback dispatched values which are
+ * handled by a Perl match, that interpreter is returned again.
+ *
+ * Before perl_init() has been called, i.e. while reading the configuration
+ * and running the init callbacks of other plugins, the base interpreter is
+ * used.
+ */
+static c_ithread_t *c_ithread_acquire (void)
+{
+	c_ithread_t *t = NULL;
+
+	assert (NULL != perl_threads);
+
+	pthread_mutex_lock (&perl_threads->mutex);
+
+	t = (c_ithread_t *)pthread_getspecific (perl_thr_key);
+	if (NULL != t) {
+		++t->depth;
+		pthread_mutex_unlock (&perl_threads->mutex);
+		return t;
+	}
+
+	while (42) {
+		if (! perl_threads->started) {
+			if (0 == perl_threads->head->depth)
+				t = perl_threads->head;
+		}
+		else {
+			for (t = perl_threads->head->next; NULL != t; t = t->next)
+				if (0 == t->depth)
+					break;
+
+			/* Do not clone the base interpreter while it is being used
+			 * by another thread. See
+			 * https://github.com/collectd/collectd/issues/9 for details. */
+			if ((NULL == t) && (0 == perl_threads->head->depth)
+					&& (perl_threads->number_of_threads <= perl_interpreters))
+				t = c_ithread_create (perl_threads->head->interp);
+		}
+
+		if (NULL != t)
+			break;
 
+		pthread_cond_wait (&perl_threads->cond, &perl_threads->mutex);
+	}
+
+	t->depth = 1;
 	pthread_setspecific (perl_thr_key, (const void *)t);
+
+	pthread_mutex_unlock (&perl_threads->mutex);
+
+	PERL_SET_CONTEXT (t->interp);
 	return t;
-} /* static c_ithread_t *c_ithread_create (PerlInterpreter *) */
+} /* static c_ithread_t *c_ithread_acquire (void) */
+
+static void c_ithread_release (c_ithread_t *t)
+{
+	pthread_mutex_lock (&perl_threads->mutex);
+
+	assert (0 < t->depth);
+	--t->depth;
+
+	if (0 == t->depth) {
+		pthread_setspecific (perl_thr_key, NULL);
+		pthread_cond_broadcast (&perl_threads->cond);
+	}
+
+	pthread_mutex_unlock (&perl_threads->mutex);
+	return;
+} /* static void c_ithread_release (c_ithread_t *) */
+
+/*
+ * Write queue.
+ *
+ * Value lists are copied into a queue and passed to the Perl write callbacks
+ * by a separate thread. This way, the write threads of the daemon do not
+ * need an interpreter each. All queued value lists are handled as a batch
+ * using a single interpreter and the data set of consecutive value lists of
+ * the same type is converted only once.
+ */
+
+static void c_write_free (c_write_t *w)
+{
+	while (NULL != w) {
+		c_write_t *next = w->next;
+
+		sfree (w->vl.values);
+		sfree (w);
+
+		w = next;
+	}
+	return;
+} /* static void c_write_free (c_write_t *) */
+
+static int c_write_batch (pTHX_ c_write_t *batch)
+{
+	const data_set_t *ds = NULL;
+	AV *pds = NULL;
+
+	c_write_t *w;
+	int ret = 0;
+
+	for (w = batch; NULL != w; w = w->next) {
+		if ((NULL == ds) || (0 != strcmp (ds->type, w->vl.type))) {
+			if (NULL != pds)
+				SvREFCNT_dec ((SV *)pds);
+			pds = NULL;
+
+			ds = plugin_get_ds (w->vl.type);
+			if (NULL == ds) {
+				log_err ("c_write_batch: Unknown type \"%s\".", w->vl.type);
+				ret = -1;
+				continue;
+			}
+
+			pds = newAV ();
+			if (-1 == data_set2av (aTHX_ (data_set_t *)ds, pds)) {
+				SvREFCNT_dec ((SV *)pds);
+				pds = NULL;
+			}
+		}
+
+		if (0 != pplugin_call_all (aTHX_ PLUGIN_WRITE, ds, pds, &w->vl))
+			ret = -1;
+	}
+
+	if (NULL != pds)
+		SvREFCNT_dec ((SV *)pds);
+	return ret;
+} /* static int c_write_batch (c_write_t *) */
+
+static void *c_write_thread (void __attribute__((unused)) *arg)
+{
+	pthread_mutex_lock (&write_lock);
+
+	while (write_thread_loop || (NULL != write_queue_head)) {
+		c_write_t   *batch;
+		c_ithread_t *t;
+
+		if (NULL == write_queue_head) {
+			pthread_cond_wait (&write_cond, &write_lock);
+			continue;
+		}
+
+		batch = write_queue_head;
+		write_queue_head = NULL;
+		write_queue_tail = NULL;
+		write_queue_length = 0;
+		write_busy = 1;
+
+		/* wake up threads waiting for space in the queue */
+		pthread_cond_broadcast (&write_cond);
+		pthread_mutex_unlock (&write_lock);
+
+		t = c_ithread_acquire ();
+		c_write_batch (t->interp, batch);
+		c_ithread_release (t);
+
+		c_write_free (batch);
+
+		pthread_mutex_lock (&write_lock);
+		write_busy = 0;
+
+		/* wake up threads waiting in perl_flush() */
+		pthread_cond_broadcast (&write_cond);
+	}
+
+	pthread_mutex_unlock (&write_lock);
+	return (NULL);
+} /* static void *c_write_thread (void *) */
+
+/* Returns non-zero if the value list has been queued. */
+static int c_write_enqueue (const value_list_t *vl)
+{
+	c_write_t *w;
+
+	w = (c_write_t *)smalloc (sizeof (*w));
+	memcpy (&w->vl, vl, sizeof (w->vl));
+	w->vl.values = (value_t *)smalloc (vl->values_len * sizeof (value_t));
+	memcpy (w->vl.values, vl->values, vl->values_len * sizeof (value_t));
+	w->vl.meta = NULL;
+	w->next = NULL;
+
+	pthread_mutex_lock (&write_lock);
+
+	while (write_thread_loop && (WRITE_QUEUE_LIMIT <= write_queue_length))
+		pthread_cond_wait (&write_cond, &write_lock);
+
+	if (! write_thread_loop) {
+		pthread_mutex_unlock (&write_lock);
+		c_write_free (w);
+		return 0;
+	}
+
+	if (NULL == write_queue_tail)
+		write_queue_head = w;
+	else
+		write_queue_tail->next = w;
+	write_queue_tail = w;
+	++write_queue_length;
+
+	pthread_cond_broadcast (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+	return 1;
+} /* static int c_write_enqueue (const value_list_t *) */
+
+static int c_write_start (void)
+{
+	int status;
+
+	pthread_mutex_lock (&write_lock);
+
+	if (write_thread_running) {
+		pthread_mutex_unlock (&write_lock);
+		return 0;
+	}
+
+	write_thread_loop = 1;
+	status = pthread_create (&write_thread, /* attr = */ NULL,
+			c_write_thread, /* arg = */ NULL);
+	if (0 != status) {
+		char errbuf[1024];
+		write_thread_loop = 0;
+		pthread_mutex_unlock (&write_lock);
+		log_err ("Starting the write thread failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return -1;
+	}
+
+	write_thread_running = 1;
+	pthread_mutex_unlock (&write_lock);
+	return 0;
+} /* static int c_write_start (void) */
+
+/* Passes all queued value lists to the write callbacks and stops the write
+ * thread. */
+static void c_write_stop (void)
+{
+	pthread_mutex_lock (&write_lock);
+
+	if (! write_thread_running) {
+		pthread_mutex_unlock (&write_lock);
+		return;
+	}
+
+	write_thread_loop = 0;
+	pthread_cond_broadcast (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	pthread_join (write_thread, /* retval = */ NULL);
+
+	pthread_mutex_lock (&write_lock);
+	write_thread_running = 0;
+	pthread_mutex_unlock (&write_lock);
+	return;
+} /* static void c_write_stop (void) */
+
+/* Blocks until all value lists queued so far have been written. */
+static void c_write_wait (void)
+{
+	pthread_mutex_lock (&write_lock);
+	while (write_thread_running
+			&& ((NULL != write_queue_head) || write_busy))
+		pthread_cond_wait (&write_cond, &write_lock);
+	pthread_mutex_unlock (&write_lock);
+	return;
+} /* static void c_write_wait (void) */
 
 /*
  * Filter chains implementation.
@@ -1402,26 +1688,14 @@ static int fc_create (int type, const oconfig_item_t *ci, void **user_data)
 {
 	pfc_user_data_t *data;
 
+	c_ithread_t *t = NULL;
 	int ret = 0;
 
-	dTHX;
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
-
-	log_debug ("fc_create: c_ithread: interp = %p (active threads: %i)",
-			aTHX, perl_threads->number_of_threads);
-
 	if ((1 != ci->values_num)
 			|| (OCONFIG_TYPE_STRING != ci->values[0].type)) {
 		log_warn ("A \"%s\" block expects a single string argument.",
@@ -1429,12 +1703,20 @@ static int fc_create (int type, const oconfig_item_t *ci, void **user_data)
 		return -1;
 	}
 
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
+
+	log_debug ("fc_create: c_ithread: interp = %p (active threads: %i)",
+			aTHX, perl_threads->number_of_threads);
+
 	data = (pfc_user_data_t *)smalloc (sizeof (*data));
 	data->name      = sstrdup (ci->values[0].value.string);
 	data->user_data = newSV (0);
 
 	ret = fc_call (aTHX_ type, FC_CB_CREATE, data, ci);
 
+	c_ithread_release (t);
+
 	if (0 != ret)
 		PFC_USER_DATA_FREE (data);
 	else
@@ -1446,22 +1728,16 @@ static int fc_destroy (int type, void **user_data)
 {
 	pfc_user_data_t *data = *(pfc_user_data_t **)user_data;
 
+	c_ithread_t *t = NULL;
 	int ret = 0;
 
-	dTHX;
+	dTHXa (NULL);
 
 	if ((NULL == perl_threads) || (NULL == data))
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	log_debug ("fc_destroy: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
@@ -1469,6 +1745,7 @@ static int fc_destroy (int type, void **user_data)
 	ret = fc_call (aTHX_ type, FC_CB_DESTROY, data);
 
 	PFC_USER_DATA_FREE (data);
+	c_ithread_release (t);
 	*user_data = NULL;
 	return ret;
 } /* static int fc_destroy (int, void **) */
@@ -1478,27 +1755,26 @@ static int fc_exec (int type, const data_set_t *ds, const value_list_t *vl,
 {
 	pfc_user_data_t *data = *(pfc_user_data_t **)user_data;
 
-	dTHX;
+	c_ithread_t *t = NULL;
+	int ret = 0;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
 	assert (NULL != data);
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	log_debug ("fc_exec: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
 
-	return fc_call (aTHX_ type, FC_CB_EXEC, data, ds, vl, meta);
+	ret = fc_call (aTHX_ type, FC_CB_EXEC, data, ds, vl, meta);
+
+	c_ithread_release (t);
+	return ret;
 } /* static int fc_exec (int, const data_set_t *, const value_list_t *,
 		notification_meta_t **, void **) */
 
@@ -1909,42 +2185,44 @@ static XS (Collectd_call_by_name)
 
 static int perl_init (void)
 {
-	dTHX;
+	c_ithread_t *t = NULL;
+	int status;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
+	pthread_mutex_lock (&perl_threads->mutex);
+	perl_threads->started = 1;
+	pthread_mutex_unlock (&perl_threads->mutex);
 
-		aTHX = t->interp;
-	}
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	log_debug ("perl_init: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
-	return pplugin_call_all (aTHX_ PLUGIN_INIT);
+	status = pplugin_call_all (aTHX_ PLUGIN_INIT);
+
+	c_ithread_release (t);
+
+	if (0 != c_write_start ())
+		return -1;
+	return status;
 } /* static int perl_init (void) */
 
 static int perl_read (void)
 {
-	dTHX;
+	c_ithread_t *t = NULL;
+	int status;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	/* Assert that we're not running as the base thread. Otherwise, we might
 	 * run into concurrency issues with c_ithread_create(). See
@@ -1953,114 +2231,103 @@ static int perl_read (void)
 
 	log_debug ("perl_read: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
-	return pplugin_call_all (aTHX_ PLUGIN_READ);
+	status = pplugin_call_all (aTHX_ PLUGIN_READ);
+
+	c_ithread_release (t);
+	return status;
 } /* static int perl_read (void) */
 
 static int perl_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
+	c_ithread_t *t = NULL;
 	int status;
-	dTHX;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
+	/* Values dispatched by a Perl callback are written right away using the
+	 * same interpreter. Waiting for the write thread might deadlock if all
+	 * interpreters are in use. */
+	if ((NULL == pthread_getspecific (perl_thr_key))
+			&& c_write_enqueue (vl))
+		return 0;
 
-	/* Lock the base thread if this is not called from one of the read threads
-	 * to avoid race conditions with c_ithread_create(). See
-	 * https://github.com/collectd/collectd/issues/9 for details. */
-	if (aTHX == perl_threads->head->interp)
-		pthread_mutex_lock (&perl_threads->mutex);
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	log_debug ("perl_write: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
-	status = pplugin_call_all (aTHX_ PLUGIN_WRITE, ds, vl);
-
-	if (aTHX == perl_threads->head->interp)
-		pthread_mutex_unlock (&perl_threads->mutex);
+	status = pplugin_call_all (aTHX_ PLUGIN_WRITE, ds, NULL, vl);
 
+	c_ithread_release (t);
 	return status;
 } /* static int perl_write (const data_set_t *, const value_list_t *) */
 
 static void perl_log (int level, const char *msg,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	dTHX;
+	c_ithread_t *t = NULL;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
-
-	/* Lock the base thread if this is not called from one of the read threads
-	 * to avoid race conditions with c_ithread_create(). See
-	 * https://github.com/collectd/collectd/issues/9 for details. */
-	if (aTHX == perl_threads->head->interp)
-		pthread_mutex_lock (&perl_threads->mutex);
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
 	pplugin_call_all (aTHX_ PLUGIN_LOG, level, msg);
 
-	if (aTHX == perl_threads->head->interp)
-		pthread_mutex_unlock (&perl_threads->mutex);
-
+	c_ithread_release (t);
 	return;
 } /* static void perl_log (int, const char *) */
 
 static int perl_notify (const notification_t *notif,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	dTHX;
+	c_ithread_t *t = NULL;
+	int status;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
+	status = pplugin_call_all (aTHX_ PLUGIN_NOTIF, notif);
 
-		aTHX = t->interp;
-	}
-	return pplugin_call_all (aTHX_ PLUGIN_NOTIF, notif);
+	c_ithread_release (t);
+	return status;
 } /* static int perl_notify (const notification_t *) */
 
 static int perl_flush (cdtime_t timeout, const char *identifier,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	dTHX;
+	c_ithread_t *t = NULL;
+	int status;
+
+	dTHXa (NULL);
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
+	/* Flushing a plugin is expected to include all values dispatched before.
+	 * Waiting from a Perl callback might deadlock, see perl_write(). */
+	if (NULL == pthread_getspecific (perl_thr_key))
+		c_write_wait ();
 
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
 
-		aTHX = t->interp;
-	}
-	return pplugin_call_all (aTHX_ PLUGIN_FLUSH, timeout, identifier);
+	status = pplugin_call_all (aTHX_ PLUGIN_FLUSH, timeout, identifier);
+
+	c_ithread_release (t);
+	return status;
 } /* static int perl_flush (const int) */
 
 static int perl_shutdown (void)
@@ -2069,26 +2336,13 @@ static int perl_shutdown (void)
 
 	int ret = 0;
 
-	dTHX;
+	dTHXa (NULL);
 
 	plugin_unregister_complex_config ("perl");
 
 	if (NULL == perl_threads)
 		return 0;
 
-	if (NULL == aTHX) {
-		c_ithread_t *t = NULL;
-
-		pthread_mutex_lock (&perl_threads->mutex);
-		t = c_ithread_create (perl_threads->head->interp);
-		pthread_mutex_unlock (&perl_threads->mutex);
-
-		aTHX = t->interp;
-	}
-
-	log_debug ("perl_shutdown: c_ithread: interp = %p (active threads: %i)",
-			aTHX, perl_threads->number_of_threads);
-
 	plugin_unregister_log ("perl");
 	plugin_unregister_notification ("perl");
 	plugin_unregister_init ("perl");
@@ -2096,9 +2350,26 @@ static int perl_shutdown (void)
 	plugin_unregister_write ("perl");
 	plugin_unregister_flush ("perl");
 
+	c_write_stop ();
+
+	t = c_ithread_acquire ();
+	aTHX = t->interp;
+
+	log_debug ("perl_shutdown: c_ithread: interp = %p (active threads: %i)",
+			aTHX, perl_threads->number_of_threads);
+
 	ret = pplugin_call_all (aTHX_ PLUGIN_SHUTDOWN);
 
+	c_ithread_release (t);
+
 	pthread_mutex_lock (&perl_threads->mutex);
+
+	/* wait for other threads, e.g. running a Perl match, to finish */
+	for (t = perl_threads->head; NULL != t; t = t->next) {
+		while (0 != t->depth)
+			pthread_cond_wait (&perl_threads->cond, &perl_threads->mutex);
+	}
+
 	t = perl_threads->tail;
 
 	while (NULL != t) {
@@ -2113,6 +2384,7 @@ static int perl_shutdown (void)
 
 	pthread_mutex_unlock (&perl_threads->mutex);
 	pthread_mutex_destroy (&perl_threads->mutex);
+	pthread_cond_destroy (&perl_threads->cond);
 
 	sfree (perl_threads);
 
@@ -2239,7 +2511,7 @@ static int init_pi (int argc, char **argv)
 	}
 #endif /* COLLECT_DEBUG */
 
-	if (0 != pthread_key_create (&perl_thr_key, c_ithread_destructor)) {
+	if (0 != pthread_key_create (&perl_thr_key, NULL)) {
 		log_err ("init_pi: pthread_key_create failed");
 
 		/* this must not happen - cowardly giving up if it does */
@@ -2257,6 +2529,7 @@ static int init_pi (int argc, char **argv)
 	memset (perl_threads, 0, sizeof (c_ithread_list_t));
 
 	pthread_mutex_init (&perl_threads->mutex, NULL);
+	pthread_cond_init (&perl_threads->cond, NULL);
 	/* locking the mutex should not be necessary at this point
 	 * but let's just do it for the sake of completeness */
 	pthread_mutex_lock (&perl_threads->mutex);
@@ -2404,6 +2677,31 @@ static int perl_config_enabledebugger (pTHX_ oconfig_item_t *ci)
 	return 0;
 } /* static int perl_config_enabledebugger (oconfig_item_it *) */
 
+/*
+ * Interpreters <Number>
+ */
+static int perl_config_interpreters (pTHX_ oconfig_item_t *ci)
+{
+	int value;
+
+	if ((0 != ci->children_num) || (1 != ci->values_num)
+			|| (OCONFIG_TYPE_NUMBER != ci->values[0].type)) {
+		log_err ("Interpreters expects a single numeric argument.");
+		return 1;
+	}
+
+	value = (int)ci->values[0].value.number;
+	if (1 > value) {
+		log_err ("Interpreters: The number of interpreters must be "
+				"at least one.");
+		return 1;
+	}
+
+	log_debug ("perl_config: Setting the number of interpreters to %i", value);
+	perl_interpreters = value;
+	return 0;
+} /* static int perl_config_interpreters (oconfig_item_it *) */
+
 /*
  * IncludeDir "<Dir>"
  */
@@ -2520,6 +2818,8 @@ static int perl_config (oconfig_item_t *ci)
 			current_status = perl_config_enabledebugger (aTHX_ c);
 		else if (0 == strcasecmp (c->key, "IncludeDir"))
 			current_status = perl_config_includedir (aTHX_ c);
+		else if (0 == strcasecmp (c->key, "Interpreters"))
+			current_status = perl_config_interpreters (aTHX_ c);
 		else if (0 == strcasecmp (c->key, "Plugin"))
 			current_status = perl_config_plugin (aTHX_ c);
 		else
@@ -28,6 +28,7 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_downsample.h"
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_time.h"
@@ -47,6 +48,9 @@ struct callback_func_s
 	void *cf_callback;
 	user_data_t cf_udata;
 	plugin_ctx_t cf_ctx;
+	/* Number of callers using the callback via the write or flush index,
+	 * minus one once it has been destroyed. See callback_index_release(). */
+	int cf_refs;
 };
 typedef struct callback_func_s callback_func_t;
 
@@ -67,9 +71,68 @@ struct read_func_s
 	cdtime_t rf_interval;
 	cdtime_t rf_effective_interval;
 	cdtime_t rf_next_read;
+	/* Only used if `rf_ctx.downsample' is set: The callback is called every
+	 * `rf_sample_interval' and the samples are dispatched at `rf_next_flush'. */
+	cdtime_t rf_sample_interval;
+	cdtime_t rf_next_flush;
 };
 typedef struct read_func_s read_func_t;
 
+#ifndef NOTIFICATION_QUEUE_LIMIT
+# define NOTIFICATION_QUEUE_LIMIT 10000
+#endif
+
+struct notification_queue_entry_s;
+typedef struct notification_queue_entry_s notification_queue_entry_t;
+struct notification_queue_entry_s
+{
+	notification_t n;
+	plugin_ctx_t ctx;
+	/* Identifier used for coalescing, NULL if not coalesced. */
+	char *key;
+	notification_queue_entry_t *next;
+};
+
+struct notification_queue_s
+{
+	char *name;
+	callback_func_t *cf;
+
+	pthread_t thread;
+	_Bool thread_running;
+	_Bool loop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	notification_queue_entry_t *head;
+	notification_queue_entry_t *tail;
+	size_t length;
+	/* Queued entries by identifier. */
+	c_avl_tree_t *pending;
+
+	/* Token bucket implementing `notification_rate_limit'. */
+	double tokens;
+	cdtime_t tokens_time;
+};
+typedef struct notification_queue_s notification_queue_t;
+
+struct flap_state_s
+{
+	int severity;
+	cdtime_t last_change;
+
+	/* Ring buffer with the times of the last severity changes. */
+	cdtime_t *changes;
+	size_t changes_pos;
+	size_t changes_num;
+
+	_Bool flapping;
+	/* Most recent notification, delivered when flapping ends. */
+	notification_t last;
+	_Bool have_last;
+};
+typedef struct flap_state_s flap_state_t;
+
 struct write_queue_s;
 typedef struct write_queue_s write_queue_t;
 struct write_queue_s
@@ -87,6 +150,23 @@ static c_avl_tree_t *plugins_loaded = NULL;
 static llist_t *list_init;
 static llist_t *list_write;
 static llist_t *list_flush;
+
+/* Write and flush callbacks by name, ignoring case, for plugin_write() and
+ * plugin_flush(). Entries are only removed on shutdown, so that handles
+ * returned by plugin_write_handle_get() stay valid; "cf" is NULL while no
+ * callback with that name is registered. Callers hold a reference to "cf"
+ * while calling it, so unregistering a callback that is in use defers its
+ * destruction to the last caller. */
+struct plugin_write_handle_s
+{
+	char *name;
+	callback_func_t *cf;
+};
+typedef struct plugin_write_handle_s callback_index_entry_t;
+
+static c_avl_tree_t *write_index = NULL;
+static c_avl_tree_t *flush_index = NULL;
+static pthread_rwlock_t callback_index_lock = PTHREAD_RWLOCK_INITIALIZER;
 static llist_t *list_missing;
 static llist_t *list_shutdown;
 static llist_t *list_log;
@@ -122,6 +202,43 @@ static _Bool           plugin_ctx_key_initialized = 0;
 static long            write_limit_high = 0;
 static long            write_limit_low = 0;
 
+static llist_t        *notification_queues = NULL;
+static pthread_mutex_t notification_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+static double          notification_rate_limit = 0.0;
+
+static c_avl_tree_t   *flap_tree = NULL;
+static pthread_mutex_t flap_lock = PTHREAD_MUTEX_INITIALIZER;
+static long            notification_flap_threshold = 0;
+static cdtime_t        notification_flap_window = 0;
+
+/* Log messages are formatted into a ring of LOG_RING_SIZE slots by
+ * plugin_log() and passed to the log callbacks by the log thread. */
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 1024
+
+struct log_slot_s
+{
+	/* Position this slot is ready for: `pos' if empty, `pos + 1' if
+	 * filled. */
+	unsigned long seq;
+	int level;
+	plugin_ctx_t ctx;
+	char msg[LOG_MESSAGE_SIZE];
+};
+typedef struct log_slot_s log_slot_t;
+
+static log_slot_t     *log_ring = NULL;
+static unsigned long   log_ring_head = 0;
+static unsigned long   log_ring_tail = 0;
+static unsigned long   log_dropped = 0;
+static unsigned long   log_dropped_total = 0;
+static _Bool           log_thread_running = 0;
+static _Bool           log_thread_loop = 0;
+static int             log_thread_sleeping = 0;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       log_thread;
+
 /*
  * Static functions
  */
@@ -140,12 +257,22 @@ static void destroy_callback (callback_func_t *cf) /* {{{ */
 	if (cf == NULL)
 		return;
 
+	/* Still in use by plugin_write() or plugin_flush(): the last caller
+	 * destroys the callback in callback_index_release(). */
+	if (__sync_sub_and_fetch (&cf->cf_refs, 1) >= 0)
+		return;
+
 	if ((cf->cf_udata.data != NULL) && (cf->cf_udata.free_func != NULL))
 	{
 		cf->cf_udata.free_func (cf->cf_udata.data);
 		cf->cf_udata.data = NULL;
 		cf->cf_udata.free_func = NULL;
 	}
+	if (cf->cf_ctx.downsample != NULL)
+	{
+		downsample_destroy (cf->cf_ctx.downsample);
+		cf->cf_ctx.downsample = NULL;
+	}
 	sfree (cf);
 } /* }}} void destroy_callback */
 
@@ -303,6 +430,136 @@ static int plugin_unregister (llist_t *list, const char *name) /* {{{ */
 	return (0);
 } /* }}} int plugin_unregister */
 
+/* Returns the index entry for `name', creating it if necessary. Must be
+ * called with `callback_index_lock' held for writing. */
+static callback_index_entry_t *callback_index_get (c_avl_tree_t **index, /* {{{ */
+		const char *name)
+{
+	callback_index_entry_t *e;
+
+	if (*index == NULL)
+	{
+		*index = c_avl_create ((void *) strcasecmp);
+		if (*index == NULL)
+			return (NULL);
+	}
+
+	if (c_avl_get (*index, name, (void *) &e) == 0)
+		return (e);
+
+	e = malloc (sizeof (*e));
+	if (e == NULL)
+		return (NULL);
+	memset (e, 0, sizeof (*e));
+
+	e->name = strdup (name);
+	if ((e->name == NULL) || (c_avl_insert (*index, e->name, e) != 0))
+	{
+		sfree (e->name);
+		sfree (e);
+		return (NULL);
+	}
+
+	return (e);
+} /* }}} callback_index_entry_t *callback_index_get */
+
+/* Points the index entry for `name' to the first callback in `list' whose
+ * name matches, ignoring case, just like the linear search did. The callback
+ * named `exclude', if not NULL, is skipped because it is about to be
+ * unregistered. */
+static void callback_index_update (llist_t *list, /* {{{ */
+		c_avl_tree_t **index, const char *name, const char *exclude)
+{
+	callback_index_entry_t *e;
+	llentry_t *le;
+
+	pthread_rwlock_wrlock (&callback_index_lock);
+
+	e = callback_index_get (index, name);
+	if (e == NULL)
+	{
+		pthread_rwlock_unlock (&callback_index_lock);
+		ERROR ("plugin: callback_index_update: Updating the entry "
+				"for `%s' failed.", name);
+		return;
+	}
+
+	e->cf = NULL;
+	for (le = (list != NULL) ? llist_head (list) : NULL;
+			le != NULL; le = le->next)
+	{
+		if ((exclude != NULL) && (strcmp (exclude, le->key) == 0))
+			continue;
+
+		if (strcasecmp (name, le->key) == 0)
+		{
+			e->cf = le->value;
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock (&callback_index_lock);
+} /* }}} void callback_index_update */
+
+/* Frees the index on shutdown, after the write threads have been stopped.
+ * Handles returned by plugin_write_handle_get() are invalid afterwards. */
+static void callback_index_destroy (c_avl_tree_t **index) /* {{{ */
+{
+	char *name;
+	callback_index_entry_t *e;
+
+	if (*index == NULL)
+		return;
+
+	pthread_rwlock_wrlock (&callback_index_lock);
+	while (c_avl_pick (*index, (void *) &name, (void *) &e) == 0)
+	{
+		sfree (e->name);
+		sfree (e);
+	}
+	c_avl_destroy (*index);
+	*index = NULL;
+	pthread_rwlock_unlock (&callback_index_lock);
+} /* }}} void callback_index_destroy */
+
+/* Returns the callback of the index entry `e' with a reference held, so it
+ * is not destroyed while being called. Must be called with
+ * `callback_index_lock' held for reading or writing. */
+static callback_func_t *callback_index_acquire (callback_index_entry_t *e) /* {{{ */
+{
+	callback_func_t *cf = e->cf;
+
+	if (cf != NULL)
+		__sync_fetch_and_add (&cf->cf_refs, 1);
+
+	return (cf);
+} /* }}} callback_func_t *callback_index_acquire */
+
+static callback_func_t *callback_index_lookup (c_avl_tree_t *index, /* {{{ */
+		const char *name)
+{
+	callback_index_entry_t *e;
+	callback_func_t *cf = NULL;
+
+	if (index == NULL)
+		return (NULL);
+
+	pthread_rwlock_rdlock (&callback_index_lock);
+	if (c_avl_get (index, name, (void *) &e) == 0)
+		cf = callback_index_acquire (e);
+	pthread_rwlock_unlock (&callback_index_lock);
+
+	return (cf);
+} /* }}} callback_func_t *callback_index_lookup */
+
+/* Drops the reference taken by callback_index_acquire(). If the callback has
+ * been unregistered meanwhile, it is destroyed now. */
+static void callback_index_release (callback_func_t *cf) /* {{{ */
+{
+	if (__sync_sub_and_fetch (&cf->cf_refs, 1) < 0)
+		destroy_callback (cf);
+} /* }}} void callback_index_release */
+
 /*
  * (Try to) load the shared object `file'. Won't complain if it isn't a shared
  * object, but it will bitch about a shared object not having a
@@ -367,6 +624,22 @@ static int plugin_load_file (char *file, uint32_t flags)
 	return (0);
 }
 
+/* Dispatches the values buffered for a read function with a sample interval.
+ * The values are dispatched with the read function's context, but without the
+ * downsample buffer, so they're not added to it again. */
+static void plugin_read_flush_samples (read_func_t *rf) /* {{{ */
+{
+	plugin_ctx_t ctx;
+	plugin_ctx_t old_ctx;
+
+	ctx = rf->rf_ctx;
+	ctx.downsample = NULL;
+
+	old_ctx = plugin_set_ctx (ctx);
+	downsample_flush (rf->rf_ctx.downsample);
+	plugin_set_ctx (old_ctx);
+} /* }}} void plugin_read_flush_samples */
+
 static void *plugin_read_thread (void __attribute__((unused)) *args)
 {
 	while (read_loop != 0)
@@ -473,6 +746,16 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 
 		plugin_set_ctx (old_ctx);
 
+		if ((rf->rf_ctx.downsample != NULL)
+				&& (cdtime () >= rf->rf_next_flush))
+		{
+			plugin_read_flush_samples (rf);
+
+			rf->rf_next_flush += rf->rf_interval;
+			if (rf->rf_next_flush < cdtime ())
+				rf->rf_next_flush = cdtime () + rf->rf_interval;
+		}
+
 		/* If the function signals failure, we will increase the
 		 * intervals in which it will be called. */
 		if (status != 0)
@@ -489,7 +772,10 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 		else
 		{
 			/* Success: Restore the interval, if it was changed. */
-			rf->rf_effective_interval = rf->rf_interval;
+			if (rf->rf_ctx.downsample != NULL)
+				rf->rf_effective_interval = rf->rf_sample_interval;
+			else
+				rf->rf_effective_interval = rf->rf_interval;
 		}
 
 		/* update the ``next read due'' field */
@@ -651,6 +937,13 @@ static value_list_t *plugin_value_list_clone (value_list_t const *vl_orig) /* {{
 static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 {
 	write_queue_t *q;
+	plugin_ctx_t ctx;
+
+	/* Values dispatched by a read function with a sample interval are
+	 * buffered and dispatched in summarized form later on. */
+	ctx = plugin_get_ctx ();
+	if (ctx.downsample != NULL)
+		return (downsample_add (ctx.downsample, vl));
 
 	q = malloc (sizeof (*q));
 	if (q == NULL)
@@ -667,7 +960,7 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 	/* Store context of caller (read plugin); otherwise, it would not be
 	 * available to the write plugins when actually dispatching the
 	 * value-list later on. */
-	q->ctx = plugin_get_ctx ();
+	q->ctx = ctx;
 
 	pthread_mutex_lock (&write_lock);
 
@@ -690,6 +983,84 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 	return (0);
 } /* }}} int plugin_write_enqueue */
 
+static _Bool check_drop_value (long pending);
+
+/* Like plugin_write_enqueue(), but appends all elements to the queue at
+ * once. Returns the number of value lists which could not be enqueued. */
+static int plugin_write_enqueue_batch (value_list_t const *vl, /* {{{ */
+		size_t vl_num)
+{
+	write_queue_t *head = NULL;
+	write_queue_t *tail = NULL;
+	long length = 0;
+	plugin_ctx_t ctx;
+	int failed = 0;
+	size_t i;
+
+	ctx = plugin_get_ctx ();
+
+	for (i = 0; i < vl_num; i++)
+	{
+		write_queue_t *q;
+
+		/* The value lists of this batch are not in the queue yet, so
+		 * count them in, too. */
+		if (check_drop_value (length))
+			continue;
+
+		if (ctx.downsample != NULL)
+		{
+			if (downsample_add (ctx.downsample, vl + i) != 0)
+				failed++;
+			continue;
+		}
+
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+		{
+			failed++;
+			continue;
+		}
+		q->next = NULL;
+		q->ctx = ctx;
+
+		q->vl = plugin_value_list_clone (vl + i);
+		if (q->vl == NULL)
+		{
+			sfree (q);
+			failed++;
+			continue;
+		}
+
+		if (tail == NULL)
+			head = q;
+		else
+			tail->next = q;
+		tail = q;
+		length++;
+	}
+
+	if (head == NULL)
+		return (failed);
+
+	pthread_mutex_lock (&write_lock);
+
+	if (write_queue_tail == NULL)
+		write_queue_head = head;
+	else
+		write_queue_tail->next = head;
+	write_queue_tail = tail;
+	write_queue_length += length;
+
+	if (length > 1)
+		pthread_cond_broadcast (&write_cond);
+	else
+		pthread_cond_signal (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	return (failed);
+} /* }}} int plugin_write_enqueue_batch */
+
 static value_list_t *plugin_write_dequeue (void) /* {{{ */
 {
 	write_queue_t *q;
@@ -759,72 +1130,918 @@ static void start_write_threads (size_t num) /* {{{ */
 	{
 		int status;
 
-		status = pthread_create (write_threads + write_threads_num,
-				/* attr = */ NULL,
-				plugin_write_thread,
-				/* arg = */ NULL);
-		if (status != 0)
+		status = pthread_create (write_threads + write_threads_num,
+				/* attr = */ NULL,
+				plugin_write_thread,
+				/* arg = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("plugin: start_write_threads: pthread_create failed "
+					"with status %i (%s).", status,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			return;
+		}
+
+		write_threads_num++;
+	} /* for (i) */
+} /* }}} void start_write_threads */
+
+static void stop_write_threads (void) /* {{{ */
+{
+	write_queue_t *q;
+	int i;
+
+	if (write_threads == NULL)
+		return;
+
+	INFO ("collectd: Stopping %zu write threads.", write_threads_num);
+
+	pthread_mutex_lock (&write_lock);
+	write_loop = 0;
+	DEBUG ("plugin: stop_write_threads: Signalling `write_cond'");
+	pthread_cond_broadcast (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	for (i = 0; i < write_threads_num; i++)
+	{
+		if (pthread_join (write_threads[i], NULL) != 0)
+		{
+			ERROR ("plugin: stop_write_threads: pthread_join failed.");
+		}
+		write_threads[i] = (pthread_t) 0;
+	}
+	sfree (write_threads);
+	write_threads_num = 0;
+
+	pthread_mutex_lock (&write_lock);
+	i = 0;
+	for (q = write_queue_head; q != NULL; )
+	{
+		write_queue_t *q1 = q;
+		plugin_value_list_free (q->vl);
+		q = q->next;
+		sfree (q1);
+		i++;
+	}
+	write_queue_head = NULL;
+	write_queue_tail = NULL;
+	write_queue_length = 0;
+	pthread_mutex_unlock (&write_lock);
+
+	if (i > 0)
+	{
+		WARNING ("plugin: %i value list%s left after shutting down "
+				"the write threads.",
+				i, (i == 1) ? " was" : "s were");
+	}
+} /* }}} void stop_write_threads */
+
+/*
+ * Notification queues: Every notification callback gets its own queue and
+ * thread, so that slow notification plugins neither block the thread
+ * dispatching the notification (usually a write thread running the threshold
+ * checks) nor each other.
+ */
+static void notification_meta_reset (notification_t *n) /* {{{ */
+{
+	if (n->meta != NULL)
+		plugin_notification_meta_free (n->meta);
+	n->meta = NULL;
+} /* }}} void notification_meta_reset */
+
+static int notification_copy (notification_t *dst, /* {{{ */
+		notification_t const *src)
+{
+	memcpy (dst, src, sizeof (*dst));
+	dst->meta = NULL;
+	return (plugin_notification_meta_copy (dst, src));
+} /* }}} int notification_copy */
+
+static void notification_queue_entry_free ( /* {{{ */
+		notification_queue_entry_t *e)
+{
+	if (e == NULL)
+		return;
+
+	notification_meta_reset (&e->n);
+	sfree (e->key);
+	sfree (e);
+} /* }}} void notification_queue_entry_free */
+
+/* Returns zero if a notification may be delivered now, according to the
+ * rate limit, or the time to wait otherwise. Must be called with the queue's
+ * lock held. */
+static cdtime_t notification_queue_take_token (notification_queue_t *q) /* {{{ */
+{
+	cdtime_t now;
+	double burst;
+
+	if (notification_rate_limit <= 0.0)
+		return (0);
+
+	now = cdtime ();
+	burst = (notification_rate_limit < 1.0) ? 1.0 : notification_rate_limit;
+
+	q->tokens += notification_rate_limit
+		* CDTIME_T_TO_DOUBLE (now - q->tokens_time);
+	if (q->tokens > burst)
+		q->tokens = burst;
+	q->tokens_time = now;
+
+	if (q->tokens >= 1.0)
+	{
+		q->tokens -= 1.0;
+		return (0);
+	}
+
+	return (DOUBLE_TO_CDTIME_T ((1.0 - q->tokens) / notification_rate_limit));
+} /* }}} cdtime_t notification_queue_take_token */
+
+static void *notification_queue_thread (void *arg) /* {{{ */
+{
+	notification_queue_t *q = arg;
+
+	pthread_mutex_lock (&q->lock);
+	/* Remaining notifications are delivered when shutting down, ignoring
+	 * the rate limit. */
+	while (q->loop || (q->head != NULL))
+	{
+		notification_queue_entry_t *e;
+		plugin_notification_cb callback;
+		plugin_ctx_t old_ctx;
+		cdtime_t wait;
+		int status;
+
+		if (q->head == NULL)
+		{
+			pthread_cond_wait (&q->cond, &q->lock);
+			continue;
+		}
+
+		wait = q->loop ? notification_queue_take_token (q) : 0;
+		if (wait != 0)
+		{
+			struct timespec ts = { 0 };
+
+			CDTIME_T_TO_TIMESPEC (cdtime () + wait, &ts);
+			pthread_cond_timedwait (&q->cond, &q->lock, &ts);
+			continue;
+		}
+
+		e = q->head;
+		q->head = e->next;
+		if (q->head == NULL)
+			q->tail = NULL;
+		q->length--;
+
+		if (e->key != NULL)
+			c_avl_remove (q->pending, e->key, NULL, NULL);
+
+		pthread_mutex_unlock (&q->lock);
+
+		/* Run the callback in the context of the plugin that
+		 * dispatched the notification, as if called directly. */
+		old_ctx = plugin_set_ctx (e->ctx);
+		callback = q->cf->cf_callback;
+		status = (*callback) (&e->n, &q->cf->cf_udata);
+		plugin_set_ctx (old_ctx);
+
+		if (status != 0)
+		{
+			WARNING ("plugin_dispatch_notification: Notification "
+					"callback %s returned %i.",
+					q->name, status);
+		}
+
+		notification_queue_entry_free (e);
+
+		pthread_mutex_lock (&q->lock);
+	}
+	pthread_mutex_unlock (&q->lock);
+
+	return ((void *) 0);
+} /* }}} void *notification_queue_thread */
+
+/* Adds a notification to a queue. If a notification with the same identifier
+ * ("key") and severity is still waiting in the queue, it is replaced by the
+ * new one, so that a storm of updates results in one notification per
+ * identifier and state. A change of severity is always queued separately,
+ * so that e.g. an OKAY doesn't swallow the FAILURE before it. */
+static int notification_queue_enqueue (notification_queue_t *q, /* {{{ */
+		notification_t const *n, char const *key)
+{
+	static c_complain_t queue_full_complaint = C_COMPLAIN_INIT_STATIC;
+	notification_queue_entry_t *e = NULL;
+
+	pthread_mutex_lock (&q->lock);
+
+	if ((key != NULL)
+			&& (c_avl_get (q->pending, key, (void *) &e) == 0))
+	{
+		if (e->n.severity == n->severity)
+		{
+			notification_meta_reset (&e->n);
+			notification_copy (&e->n, n);
+			e->ctx = plugin_get_ctx ();
+			pthread_mutex_unlock (&q->lock);
+
+			DEBUG ("plugin_dispatch_notification: Coalesced "
+					"notification for \"%s\" queued for %s.",
+					key, q->name);
+			return (0);
+		}
+	}
+
+	if (q->length >= NOTIFICATION_QUEUE_LIMIT)
+	{
+		pthread_mutex_unlock (&q->lock);
+		c_complain (LOG_WARNING, &queue_full_complaint,
+				"plugin_dispatch_notification: The notification "
+				"queue of %s is full. Dropping notifications.",
+				q->name);
+		return (-1);
+	}
+
+	e = malloc (sizeof (*e));
+	if (e == NULL)
+	{
+		pthread_mutex_unlock (&q->lock);
+		ERROR ("plugin_dispatch_notification: malloc failed.");
+		return (ENOMEM);
+	}
+	memset (e, 0, sizeof (*e));
+
+	notification_copy (&e->n, n);
+	e->ctx = plugin_get_ctx ();
+	if (key != NULL)
+	{
+		notification_queue_entry_t *prev = NULL;
+
+		/* Later notifications are coalesced with this one, not with
+		 * the one of a different severity still waiting. */
+		if (c_avl_remove (q->pending, key, NULL, (void *) &prev) == 0)
+			sfree (prev->key);
+
+		e->key = strdup (key);
+		if ((e->key == NULL)
+				|| (c_avl_insert (q->pending, e->key, e) != 0))
+			sfree (e->key);
+	}
+
+	if (q->tail == NULL)
+		q->head = e;
+	else
+		q->tail->next = e;
+	q->tail = e;
+	q->length++;
+
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+
+	return (0);
+} /* }}} int notification_queue_enqueue */
+
+static void notification_queue_destroy (notification_queue_t *q) /* {{{ */
+{
+	if (q == NULL)
+		return;
+
+	if (q->thread_running)
+	{
+		pthread_mutex_lock (&q->lock);
+		q->loop = 0;
+		pthread_cond_broadcast (&q->cond);
+		pthread_mutex_unlock (&q->lock);
+
+		pthread_join (q->thread, NULL);
+		q->thread_running = 0;
+	}
+
+	/* The thread delivers all remaining notifications before exiting, so
+	 * the queue is empty now unless the thread never ran. */
+	while (q->head != NULL)
+	{
+		notification_queue_entry_t *e = q->head;
+		q->head = e->next;
+		notification_queue_entry_free (e);
+	}
+
+	if (q->pending != NULL)
+		c_avl_destroy (q->pending);
+	pthread_mutex_destroy (&q->lock);
+	pthread_cond_destroy (&q->cond);
+	sfree (q->name);
+	sfree (q);
+} /* }}} void notification_queue_destroy */
+
+static notification_queue_t *notification_queue_create (char const *name, /* {{{ */
+		callback_func_t *cf)
+{
+	notification_queue_t *q;
+	int status;
+
+	q = malloc (sizeof (*q));
+	if (q == NULL)
+		return (NULL);
+	memset (q, 0, sizeof (*q));
+
+	q->name = strdup (name);
+	q->cf = cf;
+	q->loop = 1;
+	q->tokens = (notification_rate_limit < 1.0) ? 1.0 : notification_rate_limit;
+	q->tokens_time = cdtime ();
+	pthread_mutex_init (&q->lock, /* attr = */ NULL);
+	pthread_cond_init (&q->cond, /* attr = */ NULL);
+
+	q->pending = c_avl_create ((void *) strcmp);
+	if ((q->name == NULL) || (q->pending == NULL))
+	{
+		notification_queue_destroy (q);
+		return (NULL);
+	}
+
+	status = pthread_create (&q->thread, /* attr = */ NULL,
+			notification_queue_thread, q);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("plugin: notification_queue_create: pthread_create "
+				"failed with status %i (%s).", status,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		notification_queue_destroy (q);
+		return (NULL);
+	}
+	q->thread_running = 1;
+
+	return (q);
+} /* }}} notification_queue_t *notification_queue_create */
+
+/* Must be called with `notification_queues_lock' held. */
+static notification_queue_t *notification_queue_get (char const *name) /* {{{ */
+{
+	llentry_t *le;
+
+	if (notification_queues == NULL)
+		return (NULL);
+
+	le = llist_search (notification_queues, name);
+	if (le == NULL)
+		return (NULL);
+
+	return (le->value);
+} /* }}} notification_queue_t *notification_queue_get */
+
+static void start_notification_threads (void) /* {{{ */
+{
+	llentry_t *le;
+
+	if (list_notification == NULL)
+		return;
+
+	pthread_mutex_lock (&notification_queues_lock);
+
+	if (notification_queues == NULL)
+		notification_queues = llist_create ();
+	if (notification_queues == NULL)
+	{
+		pthread_mutex_unlock (&notification_queues_lock);
+		ERROR ("plugin: start_notification_threads: llist_create failed.");
+		return;
+	}
+
+	for (le = llist_head (list_notification); le != NULL; le = le->next)
+	{
+		notification_queue_t *q;
+		llentry_t *qe;
+
+		if (notification_queue_get (le->key) != NULL)
+			continue;
+
+		/* Callbacks without a queue are called synchronously. */
+		q = notification_queue_create (le->key, le->value);
+		if (q == NULL)
+			continue;
+
+		qe = llentry_create (q->name, q);
+		if (qe == NULL)
+		{
+			notification_queue_destroy (q);
+			continue;
+		}
+		llist_append (notification_queues, qe);
+	}
+
+	pthread_mutex_unlock (&notification_queues_lock);
+} /* }}} void start_notification_threads */
+
+/* Delivers all queued notifications and stops the notification threads.
+ * Notifications dispatched afterwards are delivered synchronously. If
+ * `name' is not NULL, only the queue of that callback is stopped. Returns the
+ * number of queues stopped. */
+static int stop_notification_threads (char const *name) /* {{{ */
+{
+	llentry_t *stopped = NULL;
+	llentry_t *le;
+	int stopped_num = 0;
+
+	/* Detach the queues while holding the lock, but wait for the threads
+	 * without it: callbacks delivering the remaining notifications may
+	 * dispatch notifications themselves, which takes the lock. */
+	pthread_mutex_lock (&notification_queues_lock);
+
+	if (notification_queues == NULL)
+	{
+		pthread_mutex_unlock (&notification_queues_lock);
+		return (0);
+	}
+
+	le = llist_head (notification_queues);
+	while (le != NULL)
+	{
+		llentry_t *next = le->next;
+
+		if ((name == NULL) || (strcmp (name, le->key) == 0))
+		{
+			llist_remove (notification_queues, le);
+			le->next = stopped;
+			stopped = le;
+		}
+
+		le = next;
+	}
+
+	if (llist_size (notification_queues) == 0)
+	{
+		llist_destroy (notification_queues);
+		notification_queues = NULL;
+	}
+
+	pthread_mutex_unlock (&notification_queues_lock);
+
+	while (stopped != NULL)
+	{
+		le = stopped;
+		stopped = le->next;
+
+		notification_queue_destroy (le->value);
+		llentry_destroy (le);
+		stopped_num++;
+	}
+
+	return (stopped_num);
+} /* }}} int stop_notification_threads */
+
+/*
+ * Flap detection: If the severity of notifications with the same identifier
+ * changes `notification_flap_threshold' times within
+ * `notification_flap_window', the identifier is considered to be flapping.
+ * The notification starting this is annotated accordingly and subsequent
+ * notifications are suppressed until no change has happened for an entire
+ * window. Then the latest notification is delivered.
+ */
+static void flap_state_free (flap_state_t *st) /* {{{ */
+{
+	if (st == NULL)
+		return;
+
+	if (st->have_last)
+		notification_meta_reset (&st->last);
+	sfree (st->changes);
+	sfree (st);
+} /* }}} void flap_state_free */
+
+static void flap_state_set_last (flap_state_t *st, /* {{{ */
+		notification_t const *n)
+{
+	if (st->have_last)
+		notification_meta_reset (&st->last);
+	notification_copy (&st->last, n);
+	st->have_last = 1;
+} /* }}} void flap_state_set_last */
+
+/* Returns true if the notification is to be suppressed. */
+static _Bool notification_flap_check (char const *key, /* {{{ */
+		notification_t *n)
+{
+	flap_state_t *st = NULL;
+	cdtime_t now = cdtime ();
+	cdtime_t oldest;
+
+	pthread_mutex_lock (&flap_lock);
+
+	if (flap_tree == NULL)
+		flap_tree = c_avl_create ((void *) strcmp);
+	if (flap_tree == NULL)
+	{
+		pthread_mutex_unlock (&flap_lock);
+		return (0);
+	}
+
+	if (c_avl_get (flap_tree, key, (void *) &st) != 0)
+	{
+		char *st_key;
+
+		st = calloc (1, sizeof (*st));
+		st_key = strdup (key);
+		if (st != NULL)
+			st->changes = calloc ((size_t) notification_flap_threshold,
+					sizeof (*st->changes));
+		if ((st == NULL) || (st->changes == NULL) || (st_key == NULL)
+				|| (c_avl_insert (flap_tree, st_key, st) != 0))
+		{
+			pthread_mutex_unlock (&flap_lock);
+			flap_state_free (st);
+			sfree (st_key);
+			return (0);
+		}
+
+		/* Force the first notification to be counted as a change. */
+		st->severity = -1;
+	}
+
+	if (n->severity != st->severity)
+	{
+		st->severity = n->severity;
+		st->last_change = now;
+
+		st->changes[st->changes_pos] = now;
+		st->changes_pos = (st->changes_pos + 1)
+			% ((size_t) notification_flap_threshold);
+		if (st->changes_num < ((size_t) notification_flap_threshold))
+			st->changes_num++;
+	}
+
+	if (st->flapping)
+	{
+		flap_state_set_last (st, n);
+		pthread_mutex_unlock (&flap_lock);
+		return (1);
+	}
+
+	if (st->changes_num < ((size_t) notification_flap_threshold))
+	{
+		pthread_mutex_unlock (&flap_lock);
+		return (0);
+	}
+
+	/* The ring is full, so the next position holds the oldest change. */
+	oldest = st->changes[st->changes_pos];
+	if ((now - oldest) <= notification_flap_window)
+	{
+		size_t len = strlen (n->message);
+
+		st->flapping = 1;
+		flap_state_set_last (st, n);
+
+		ssnprintf (n->message + len, sizeof (n->message) - len,
+				"%sFlapping detected, further notifications are "
+				"suppressed.", (len > 0) ? " " : "");
+		plugin_notification_meta_add_boolean (n, "flapping", 1);
+
+		NOTICE ("plugin_dispatch_notification: \"%s\" is flapping.",
+				key);
+	}
+
+	pthread_mutex_unlock (&flap_lock);
+	return (0);
+} /* }}} _Bool notification_flap_check */
+
+static int plugin_dispatch_notification_internal (notification_t const *n,
+		char const *key);
+
+/* Ends flapping of identifiers which have been stable for an entire window
+ * and forgets about identifiers which haven't changed for that long. */
+static void notification_flap_timeout (void) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	char *key;
+	flap_state_t *st;
+	cdtime_t now;
+
+	char **remove_list = NULL;
+	size_t remove_list_len = 0;
+	notification_t *deliver_list = NULL;
+	size_t deliver_list_len = 0;
+	size_t i;
+
+	if (notification_flap_threshold <= 0)
+		return;
+
+	now = cdtime ();
+
+	pthread_mutex_lock (&flap_lock);
+
+	if (flap_tree == NULL)
+	{
+		pthread_mutex_unlock (&flap_lock);
+		return;
+	}
+
+	iter = c_avl_get_iterator (flap_tree);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &st) == 0)
+	{
+		if ((now - st->last_change) <= notification_flap_window)
+			continue;
+
+		if (st->flapping && st->have_last)
+		{
+			notification_t *tmp;
+
+			tmp = realloc (deliver_list, (deliver_list_len + 1)
+					* sizeof (*deliver_list));
+			if (tmp == NULL)
+				continue;
+			deliver_list = tmp;
+
+			/* Hand over the notification, including its meta
+			 * data. */
+			deliver_list[deliver_list_len] = st->last;
+			deliver_list_len++;
+			st->have_last = 0;
+			st->flapping = 0;
+			st->changes_num = 0;
+
+			NOTICE ("plugin_dispatch_notification: \"%s\" stopped "
+					"flapping.", key);
+			continue;
+		}
+
+		if (!st->flapping)
+		{
+			char **tmp;
+
+			tmp = realloc (remove_list, (remove_list_len + 1)
+					* sizeof (*remove_list));
+			if (tmp == NULL)
+				continue;
+			remove_list = tmp;
+			remove_list[remove_list_len] = key;
+			remove_list_len++;
+		}
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < remove_list_len; i++)
+	{
+		if (c_avl_remove (flap_tree, remove_list[i],
+					(void *) &key, (void *) &st) == 0)
+		{
+			sfree (key);
+			flap_state_free (st);
+		}
+	}
+	sfree (remove_list);
+
+	pthread_mutex_unlock (&flap_lock);
+
+	for (i = 0; i < deliver_list_len; i++)
+	{
+		notification_t *n = deliver_list + i;
+		char ident[6 * DATA_MAX_NAME_LEN];
+
+		plugin_notification_meta_add_boolean (n, "flapping", 0);
+
+		format_name (ident, sizeof (ident), n->host, n->plugin,
+				n->plugin_instance, n->type, n->type_instance);
+		n->time = now;
+		plugin_dispatch_notification_internal (n, ident);
+		notification_meta_reset (n);
+	}
+	sfree (deliver_list);
+} /* }}} void notification_flap_timeout */
+
+static void notification_flap_destroy (void) /* {{{ */
+{
+	char *key;
+	flap_state_t *st;
+
+	pthread_mutex_lock (&flap_lock);
+	if (flap_tree != NULL)
+	{
+		while (c_avl_pick (flap_tree, (void *) &key, (void *) &st) == 0)
+		{
+			sfree (key);
+			flap_state_free (st);
+		}
+		c_avl_destroy (flap_tree);
+		flap_tree = NULL;
+	}
+	pthread_mutex_unlock (&flap_lock);
+} /* }}} void notification_flap_destroy */
+
+/*
+ * Log ring: plugin_log() reserves a slot using compare-and-swap on
+ * `log_ring_head', formats the message into it and marks it as filled. The
+ * log thread is the only consumer. Producers never block: if the ring is full,
+ * the message is dropped and counted. The log thread is only woken up if it
+ * is waiting, so the lock is not taken while messages are being written.
+ */
+static void log_callbacks_call (int level, char const *msg) /* {{{ */
+{
+	llentry_t *le;
+
+	if (list_log == NULL)
+	{
+		fprintf (stderr, "%s\n", msg);
+		return;
+	}
+
+	for (le = llist_head (list_log); le != NULL; le = le->next)
+	{
+		callback_func_t *cf;
+		plugin_log_cb callback;
+
+		cf = le->value;
+		callback = cf->cf_callback;
+
+		(*callback) (level, msg, &cf->cf_udata);
+	}
+} /* }}} void log_callbacks_call */
+
+/* Returns the reserved slot or NULL if the ring is full. */
+static log_slot_t *log_ring_reserve (void) /* {{{ */
+{
+	unsigned long pos = __sync_fetch_and_add (&log_ring_head, 0);
+
+	while (42)
+	{
+		log_slot_t *slot = log_ring + (pos % LOG_RING_SIZE);
+		unsigned long seq = __sync_fetch_and_add (&slot->seq, 0);
+		long diff = (long) (seq - pos);
+
+		if (diff == 0)
+		{
+			if (__sync_bool_compare_and_swap (&log_ring_head, pos, pos + 1))
+				return (slot);
+		}
+		else if (diff < 0)
+			return (NULL);
+
+		pos = __sync_fetch_and_add (&log_ring_head, 0);
+	}
+} /* }}} log_slot_t *log_ring_reserve */
+
+static void log_ring_publish (log_slot_t *slot) /* {{{ */
+{
+	/* Marks the slot as filled; implies a full memory barrier. */
+	__sync_fetch_and_add (&slot->seq, 1);
+
+	if (__sync_fetch_and_add (&log_thread_sleeping, 0))
+	{
+		pthread_mutex_lock (&log_lock);
+		pthread_cond_signal (&log_cond);
+		pthread_mutex_unlock (&log_lock);
+	}
+} /* }}} void log_ring_publish */
+
+/* Passes all filled slots to the log callbacks. Returns the number of
+ * messages. Must only be called by one thread at a time. */
+static size_t log_ring_drain (void) /* {{{ */
+{
+	size_t count = 0;
+	unsigned long dropped;
+
+	while (42)
+	{
+		unsigned long pos = log_ring_tail;
+		log_slot_t *slot = log_ring + (pos % LOG_RING_SIZE);
+		plugin_ctx_t old_ctx;
+
+		if (__sync_fetch_and_add (&slot->seq, 0) != (pos + 1))
+			break;
+
+		/* Advance the tail first, so plugin_log_pending() does not
+		 * count the current message. */
+		__sync_lock_test_and_set (&log_ring_tail, pos + 1);
+
+		/* Keep the context (interval) information of the plugin which
+		 * logged the message. */
+		old_ctx = plugin_set_ctx (slot->ctx);
+		log_callbacks_call (slot->level, slot->msg);
+		plugin_set_ctx (old_ctx);
+
+		/* Hand the slot back to the producers: pos + LOG_RING_SIZE */
+		__sync_fetch_and_add (&slot->seq, LOG_RING_SIZE - 1);
+		count++;
+	}
+
+	dropped = __sync_fetch_and_and (&log_dropped, 0);
+	if (dropped > 0)
+	{
+		char msg[LOG_MESSAGE_SIZE];
+
+		log_dropped_total += dropped;
+		ssnprintf (msg, sizeof (msg), "plugin_log: %lu log messages have "
+				"been dropped because the log queue was full "
+				"(%lu in total).", dropped, log_dropped_total);
+		log_callbacks_call (LOG_WARNING, msg);
+	}
+
+	return (count);
+} /* }}} size_t log_ring_drain */
+
+static void *log_thread_main (void __attribute__((unused)) *args) /* {{{ */
+{
+	while (42)
+	{
+		struct timespec ts;
+
+		log_ring_drain ();
+
+		pthread_mutex_lock (&log_lock);
+		if (!log_thread_loop)
+		{
+			pthread_mutex_unlock (&log_lock);
+			break;
+		}
+
+		/* Check the ring again after announcing that we are waiting,
+		 * so a message published in between is not missed. */
+		__sync_lock_test_and_set (&log_thread_sleeping, 1);
+		__sync_synchronize ();
+		if (__sync_fetch_and_add (&log_ring[log_ring_tail % LOG_RING_SIZE].seq, 0)
+				== (log_ring_tail + 1))
 		{
-			char errbuf[1024];
-			ERROR ("plugin: start_write_threads: pthread_create failed "
-					"with status %i (%s).", status,
-					sstrerror (status, errbuf, sizeof (errbuf)));
-			return;
+			__sync_lock_release (&log_thread_sleeping);
+			pthread_mutex_unlock (&log_lock);
+			continue;
 		}
 
-		write_threads_num++;
-	} /* for (i) */
-} /* }}} void start_write_threads */
+		CDTIME_T_TO_TIMESPEC (cdtime () + TIME_T_TO_CDTIME_T (1), &ts);
+		pthread_cond_timedwait (&log_cond, &log_lock, &ts);
+		__sync_lock_release (&log_thread_sleeping);
+		pthread_mutex_unlock (&log_lock);
+	}
 
-static void stop_write_threads (void) /* {{{ */
+	log_ring_drain ();
+	return ((void *) 0);
+} /* }}} void *log_thread_main */
+
+static void start_log_thread (void) /* {{{ */
 {
-	write_queue_t *q;
-	int i;
+	size_t i;
+	int status;
 
-	if (write_threads == NULL)
+	if (log_thread_running || (list_log == NULL))
 		return;
 
-	INFO ("collectd: Stopping %zu write threads.", write_threads_num);
-
-	pthread_mutex_lock (&write_lock);
-	write_loop = 0;
-	DEBUG ("plugin: stop_write_threads: Signalling `write_cond'");
-	pthread_cond_broadcast (&write_cond);
-	pthread_mutex_unlock (&write_lock);
-
-	for (i = 0; i < write_threads_num; i++)
+	if (log_ring == NULL)
 	{
-		if (pthread_join (write_threads[i], NULL) != 0)
+		log_ring = calloc (LOG_RING_SIZE, sizeof (*log_ring));
+		if (log_ring == NULL)
 		{
-			ERROR ("plugin: stop_write_threads: pthread_join failed.");
+			ERROR ("plugin: start_log_thread: calloc failed.");
+			return;
 		}
-		write_threads[i] = (pthread_t) 0;
 	}
-	sfree (write_threads);
-	write_threads_num = 0;
 
-	pthread_mutex_lock (&write_lock);
-	i = 0;
-	for (q = write_queue_head; q != NULL; )
-	{
-		write_queue_t *q1 = q;
-		plugin_value_list_free (q->vl);
-		q = q->next;
-		sfree (q1);
-		i++;
-	}
-	write_queue_head = NULL;
-	write_queue_tail = NULL;
-	write_queue_length = 0;
-	pthread_mutex_unlock (&write_lock);
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		log_ring[i].seq = (unsigned long) i;
+	log_ring_head = 0;
+	log_ring_tail = 0;
 
-	if (i > 0)
+	log_thread_loop = 1;
+	__sync_synchronize ();
+
+	status = pthread_create (&log_thread, NULL, log_thread_main, NULL);
+	if (status != 0)
 	{
-		WARNING ("plugin: %i value list%s left after shutting down "
-				"the write threads.",
-				i, (i == 1) ? " was" : "s were");
+		char errbuf[1024];
+		log_thread_loop = 0;
+		ERROR ("plugin: start_log_thread: pthread_create failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return;
 	}
-} /* }}} void stop_write_threads */
+
+	log_thread_running = 1;
+	__sync_synchronize ();
+} /* }}} void start_log_thread */
+
+/* Passes all queued messages to the log callbacks and stops the log thread.
+ * Messages logged afterwards are passed to the callbacks synchronously. */
+static void stop_log_thread (void) /* {{{ */
+{
+	if (!log_thread_running)
+		return;
+
+	log_thread_running = 0;
+	__sync_synchronize ();
+
+	pthread_mutex_lock (&log_lock);
+	log_thread_loop = 0;
+	pthread_cond_broadcast (&log_cond);
+	pthread_mutex_unlock (&log_lock);
+
+	pthread_join (log_thread, NULL);
+
+	/* Catch messages which were added while the thread was exiting. */
+	log_ring_drain ();
+
+	if (log_dropped_total > 0)
+		INFO ("plugin: %lu log messages have been dropped in total.",
+				log_dropped_total);
+} /* }}} void stop_log_thread */
 
 /*
  * Public functions
@@ -1048,7 +2265,13 @@ static int plugin_insert_read (read_func_t *rf)
 	llentry_t *le;
 
 	rf->rf_next_read = cdtime ();
-	rf->rf_effective_interval = rf->rf_interval;
+	if (rf->rf_ctx.downsample != NULL)
+	{
+		rf->rf_effective_interval = rf->rf_sample_interval;
+		rf->rf_next_flush = rf->rf_next_read + rf->rf_interval;
+	}
+	else
+		rf->rf_effective_interval = rf->rf_interval;
 
 	pthread_mutex_lock (&read_lock);
 
@@ -1111,6 +2334,39 @@ static int plugin_insert_read (read_func_t *rf)
 	return (0);
 } /* int plugin_insert_read */
 
+/* Sets up the downsample buffer if a sample interval has been configured for
+ * the plugin registering `rf'. `rf_ctx' and `rf_interval' must be set. */
+static void plugin_read_setup_sampling (read_func_t *rf) /* {{{ */
+{
+	cdtime_t sample_interval = rf->rf_ctx.sample_interval;
+
+	rf->rf_ctx.downsample = NULL;
+	if (sample_interval == 0)
+		return;
+
+	if (sample_interval >= rf->rf_interval)
+	{
+		WARNING ("The sample interval of the \"%s\" read function "
+				"(%.3f seconds) is not shorter than its interval "
+				"(%.3f seconds) and will be ignored.",
+				rf->rf_name,
+				CDTIME_T_TO_DOUBLE (sample_interval),
+				CDTIME_T_TO_DOUBLE (rf->rf_interval));
+		return;
+	}
+
+	rf->rf_ctx.downsample = downsample_create (rf->rf_interval,
+			sample_interval);
+	if (rf->rf_ctx.downsample == NULL)
+	{
+		ERROR ("plugin_read_setup_sampling: downsample_create failed. "
+				"The \"%s\" read function will be called at "
+				"its normal interval.", rf->rf_name);
+		return;
+	}
+	rf->rf_sample_interval = sample_interval;
+} /* }}} void plugin_read_setup_sampling */
+
 int plugin_register_read (const char *name,
 		int (*callback) (void))
 {
@@ -1133,10 +2389,14 @@ int plugin_register_read (const char *name,
 	rf->rf_name = strdup (name);
 	rf->rf_type = RF_SIMPLE;
 	rf->rf_interval = plugin_get_interval ();
+	plugin_read_setup_sampling (rf);
 
 	status = plugin_insert_read (rf);
 	if (status != 0)
+	{
+		downsample_destroy (rf->rf_ctx.downsample);
 		sfree (rf);
+	}
 
 	return (status);
 } /* int plugin_register_read */
@@ -1181,10 +2441,14 @@ int plugin_register_complex_read (const char *group, const char *name,
 	}
 
 	rf->rf_ctx = plugin_get_ctx ();
+	plugin_read_setup_sampling (rf);
 
 	status = plugin_insert_read (rf);
 	if (status != 0)
+	{
+		downsample_destroy (rf->rf_ctx.downsample);
 		sfree (rf);
+	}
 
 	return (status);
 } /* int plugin_register_complex_read */
@@ -1192,15 +2456,31 @@ int plugin_register_complex_read (const char *group, const char *name,
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_write, name,
-				(void *) callback, ud));
+	int status;
+
+	/* register_callback() destroys a callback of the same name, so remove
+	 * it from the index first. */
+	callback_index_update (list_write, &write_index, name,
+			/* exclude = */ name);
+	status = create_register_callback (&list_write, name,
+			(void *) callback, ud);
+	callback_index_update (list_write, &write_index, name,
+			/* exclude = */ NULL);
+	return (status);
 } /* int plugin_register_write */
 
 int plugin_register_flush (const char *name,
 		plugin_flush_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_flush, name,
-				(void *) callback, ud));
+	int status;
+
+	callback_index_update (list_flush, &flush_index, name,
+			/* exclude = */ name);
+	status = create_register_callback (&list_flush, name,
+			(void *) callback, ud);
+	callback_index_update (list_flush, &flush_index, name,
+			/* exclude = */ NULL);
+	return (status);
 } /* int plugin_register_flush */
 
 int plugin_register_missing (const char *name,
@@ -1285,9 +2565,22 @@ int plugin_register_log (const char *name,
 int plugin_register_notification (const char *name,
 		plugin_notification_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_notification, name,
-				(void *) callback, ud));
-} /* int plugin_register_log */
+	int queued;
+	int status;
+
+	/* Registering a callback under an existing name frees the old one,
+	 * which its queue still refers to. Deliver the queued notifications
+	 * to the old callback and give the new one a queue of its own. */
+	queued = stop_notification_threads (name);
+
+	status = create_register_callback (&list_notification, name,
+				(void *) callback, ud);
+
+	if (queued > 0)
+		start_notification_threads ();
+
+	return (status);
+} /* int plugin_register_notification */
 
 int plugin_unregister_config (const char *name)
 {
@@ -1409,11 +2702,17 @@ int plugin_unregister_read_group (const char *group) /* {{{ */
 
 int plugin_unregister_write (const char *name)
 {
+	/* Remove the callback from the index first, so that no new caller can
+	 * pick it up. Callers still using it destroy it when they are done. */
+	callback_index_update (list_write, &write_index, name,
+			/* exclude = */ name);
 	return (plugin_unregister (list_write, name));
 }
 
 int plugin_unregister_flush (const char *name)
 {
+	callback_index_update (list_flush, &flush_index, name,
+			/* exclude = */ name);
 	return (plugin_unregister (list_flush, name));
 }
 
@@ -1450,16 +2749,23 @@ int plugin_unregister_log (const char *name)
 
 int plugin_unregister_notification (const char *name)
 {
+	/* Stop the thread before the callback goes away. */
+	stop_notification_threads (name);
+
 	return (plugin_unregister (list_notification, name));
 }
 
 void plugin_init_all (void)
 {
 	char const *chain_name;
+	char const *str;
 	long write_threads_num;
 	llentry_t *le;
 	int status;
 
+	/* Pass log messages to the log plugins from a separate thread. */
+	start_log_thread ();
+
 	/* Init the value cache */
 	uc_init ();
 
@@ -1501,8 +2807,34 @@ void plugin_init_all (void)
 
 	start_write_threads ((size_t) write_threads_num);
 
+	str = global_option_get ("NotificationRateLimit");
+	if (str != NULL)
+		notification_rate_limit = atof (str);
+	if (notification_rate_limit < 0.0)
+	{
+		ERROR ("NotificationRateLimit must be positive or zero.");
+		notification_rate_limit = 0.0;
+	}
+
+	notification_flap_threshold = global_option_get_long (
+			"NotificationFlapThreshold", /* default = */ 0);
+	if (notification_flap_threshold < 0)
+	{
+		ERROR ("NotificationFlapThreshold must be positive or zero.");
+		notification_flap_threshold = 0;
+	}
+
+	str = global_option_get ("NotificationFlapWindow");
+	if ((str != NULL) && (atof (str) > 0.0))
+		notification_flap_window = DOUBLE_TO_CDTIME_T (atof (str));
+	else
+		notification_flap_window = TIME_T_TO_CDTIME_T (300);
+
 	if ((list_init == NULL) && (read_heap == NULL))
+	{
+		start_notification_threads ();
 		return;
+	}
 
 	/* Calling all init callbacks before checking if read callbacks
 	 * are available allows the init callbacks to register the read
@@ -1536,6 +2868,10 @@ void plugin_init_all (void)
 		le = le->next;
 	}
 
+	/* Init callbacks may register notification callbacks, so start the
+	 * notification threads afterwards. */
+	start_notification_threads ();
+
 	/* Start read-threads */
 	if (read_heap != NULL)
 	{
@@ -1552,6 +2888,7 @@ void plugin_init_all (void)
 void plugin_read_all (void)
 {
 	uc_check_timeout ();
+	notification_flap_timeout ();
 
 	return;
 } /* void plugin_read_all */
@@ -1596,6 +2933,9 @@ int plugin_read_all_once (void)
 
 		plugin_set_ctx (old_ctx);
 
+		if (rf->rf_ctx.downsample != NULL)
+			plugin_read_flush_samples (rf);
+
 		if (status != 0)
 		{
 			NOTICE ("read-function of plugin `%s' failed.",
@@ -1666,31 +3006,77 @@ int plugin_write (const char *plugin, /* {{{ */
     callback_func_t *cf;
     plugin_write_cb callback;
 
-    le = llist_head (list_write);
-    while (le != NULL)
-    {
-      if (strcasecmp (plugin, le->key) == 0)
-        break;
-
-      le = le->next;
-    }
-
-    if (le == NULL)
+    cf = callback_index_lookup (write_index, plugin);
+    if (cf == NULL)
       return (ENOENT);
 
-    cf = le->value;
-
     /* do not switch plugin context; rather keep the context (interval)
      * information of the calling read plugin */
 
-    DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+    DEBUG ("plugin: plugin_write: Writing values via %s.", plugin);
     callback = cf->cf_callback;
     status = (*callback) (ds, vl, &cf->cf_udata);
+    callback_index_release (cf);
   }
 
   return (status);
 } /* }}} int plugin_write */
 
+plugin_write_handle_t *plugin_write_handle_get (const char *plugin) /* {{{ */
+{
+  callback_index_entry_t *e;
+
+  if (plugin == NULL)
+    return (NULL);
+
+  pthread_rwlock_wrlock (&callback_index_lock);
+  e = callback_index_get (&write_index, plugin);
+  pthread_rwlock_unlock (&callback_index_lock);
+
+  if (e == NULL)
+    ERROR ("plugin_write_handle_get: Creating the handle for `%s' failed.",
+        plugin);
+
+  return (e);
+} /* }}} plugin_write_handle_t *plugin_write_handle_get */
+
+int plugin_write_handle (plugin_write_handle_t *h, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  callback_func_t *cf;
+  plugin_write_cb callback;
+  int status;
+
+  if ((h == NULL) || (vl == NULL))
+    return (EINVAL);
+
+  if (ds == NULL)
+  {
+    ds = plugin_get_ds (vl->type);
+    if (ds == NULL)
+    {
+      ERROR ("plugin_write_handle: Unable to lookup type `%s'.", vl->type);
+      return (ENOENT);
+    }
+  }
+
+  pthread_rwlock_rdlock (&callback_index_lock);
+  cf = callback_index_acquire (h);
+  pthread_rwlock_unlock (&callback_index_lock);
+  if (cf == NULL)
+    return (ENOENT);
+
+  /* do not switch plugin context; rather keep the context (interval)
+   * information of the calling read plugin */
+
+  DEBUG ("plugin: plugin_write_handle: Writing values via %s.", h->name);
+  callback = cf->cf_callback;
+  status = (*callback) (ds, vl, &cf->cf_udata);
+
+  callback_index_release (cf);
+  return (status);
+} /* }}} int plugin_write_handle */
+
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
 {
   llentry_t *le;
@@ -1698,6 +3084,26 @@ int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
   if (list_flush == NULL)
     return (0);
 
+  if (plugin != NULL)
+  {
+    callback_func_t *cf;
+    plugin_flush_cb callback;
+    plugin_ctx_t old_ctx;
+
+    cf = callback_index_lookup (flush_index, plugin);
+    if (cf == NULL)
+      return (0);
+
+    old_ctx = plugin_set_ctx (cf->cf_ctx);
+    callback = cf->cf_callback;
+
+    (*callback) (timeout, identifier, &cf->cf_udata);
+
+    plugin_set_ctx (old_ctx);
+    callback_index_release (cf);
+    return (0);
+  }
+
   le = llist_head (list_flush);
   while (le != NULL)
   {
@@ -1705,13 +3111,6 @@ int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
     plugin_flush_cb callback;
     plugin_ctx_t old_ctx;
 
-    if ((plugin != NULL)
-        && (strcmp (plugin, le->key) != 0))
-    {
-      le = le->next;
-      continue;
-    }
-
     cf = le->value;
     old_ctx = plugin_set_ctx (cf->cf_ctx);
     callback = cf->cf_callback;
@@ -1744,6 +3143,10 @@ void plugin_shutdown_all (void)
 			/* timeout = */ 0,
 			/* identifier = */ NULL);
 
+	/* Deliver queued notifications while the notification plugins are
+	 * still available. */
+	stop_notification_threads (/* name = */ NULL);
+
 	le = NULL;
 	if (list_shutdown != NULL)
 		le = llist_head (list_shutdown);
@@ -1776,12 +3179,17 @@ void plugin_shutdown_all (void)
 	 * the free_function to NULL when registering the flush callback and to
 	 * the real free function when registering the write callback. This way
 	 * the data isn't freed twice. */
+	callback_index_destroy (&flush_index);
+	callback_index_destroy (&write_index);
 	destroy_all_callbacks (&list_flush);
 	destroy_all_callbacks (&list_missing);
 	destroy_all_callbacks (&list_write);
 
 	destroy_all_callbacks (&list_notification);
+	notification_flap_destroy ();
 	destroy_all_callbacks (&list_shutdown);
+
+	stop_log_thread ();
 	destroy_all_callbacks (&list_log);
 
 	plugin_free_loaded ();
@@ -1908,7 +3316,7 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 #else
 	if (ds->ds_num != vl->values_len)
 	{
-		ERROR ("plugin_dispatch_values: ds->type = %s: "
+		c_log_limited (LOG_ERR, "plugin_dispatch_values: ds->type = %s: "
 				"(ds->ds_num = %i) != "
 				"(vl->values_len = %i)",
 				ds->type, ds->ds_num, vl->values_len);
@@ -2006,14 +3414,16 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	return (0);
 } /* int plugin_dispatch_values_internal */
 
-static double get_drop_probability (void) /* {{{ */
+/* "pending" is the number of value lists which are about to be added to the
+ * write queue. */
+static double get_drop_probability (long pending) /* {{{ */
 {
 	long pos;
 	long size;
 	long wql;
 
 	pthread_mutex_lock (&write_lock);
-	wql = write_queue_length;
+	wql = write_queue_length + pending;
 	pthread_mutex_unlock (&write_lock);
 
 	if (wql < write_limit_low)
@@ -2027,7 +3437,7 @@ static double get_drop_probability (void) /* {{{ */
 	return (((double) pos) / ((double) size));
 } /* }}} double get_drop_probability */
 
-static _Bool check_drop_value (void) /* {{{ */
+static _Bool check_drop_value (long pending) /* {{{ */
 {
 	static cdtime_t last_message_time = 0;
 	static pthread_mutex_t last_message_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -2039,7 +3449,7 @@ static _Bool check_drop_value (void) /* {{{ */
 	if (write_limit_high == 0)
 		return (0);
 
-	p = get_drop_probability ();
+	p = get_drop_probability (pending);
 	if (p == 0.0)
 		return (0);
 
@@ -2073,15 +3483,15 @@ int plugin_dispatch_values (value_list_t const *vl)
 {
 	int status;
 
-	if (check_drop_value ())
+	if (check_drop_value (/* pending = */ 0))
 		return (0);
 
 	status = plugin_write_enqueue (vl);
 	if (status != 0)
 	{
 		char errbuf[1024];
-		ERROR ("plugin_dispatch_values: plugin_write_enqueue failed "
-				"with status %i (%s).", status,
+		c_log_limited (LOG_ERR, "plugin_dispatch_values: "
+				"plugin_write_enqueue failed with status %i (%s).", status,
 				sstrerror (status, errbuf, sizeof (errbuf)));
 		return (status);
 	}
@@ -2089,6 +3499,20 @@ int plugin_dispatch_values (value_list_t const *vl)
 	return (0);
 }
 
+int plugin_dispatch_values_batch (value_list_t const *vl, /* {{{ */
+		size_t vl_num)
+{
+	int failed;
+
+	failed = plugin_write_enqueue_batch (vl, vl_num);
+	if (failed != 0)
+		c_log_limited (LOG_ERR, "plugin_dispatch_values_batch: "
+				"Enqueuing %i of %zu value lists failed.",
+				failed, vl_num);
+
+	return (failed);
+} /* }}} int plugin_dispatch_values_batch */
+
 __attribute__((sentinel))
 int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 		_Bool store_percentage, ...)
@@ -2148,27 +3572,33 @@ int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 	return (failed);
 } /* }}} int plugin_dispatch_multivalue */
 
-int plugin_dispatch_notification (const notification_t *notif)
+/* Passes the notification to all notification callbacks, using their queues
+ * if the notification threads are running. */
+static int plugin_dispatch_notification_internal ( /* {{{ */
+		notification_t const *notif, char const *key)
 {
 	llentry_t *le;
-	/* Possible TODO: Add flap detection here */
-
-	DEBUG ("plugin_dispatch_notification: severity = %i; message = %s; "
-			"time = %.3f; host = %s;",
-			notif->severity, notif->message,
-			CDTIME_T_TO_DOUBLE (notif->time), notif->host);
-
-	/* Nobody cares for notifications */
-	if (list_notification == NULL)
-		return (-1);
 
 	le = llist_head (list_notification);
 	while (le != NULL)
 	{
 		callback_func_t *cf;
 		plugin_notification_cb callback;
+		notification_queue_t *q;
 		int status;
 
+		pthread_mutex_lock (&notification_queues_lock);
+		q = notification_queue_get (le->key);
+		if (q != NULL)
+			notification_queue_enqueue (q, notif, key);
+		pthread_mutex_unlock (&notification_queues_lock);
+
+		if (q != NULL)
+		{
+			le = le->next;
+			continue;
+		}
+
 		/* do not switch plugin context; rather keep the context
 		 * (interval) information of the calling plugin */
 
@@ -2186,48 +3616,103 @@ int plugin_dispatch_notification (const notification_t *notif)
 	}
 
 	return (0);
+} /* }}} int plugin_dispatch_notification_internal */
+
+int plugin_dispatch_notification (const notification_t *notif)
+{
+	char key[6 * DATA_MAX_NAME_LEN];
+	notification_t n;
+	_Bool suppress;
+	int status;
+
+	DEBUG ("plugin_dispatch_notification: severity = %i; message = %s; "
+			"time = %.3f; host = %s;",
+			notif->severity, notif->message,
+			CDTIME_T_TO_DOUBLE (notif->time), notif->host);
+
+	/* Nobody cares for notifications */
+	if (list_notification == NULL)
+		return (-1);
+
+	/* Notifications without a type, e.g. those created using the
+	 * PUTNOTIF command without specifying one, are neither coalesced nor
+	 * checked for flapping. */
+	if (notif->type[0] == 0)
+		return (plugin_dispatch_notification_internal (notif, NULL));
+
+	format_name (key, sizeof (key), notif->host, notif->plugin,
+			notif->plugin_instance, notif->type, notif->type_instance);
+
+	if (notification_flap_threshold <= 0)
+		return (plugin_dispatch_notification_internal (notif, key));
+
+	/* The flap detection may annotate the notification. */
+	notification_copy (&n, notif);
+
+	suppress = notification_flap_check (key, &n);
+	if (suppress)
+	{
+		DEBUG ("plugin_dispatch_notification: Suppressing notification "
+				"for flapping \"%s\".", key);
+		status = 0;
+	}
+	else
+		status = plugin_dispatch_notification_internal (&n, key);
+
+	notification_meta_reset (&n);
+	return (status);
 } /* int plugin_dispatch_notification */
 
 void plugin_log (int level, const char *format, ...)
 {
-	char msg[1024];
+	char msg[LOG_MESSAGE_SIZE];
 	va_list ap;
-	llentry_t *le;
 
 #if !COLLECT_DEBUG
 	if (level >= LOG_DEBUG)
 		return;
 #endif
 
-	va_start (ap, format);
-	vsnprintf (msg, sizeof (msg), format, ap);
-	msg[sizeof (msg) - 1] = '\0';
-	va_end (ap);
-
-	if (list_log == NULL)
+	if (log_thread_running)
 	{
-		fprintf (stderr, "%s\n", msg);
-		return;
-	}
+		log_slot_t *slot = log_ring_reserve ();
 
-	le = llist_head (list_log);
-	while (le != NULL)
-	{
-		callback_func_t *cf;
-		plugin_log_cb callback;
+		if (slot == NULL)
+		{
+			__sync_fetch_and_add (&log_dropped, 1);
+			return;
+		}
 
-		cf = le->value;
-		callback = cf->cf_callback;
+		va_start (ap, format);
+		vsnprintf (slot->msg, sizeof (slot->msg), format, ap);
+		slot->msg[sizeof (slot->msg) - 1] = '\0';
+		va_end (ap);
 
-		/* do not switch plugin context; rather keep the context
-		 * (interval) information of the calling plugin */
+		slot->level = level;
+		slot->ctx = plugin_get_ctx ();
+		log_ring_publish (slot);
+		return;
+	}
 
-		(*callback) (level, msg, &cf->cf_udata);
+	va_start (ap, format);
+	vsnprintf (msg, sizeof (msg), format, ap);
+	msg[sizeof (msg) - 1] = '\0';
+	va_end (ap);
 
-		le = le->next;
-	}
+	/* do not switch plugin context; rather keep the context
+	 * (interval) information of the calling plugin */
+	log_callbacks_call (level, msg);
 } /* void plugin_log */
 
+size_t plugin_log_pending (void) /* {{{ */
+{
+	if (!log_thread_running)
+		return (0);
+
+	return ((size_t) (__sync_fetch_and_add (&log_ring_head, 0)
+				- __sync_fetch_and_add (&log_ring_tail, 0)));
+} /* }}} size_t plugin_log_pending */
+
 int parse_log_severity (const char *severity)
 {
 	int log_level = -1;
@@ -164,9 +164,15 @@ struct user_data_s
 };
 typedef struct user_data_s user_data_t;
 
+struct downsample_s;
 struct plugin_ctx_s
 {
 	cdtime_t interval;
+	/* If non-zero, read callbacks are called at this (shorter) interval and
+	 * their values are summarized by `downsample' before being dispatched at
+	 * the normal interval. See utils_downsample.h. */
+	cdtime_t sample_interval;
+	struct downsample_s *downsample;
 };
 typedef struct plugin_ctx_s plugin_ctx_t;
 
@@ -263,6 +269,31 @@ void plugin_shutdown_all (void);
 int plugin_write (const char *plugin,
     const data_set_t *ds, const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_write_handle_get
+ *
+ * DESCRIPTION
+ *  Looks up the write function of the given plugin once, so values can be
+ *  passed to it using `plugin_write_handle' without looking up the name every
+ *  time. The plugin does not need to be registered yet: the handle follows
+ *  (un)registrations of write functions with that name and stays valid until
+ *  the daemon shuts down. Plugin names are compared ignoring case, like in
+ *  `plugin_write'.
+ *
+ * RETURN VALUE
+ *  Returns NULL if `plugin' is NULL or memory could not be allocated.
+ */
+struct plugin_write_handle_s;
+typedef struct plugin_write_handle_s plugin_write_handle_t;
+
+plugin_write_handle_t *plugin_write_handle_get (const char *plugin);
+
+/* Like `plugin_write', but for the plugin referred to by `h'. Returns ENOENT
+ * if no write function with that name is currently registered. */
+int plugin_write_handle (plugin_write_handle_t *h,
+    const data_set_t *ds, const value_list_t *vl);
+
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier);
 
 /*
@@ -280,7 +311,10 @@ int plugin_register_init (const char *name,
 int plugin_register_read (const char *name,
 		int (*callback) (void));
 /* "user_data" will be freed automatically, unless
- * "plugin_register_complex_read" returns an error (non-zero). */
+ * "plugin_register_complex_read" returns an error (non-zero).
+ * If a "SampleInterval" shorter than the read interval has been configured
+ * for the plugin, the callback is called at that interval instead and the
+ * values it dispatches are downsampled to the read interval. */
 int plugin_register_complex_read (const char *group, const char *name,
 		plugin_read_cb callback,
 		const struct timespec *interval,
@@ -329,6 +363,20 @@ int plugin_unregister_notification (const char *name);
  */
 int plugin_dispatch_values (value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches the `vl_num' value lists in the array `vl'. Equivalent to
+ *  calling `plugin_dispatch_values' for each of them, but the write queue is
+ *  locked only once. Meant for plugins receiving values at a high rate.
+ *
+ * RETURNS
+ *  The number of value lists it failed to dispatch (zero on success).
+ */
+int plugin_dispatch_values_batch (value_list_t const *vl, size_t vl_num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
@@ -364,6 +412,11 @@ int plugin_dispatch_notification (const notification_t *notif);
 void plugin_log (int level, const char *format, ...)
 	__attribute__ ((format(printf,2,3)));
 
+/* Returns the number of log messages which have not yet been passed to the
+ * log callbacks. Log callbacks may use this to batch writes: when called
+ * with the last queued message, zero is returned. */
+size_t plugin_log_pending (void);
+
 /* These functions return the parsed severity or less than zero on failure. */
 int parse_log_severity (const char *severity);
 int parse_notif_severity (const char *severity);
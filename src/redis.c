@@ -59,11 +59,30 @@ struct redis_node_s
   int port;
   int timeout;
 
+  /* The connection is kept open between reads. */
+  REDIS rh;
+
   redis_node_t *next;
 };
 
 static redis_node_t *nodes_head = NULL;
 
+static void redis_node_free (void *arg) /* {{{ */
+{
+  redis_node_t *rn = arg;
+
+  if (rn == NULL)
+    return;
+
+  if (rn->rh != NULL)
+  {
+    credis_close (rn->rh);
+    rn->rh = NULL;
+  }
+
+  sfree (rn);
+} /* }}} void redis_node_free */
+
 static int redis_node_add (const redis_node_t *rn) /* {{{ */
 {
   redis_node_t *rn_copy;
@@ -89,6 +108,7 @@ static int redis_node_add (const redis_node_t *rn) /* {{{ */
   }
 
   memcpy (rn_copy, rn, sizeof (*rn_copy));
+  rn_copy->rh = NULL;
   rn_copy->next = NULL;
 
   DEBUG ("redis plugin: Adding node \"%s\".", rn->name);
@@ -228,101 +248,179 @@ static void redis_submit_d (char *plugin_instance,
   plugin_dispatch_values (&vl);
 } /* }}} */
 
-static int redis_init (void) /* {{{ */
+static int redis_connect (redis_node_t *rn) /* {{{ */
 {
-  redis_node_t rn = { "default", REDIS_DEF_HOST, REDIS_DEF_PASSWD,
-    REDIS_DEF_PORT, REDIS_DEF_TIMEOUT, /* next = */ NULL };
+  int status;
 
-  if (nodes_head == NULL)
-    redis_node_add (&rn);
+  DEBUG ("redis plugin: connecting to node `%s' (%s:%d).",
+      rn->name, rn->host, rn->port);
+
+  rn->rh = credis_connect (rn->host, rn->port, rn->timeout);
+  if (rn->rh == NULL)
+  {
+    ERROR ("redis plugin: unable to connect to node `%s' (%s:%d).",
+        rn->name, rn->host, rn->port);
+    return (-1);
+  }
+
+  if (strlen (rn->passwd) > 0)
+  {
+    DEBUG ("redis plugin: authenticanting node `%s' passwd(%s).", rn->name, rn->passwd);
+    status = credis_auth (rn->rh, rn->passwd);
+    if (status != 0)
+    {
+      WARNING ("redis plugin: unable to authenticate on node `%s'.", rn->name);
+      credis_close (rn->rh);
+      rn->rh = NULL;
+      return (-1);
+    }
+  }
 
   return (0);
-} /* }}} int redis_init */
+} /* }}} int redis_connect */
 
-static int redis_read (void) /* {{{ */
+static int redis_query_info (redis_node_t *rn, REDIS_INFO *info) /* {{{ */
 {
-  redis_node_t *rn;
+  _Bool reused = (rn->rh != NULL);
+  int status;
+
+  if (rn->rh == NULL)
+  {
+    status = redis_connect (rn);
+    if (status != 0)
+      return (status);
+  }
+
+  memset (info, 0, sizeof (*info));
+  status = credis_info (rn->rh, info);
+  if ((status != 0) && reused)
+  {
+    /* The server may have closed the connection since the last read, e.g.
+     * because of its "timeout" setting or a restart. Try once more using a
+     * new connection. */
+    DEBUG ("redis plugin: reconnecting to node `%s'.", rn->name);
+    credis_close (rn->rh);
+    rn->rh = NULL;
+
+    status = redis_connect (rn);
+    if (status != 0)
+      return (status);
+
+    memset (info, 0, sizeof (*info));
+    status = credis_info (rn->rh, info);
+  }
 
-  for (rn = nodes_head; rn != NULL; rn = rn->next)
+  if (status != 0)
   {
-    REDIS rh;
-    REDIS_INFO info;
+    WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
+    credis_close (rn->rh);
+    rn->rh = NULL;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int redis_query_info */
+
+/* Every node has its own read callback, so that the nodes are queried in
+ * parallel by the read threads and a node which is down is retried with an
+ * increasing interval without holding up the others. */
+static int redis_read (user_data_t *ud) /* {{{ */
+{
+  redis_node_t *rn = ud->data;
+  REDIS_INFO info;
+  int status;
+
+  DEBUG ("redis plugin: querying info from node `%s' (%s:%d).", rn->name, rn->host, rn->port);
+
+  status = redis_query_info (rn, &info);
+  if (status != 0)
+    return (-1);
+
+  /* typedef struct _cr_info {
+   *   char redis_version[CREDIS_VERSION_STRING_SIZE];
+   *   int bgsave_in_progress;
+   *   int connected_clients;
+   *   int connected_slaves;
+   *   unsigned int used_memory;
+   *   long long changes_since_last_save;
+   *   int last_save_time;
+   *   long long total_connections_received;
+   *   long long total_commands_processed;
+   *   int uptime_in_seconds;
+   *   int uptime_in_days;
+   *   int role;
+   * } REDIS_INFO; */
+
+  DEBUG ("redis plugin: received info from node `%s': connected_clients = %d; "
+      "connected_slaves = %d; used_memory = %lu; changes_since_last_save = %lld; "
+      "bgsave_in_progress = %d; total_connections_received = %lld; "
+      "total_commands_processed = %lld; uptime_in_seconds = %ld", rn->name,
+      info.connected_clients, info.connected_slaves, info.used_memory,
+      info.changes_since_last_save, info.bgsave_in_progress,
+      info.total_connections_received, info.total_commands_processed,
+      info.uptime_in_seconds);
+
+  redis_submit_g (rn->name, "current_connections", "clients", info.connected_clients);
+  redis_submit_g (rn->name, "current_connections", "slaves", info.connected_slaves);
+  redis_submit_g (rn->name, "memory", "used", info.used_memory);
+  redis_submit_g (rn->name, "volatile_changes", NULL, info.changes_since_last_save);
+  redis_submit_d (rn->name, "total_connections", NULL, info.total_connections_received);
+  redis_submit_d (rn->name, "total_operations", NULL, info.total_commands_processed);
+
+  return (0);
+} /* }}} int redis_read */
+
+static int redis_init (void) /* {{{ */
+{
+  redis_node_t rn = { "default", REDIS_DEF_HOST, REDIS_DEF_PASSWD,
+    REDIS_DEF_PORT, REDIS_DEF_TIMEOUT, /* rh = */ NULL, /* next = */ NULL };
+  redis_node_t *rn_ptr;
 
+  if (nodes_head == NULL)
+    redis_node_add (&rn);
+
+  /* The read callbacks own the nodes from here on. */
+  rn_ptr = nodes_head;
+  nodes_head = NULL;
+  while (rn_ptr != NULL)
+  {
+    redis_node_t *next = rn_ptr->next;
+    char cb_name[DATA_MAX_NAME_LEN];
+    user_data_t ud;
     int status;
 
-    DEBUG ("redis plugin: querying info from node `%s' (%s:%d).", rn->name, rn->host, rn->port);
+    rn_ptr->next = NULL;
 
-    rh = credis_connect (rn->host, rn->port, rn->timeout);
-    if (rh == NULL)
-    {
-      ERROR ("redis plugin: unable to connect to node `%s' (%s:%d).", rn->name, rn->host, rn->port);
-      continue;
-    }
+    ssnprintf (cb_name, sizeof (cb_name), "redis/%s", rn_ptr->name);
 
-    if (strlen (rn->passwd) > 0)
-    {
-      DEBUG ("redis plugin: authenticanting node `%s' passwd(%s).", rn->name, rn->passwd);
-      status = credis_auth(rh, rn->passwd);
-      if (status != 0)
-      {
-        WARNING ("redis plugin: unable to authenticate on node `%s'.", rn->name);
-        credis_close (rh);
-        continue;
-      }
-    }
+    memset (&ud, 0, sizeof (ud));
+    ud.data = rn_ptr;
+    ud.free_func = redis_node_free;
 
-    memset (&info, 0, sizeof (info));
-    status = credis_info (rh, &info);
+    status = plugin_register_complex_read (/* group = */ "redis",
+        /* name      = */ cb_name,
+        /* callback  = */ redis_read,
+        /* interval  = */ NULL,
+        /* user_data = */ &ud);
+    /* The node is only freed by the read callback once it has been
+     * registered. */
     if (status != 0)
     {
-      WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
-      credis_close (rh);
-      continue;
+      ERROR ("redis plugin: Registering the read callback for node "
+          "\"%s\" failed.", rn_ptr->name);
+      redis_node_free (rn_ptr);
     }
 
-    /* typedef struct _cr_info {
-     *   char redis_version[CREDIS_VERSION_STRING_SIZE];
-     *   int bgsave_in_progress;
-     *   int connected_clients;
-     *   int connected_slaves;
-     *   unsigned int used_memory;
-     *   long long changes_since_last_save;
-     *   int last_save_time;
-     *   long long total_connections_received;
-     *   long long total_commands_processed;
-     *   int uptime_in_seconds;
-     *   int uptime_in_days;
-     *   int role;
-     * } REDIS_INFO; */
-
-    DEBUG ("redis plugin: received info from node `%s': connected_clients = %d; "
-        "connected_slaves = %d; used_memory = %lu; changes_since_last_save = %lld; "
-        "bgsave_in_progress = %d; total_connections_received = %lld; "
-        "total_commands_processed = %lld; uptime_in_seconds = %ld", rn->name,
-        info.connected_clients, info.connected_slaves, info.used_memory,
-        info.changes_since_last_save, info.bgsave_in_progress,
-        info.total_connections_received, info.total_commands_processed,
-        info.uptime_in_seconds);
-
-    redis_submit_g (rn->name, "current_connections", "clients", info.connected_clients);
-    redis_submit_g (rn->name, "current_connections", "slaves", info.connected_slaves);
-    redis_submit_g (rn->name, "memory", "used", info.used_memory);
-    redis_submit_g (rn->name, "volatile_changes", NULL, info.changes_since_last_save);
-    redis_submit_d (rn->name, "total_connections", NULL, info.total_connections_received);
-    redis_submit_d (rn->name, "total_operations", NULL, info.total_commands_processed);
-
-    credis_close (rh);
+    rn_ptr = next;
   }
 
-  return 0;
-}
-/* }}} */
+  return (0);
+} /* }}} int redis_init */
 
 void module_register (void) /* {{{ */
 {
   plugin_register_complex_config ("redis", redis_config);
   plugin_register_init ("redis", redis_init);
-  plugin_register_read ("redis", redis_read);
   /* TODO: plugin_register_write: one redis list per value id with
    * X elements */
 }
@@ -48,7 +48,9 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions = */ NULL,
 	/* consolidation_functions_num = */ 0,
 
-	/* async = */ 0
+	/* async = */ 0,
+	/* async_threads = */ 0,
+	/* creates_per_second = */ 0.0
 };
 
 /*
@@ -243,6 +245,23 @@ static int rc_config (oconfig_item_t *ci)
       status = cf_util_get_boolean (child, &config_create_files);
     else if (strcasecmp ("CreateFilesAsync", key) == 0)
       status = cf_util_get_boolean (child, &rrdcreate_config.async);
+    else if (strcasecmp ("CreateFilesThreads", key) == 0)
+      status = rc_config_get_int_positive (child,
+          &rrdcreate_config.async_threads);
+    else if (strcasecmp ("CreatesPerSecond", key) == 0)
+    {
+      double tmp = 0.0;
+
+      status = cf_util_get_double (child, &tmp);
+      if ((status == 0) && (tmp < 0.0))
+      {
+        ERROR ("rrdcached plugin: The \"CreatesPerSecond\" option must "
+            "be greater than or equal to zero.");
+        status = -1;
+      }
+      else if (status == 0)
+        rrdcreate_config.creates_per_second = tmp;
+    }
     else if (strcasecmp ("CollectStatistics", key) == 0)
       status = cf_util_get_boolean (child, &config_collect_stats);
     else if (strcasecmp ("StepSize", key) == 0)
@@ -522,6 +541,9 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  if (rrdcreate_config.async)
+    cu_rrd_create_shutdown ();
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -29,6 +29,7 @@
 #include "utils_avltree.h"
 #include "utils_random.h"
 #include "utils_rrdcreate.h"
+#include "utils_rrdmmap.h"
 
 #include <rrd.h>
 
@@ -39,10 +40,21 @@
 /*
  * Private types
  */
+/* Pending updates are kept in binary form, in a ring buffer of "values_size"
+ * slots which is only grown, never shrunk. Slot "i" consists of "times[i]"
+ * and the "ds_num" values starting at "values[i * ds_num]". The strings
+ * handed to librrd are built by the queue thread when writing the file. */
 struct rrd_cache_s
 {
-	int      values_num;
-	char   **values;
+	int       values_num;
+	int       values_size;
+	int       values_first;
+	cdtime_t *times;
+	value_t  *values;
+
+	int       ds_num;
+	int      *ds_types;
+
 	cdtime_t first_value;
 	cdtime_t last_value;
 	int64_t  random_variation;
@@ -69,6 +81,28 @@ struct rrd_queue_s
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Used by the queue thread to copy updates out of the cache and to format
+ * them for librrd. The buffers are reused for all files and only grown. */
+struct rrd_write_buffer_s
+{
+	int       values_num;
+	int       slots_size;
+	cdtime_t *times;
+	size_t   *offsets;
+	char    **argv;
+
+	value_t  *values;
+	size_t    values_size;
+
+	int       ds_num;
+	int       ds_size;
+	int      *ds_types;
+
+	char     *strings;
+	size_t    strings_size;
+};
+typedef struct rrd_write_buffer_s rrd_write_buffer_t;
+
 /*
  * Private variables
  */
@@ -77,9 +111,13 @@ static const char *config_keys[] =
 	"CacheTimeout",
 	"CacheFlush",
 	"CreateFilesAsync",
+	"CreateFilesThreads",
+	"CreatesPerSecond",
 	"DataDir",
 	"StepSize",
 	"HeartBeat",
+	"MmapFiles",
+	"MmapSyncInterval",
 	"RRARows",
 	"RRATimespan",
 	"XFF",
@@ -93,6 +131,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
  * being used. */
 static char *datadir   = NULL;
 static double write_rate = 0.0;
+static int mmap_files = 0;
+static cdtime_t mmap_sync_interval = TIME_T_TO_CDTIME_T (60);
+static rrd_mmap_t *mmap_cache = NULL;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -106,7 +147,9 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions = */ NULL,
 	/* consolidation_functions_num = */ 0,
 
-	/* async = */ 0
+	/* async = */ 0,
+	/* async_threads = */ 0,
+	/* creates_per_second = */ 0.0
 };
 
 /* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
@@ -198,90 +241,46 @@ static int srrd_update (char *filename, char *template,
 } /* int srrd_update */
 #endif /* !HAVE_THREADSAFE_LIBRRD */
 
-static int value_list_to_string_multiple (char *buffer, int buffer_len,
-		const data_set_t *ds, const value_list_t *vl)
+/* Formats one update in the "<time>:<value>[:<value>...]" format expected by
+ * librrd. Returns the number of bytes written, excluding the terminating null
+ * byte, or -1 if the buffer is too small. */
+static int rrd_format_update (char *buffer, size_t buffer_size, /* {{{ */
+		cdtime_t t, const value_t *values,
+		const int *ds_types, int ds_num)
 {
-	int offset;
+	size_t offset;
 	int status;
-	time_t tt;
 	int i;
 
-	memset (buffer, '\0', buffer_len);
-
-	tt = CDTIME_T_TO_TIME_T (vl->time);
-	status = ssnprintf (buffer, buffer_len, "%u", (unsigned int) tt);
-	if ((status < 1) || (status >= buffer_len))
+	status = snprintf (buffer, buffer_size, "%u",
+			(unsigned int) CDTIME_T_TO_TIME_T (t));
+	if ((status < 1) || ((size_t) status >= buffer_size))
 		return (-1);
-	offset = status;
+	offset = (size_t) status;
 
-	for (i = 0; i < ds->ds_num; i++)
+	for (i = 0; i < ds_num; i++)
 	{
-		if ((ds->ds[i].type != DS_TYPE_COUNTER)
-				&& (ds->ds[i].type != DS_TYPE_GAUGE)
-				&& (ds->ds[i].type != DS_TYPE_DERIVE)
-				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
+		if (ds_types[i] == DS_TYPE_COUNTER)
+			status = snprintf (buffer + offset, buffer_size - offset,
+					":%llu", values[i].counter);
+		else if (ds_types[i] == DS_TYPE_GAUGE)
+			status = snprintf (buffer + offset, buffer_size - offset,
+					":%lf", values[i].gauge);
+		else if (ds_types[i] == DS_TYPE_DERIVE)
+			status = snprintf (buffer + offset, buffer_size - offset,
+					":%"PRIi64, values[i].derive);
+		else /* if (ds_types[i] == DS_TYPE_ABSOLUTE) */
+			status = snprintf (buffer + offset, buffer_size - offset,
+					":%"PRIu64, values[i].absolute);
+
+		if ((status < 1) || ((size_t) status >= (buffer_size - offset)))
 			return (-1);
 
-		if (ds->ds[i].type == DS_TYPE_COUNTER)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%llu", vl->values[i].counter);
-		else if (ds->ds[i].type == DS_TYPE_GAUGE)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%lf", vl->values[i].gauge);
-		else if (ds->ds[i].type == DS_TYPE_DERIVE)
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIi64, vl->values[i].derive);
-		else /*if (ds->ds[i].type == DS_TYPE_ABSOLUTE) */
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIu64, vl->values[i].absolute);
-
-		if ((status < 1) || (status >= (buffer_len - offset)))
-			return (-1);
-
-		offset += status;
-	} /* for ds->ds_num */
-
-	return (0);
-} /* int value_list_to_string_multiple */
-
-static int value_list_to_string (char *buffer, int buffer_len,
-		const data_set_t *ds, const value_list_t *vl)
-{
-	int status;
-	time_t tt;
-
-	if (ds->ds_num != 1)
-		return (value_list_to_string_multiple (buffer, buffer_len,
-					ds, vl));
-
-	tt = CDTIME_T_TO_TIME_T (vl->time);
-	switch (ds->ds[0].type)
-	{
-		case DS_TYPE_DERIVE:
-			status = ssnprintf (buffer, buffer_len, "%u:%"PRIi64,
-				(unsigned) tt, vl->values[0].derive);
-			break;
-		case DS_TYPE_GAUGE:
-			status = ssnprintf (buffer, buffer_len, "%u:%lf",
-				(unsigned) tt, vl->values[0].gauge);
-			break;
-		case DS_TYPE_COUNTER:
-			status = ssnprintf (buffer, buffer_len, "%u:%llu",
-				(unsigned) tt, vl->values[0].counter);
-			break;
-		case DS_TYPE_ABSOLUTE:
-			status = ssnprintf (buffer, buffer_len, "%u:%"PRIu64,
-				(unsigned) tt, vl->values[0].absolute);
-			break;
-		default:
-			return (EINVAL);
-	}
-
-	if ((status < 1) || (status >= buffer_len))
-		return (ENOMEM);
+		offset += (size_t) status;
+	} /* for (i = 0; i < ds_num; i++) */
 
-	return (0);
-} /* int value_list_to_string */
+	return ((int) offset);
+} /* }}} int rrd_format_update */
 
 static int value_list_to_filename (char *buffer, size_t buffer_size,
 		value_list_t const *vl)
@@ -321,24 +320,217 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 	return (0);
 } /* int value_list_to_filename */
 
+/* Copies the updates in the ring buffer of "rc" to "times" and "values",
+ * oldest first. */
+static void rrd_cache_copy (const rrd_cache_t *rc, /* {{{ */
+		cdtime_t *times, value_t *values)
+{
+	int head_num;
+	int tail_num;
+
+	head_num = rc->values_size - rc->values_first;
+	if (head_num > rc->values_num)
+		head_num = rc->values_num;
+	tail_num = rc->values_num - head_num;
+
+	memcpy (times, rc->times + rc->values_first,
+			head_num * sizeof (*times));
+	memcpy (values, rc->values + rc->values_first * rc->ds_num,
+			head_num * rc->ds_num * sizeof (*values));
+	if (tail_num > 0)
+	{
+		memcpy (times + head_num, rc->times,
+				tail_num * sizeof (*times));
+		memcpy (values + head_num * rc->ds_num, rc->values,
+				tail_num * rc->ds_num * sizeof (*values));
+	}
+} /* }}} void rrd_cache_copy */
+
+/* Grows the ring buffer of "rc" so that it can hold at least "size"
+ * updates. */
+static int rrd_cache_grow (rrd_cache_t *rc, int size) /* {{{ */
+{
+	cdtime_t *times;
+	value_t *values;
+
+	if (size <= rc->values_size)
+		return (0);
+
+	times = malloc (size * sizeof (*times));
+	values = malloc (size * rc->ds_num * sizeof (*values));
+	if ((times == NULL) || (values == NULL))
+	{
+		sfree (times);
+		sfree (values);
+		return (ENOMEM);
+	}
+
+	if (rc->values_num > 0)
+		rrd_cache_copy (rc, times, values);
+
+	sfree (rc->times);
+	sfree (rc->values);
+	rc->times = times;
+	rc->values = values;
+	rc->values_size = size;
+	rc->values_first = 0;
+
+	return (0);
+} /* }}} int rrd_cache_grow */
+
+static void rrd_cache_entry_free (rrd_cache_t *rc) /* {{{ */
+{
+	if (rc == NULL)
+		return;
+
+	sfree (rc->times);
+	sfree (rc->values);
+	sfree (rc->ds_types);
+	sfree (rc);
+} /* }}} void rrd_cache_entry_free */
+
+/* Moves all updates of "rc" to the write buffer. You must hold "cache_lock"
+ * when calling this function. */
+static int rrd_write_buffer_take (rrd_write_buffer_t *wb, /* {{{ */
+		rrd_cache_t *rc)
+{
+	size_t values_num = (size_t) (rc->values_num * rc->ds_num);
+
+	if (wb->slots_size < rc->values_num)
+	{
+		cdtime_t *times;
+		size_t *offsets;
+		char **argv;
+
+		times = realloc (wb->times, rc->values_num * sizeof (*times));
+		if (times == NULL)
+			return (ENOMEM);
+		wb->times = times;
+
+		offsets = realloc (wb->offsets,
+				rc->values_num * sizeof (*offsets));
+		if (offsets == NULL)
+			return (ENOMEM);
+		wb->offsets = offsets;
+
+		argv = realloc (wb->argv, (rc->values_num + 1) * sizeof (*argv));
+		if (argv == NULL)
+			return (ENOMEM);
+		wb->argv = argv;
+
+		wb->slots_size = rc->values_num;
+	}
+
+	if (wb->values_size < values_num)
+	{
+		value_t *values;
+
+		values = realloc (wb->values, values_num * sizeof (*values));
+		if (values == NULL)
+			return (ENOMEM);
+		wb->values = values;
+		wb->values_size = values_num;
+	}
+
+	if (wb->ds_size < rc->ds_num)
+	{
+		int *ds_types;
+
+		ds_types = realloc (wb->ds_types,
+				rc->ds_num * sizeof (*ds_types));
+		if (ds_types == NULL)
+			return (ENOMEM);
+		wb->ds_types = ds_types;
+		wb->ds_size = rc->ds_num;
+	}
+
+	rrd_cache_copy (rc, wb->times, wb->values);
+	memcpy (wb->ds_types, rc->ds_types, rc->ds_num * sizeof (*wb->ds_types));
+	wb->values_num = rc->values_num;
+	wb->ds_num = rc->ds_num;
+
+	rc->values_num = 0;
+	rc->values_first = 0;
+
+	return (0);
+} /* }}} int rrd_write_buffer_take */
+
+/* Formats the updates in the write buffer and points "wb->argv" at the
+ * resulting strings. Returns the number of strings. */
+static int rrd_write_buffer_format (rrd_write_buffer_t *wb) /* {{{ */
+{
+	size_t offset = 0;
+	int argc = 0;
+	int i;
+
+	if (wb->strings_size == 0)
+	{
+		wb->strings = malloc (4096);
+		if (wb->strings == NULL)
+			return (-1);
+		wb->strings_size = 4096;
+	}
+
+	for (i = 0; i < wb->values_num; i++)
+	{
+		int status;
+
+		status = rrd_format_update (wb->strings + offset,
+				wb->strings_size - offset, wb->times[i],
+				wb->values + i * wb->ds_num,
+				wb->ds_types, wb->ds_num);
+		if (status < 0)
+		{
+			char *tmp;
+
+			tmp = realloc (wb->strings, 2 * wb->strings_size);
+			if (tmp == NULL)
+				break;
+			wb->strings = tmp;
+			wb->strings_size *= 2;
+
+			i--;
+			continue;
+		}
+
+		wb->offsets[argc] = offset;
+		argc++;
+		offset += (size_t) status + 1;
+	}
+
+	for (i = 0; i < argc; i++)
+		wb->argv[i] = wb->strings + wb->offsets[i];
+	wb->argv[argc] = NULL;
+
+	return (argc);
+} /* }}} int rrd_write_buffer_format */
+
+static void rrd_write_buffer_free (rrd_write_buffer_t *wb) /* {{{ */
+{
+	sfree (wb->times);
+	sfree (wb->values);
+	sfree (wb->ds_types);
+	sfree (wb->strings);
+	sfree (wb->offsets);
+	sfree (wb->argv);
+	memset (wb, 0, sizeof (*wb));
+} /* }}} void rrd_write_buffer_free */
+
 static void *rrd_queue_thread (void __attribute__((unused)) *data)
 {
+	rrd_write_buffer_t wb;
         struct timeval tv_next_update;
         struct timeval tv_now;
 
+	memset (&wb, 0, sizeof (wb));
         gettimeofday (&tv_next_update, /* timezone = */ NULL);
 
 	while (42)
 	{
 		rrd_queue_t *queue_entry;
 		rrd_cache_t *cache_entry;
-		char **values;
 		int    values_num;
 		int    status;
-		int    i;
-
-		values = NULL;
-		values_num = 0;
 
                 pthread_mutex_lock (&queue_lock);
                 /* Wait for values to arrive */
@@ -422,13 +614,27 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		status = c_avl_get (cache, queue_entry->filename,
 				(void *) &cache_entry);
 
-		if (status == 0)
+		/* The file is still being created: Leave the values in the
+		 * cache. The entry will be queued again with the next value
+		 * or flush. */
+		if ((status == 0) && rrdcreate_config.async
+				&& cu_rrd_create_pending (queue_entry->filename))
 		{
-			values = cache_entry->values;
-			values_num = cache_entry->values_num;
-
-			cache_entry->values = NULL;
-			cache_entry->values_num = 0;
+			DEBUG ("rrdtool plugin: queue thread: %s is being "
+					"created, holding back %i value%s.",
+					queue_entry->filename,
+					cache_entry->values_num,
+					(cache_entry->values_num == 1) ? "" : "s");
+			cache_entry->flags = FLAG_NONE;
+			status = -1;
+		}
+		else if (status == 0)
+		{
+			status = rrd_write_buffer_take (&wb, cache_entry);
+			if (status != 0)
+				ERROR ("rrdtool plugin: queue thread: "
+						"Allocating the write buffer "
+						"failed.");
 			cache_entry->flags = FLAG_NONE;
 		}
 
@@ -456,21 +662,32 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                 }
 
 		/* Write the values to the RRD-file */
-		srrd_update (queue_entry->filename, NULL,
-				values_num, (const char **)values);
+		values_num = rrd_write_buffer_format (&wb);
+		if (values_num > 0)
+		{
+			/* Files and updates the native updater can't handle
+			 * are left untouched and passed on to librrd. */
+			status = ENOTSUP;
+			if (mmap_cache != NULL)
+				status = rrd_mmap_update (mmap_cache,
+						queue_entry->filename,
+						values_num,
+						(const char **) wb.argv);
+			if (status == ENOTSUP)
+				srrd_update (queue_entry->filename, NULL,
+						values_num,
+						(const char **) wb.argv);
+		}
 		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
 				values_num, (values_num == 1) ? "" : "s",
 				queue_entry->filename);
 
-		for (i = 0; i < values_num; i++)
-		{
-			sfree (values[i]);
-		}
-		sfree (values);
 		sfree (queue_entry->filename);
 		sfree (queue_entry);
 	} /* while (42) */
 
+	rrd_write_buffer_free (&wb);
+
 	pthread_exit ((void *) 0);
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
@@ -616,10 +833,9 @@ static void rrd_cache_flush (cdtime_t timeout)
 			continue;
 		}
 
-		assert (rc->values == NULL);
 		assert (rc->values_num == 0);
 
-		sfree (rc);
+		rrd_cache_entry_free (rc);
 		sfree (key);
 		keys[i] = NULL;
 	} /* for (i = 0..keys_num) */
@@ -709,12 +925,63 @@ static int64_t rrd_get_random_variation (void)
   return ((int64_t) cdrand_range (min, max));
 } /* int64_t rrd_get_random_variation */
 
+static rrd_cache_t *rrd_cache_entry_create (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl)
+{
+	rrd_cache_t *rc;
+	int size;
+	int i;
+
+	rc = calloc (1, sizeof (*rc));
+	if (rc == NULL)
+		return (NULL);
+
+	rc->ds_num = ds->ds_num;
+	rc->ds_types = calloc ((size_t) ds->ds_num, sizeof (*rc->ds_types));
+	if (rc->ds_types == NULL)
+	{
+		rrd_cache_entry_free (rc);
+		return (NULL);
+	}
+
+	for (i = 0; i < ds->ds_num; i++)
+	{
+		if ((ds->ds[i].type != DS_TYPE_COUNTER)
+				&& (ds->ds[i].type != DS_TYPE_GAUGE)
+				&& (ds->ds[i].type != DS_TYPE_DERIVE)
+				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
+		{
+			ERROR ("rrdtool plugin: Unknown data source type: %i",
+					ds->ds[i].type);
+			rrd_cache_entry_free (rc);
+			return (NULL);
+		}
+		rc->ds_types[i] = ds->ds[i].type;
+	}
+
+	/* Size the ring buffer for the updates expected within one
+	 * "CacheTimeout", so it usually doesn't have to grow. */
+	size = 2;
+	if (vl->interval > 0)
+		size += (int) ((cache_timeout + random_timeout) / vl->interval);
+	if (rrd_cache_grow (rc, size) != 0)
+	{
+		rrd_cache_entry_free (rc);
+		return (NULL);
+	}
+
+	rc->random_variation = rrd_get_random_variation ();
+	rc->flags = FLAG_NONE;
+
+	return (rc);
+} /* }}} rrd_cache_t *rrd_cache_entry_create */
+
 static int rrd_cache_insert (const char *filename,
-		const char *value, cdtime_t value_time)
+		const data_set_t *ds, const value_list_t *vl)
 {
 	rrd_cache_t *rc = NULL;
 	int new_rc = 0;
-	char **values_new;
+	int slot;
 
 	pthread_mutex_lock (&cache_lock);
 
@@ -731,55 +998,51 @@ static int rrd_cache_insert (const char *filename,
 
 	if (rc == NULL)
 	{
-		rc = malloc (sizeof (*rc));
+		rc = rrd_cache_entry_create (ds, vl);
 		if (rc == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
 			return (-1);
-		rc->values_num = 0;
-		rc->values = NULL;
-		rc->first_value = 0;
-		rc->last_value = 0;
-		rc->random_variation = rrd_get_random_variation ();
-		rc->flags = FLAG_NONE;
+		}
 		new_rc = 1;
 	}
+	else if (rc->ds_num != ds->ds_num)
+	{
+		pthread_mutex_unlock (&cache_lock);
+		ERROR ("rrdtool plugin: rrd_cache_insert: %s: Expected %i "
+				"values, got %i.", filename, rc->ds_num, ds->ds_num);
+		return (-1);
+	}
 
-	if (rc->last_value >= value_time)
+	if (rc->last_value >= vl->time)
 	{
 		pthread_mutex_unlock (&cache_lock);
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
-				rc->last_value, value_time);
+				rc->last_value, vl->time);
+		if (new_rc)
+			rrd_cache_entry_free (rc);
 		return (-1);
 	}
 
-	values_new = (char **) realloc ((void *) rc->values,
-			(rc->values_num + 1) * sizeof (char *));
-	if (values_new == NULL)
+	if ((rc->values_num == rc->values_size)
+			&& (rrd_cache_grow (rc, 2 * rc->values_size) != 0))
 	{
-		char errbuf[1024];
-		void *cache_key = NULL;
-
-		sstrerror (errno, errbuf, sizeof (errbuf));
-
-		c_avl_remove (cache, filename, &cache_key, NULL);
 		pthread_mutex_unlock (&cache_lock);
-
-		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
-
-		sfree (cache_key);
-		sfree (rc->values);
-		sfree (rc);
+		ERROR ("rrdtool plugin: rrd_cache_insert: Growing the "
+				"cache of %s failed.", filename);
 		return (-1);
 	}
-	rc->values = values_new;
 
-	rc->values[rc->values_num] = strdup (value);
-	if (rc->values[rc->values_num] != NULL)
-		rc->values_num++;
+	slot = (rc->values_first + rc->values_num) % rc->values_size;
+	rc->times[slot] = vl->time;
+	memcpy (rc->values + slot * rc->ds_num, vl->values,
+			rc->ds_num * sizeof (*rc->values));
+	rc->values_num++;
 
 	if (rc->values_num == 1)
-		rc->first_value = value_time;
-	rc->last_value = value_time;
+		rc->first_value = vl->time;
+	rc->last_value = vl->time;
 
 	/* Insert if this is the first value */
 	if (new_rc == 1)
@@ -795,9 +1058,7 @@ static int rrd_cache_insert (const char *filename,
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
-			sfree (rc->values[0]);
-			sfree (rc->values);
-			sfree (rc);
+			rrd_cache_entry_free (rc);
 			return (-1);
 		}
 
@@ -856,7 +1117,6 @@ static int rrd_cache_destroy (void) /* {{{ */
   while (c_avl_pick (cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
-    int i;
 
     sfree (key);
     key = NULL;
@@ -867,10 +1127,7 @@ static int rrd_cache_destroy (void) /* {{{ */
     if (rc->values_num > 0)
       non_empty++;
 
-    for (i = 0; i < rc->values_num; i++)
-      sfree (rc->values[i]);
-    sfree (rc->values);
-    sfree (rc);
+    rrd_cache_entry_free (rc);
   }
 
   c_avl_destroy (cache);
@@ -909,7 +1166,6 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 {
 	struct stat  statbuf;
 	char         filename[512];
-	char         values[512];
 	int          status;
 
 	if (do_shutdown)
@@ -923,19 +1179,17 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 	if (value_list_to_filename (filename, sizeof (filename), vl) != 0)
 		return (-1);
 
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
-		return (-1);
-
 	if (stat (filename, &statbuf) == -1)
 	{
 		if (errno == ENOENT)
 		{
+			/* With "CreateFilesAsync" the file is only queued for
+			 * creation. The value is kept in the cache until the
+			 * file exists, see rrd_queue_thread(). */
 			status = cu_rrd_create_file (filename,
 					ds, vl, &rrdcreate_config);
 			if (status != 0)
 				return (-1);
-			else if (rrdcreate_config.async)
-				return (0);
 		}
 		else
 		{
@@ -953,7 +1207,7 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		return (-1);
 	}
 
-	status = rrd_cache_insert (filename, values, vl->time);
+	status = rrd_cache_insert (filename, ds, vl);
 
 	return (status);
 } /* int rrd_write */
@@ -1041,6 +1295,50 @@ static int rrd_config (const char *key, const char *value)
 		else
 			rrdcreate_config.async = 0;
 	}
+	else if (strcasecmp ("CreateFilesThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			ERROR ("rrdtool plugin: `CreateFilesThreads' must "
+					"be greater than 0.");
+			return (1);
+		}
+		rrdcreate_config.async_threads = tmp;
+	}
+	else if (strcasecmp ("CreatesPerSecond", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			ERROR ("rrdtool plugin: `CreatesPerSecond' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		rrdcreate_config.creates_per_second = tmp;
+	}
+	else if (strcasecmp ("MmapFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			ERROR ("rrdtool plugin: `MmapFiles' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		mmap_files = tmp;
+	}
+	else if (strcasecmp ("MmapSyncInterval", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			ERROR ("rrdtool plugin: `MmapSyncInterval' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		mmap_sync_interval = DOUBLE_TO_CDTIME_T (tmp);
+	}
 	else if (strcasecmp ("RRARows", key) == 0)
 	{
 		int tmp = atoi (value);
@@ -1180,6 +1478,14 @@ static int rrd_shutdown (void)
 		DEBUG ("rrdtool plugin: queue_thread exited.");
 	}
 
+	/* Stop the threads creating files in the background. */
+	if (rrdcreate_config.async)
+		cu_rrd_create_shutdown ();
+
+	/* The queue thread is gone, so nobody is using the mappings anymore. */
+	rrd_mmap_destroy (mmap_cache);
+	mmap_cache = NULL;
+
 	rrd_cache_destroy ();
 
 	return (0);
@@ -1217,6 +1523,16 @@ static int rrd_init (void)
 
 	pthread_mutex_unlock (&cache_lock);
 
+	if (mmap_files > 0)
+	{
+		mmap_cache = rrd_mmap_create ((size_t) mmap_files,
+				mmap_sync_interval);
+		if (mmap_cache == NULL)
+			WARNING ("rrdtool plugin: Setting up the native updater "
+					"failed. All files will be updated "
+					"using librrd.");
+	}
+
 	status = plugin_thread_create (&queue_thread, /* attr = */ NULL,
 			rrd_queue_thread, /* args = */ NULL);
 	if (status != 0)
@@ -0,0 +1,839 @@
+/**
+ * collectd - src/shm_ingest.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Receives value lists from processes on the same host through ring buffers
+ * in shared memory, see "libcollectdclient/shm_ring.h" for the layout.
+ * Producers create their rings with lcc_shm_create() in the directory
+ * configured here. A single thread discovers new rings, reads records from
+ * all of them and dispatches the value lists in batches. When there is no
+ * data, the thread sleeps for increasing periods of time, up to
+ * "PollInterval".
+ *
+ * Producers can modify the rings at any time, so every field is checked
+ * after it has been read. If a producer truncates its ring, reading the
+ * mapping raises SIGBUS; the reader thread catches that signal and ignores
+ * the ring from then on.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+
+#include "libcollectdclient/network_codec.h"
+#include "libcollectdclient/shm_ring.h"
+
+#include <pthread.h>
+#include <dirent.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <arpa/inet.h> /* ntohs */
+
+#define SI_DEFAULT_DIRECTORY LOCALSTATEDIR"/run/"PACKAGE_NAME"-shm"
+
+/* Maximum number of value lists passed to plugin_dispatch_values_batch() at
+ * once and maximum number of values they may have in total. */
+#define SI_BATCH_SIZE 512
+#define SI_BATCH_VALUES 4096
+
+#define SI_SLEEP_MIN MS_TO_CDTIME_T (1)
+
+#define TYPE_HOST            0x0000
+#define TYPE_TIME_HR         0x0008
+#define TYPE_PLUGIN          0x0002
+#define TYPE_PLUGIN_INSTANCE 0x0003
+#define TYPE_TYPE            0x0004
+#define TYPE_TYPE_INSTANCE   0x0005
+#define TYPE_VALUES          0x0006
+#define TYPE_INTERVAL_HR     0x0009
+
+/*
+ * Private data types
+ */
+struct si_ring_s;
+typedef struct si_ring_s si_ring_t;
+struct si_ring_s
+{
+  char *name;
+
+  /* NULL if the file is not a valid ring. It is ignored until it is
+   * removed. */
+  lcc_shm_header_t *header;
+  char *data;
+  uint64_t data_size;
+  size_t map_size;
+  /* Kept open to check whether the file has been truncated. */
+  int fd;
+
+  uint64_t tail;
+  lcc_shm_state_t state;
+  /* Number of values dropped by the producer, as of the last read. */
+  uint64_t dropped;
+
+  _Bool seen;
+  si_ring_t *next;
+};
+
+struct si_batch_s
+{
+  value_list_t vl[SI_BATCH_SIZE];
+  size_t vl_num;
+  value_t values[SI_BATCH_VALUES];
+  size_t values_num;
+};
+typedef struct si_batch_s si_batch_t;
+
+/*
+ * Private variables
+ */
+static char *si_directory = NULL;
+static int si_directory_perms = S_IRWXU | S_IRWXG;
+static cdtime_t si_poll_interval = 0;
+
+/* Only accessed by the reader thread. */
+static si_ring_t *si_rings = NULL;
+static si_batch_t si_batch;
+
+static pthread_t si_thread;
+static _Bool si_thread_running = 0;
+static _Bool si_loop = 0;
+static pthread_mutex_t si_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t si_cond = PTHREAD_COND_INITIALIZER;
+
+/* Statistics, updated by the reader thread. "si_dropped_closed" holds the
+ * number of values dropped by producers of rings which have been removed. */
+static uint64_t si_received = 0;
+static uint64_t si_invalid = 0;
+static uint64_t si_dropped = 0;
+static uint64_t si_dropped_closed = 0;
+
+/* Set while the reader thread accesses a ring, see si_ring_guard(). */
+static volatile sig_atomic_t si_sigbus_armed = 0;
+static sigjmp_buf si_sigbus_env;
+static struct sigaction si_sigbus_old;
+static _Bool si_sigbus_installed = 0;
+
+/*
+ * Private functions
+ */
+static void si_ring_unmap (si_ring_t *r) /* {{{ */
+{
+  if (r->header != NULL)
+    munmap (r->header, r->map_size);
+  r->header = NULL;
+  r->data = NULL;
+
+  if (r->fd >= 0)
+    close (r->fd);
+  r->fd = -1;
+} /* }}} void si_ring_unmap */
+
+static void si_ring_free (si_ring_t *r) /* {{{ */
+{
+  if (r == NULL)
+    return;
+
+  si_ring_unmap (r);
+  sfree (r->name);
+  sfree (r);
+} /* }}} void si_ring_free */
+
+/* Stops reading a ring because it is not valid. */
+static void si_ring_invalid (si_ring_t *r, char const *reason) /* {{{ */
+{
+  ERROR ("shm_ingest plugin: Ignoring \"%s/%s\": %s",
+      si_directory, r->name, reason);
+  si_ring_unmap (r);
+} /* }}} void si_ring_invalid */
+
+static void si_sigbus_handler (int signum) /* {{{ */
+{
+  if (si_sigbus_armed && pthread_equal (pthread_self (), si_thread))
+    siglongjmp (si_sigbus_env, 1);
+
+  /* Not caused by reading a ring: restore the previous action, which
+   * handles the signal when the faulting instruction is executed again. */
+  sigaction (signum, &si_sigbus_old, /* oldact = */ NULL);
+} /* }}} void si_sigbus_handler */
+
+/* Calls "callback", which accesses the mapping of "r". If the producer has
+ * truncated the file, the access raises SIGBUS and the ring is ignored until
+ * it is removed. Returns the callback's return value or -1 in that case. */
+static int si_ring_guard (si_ring_t *r, /* {{{ */
+    int (*callback) (si_ring_t *, void *), void *arg)
+{
+  int status;
+
+  /* The handler is installed with SA_NODEFER, so the signal mask does not
+   * need to be restored, which would take a system call. */
+  if (sigsetjmp (si_sigbus_env, /* savemask = */ 0) != 0)
+  {
+    si_sigbus_armed = 0;
+    si_ring_invalid (r, "The file has been truncated.");
+    return (-1);
+  }
+
+  si_sigbus_armed = 1;
+  status = (*callback) (r, arg);
+  si_sigbus_armed = 0;
+
+  return (status);
+} /* }}} int si_ring_guard */
+
+/* Returns true if the file is smaller than the mapping, i.e. accessing the
+ * end of the mapping would raise SIGBUS. */
+static _Bool si_ring_truncated (si_ring_t const *r) /* {{{ */
+{
+  struct stat statbuf;
+
+  if (fstat (r->fd, &statbuf) != 0)
+    return (1);
+
+  return (statbuf.st_size < (off_t) r->map_size);
+} /* }}} _Bool si_ring_truncated */
+
+/* Checks the header of a newly mapped ring and loads the reader's state. */
+static int si_ring_load (si_ring_t *r, /* {{{ */
+    void __attribute__((unused)) *arg)
+{
+  r->data_size = r->header->data_size;
+
+  if ((LCC_SHM_LOAD (&r->header->magic) != LCC_SHM_MAGIC)
+      || (r->header->version != LCC_SHM_VERSION))
+  {
+    si_ring_invalid (r, "Unknown file format.");
+    return (-1);
+  }
+  if ((r->data_size == 0) || ((r->data_size & (r->data_size - 1)) != 0)
+      || ((LCC_SHM_HEADER_SIZE + r->data_size) != (uint64_t) r->map_size))
+  {
+    si_ring_invalid (r, "Invalid size.");
+    return (-1);
+  }
+
+  /* Continue where the previous instance of the daemon stopped. */
+  r->tail = LCC_SHM_LOAD (&r->header->tail);
+  memcpy (&r->state, &r->header->state, sizeof (r->state));
+  r->state.host[sizeof (r->state.host) - 1] = 0;
+  r->state.plugin[sizeof (r->state.plugin) - 1] = 0;
+  r->state.plugin_instance[sizeof (r->state.plugin_instance) - 1] = 0;
+  r->state.type[sizeof (r->state.type) - 1] = 0;
+  r->state.type_instance[sizeof (r->state.type_instance) - 1] = 0;
+  r->dropped = r->header->dropped;
+
+  DEBUG ("shm_ingest plugin: Reading \"%s/%s\" (%"PRIu64" bytes) of process "
+      "%"PRIu64".", si_directory, r->name, r->data_size, r->header->pid);
+  return (0);
+} /* }}} int si_ring_load */
+
+static si_ring_t *si_ring_open (char const *name) /* {{{ */
+{
+  si_ring_t *r;
+  char path[PATH_MAX];
+  struct stat statbuf;
+
+  r = malloc (sizeof (*r));
+  if (r == NULL)
+    return (NULL);
+  memset (r, 0, sizeof (*r));
+  r->fd = -1;
+
+  r->name = strdup (name);
+  if (r->name == NULL)
+  {
+    sfree (r);
+    return (NULL);
+  }
+
+  ssnprintf (path, sizeof (path), "%s/%s", si_directory, name);
+  /* Anyone allowed to create files in the directory may put a FIFO, which
+   * would block open(2), or a symbolic link there. */
+  r->fd = open (path, O_RDWR | O_NONBLOCK | O_NOFOLLOW);
+  if (r->fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("shm_ingest plugin: open (%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (r);
+  }
+
+  if (fstat (r->fd, &statbuf) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("shm_ingest plugin: fstat (%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    si_ring_unmap (r);
+    return (r);
+  }
+  if (!S_ISREG (statbuf.st_mode))
+  {
+    si_ring_invalid (r, "Not a regular file.");
+    return (r);
+  }
+  if (statbuf.st_size < (off_t) (LCC_SHM_HEADER_SIZE + 8))
+  {
+    si_ring_invalid (r, "File is too small.");
+    return (r);
+  }
+
+  r->map_size = (size_t) statbuf.st_size;
+  r->header = mmap (/* addr = */ NULL, r->map_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, r->fd, /* offset = */ 0);
+  if (r->header == MAP_FAILED)
+  {
+    char errbuf[1024];
+    r->header = NULL;
+    ERROR ("shm_ingest plugin: mmap (%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    si_ring_unmap (r);
+    return (r);
+  }
+  r->data = ((char *) r->header) + LCC_SHM_HEADER_SIZE;
+
+  si_ring_guard (r, si_ring_load, /* arg = */ NULL);
+  return (r);
+} /* }}} si_ring_t *si_ring_open */
+
+/* Returns one if all records have been read and the producer is gone. */
+static int si_ring_finished (si_ring_t *r, /* {{{ */
+    void __attribute__((unused)) *arg)
+{
+  _Bool gone = 0;
+  uint32_t flags;
+
+  /* Check whether the producer is gone before looking at "head", so that a
+   * record written just before closing the ring is not missed. */
+  flags = *((volatile uint32_t *) &r->header->flags);
+  __sync_synchronize ();
+  if ((flags & LCC_SHM_FLAG_CLOSED) != 0)
+    gone = 1;
+  else if ((kill ((pid_t) r->header->pid, 0) != 0) && (errno == ESRCH))
+    gone = 1;
+
+  if (!gone)
+    return (0);
+
+  return (LCC_SHM_LOAD (&r->header->head) == r->tail);
+} /* }}} int si_ring_finished */
+
+/* Opens new rings and removes those of producers which are gone. */
+static void si_scan (void) /* {{{ */
+{
+  si_ring_t *r;
+  si_ring_t **prev;
+  DIR *dh;
+  struct dirent *de;
+  size_t suffix_len = strlen (LCC_SHM_SUFFIX);
+
+  dh = opendir (si_directory);
+  if (dh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("shm_ingest plugin: opendir (%s) failed: %s", si_directory,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return;
+  }
+
+  for (r = si_rings; r != NULL; r = r->next)
+    r->seen = 0;
+
+  while ((de = readdir (dh)) != NULL)
+  {
+    size_t len = strlen (de->d_name);
+
+    if ((len <= suffix_len)
+        || (strcmp (de->d_name + len - suffix_len, LCC_SHM_SUFFIX) != 0))
+      continue;
+
+    for (r = si_rings; r != NULL; r = r->next)
+      if (strcmp (r->name, de->d_name) == 0)
+        break;
+
+    if (r == NULL)
+    {
+      r = si_ring_open (de->d_name);
+      if (r == NULL)
+        continue;
+      r->next = si_rings;
+      si_rings = r;
+    }
+    r->seen = 1;
+  }
+  closedir (dh);
+
+  prev = &si_rings;
+  while ((r = *prev) != NULL)
+  {
+    if (r->seen && ((r->header == NULL)
+          || (si_ring_guard (r, si_ring_finished, /* arg = */ NULL) != 1)))
+    {
+      prev = &r->next;
+      continue;
+    }
+
+    if (r->seen)
+    {
+      char path[PATH_MAX];
+
+      ssnprintf (path, sizeof (path), "%s/%s", si_directory, r->name);
+      unlink (path);
+    }
+    si_dropped_closed += r->dropped;
+
+    *prev = r->next;
+    si_ring_free (r);
+  }
+} /* }}} void si_scan */
+
+static void si_batch_dispatch (void) /* {{{ */
+{
+  if (si_batch.vl_num == 0)
+    return;
+
+  plugin_dispatch_values_batch (si_batch.vl, si_batch.vl_num);
+  __sync_add_and_fetch (&si_received, (uint64_t) si_batch.vl_num);
+
+  si_batch.vl_num = 0;
+  si_batch.values_num = 0;
+} /* }}} void si_batch_dispatch */
+
+/* Adds a value list made up of the values in "part" and the identifier in
+ * "state" to the batch. */
+static int si_batch_add (lcc_shm_state_t const *state, /* {{{ */
+    char const *part, uint16_t part_len)
+{
+  value_list_t *vl;
+  uint16_t values_num;
+  uint8_t const *types;
+
+  if (part_len < LCC_NETWORK_VALUES_PART_SIZE (1))
+    return (-1);
+  memcpy (&values_num, part + LCC_NETWORK_PART_HEADER_SIZE,
+      sizeof (values_num));
+  values_num = ntohs (values_num);
+  if ((values_num == 0) || (values_num > SI_BATCH_VALUES)
+      || (part_len != LCC_NETWORK_VALUES_PART_SIZE (values_num)))
+    return (-1);
+  if ((state->plugin[0] == 0) || (state->type[0] == 0))
+    return (-1);
+
+  if ((si_batch.vl_num >= SI_BATCH_SIZE)
+      || ((si_batch.values_num + values_num) > SI_BATCH_VALUES))
+    si_batch_dispatch ();
+
+  vl = si_batch.vl + si_batch.vl_num;
+  memset (vl, 0, sizeof (*vl));
+  vl->values = si_batch.values + si_batch.values_num;
+  vl->values_len = (int) values_num;
+
+  types = (uint8_t const *) (part + LCC_NETWORK_PART_HEADER_SIZE
+      + sizeof (values_num));
+  if (lcc_network_decode_values (vl->values, types + values_num,
+        types, values_num) != 0)
+    return (-1);
+
+  sstrncpy (vl->host, (state->host[0] != 0) ? state->host : hostname_g,
+      sizeof (vl->host));
+  sstrncpy (vl->plugin, state->plugin, sizeof (vl->plugin));
+  sstrncpy (vl->plugin_instance, state->plugin_instance,
+      sizeof (vl->plugin_instance));
+  sstrncpy (vl->type, state->type, sizeof (vl->type));
+  sstrncpy (vl->type_instance, state->type_instance,
+      sizeof (vl->type_instance));
+  vl->time = (cdtime_t) state->time;
+  vl->interval = (cdtime_t) state->interval;
+
+  si_batch.vl_num++;
+  si_batch.values_num += values_num;
+  return (0);
+} /* }}} int si_batch_add */
+
+/* Decodes the parts of one record, updating "state". Since the record is in
+ * shared memory, every field is read exactly once before it is checked. */
+static int si_decode (lcc_shm_state_t *state, /* {{{ */
+    char const *buffer, size_t buffer_size)
+{
+  while (buffer_size >= LCC_NETWORK_PART_HEADER_SIZE)
+  {
+    uint16_t part_type;
+    uint16_t part_len;
+    char *field = NULL;
+    uint64_t *number = NULL;
+
+    memcpy (&part_type, buffer, sizeof (part_type));
+    memcpy (&part_len, buffer + sizeof (part_type), sizeof (part_len));
+    part_type = ntohs (part_type);
+    part_len = ntohs (part_len);
+    if (part_len == 0) /* alignment padding */
+      break;
+    if ((part_len < LCC_NETWORK_PART_HEADER_SIZE) || (part_len > buffer_size))
+      return (-1);
+
+    switch (part_type)
+    {
+      case TYPE_HOST:            field = state->host;            break;
+      case TYPE_PLUGIN:          field = state->plugin;          break;
+      case TYPE_PLUGIN_INSTANCE: field = state->plugin_instance; break;
+      case TYPE_TYPE:            field = state->type;            break;
+      case TYPE_TYPE_INSTANCE:   field = state->type_instance;   break;
+      case TYPE_TIME_HR:         number = &state->time;          break;
+      case TYPE_INTERVAL_HR:     number = &state->interval;      break;
+      case TYPE_VALUES:
+        if (si_batch_add (state, buffer, part_len) != 0)
+          return (-1);
+        break;
+      default:
+        /* ignore unknown parts */
+        break;
+    }
+
+    if (field != NULL)
+    {
+      size_t len = part_len - LCC_NETWORK_PART_HEADER_SIZE;
+
+      if ((len < 1) || (len > LCC_SHM_NAME_LEN))
+        return (-1);
+      memcpy (field, buffer + LCC_NETWORK_PART_HEADER_SIZE, len);
+      if (field[len - 1] != 0)
+      {
+        field[0] = 0;
+        return (-1);
+      }
+    }
+    else if (number != NULL)
+    {
+      uint64_t tmp;
+
+      if (part_len != (LCC_NETWORK_PART_HEADER_SIZE + sizeof (tmp)))
+        return (-1);
+      memcpy (&tmp, buffer + LCC_NETWORK_PART_HEADER_SIZE, sizeof (tmp));
+      *number = ntohll (tmp);
+    }
+
+    buffer += part_len;
+    buffer_size -= part_len;
+  }
+
+  return (0);
+} /* }}} int si_decode */
+
+/* Reads up to SI_BATCH_SIZE records from the ring and adds the number of
+ * records read to "*ret_num". */
+static int si_ring_read (si_ring_t *r, void *arg) /* {{{ */
+{
+  size_t *ret_num = arg;
+  uint64_t head;
+  uint64_t invalid = 0;
+  size_t num = 0;
+
+  r->dropped = r->header->dropped;
+
+  head = LCC_SHM_LOAD (&r->header->head);
+  if (head == r->tail)
+    return (0);
+  if ((head - r->tail) > r->data_size)
+  {
+    si_ring_invalid (r, "Producer and consumer positions are inconsistent.");
+    return (-1);
+  }
+  /* Most truncations are caught here; the SIGBUS handler catches those
+   * which happen while reading. */
+  if (si_ring_truncated (r))
+  {
+    si_ring_invalid (r, "The file has been truncated.");
+    return (-1);
+  }
+
+  while ((r->tail != head) && (num < SI_BATCH_SIZE))
+  {
+    lcc_shm_record_t record;
+    uint64_t offset = r->tail & (r->data_size - 1);
+
+    memcpy (&record, r->data + offset, sizeof (record));
+    if ((record.size < sizeof (record)) || ((record.size % 8) != 0)
+        || (record.size > (head - r->tail))
+        || ((offset + record.size) > r->data_size))
+    {
+      si_ring_invalid (r, "Invalid record size.");
+      *ret_num += num;
+      return (-1);
+    }
+
+    if (record.type == LCC_SHM_RECORD_VALUES)
+    {
+      if (si_decode (&r->state, r->data + offset + sizeof (record),
+            record.size - sizeof (record)) != 0)
+        invalid++;
+    }
+    else if (record.type != LCC_SHM_RECORD_PADDING)
+    {
+      si_ring_invalid (r, "Invalid record type.");
+      *ret_num += num;
+      return (-1);
+    }
+
+    r->tail += record.size;
+    num++;
+  }
+
+  /* The value lists have been copied, so the producer may reuse the space
+   * before they have been dispatched. */
+  memcpy (&r->header->state, &r->state, sizeof (r->state));
+  LCC_SHM_STORE (&r->header->tail, r->tail);
+
+  if (invalid > 0)
+  {
+    __sync_add_and_fetch (&si_invalid, invalid);
+    DEBUG ("shm_ingest plugin: %"PRIu64" invalid records in \"%s\".",
+        invalid, r->name);
+  }
+
+  *ret_num += num;
+  return (0);
+} /* }}} int si_ring_read */
+
+static void *si_thread_main (void __attribute__((unused)) *arg) /* {{{ */
+{
+  cdtime_t sleep_time = SI_SLEEP_MIN;
+  cdtime_t next_scan = 0;
+
+  pthread_mutex_lock (&si_lock);
+  while (si_loop)
+  {
+    si_ring_t *r;
+    uint64_t dropped = 0;
+    size_t num = 0;
+    cdtime_t now;
+
+    pthread_mutex_unlock (&si_lock);
+
+    now = cdtime ();
+    if (now >= next_scan)
+    {
+      si_scan ();
+      next_scan = now + plugin_get_interval ();
+    }
+
+    for (r = si_rings; r != NULL; r = r->next)
+    {
+      if (r->header != NULL)
+        si_ring_guard (r, si_ring_read, &num);
+      dropped += r->dropped;
+    }
+    si_batch_dispatch ();
+    si_dropped = si_dropped_closed + dropped;
+
+    pthread_mutex_lock (&si_lock);
+
+    /* Sleep for increasing periods of time while the rings are empty. */
+    if (num > 0)
+    {
+      sleep_time = SI_SLEEP_MIN;
+    }
+    else
+    {
+      struct timespec ts;
+
+      CDTIME_T_TO_TIMESPEC (cdtime () + sleep_time, &ts);
+      if (si_loop)
+        pthread_cond_timedwait (&si_cond, &si_lock, &ts);
+
+      sleep_time *= 2;
+      if (sleep_time > si_poll_interval)
+        sleep_time = si_poll_interval;
+    }
+  }
+  pthread_mutex_unlock (&si_lock);
+
+  return ((void *) 0);
+} /* }}} void *si_thread_main */
+
+static int si_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("Directory", child->key) == 0)
+      status = cf_util_get_string (child, &si_directory);
+    else if (strcasecmp ("DirectoryPerms", child->key) == 0)
+    {
+      char *perms = NULL;
+
+      status = cf_util_get_string (child, &perms);
+      if (status == 0)
+        si_directory_perms = (int) strtol (perms, NULL, 8);
+      sfree (perms);
+    }
+    else if (strcasecmp ("PollInterval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &si_poll_interval);
+    else
+    {
+      WARNING ("shm_ingest plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+    }
+
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int si_config */
+
+static int si_init (void) /* {{{ */
+{
+  char path[PATH_MAX];
+  int status;
+
+  if (si_thread_running)
+    return (0);
+
+  if (si_directory == NULL)
+  {
+    si_directory = strdup (SI_DEFAULT_DIRECTORY);
+    if (si_directory == NULL)
+      return (-1);
+  }
+  if ((si_poll_interval == 0) || (si_poll_interval < SI_SLEEP_MIN))
+    si_poll_interval = MS_TO_CDTIME_T (10);
+
+  /* check_create_dir() treats the last component as a file name. */
+  ssnprintf (path, sizeof (path), "%s/", si_directory);
+  if (check_create_dir (path) != 0)
+  {
+    ERROR ("shm_ingest plugin: Creating \"%s\" failed.", si_directory);
+    return (-1);
+  }
+  if (chmod (si_directory, (mode_t) si_directory_perms) != 0)
+  {
+    char errbuf[1024];
+    WARNING ("shm_ingest plugin: chmod (%s, %04o) failed: %s",
+        si_directory, si_directory_perms,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  if (!si_sigbus_installed)
+  {
+    struct sigaction sa;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = si_sigbus_handler;
+    sa.sa_flags = SA_NODEFER;
+    sigemptyset (&sa.sa_mask);
+    if (sigaction (SIGBUS, &sa, &si_sigbus_old) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("shm_ingest plugin: sigaction failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    si_sigbus_installed = 1;
+  }
+
+  si_loop = 1;
+  status = plugin_thread_create (&si_thread, /* attr = */ NULL,
+      si_thread_main, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("shm_ingest plugin: plugin_thread_create failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    si_loop = 0;
+    return (-1);
+  }
+  si_thread_running = 1;
+
+  return (0);
+} /* }}} int si_init */
+
+static void si_submit (char const *type_instance, uint64_t value) /* {{{ */
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
+  values[0].derive = (derive_t) value;
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "shm_ingest", sizeof (vl.plugin));
+  sstrncpy (vl.type, "total_values", sizeof (vl.type));
+  sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void si_submit */
+
+static int si_read (void) /* {{{ */
+{
+  si_submit ("received", __sync_add_and_fetch (&si_received, 0));
+  si_submit ("invalid", __sync_add_and_fetch (&si_invalid, 0));
+  si_submit ("dropped", __sync_add_and_fetch (&si_dropped, 0));
+
+  return (0);
+} /* }}} int si_read */
+
+static int si_shutdown (void) /* {{{ */
+{
+  si_ring_t *r;
+
+  if (si_thread_running)
+  {
+    pthread_mutex_lock (&si_lock);
+    si_loop = 0;
+    pthread_cond_broadcast (&si_cond);
+    pthread_mutex_unlock (&si_lock);
+
+    pthread_join (si_thread, /* retval = */ NULL);
+    si_thread_running = 0;
+  }
+
+  if (si_sigbus_installed)
+  {
+    sigaction (SIGBUS, &si_sigbus_old, /* oldact = */ NULL);
+    si_sigbus_installed = 0;
+  }
+
+  /* The rings stay in place, so the next instance of the daemon continues
+   * reading them. */
+  while ((r = si_rings) != NULL)
+  {
+    si_rings = r->next;
+    si_ring_free (r);
+  }
+
+  sfree (si_directory);
+  return (0);
+} /* }}} int si_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("shm_ingest", si_config);
+  plugin_register_init ("shm_ingest", si_init);
+  plugin_register_read ("shm_ingest", si_read);
+  plugin_register_shutdown ("shm_ingest", si_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -22,15 +22,13 @@
 #include "collectd.h"
 #include "common.h"
 #include "filter_chain.h"
-#include "utils_subst.h"
-
-#include <regex.h>
+#include "utils_match.h"
 
 struct tr_action_s;
 typedef struct tr_action_s tr_action_t;
 struct tr_action_s
 {
-  regex_t re;
+  cu_regex_t *re;
   char *replacement;
   int may_be_empty;
 
@@ -70,7 +68,7 @@ static void tr_action_destroy (tr_action_t *act) /* {{{ */
   if (act == NULL)
     return;
 
-  regfree (&act->re);
+  cu_regex_destroy (act->re);
   sfree (act->replacement);
 
   if (act->next != NULL)
@@ -83,7 +81,7 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
     const oconfig_item_t *ci, int may_be_empty)
 {
   tr_action_t *act;
-  int status;
+  char errbuf[1024] = "";
 
   if (dest == NULL)
     return (-EINVAL);
@@ -108,13 +106,10 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
   act->replacement = NULL;
   act->may_be_empty = may_be_empty;
 
-  status = regcomp (&act->re, ci->values[0].value.string, REG_EXTENDED);
-  if (status != 0)
+  act->re = cu_regex_create (ci->values[0].value.string, /* flags = */ 0,
+      errbuf, sizeof (errbuf));
+  if (act->re == NULL)
   {
-    char errbuf[1024] = "";
-
-    /* regerror assures null termination. */
-    regerror (status, &act->re, errbuf, sizeof (errbuf));
     ERROR ("Target `replace': Compiling the regular expression `%s' "
         "failed: %s.",
         ci->values[0].value.string, errbuf);
@@ -126,7 +121,7 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
   if (act->replacement == NULL)
   {
     ERROR ("tr_config_add_action: tr_strdup failed.");
-    regfree (&act->re);
+    cu_regex_destroy (act->re);
     sfree (act);
     return (-ENOMEM);
   }
@@ -154,51 +149,37 @@ static int tr_action_invoke (tr_action_t *act_head, /* {{{ */
   tr_action_t *act;
   int status;
   char buffer[DATA_MAX_NAME_LEN];
-  regmatch_t matches[8];
+  _Bool modified = 0;
 
   if (act_head == NULL)
     return (-EINVAL);
 
-  sstrncpy (buffer, buffer_in, sizeof (buffer));
-  memset (matches, 0, sizeof (matches));
+  DEBUG ("target_replace plugin: tr_action_invoke: <- buffer = %s;", buffer_in);
 
-  DEBUG ("target_replace plugin: tr_action_invoke: <- buffer = %s;", buffer);
+  /* The replacements are done in place, so the original value is kept if
+   * the result is not allowed. */
+  sstrncpy (buffer, buffer_in, sizeof (buffer));
 
   for (act = act_head; act != NULL; act = act->next)
   {
-    char temp[DATA_MAX_NAME_LEN];
-    char *subst_status;
-
-    status = regexec (&act->re, buffer,
-        STATIC_ARRAY_SIZE (matches), matches,
-        /* flags = */ 0);
-    if (status == REG_NOMATCH)
-      continue;
-    else if (status != 0)
+    status = cu_regex_replace (act->re, buffer, sizeof (buffer),
+        act->replacement);
+    if (status < 0)
     {
-      char errbuf[1024] = "";
-
-      regerror (status, &act->re, errbuf, sizeof (errbuf));
-      ERROR ("Target `replace': Executing a regular expression failed: %s.",
-          errbuf);
+      ERROR ("Target `replace': Replacing `%s' in `%s' failed.",
+          cu_regex_pattern (act->re), buffer);
       continue;
     }
-
-    subst_status = subst (temp, sizeof (temp), buffer,
-        matches[0].rm_so, matches[0].rm_eo, act->replacement);
-    if (subst_status == NULL)
-    {
-      ERROR ("Target `replace': subst (buffer = %s, start = %zu, end = %zu, "
-          "replacement = %s) failed.",
-          buffer, (size_t) matches[0].rm_so, (size_t) matches[0].rm_eo,
-          act->replacement);
+    else if (status == 0)
       continue;
-    }
-    sstrncpy (buffer, temp, sizeof (buffer));
 
+    modified = 1;
     DEBUG ("target_replace plugin: tr_action_invoke: -- buffer = %s;", buffer);
   } /* for (act = act_head; act != NULL; act = act->next) */
 
+  if (!modified)
+    return (0);
+
   if ((may_be_empty == 0) && (buffer[0] == 0))
   {
     WARNING ("Target `replace': Replacement resulted in an empty string, "
@@ -521,45 +521,39 @@ static int ut_config_host (const threshold_t *th_orig, oconfig_item_t *ci)
 /* }}} */
 
 /*
- * int ut_report_state
+ * int ut_update_state
  *
- * Checks if the `state' differs from the old state and creates a notification
- * if appropriate.
- * Does not fail.
+ * Updates the hit counter and the state of the cache entry `h' and checks if
+ * the `state' differs from the old state. The old state is stored in
+ * `ret_state_old'.
+ * Returns non-zero if a notification should be created.
  */
-static int ut_report_state (const data_set_t *ds,
-    const value_list_t *vl,
+static int ut_update_state (uc_handle_t *h,
     const threshold_t *th,
-    const gauge_t *values,
-    int ds_index,
-    int state)
+    int state,
+    int *ret_state_old)
 { /* {{{ */
   int state_old;
-  notification_t n;
-
-  char *buf;
-  size_t bufsize;
-
-  int status;
 
   /* Check if hits matched */
   if ( (th->hits != 0) )
   {
-    int hits = uc_get_hits(ds,vl);
+    int hits = uc_handle_get_hits (h);
     /* STATE_OKAY resets hits unless PERSIST_OK flag is set. Hits resets if
      * threshold is hit. */
     if ( ( (state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0) ) || (hits > th->hits) )
     {
-        DEBUG("ut_report_state: reset uc_get_hits = 0");
-        uc_set_hits(ds,vl,0); /* reset hit counter and notify */
+        DEBUG("ut_update_state: reset hits = 0");
+        uc_handle_set_hits (h, 0); /* reset hit counter and notify */
     } else {
-      DEBUG("ut_report_state: th->hits = %d, uc_get_hits = %d",th->hits,uc_get_hits(ds,vl));
-      (void) uc_inc_hits(ds,vl,1); /* increase hit counter */
+      DEBUG("ut_update_state: th->hits = %d, hits = %d",th->hits,hits);
+      (void) uc_handle_inc_hits (h, 1); /* increase hit counter */
       return (0);
     }
   } /* end check hits */
 
-  state_old = uc_get_state (ds, vl);
+  state_old = uc_handle_get_state (h);
+  *ret_state_old = state_old;
 
   /* If the state didn't change, report if `persistent' is specified. If the
    * state is `okay', then only report if `persist_ok` flag is set. */
@@ -572,7 +566,31 @@ static int ut_report_state (const data_set_t *ds,
   }
 
   if (state != state_old)
-    uc_set_state (ds, vl, state);
+    uc_handle_set_state (h, state);
+
+  return (1);
+} /* }}} int ut_update_state */
+
+/*
+ * int ut_report_state
+ *
+ * Creates a notification for the transition from `state_old' to `state'.
+ * Does not fail.
+ */
+static int ut_report_state (const data_set_t *ds,
+    const value_list_t *vl,
+    const threshold_t *th,
+    const gauge_t *values,
+    int ds_index,
+    int state,
+    int state_old)
+{ /* {{{ */
+  notification_t n;
+
+  char *buf;
+  size_t bufsize;
+
+  int status;
 
   NOTIFICATION_INIT_VL (&n, vl);
 
@@ -716,19 +734,20 @@ static int ut_report_state (const data_set_t *ds,
  * `DataSource' option is set in the threshold, and the name does NOT match,
  * `okay' is returned. If the threshold does match, its failure and warning
  * min and max values are checked and `failure' or `warning' is returned if
- * appropriate.
+ * appropriate. `prev_state' is the state stored in the cache, which is used
+ * for the hysteresis.
  * Does not fail.
  */
 static int ut_check_one_data_source (const data_set_t *ds,
     const value_list_t __attribute__((unused)) *vl,
     const threshold_t *th,
     const gauge_t *values,
-    int ds_index)
+    int ds_index,
+    int prev_state)
 { /* {{{ */
   const char *ds_name;
   int is_warning = 0;
   int is_failure = 0;
-  int prev_state = STATE_OKAY;
 
   /* check if this threshold applies to this data source */
   if (ds != NULL)
@@ -747,7 +766,7 @@ static int ut_check_one_data_source (const data_set_t *ds,
 
   /* XXX: This is an experimental code, not optimized, not fast, not reliable,
    * and probably, do not work as you expect. Enjoy! :D */
-  if ( (th->hysteresis > 0) && ((prev_state = uc_get_state(ds,vl)) != STATE_OKAY) )
+  if ( (th->hysteresis > 0) && (prev_state != STATE_OKAY) )
   {
     switch(prev_state)
     {
@@ -796,6 +815,7 @@ static int ut_check_one_threshold (const data_set_t *ds,
     const value_list_t *vl,
     const threshold_t *th,
     const gauge_t *values,
+    int prev_state,
     int *ret_ds_index)
 { /* {{{ */
   int ret = -1;
@@ -843,7 +863,8 @@ static int ut_check_one_threshold (const data_set_t *ds,
   {
     int status;
 
-    status = ut_check_one_data_source (ds, vl, th, values_copy, i);
+    status = ut_check_one_data_source (ds, vl, th, values_copy, i,
+        prev_state);
     if (ret < status)
     {
       ret = status;
@@ -870,7 +891,10 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     __attribute__((unused)) user_data_t *ud)
 { /* {{{ */
   threshold_t *th;
-  gauge_t *values;
+  uc_handle_t *h;
+  gauge_t values[ds->ds_num];
+  int prev_state;
+  int state_old = STATE_OKAY;
   int status;
 
   int worst_state = -1;
@@ -890,19 +914,30 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
 
   DEBUG ("ut_check_threshold: Found matching threshold(s)");
 
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
+  /* Look up the cache entry once. The values, state and hit counter are read
+   * and updated using the handle; the cache is locked until the handle is
+   * released, so the notification is created afterwards. */
+  h = uc_handle_get (ds, vl);
+  if (h == NULL)
+    return (0);
+
+  if (uc_handle_get_rate (h, values, (size_t) ds->ds_num) != 0)
+  {
+    uc_handle_release (h);
     return (0);
+  }
+  prev_state = uc_handle_get_state (h);
 
   while (th != NULL)
   {
     int ds_index = -1;
 
-    status = ut_check_one_threshold (ds, vl, th, values, &ds_index);
+    status = ut_check_one_threshold (ds, vl, th, values, prev_state,
+        &ds_index);
     if (status < 0)
     {
+      uc_handle_release (h);
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
       return (-1);
     }
 
@@ -916,17 +951,19 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     th = th->next;
   } /* while (th) */
 
+  status = ut_update_state (h, worst_th, worst_state, &state_old);
+  uc_handle_release (h);
+  if (status == 0)
+    return (0);
+
   status = ut_report_state (ds, vl, worst_th, values,
-      worst_ds_index, worst_state);
+      worst_ds_index, worst_state, state_old);
   if (status != 0)
   {
     ERROR ("ut_check_threshold: ut_report_state failed.");
-    sfree (values);
     return (-1);
   }
 
-  sfree (values);
-
   return (0);
 } /* }}} int ut_check_threshold */
 
@@ -0,0 +1,628 @@
+/**
+ * collectd - src/tsblock.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Writes all values to a local store of compressed, append-only block files
+ * (see "utils_tsblock.h"). Writing a value only encodes it into a block in
+ * memory; a thread of its own writes all blocks to disk every
+ * "FlushInterval", so the number of files and disk writes does not grow with
+ * the number of identifiers.
+ *
+ * If "SocketFile" is set, the stored values can be read through a UNIX
+ * socket with the "GETRANGE" command, which works like the "GETVAL" command
+ * of the unixsock plugin but returns all points of a time range. Clients are
+ * answered one after another by a thread of their own.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+#include "utils_complain.h"
+#include "utils_parse_option.h"
+#include "utils_tsblock.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Connections which are idle for longer are closed, so one client cannot
+ * block the others for long. */
+#define TSB_SOCKET_TIMEOUT 10
+
+#define print_to_socket(fh, ...) \
+  if (fprintf (fh, __VA_ARGS__) < 0) { \
+    char errbuf[1024]; \
+    WARNING ("tsblock plugin: failed to write to socket #%i: %s", \
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+    return (-1); \
+  }
+
+/*
+ * Private variables
+ */
+static char *tsb_datadir = NULL;
+static cdtime_t tsb_partition_length = TSB_PARTITION_LENGTH_DEFAULT;
+static cdtime_t tsb_flush_interval = 0;
+static _Bool tsb_store_rates = 0;
+
+static tsb_store_t *tsb_store = NULL;
+static c_complain_t tsb_complaint = C_COMPLAIN_INIT_STATIC;
+
+static pthread_t tsb_thread;
+static _Bool tsb_thread_running = 0;
+static _Bool tsb_thread_loop = 0;
+static pthread_mutex_t tsb_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tsb_thread_cond = PTHREAD_COND_INITIALIZER;
+
+static char *tsb_socket_file = NULL;
+static int tsb_socket_fd = -1;
+static pthread_t tsb_socket_thread;
+static _Bool tsb_socket_running = 0;
+static int tsb_socket_loop = 0;
+
+/* Output of one GETRANGE command. The number of points is sent first, so
+ * the lines are collected in memory. */
+struct tsb_range_s
+{
+  char *buffer;
+  size_t len;
+  size_t alloc;
+  int status;
+};
+typedef struct tsb_range_s tsb_range_t;
+
+static void *tsb_flush_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  pthread_mutex_lock (&tsb_thread_lock);
+  while (tsb_thread_loop)
+  {
+    struct timespec ts_wait;
+    int status;
+
+    CDTIME_T_TO_TIMESPEC (cdtime () + tsb_flush_interval, &ts_wait);
+    status = pthread_cond_timedwait (&tsb_thread_cond, &tsb_thread_lock,
+        &ts_wait);
+    if ((status != ETIMEDOUT) || !tsb_thread_loop)
+      continue;
+
+    pthread_mutex_unlock (&tsb_thread_lock);
+    status = tsb_flush (tsb_store);
+    if (status != 0)
+      ERROR ("tsblock plugin: Flushing the store failed.");
+    pthread_mutex_lock (&tsb_thread_lock);
+  }
+  pthread_mutex_unlock (&tsb_thread_lock);
+
+  return ((void *) 0);
+} /* }}} void *tsb_flush_thread */
+
+static int tsb_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+      status = cf_util_get_string (child, &tsb_datadir);
+    else if (strcasecmp ("PartitionLength", child->key) == 0)
+    {
+      status = cf_util_get_cdtime (child, &tsb_partition_length);
+      if ((status == 0) && (CDTIME_T_TO_TIME_T (tsb_partition_length) < 1))
+      {
+        ERROR ("tsblock plugin: \"PartitionLength\" must be at least one "
+            "second.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("FlushInterval", child->key) == 0)
+    {
+      status = cf_util_get_cdtime (child, &tsb_flush_interval);
+      if ((status == 0) && (tsb_flush_interval == 0))
+      {
+        ERROR ("tsblock plugin: \"FlushInterval\" must be positive.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("StoreRates", child->key) == 0)
+      status = cf_util_get_boolean (child, &tsb_store_rates);
+    else if (strcasecmp ("SocketFile", child->key) == 0)
+      status = cf_util_get_string (child, &tsb_socket_file);
+    else
+    {
+      WARNING ("tsblock plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+    }
+
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int tsb_config */
+
+/* Formats one point like the values of the PUTVAL command:
+ * "<time>:<value>[:<value>...]". */
+static int tsb_range_add (cdtime_t time, int const *types, /* {{{ */
+    value_t const *values, size_t values_num, void *user_data)
+{
+  tsb_range_t *r = user_data;
+  /* enough for the time and every value, including the separators */
+  size_t need = r->len + 32 * (values_num + 1);
+  size_t i;
+
+  if (need > r->alloc)
+  {
+    size_t alloc = (r->alloc == 0) ? 4096 : 2 * r->alloc;
+    char *tmp;
+
+    while (alloc < need)
+      alloc *= 2;
+    tmp = realloc (r->buffer, alloc);
+    if (tmp == NULL)
+    {
+      r->status = ENOMEM;
+      return (-1);
+    }
+    r->buffer = tmp;
+    r->alloc = alloc;
+  }
+
+  r->len += (size_t) ssnprintf (r->buffer + r->len, r->alloc - r->len,
+      "%.3f", CDTIME_T_TO_DOUBLE (time));
+  for (i = 0; i < values_num; i++)
+  {
+    char *ptr = r->buffer + r->len;
+    size_t size = r->alloc - r->len;
+    int status;
+
+    if ((types[i] == DS_TYPE_GAUGE) && isnan (values[i].gauge))
+      status = ssnprintf (ptr, size, ":NaN");
+    else if (types[i] == DS_TYPE_GAUGE)
+      status = ssnprintf (ptr, size, ":%.15g", values[i].gauge);
+    else if (types[i] == DS_TYPE_COUNTER)
+      status = ssnprintf (ptr, size, ":%llu", values[i].counter);
+    else if (types[i] == DS_TYPE_DERIVE)
+      status = ssnprintf (ptr, size, ":%"PRIi64, values[i].derive);
+    else
+      status = ssnprintf (ptr, size, ":%"PRIu64, values[i].absolute);
+    r->len += (size_t) status;
+  }
+  r->buffer[r->len++] = '\n';
+
+  return (0);
+} /* }}} int tsb_range_add */
+
+/* GETRANGE <identifier> <start> <end>
+ * Returns all points of "identifier" which have been written to disk, with
+ * start <= time <= end, given in seconds since the epoch. */
+static int tsb_handle_getrange (FILE *fh, char *buffer) /* {{{ */
+{
+  char *command = NULL;
+  char *identifier = NULL;
+  char *start_str = NULL;
+  char *end_str = NULL;
+  char *endptr;
+  double start;
+  double end;
+  tsb_range_t range;
+  int status;
+
+  if ((parse_string (&buffer, &command) != 0)
+      || (strcasecmp ("GETRANGE", command) != 0))
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+
+  if ((parse_string (&buffer, &identifier) != 0)
+      || (parse_string (&buffer, &start_str) != 0)
+      || (parse_string (&buffer, &end_str) != 0))
+  {
+    print_to_socket (fh, "-1 Usage: GETRANGE <identifier> <start> <end>\n");
+    return (-1);
+  }
+  if (*buffer != 0)
+  {
+    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    return (-1);
+  }
+
+  errno = 0;
+  start = strtod (start_str, &endptr);
+  if ((errno != 0) || (*endptr != 0) || !(start >= 0.0))
+  {
+    print_to_socket (fh, "-1 Invalid start time: %s\n", start_str);
+    return (-1);
+  }
+  end = strtod (end_str, &endptr);
+  if ((errno != 0) || (*endptr != 0) || !(end >= start))
+  {
+    print_to_socket (fh, "-1 Invalid end time: %s\n", end_str);
+    return (-1);
+  }
+
+  memset (&range, 0, sizeof (range));
+  status = tsb_query (tsb_store, identifier, DOUBLE_TO_CDTIME_T (start),
+      DOUBLE_TO_CDTIME_T (end), tsb_range_add, &range);
+  if (range.status != 0)
+    status = -range.status;
+
+  if (status == -ENOENT)
+  {
+    sfree (range.buffer);
+    print_to_socket (fh, "-1 No such value\n");
+    return (-1);
+  }
+  else if (status < 0)
+  {
+    char errbuf[1024];
+    sfree (range.buffer);
+    print_to_socket (fh, "-1 Query failed: %s\n",
+        sstrerror (-status, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if ((fprintf (fh, "%i Point%s found\n", status,
+          (status == 1) ? "" : "s") < 0)
+      || (fwrite (range.buffer, 1, range.len, fh) != range.len))
+  {
+    char errbuf[1024];
+    WARNING ("tsblock plugin: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (range.buffer);
+    return (-1);
+  }
+
+  sfree (range.buffer);
+  return (0);
+} /* }}} int tsb_handle_getrange */
+
+static void tsb_handle_client (int fd) /* {{{ */
+{
+  struct timeval tv = { TSB_SOCKET_TIMEOUT, 0 };
+  FILE *fhin;
+  FILE *fhout;
+  int fdout;
+
+  setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+  fdout = dup (fd);
+  if (fdout < 0)
+  {
+    close (fd);
+    return;
+  }
+  fhin = fdopen (fd, "r");
+  if (fhin == NULL)
+  {
+    close (fd);
+    close (fdout);
+    return;
+  }
+  fhout = fdopen (fdout, "w");
+  if (fhout == NULL)
+  {
+    fclose (fhin);
+    close (fdout);
+    return;
+  }
+
+  while (tsb_socket_loop)
+  {
+    char buffer[6 * DATA_MAX_NAME_LEN + 128];
+    char buffer_copy[sizeof (buffer)];
+    char *fields[2];
+    size_t len;
+
+    /* Also returns on timeouts. */
+    if (fgets (buffer, sizeof (buffer), fhin) == NULL)
+      break;
+
+    len = strlen (buffer);
+    while ((len > 0)
+        && ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+      buffer[--len] = 0;
+    sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+    if (strsplit (buffer_copy, fields, STATIC_ARRAY_SIZE (fields)) < 1)
+      continue;
+
+    if (strcasecmp ("GETRANGE", fields[0]) == 0)
+      tsb_handle_getrange (fhout, buffer);
+    else
+      fprintf (fhout, "-1 Unknown command: %s\n", fields[0]);
+
+    if (fflush (fhout) != 0)
+      break;
+  }
+
+  fclose (fhin);
+  fclose (fhout);
+} /* }}} void tsb_handle_client */
+
+static void *tsb_socket_server (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (tsb_socket_loop)
+  {
+    struct pollfd pfd = { tsb_socket_fd, POLLIN, 0 };
+    int fd;
+
+    /* Wake up regularly to check "tsb_socket_loop". */
+    if (poll (&pfd, 1, /* timeout = */ 1000) <= 0)
+      continue;
+
+    fd = accept (tsb_socket_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      char errbuf[1024];
+      if ((errno != EINTR) && (errno != EAGAIN))
+        ERROR ("tsblock plugin: accept failed: %s",
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+      continue;
+    }
+
+    tsb_handle_client (fd);
+  }
+
+  return ((void *) 0);
+} /* }}} void *tsb_socket_server */
+
+static int tsb_socket_open (void) /* {{{ */
+{
+  struct sockaddr_un sa;
+  struct stat statbuf;
+  char errbuf[1024];
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  if (strlen (tsb_socket_file) >= sizeof (sa.sun_path))
+  {
+    ERROR ("tsblock plugin: Socket path \"%s\" is too long.",
+        tsb_socket_file);
+    return (-1);
+  }
+  sstrncpy (sa.sun_path, tsb_socket_file, sizeof (sa.sun_path));
+
+  /* A socket left behind by a daemon which has been killed. */
+  if ((lstat (sa.sun_path, &statbuf) == 0) && S_ISSOCK (statbuf.st_mode))
+    unlink (sa.sun_path);
+
+  tsb_socket_fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (tsb_socket_fd < 0)
+  {
+    ERROR ("tsblock plugin: socket failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if ((bind (tsb_socket_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (chmod (sa.sun_path, S_IRWXU | S_IRWXG) != 0)
+      || (listen (tsb_socket_fd, 8) != 0))
+  {
+    ERROR ("tsblock plugin: Opening socket \"%s\" failed: %s", sa.sun_path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (tsb_socket_fd);
+    tsb_socket_fd = -1;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int tsb_socket_open */
+
+/* Stops both threads and writes and closes the store. */
+static void tsb_stop (void) /* {{{ */
+{
+  if (tsb_socket_running)
+  {
+    tsb_socket_loop = 0;
+    pthread_join (tsb_socket_thread, /* retval = */ NULL);
+    tsb_socket_running = 0;
+  }
+  if (tsb_socket_fd >= 0)
+  {
+    close (tsb_socket_fd);
+    tsb_socket_fd = -1;
+    unlink (tsb_socket_file);
+  }
+
+  if (tsb_thread_running)
+  {
+    pthread_mutex_lock (&tsb_thread_lock);
+    tsb_thread_loop = 0;
+    pthread_cond_signal (&tsb_thread_cond);
+    pthread_mutex_unlock (&tsb_thread_lock);
+
+    pthread_join (tsb_thread, /* retval = */ NULL);
+    tsb_thread_running = 0;
+  }
+
+  /* Writes all remaining blocks. */
+  if (tsb_store != NULL)
+  {
+    tsb_close (tsb_store);
+    tsb_store = NULL;
+  }
+} /* }}} void tsb_stop */
+
+static int tsb_init (void) /* {{{ */
+{
+  int status;
+
+  if (tsb_store != NULL)
+    return (0);
+
+  tsb_store = tsb_open ((tsb_datadir != NULL) ? tsb_datadir : "tsblock",
+      tsb_partition_length);
+  if (tsb_store == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("tsblock plugin: Opening the store in \"%s\" failed: %s",
+        (tsb_datadir != NULL) ? tsb_datadir : "tsblock",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (tsb_flush_interval == 0)
+    tsb_flush_interval = TIME_T_TO_CDTIME_T (600);
+
+  tsb_thread_loop = 1;
+  status = plugin_thread_create (&tsb_thread, /* attr = */ NULL,
+      tsb_flush_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("tsblock plugin: pthread_create failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    tsb_thread_loop = 0;
+    tsb_stop ();
+    return (-1);
+  }
+  tsb_thread_running = 1;
+
+  if (tsb_socket_file != NULL)
+  {
+    if (tsb_socket_open () != 0)
+    {
+      tsb_stop ();
+      return (-1);
+    }
+
+    tsb_socket_loop = 1;
+    status = plugin_thread_create (&tsb_socket_thread, /* attr = */ NULL,
+        tsb_socket_server, /* arg = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("tsblock plugin: pthread_create failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      tsb_socket_loop = 0;
+      tsb_stop ();
+      return (-1);
+    }
+    tsb_socket_running = 1;
+  }
+
+  return (0);
+} /* }}} int tsb_init */
+
+static int tsb_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t __attribute__((unused)) *user_data)
+{
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  int types[ds->ds_num];
+  value_t values[ds->ds_num];
+  gauge_t *rates = NULL;
+  int status;
+  int i;
+
+  if (tsb_store == NULL)
+    return (-1);
+
+  if (0 != strcmp (ds->type, vl->type))
+  {
+    ERROR ("tsblock plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  if (FORMAT_VL (identifier, sizeof (identifier), vl) != 0)
+    return (-1);
+
+  /* Counters, derives and absolutes are stored as integers, unless they are
+   * converted to rates. */
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if ((ds->ds[i].type == DS_TYPE_GAUGE) || !tsb_store_rates)
+    {
+      types[i] = ds->ds[i].type;
+      values[i] = vl->values[i];
+      continue;
+    }
+
+    if (rates == NULL)
+      rates = uc_get_rate (ds, vl);
+    if (rates == NULL)
+    {
+      WARNING ("tsblock plugin: uc_get_rate failed.");
+      return (-1);
+    }
+    types[i] = DS_TYPE_GAUGE;
+    values[i].gauge = rates[i];
+  }
+  sfree (rates);
+
+  status = tsb_append (tsb_store, identifier, types, values,
+      (size_t) ds->ds_num, vl->time);
+  if (status == EEXIST)
+  {
+    DEBUG ("tsblock plugin: Dropping value for \"%s\": not newer than the "
+        "last value.", identifier);
+    return (0);
+  }
+  else if (status != 0)
+  {
+    c_complain (LOG_ERR, &tsb_complaint,
+        "tsblock plugin: Appending value for \"%s\" failed with status %i.",
+        identifier, status);
+    return (-1);
+  }
+
+  c_release (LOG_INFO, &tsb_complaint,
+      "tsblock plugin: Appending values succeeded again.");
+  return (0);
+} /* }}} int tsb_write */
+
+/* The store writes all series at once, so "identifier" is ignored. */
+static int tsb_flush_cb (cdtime_t __attribute__((unused)) timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier,
+    user_data_t __attribute__((unused)) *user_data)
+{
+  if (tsb_store == NULL)
+    return (-1);
+
+  return (tsb_flush (tsb_store));
+} /* }}} int tsb_flush_cb */
+
+static int tsb_shutdown (void) /* {{{ */
+{
+  tsb_stop ();
+
+  sfree (tsb_datadir);
+  sfree (tsb_socket_file);
+  return (0);
+} /* }}} int tsb_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("tsblock", tsb_config);
+  plugin_register_init ("tsblock", tsb_init);
+  plugin_register_write ("tsblock", tsb_write, /* user_data = */ NULL);
+  plugin_register_flush ("tsblock", tsb_flush_cb, /* user_data = */ NULL);
+  plugin_register_shutdown ("tsblock", tsb_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
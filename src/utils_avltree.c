@@ -713,6 +713,55 @@ int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value)
 	return (0);
 } /* int c_avl_iterator_prev */
 
+int c_avl_iterator_seek (c_avl_iterator_t *iter, const void *key)
+{
+	c_avl_tree_t *t;
+	c_avl_node_t *n;
+	c_avl_node_t *lower_bound = NULL;
+	int cmp;
+
+	if ((iter == NULL) || (key == NULL))
+		return (-1);
+	t = iter->tree;
+
+	/* find the smallest node not less than key */
+	n = t->root;
+	while (n != NULL)
+	{
+		cmp = t->compare (key, n->key);
+		if (cmp == 0)
+		{
+			lower_bound = n;
+			break;
+		}
+		else if (cmp < 0)
+		{
+			lower_bound = n;
+			n = n->left;
+		}
+		else
+		{
+			n = n->right;
+		}
+	}
+
+	if (lower_bound != NULL)
+	{
+		/* If lower_bound is the first node, iter->node is NULL and
+		 * c_avl_iterator_next starts from the beginning. */
+		iter->node = c_avl_node_prev (lower_bound);
+		return (0);
+	}
+
+	/* All keys are less than key: position the iterator on the last node,
+	 * so that c_avl_iterator_next fails. */
+	for (n = t->root; n != NULL; n = n->right)
+		if (n->right == NULL)
+			break;
+	iter->node = n;
+	return (0);
+} /* int c_avl_iterator_seek */
+
 void c_avl_iterator_destroy (c_avl_iterator_t *iter)
 {
 	free (iter);
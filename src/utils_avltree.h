@@ -148,6 +148,24 @@ int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy (c_avl_iterator_t *iter);
 
+/*
+ * NAME
+ *   c_avl_iterator_seek
+ *
+ * DESCRIPTION
+ *   Positions the iterator so that the next call to `c_avl_iterator_next'
+ *   returns the smallest key which is greater than or equal to `key'. This
+ *   takes O(log n) time.
+ *
+ * PARAMETERS
+ *   `iter'     Iterator returned by `c_avl_get_iterator'.
+ *   `key'      Key to search for. It does not need to be in the tree.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero if `iter' or `key' is NULL.
+ */
+int c_avl_iterator_seek (c_avl_iterator_t *iter, const void *key);
+
 /*
  * NAME
  *   c_avl_size
@@ -651,6 +651,65 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
   return (0);
 } /* int uc_get_names */
 
+int uc_iterate (const char *prefix, const char *after, size_t max_entries,
+    uc_iterate_callback_t callback, void *user_data)
+{
+  c_avl_iterator_t *iter;
+  char *key;
+  cache_entry_t *value;
+  const char *start;
+  size_t prefix_len;
+  size_t number = 0;
+
+  if ((callback == NULL) || (max_entries < 1))
+    return (-1);
+
+  if (prefix == NULL)
+    prefix = "";
+  prefix_len = strlen (prefix);
+
+  /* Start at the later one of "prefix" and "after". */
+  start = prefix;
+  if ((after != NULL) && (strcmp (after, prefix) > 0))
+    start = after;
+
+  pthread_mutex_lock (&cache_lock);
+
+  iter = c_avl_get_iterator (cache_tree);
+  if (iter == NULL)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (-1);
+  }
+  c_avl_iterator_seek (iter, start);
+
+  while ((number < max_entries)
+      && (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0))
+  {
+    /* Names are sorted, so no more names start with the prefix. */
+    if (strncmp (key, prefix, prefix_len) != 0)
+      break;
+
+    if ((after != NULL) && (strcmp (key, after) == 0))
+      continue;
+
+    if (value->state == STATE_MISSING)
+      continue;
+
+    if (callback (key, value->values_raw, value->values_gauge,
+          (size_t) value->values_num, value->last_time, value->interval,
+          user_data) != 0)
+      break;
+
+    number++;
+  } /* while (c_avl_iterator_next) */
+
+  c_avl_iterator_destroy (iter);
+  pthread_mutex_unlock (&cache_lock);
+
+  return ((int) number);
+} /* int uc_iterate */
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -702,27 +761,14 @@ int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
   return (ret);
 } /* int uc_set_state */
 
-int uc_get_history_by_name (const char *name,
+/* Must be called with "cache_lock" held. */
+static int uc_entry_get_history (cache_entry_t *ce,
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  cache_entry_t *ce = NULL;
   size_t i;
-  int status = 0;
-
-  pthread_mutex_lock (&cache_lock);
-
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
-  {
-    pthread_mutex_unlock (&cache_lock);
-    return (-ENOENT);
-  }
 
   if (((size_t) ce->values_num) != num_ds)
-  {
-    pthread_mutex_unlock (&cache_lock);
     return (-EINVAL);
-  }
 
   /* Check if there are enough values available. If not, increase the buffer
    * size. */
@@ -734,10 +780,7 @@ int uc_get_history_by_name (const char *name,
     tmp = realloc (ce->history, sizeof (*ce->history)
 	* num_steps * ce->values_num);
     if (tmp == NULL)
-    {
-      pthread_mutex_unlock (&cache_lock);
       return (-ENOMEM);
-    }
 
     for (i = ce->history_length * ce->values_num;
 	i < (num_steps * ce->values_num);
@@ -766,9 +809,29 @@ int uc_get_history_by_name (const char *name,
 	sizeof (*ret_history) * num_ds);
   }
 
+  return (0);
+} /* int uc_entry_get_history */
+
+int uc_get_history_by_name (const char *name,
+    gauge_t *ret_history, size_t num_steps, size_t num_ds)
+{
+  cache_entry_t *ce = NULL;
+  int status = 0;
+
+  pthread_mutex_lock (&cache_lock);
+
+  status = c_avl_get (cache_tree, name, (void *) &ce);
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    return (-ENOENT);
+  }
+
+  status = uc_entry_get_history (ce, ret_history, num_steps, num_ds);
+
   pthread_mutex_unlock (&cache_lock);
 
-  return (0);
+  return (status);
 } /* int uc_get_history_by_name */
 
 int uc_get_history (const data_set_t *ds, const value_list_t *vl,
@@ -862,6 +925,128 @@ int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
   return (ret);
 } /* int uc_inc_hits */
 
+/*
+ * Handle interface
+ */
+uc_handle_t *uc_handle_get (const data_set_t *ds, const value_list_t *vl)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("utils_cache: uc_handle_get: FORMAT_VL failed.");
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (c_avl_get (cache_tree, name, (void *) &ce) != 0)
+  {
+    pthread_mutex_unlock (&cache_lock);
+    DEBUG ("utils_cache: uc_handle_get: No such value: %s", name);
+    return (NULL);
+  }
+  assert (ce != NULL);
+
+  if ((ds != NULL) && (ce->values_num != ds->ds_num))
+  {
+    pthread_mutex_unlock (&cache_lock);
+    ERROR ("utils_cache: uc_handle_get: ds[%s] has %i values, "
+	"but the cache entry has %i.",
+	ds->type, ds->ds_num, ce->values_num);
+    return (NULL);
+  }
+
+  /* The lock is released in uc_handle_release(). */
+  return (ce);
+} /* uc_handle_t *uc_handle_get */
+
+void uc_handle_release (uc_handle_t *h)
+{
+  if (h == NULL)
+    return;
+
+  pthread_mutex_unlock (&cache_lock);
+} /* void uc_handle_release */
+
+int uc_handle_get_rate (uc_handle_t *h, gauge_t *ret_values, size_t num_ds)
+{
+  if ((h == NULL) || (ret_values == NULL))
+    return (-EINVAL);
+
+  if (((size_t) h->values_num) != num_ds)
+    return (-EINVAL);
+
+  /* remove missing values, like uc_get_rate_by_name() does */
+  if (h->state == STATE_MISSING)
+    return (-ENOENT);
+
+  memcpy (ret_values, h->values_gauge, num_ds * sizeof (*ret_values));
+  return (0);
+} /* int uc_handle_get_rate */
+
+int uc_handle_get_state (uc_handle_t *h)
+{
+  if (h == NULL)
+    return (STATE_ERROR);
+
+  return (h->state);
+} /* int uc_handle_get_state */
+
+int uc_handle_set_state (uc_handle_t *h, int state)
+{
+  int ret;
+
+  if (h == NULL)
+    return (-1);
+
+  ret = h->state;
+  h->state = state;
+  return (ret);
+} /* int uc_handle_set_state */
+
+int uc_handle_get_hits (uc_handle_t *h)
+{
+  if (h == NULL)
+    return (STATE_ERROR);
+
+  return (h->hits);
+} /* int uc_handle_get_hits */
+
+int uc_handle_set_hits (uc_handle_t *h, int hits)
+{
+  int ret;
+
+  if (h == NULL)
+    return (-1);
+
+  ret = h->hits;
+  h->hits = hits;
+  return (ret);
+} /* int uc_handle_set_hits */
+
+int uc_handle_inc_hits (uc_handle_t *h, int step)
+{
+  int ret;
+
+  if (h == NULL)
+    return (-1);
+
+  ret = h->hits;
+  h->hits = ret + step;
+  return (ret);
+} /* int uc_handle_inc_hits */
+
+int uc_handle_get_history (uc_handle_t *h,
+    gauge_t *ret_history, size_t num_steps, size_t num_ds)
+{
+  if ((h == NULL) || (ret_history == NULL))
+    return (-EINVAL);
+
+  return (uc_entry_get_history (h, ret_history, num_steps, num_ds));
+} /* int uc_handle_get_history */
+
 /*
  * Meta data interface
  */
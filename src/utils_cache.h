@@ -37,6 +37,23 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
 
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/*
+ * Calls "callback" for the entries whose names start with "prefix" and are
+ * greater than "after", in the order of their names. Either may be NULL.
+ * Stops after "max_entries" entries or when the callback returns non-zero,
+ * in which case that entry does not count. The cache is locked while the
+ * callback runs, so it must be quick and must not call any of the uc_*
+ * functions. Iterating over a large cache in chunks, passing the last name
+ * seen as "after", bounds the time the cache is locked.
+ * Returns the number of entries passed to the callback, or less than zero on
+ * error.
+ */
+typedef int (*uc_iterate_callback_t) (const char *name,
+    const value_t *values, const gauge_t *rates, size_t values_num,
+    cdtime_t time, cdtime_t interval, void *user_data);
+int uc_iterate (const char *prefix, const char *after, size_t max_entries,
+    uc_iterate_callback_t callback, void *user_data);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
@@ -48,6 +65,30 @@ int uc_get_history (const data_set_t *ds, const value_list_t *vl,
 int uc_get_history_by_name (const char *name,
     gauge_t *ret_history, size_t num_steps, size_t num_ds);
 
+/*
+ * Handle interface
+ *
+ * uc_handle_get() looks up the cache entry of a value list once and returns
+ * with the cache locked; the uc_handle_* functions operate on that entry
+ * without further lookups. Every handle must be released using
+ * uc_handle_release() as soon as possible, since all other cache operations
+ * block until then. Returns NULL if there is no such entry.
+ */
+struct cache_entry_s;
+typedef struct cache_entry_s uc_handle_t;
+
+uc_handle_t *uc_handle_get (const data_set_t *ds, const value_list_t *vl);
+void uc_handle_release (uc_handle_t *h);
+
+int uc_handle_get_rate (uc_handle_t *h, gauge_t *ret_values, size_t num_ds);
+int uc_handle_get_state (uc_handle_t *h);
+int uc_handle_set_state (uc_handle_t *h, int state);
+int uc_handle_get_hits (uc_handle_t *h);
+int uc_handle_set_hits (uc_handle_t *h, int hits);
+int uc_handle_inc_hits (uc_handle_t *h, int step);
+int uc_handle_get_history (uc_handle_t *h,
+    gauge_t *ret_history, size_t num_steps, size_t num_ds);
+
 /*
  * Meta data interface
  */
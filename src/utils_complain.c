@@ -96,5 +96,43 @@ void c_do_release (int level, c_complain_t *c, const char *format, ...)
 	plugin_log (level, "%s", message);
 } /* c_release */
 
+void c_ratelimit (int level, c_ratelimit_t *r, const char *format, ...)
+{
+	cdtime_t now;
+	cdtime_t start;
+	unsigned int suppressed = 0;
+	char message[512];
+	va_list ap;
+
+	now = cdtime ();
+	start = r->start;
+
+	/* Only the thread which successfully moves the window resets the
+	 * counters. */
+	if (((now - start) >= plugin_get_interval ())
+			&& __sync_bool_compare_and_swap (&r->start, start, now))
+	{
+		__sync_fetch_and_and (&r->count, 0);
+		suppressed = __sync_fetch_and_and (&r->suppressed, 0);
+	}
+
+	if (__sync_add_and_fetch (&r->count, 1) > C_RATELIMIT_BURST)
+	{
+		__sync_fetch_and_add (&r->suppressed, 1);
+		return;
+	}
+
+	va_start (ap, format);
+	vsnprintf (message, sizeof (message), format, ap);
+	message[sizeof (message) - 1] = '\0';
+	va_end (ap);
+
+	if (suppressed > 0)
+		plugin_log (level, "%s (%u similar messages suppressed)",
+				message, suppressed);
+	else
+		plugin_log (level, "%s", message);
+} /* c_ratelimit */
+
 /* vim: set sw=4 ts=4 tw=78 noexpandtab : */
 
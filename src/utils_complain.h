@@ -103,6 +103,57 @@ void c_do_release (int level, c_complain_t *c, const char *format, ...);
 			c_do_release(level, c, __VA_ARGS__); \
 	} while (0)
 
+typedef struct
+{
+	/* start of the current window */
+	cdtime_t start;
+
+	/* number of messages in the current window */
+	unsigned int count;
+
+	/* number of messages suppressed since the last report */
+	unsigned int suppressed;
+} c_ratelimit_t;
+
+/* Number of messages reported per interval of the calling plugin. */
+#define C_RATELIMIT_BURST 5
+
+#define C_RATELIMIT_INIT_STATIC { 0, 0, 0 }
+
+/*
+ * NAME
+ *   c_ratelimit
+ *
+ * DESCRIPTION
+ *   Report a message, unless more than C_RATELIMIT_BURST messages have
+ *   already been reported with the same `c_ratelimit_t' during the current
+ *   interval. Unlike `c_complain', this is meant for messages which are
+ *   reported for every value, e.g. when a write plugin's backend is
+ *   unavailable. Suppressed messages are counted and the count is appended
+ *   to the next message which is reported. This function may be called from
+ *   several threads at once with the same `c_ratelimit_t'.
+ *
+ * PARAMETERS
+ *   `level'  The log level passed to `plugin_log'.
+ *   `r'      Identifier for the message, usually the call site.
+ *   `format' Message format - see the documentation of printf(3).
+ */
+void c_ratelimit (int level, c_ratelimit_t *r, const char *format, ...);
+
+/*
+ * NAME
+ *   c_log_limited
+ *
+ * DESCRIPTION
+ *   Calls `c_ratelimit' with a static `c_ratelimit_t' for the call site, i.e.
+ *   limits the rate of each `c_log_limited' statement individually.
+ */
+#define c_log_limited(level, ...) \
+	do { \
+		static c_ratelimit_t c_log_limited_r = C_RATELIMIT_INIT_STATIC; \
+		c_ratelimit (level, &c_log_limited_r, __VA_ARGS__); \
+	} while (0)
+
 #endif /* UTILS_COMPLAIN_H */
 
 /* vim: set sw=4 ts=4 tw=78 noexpandtab : */
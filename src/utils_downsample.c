@@ -0,0 +1,418 @@
+/**
+ * collectd - src/utils_downsample.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_downsample.h"
+
+#include <math.h>
+#include <pthread.h>
+
+/* Upper bound for the number of samples kept per identifier. */
+#ifndef DOWNSAMPLE_MAX_SAMPLES
+# define DOWNSAMPLE_MAX_SAMPLES 10000
+#endif
+
+/* Number of flushes without a new sample after which an identifier is
+ * forgotten. */
+#define DOWNSAMPLE_MAX_IDLE 3
+
+struct ds_entry_s
+{
+  char *name;
+
+  /* The most recent sample. "values" and "meta" are owned by the entry. A
+   * time of zero means that no sample has been added yet. */
+  value_list_t vl;
+  _Bool updated;
+  int idle;
+
+  /* ring_size rows of vl.values_len rates each. */
+  gauge_t *ring;
+  size_t ring_pos;
+  size_t ring_num;
+};
+typedef struct ds_entry_s ds_entry_t;
+
+struct downsample_s
+{
+  cdtime_t interval;
+  size_t ring_size;
+
+  /* Scratch space for sorting the samples of one data source. */
+  gauge_t *sorted;
+
+  c_avl_tree_t *entries;
+  pthread_mutex_t lock;
+};
+
+static int gauge_compare (const void *a, const void *b) /* {{{ */
+{
+  gauge_t x = *((const gauge_t *) a);
+  gauge_t y = *((const gauge_t *) b);
+
+  if (x < y)
+    return (-1);
+  else if (x > y)
+    return (1);
+  return (0);
+} /* }}} int gauge_compare */
+
+static void ds_entry_free (ds_entry_t *e) /* {{{ */
+{
+  if (e == NULL)
+    return;
+
+  sfree (e->name);
+  sfree (e->vl.values);
+  meta_data_destroy (e->vl.meta);
+  sfree (e->ring);
+  sfree (e);
+} /* }}} void ds_entry_free */
+
+static ds_entry_t *ds_entry_create (downsample_t *d, /* {{{ */
+    char const *name, value_list_t const *vl)
+{
+  ds_entry_t *e;
+
+  e = malloc (sizeof (*e));
+  if (e == NULL)
+    return (NULL);
+  memset (e, 0, sizeof (*e));
+
+  e->name = strdup (name);
+  e->vl.values = calloc (vl->values_len, sizeof (*e->vl.values));
+  e->vl.values_len = vl->values_len;
+  e->ring = calloc (d->ring_size * vl->values_len, sizeof (*e->ring));
+  if ((e->name == NULL) || (e->vl.values == NULL) || (e->ring == NULL))
+  {
+    ds_entry_free (e);
+    return (NULL);
+  }
+
+  return (e);
+} /* }}} ds_entry_t *ds_entry_create */
+
+static void ds_entry_update (downsample_t *d, ds_entry_t *e, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl, cdtime_t t)
+{
+  value_t *values;
+  meta_data_t *meta;
+  int i;
+
+  /* Rates can only be calculated from the second sample on. */
+  if ((e->vl.time != 0) && (t > e->vl.time))
+  {
+    gauge_t *row = e->ring + (e->ring_pos * vl->values_len);
+    gauge_t interval = CDTIME_T_TO_DOUBLE (t - e->vl.time);
+
+    for (i = 0; i < ds->ds_num; i++)
+    {
+      value_t *prev = e->vl.values + i;
+      value_t const *curr = vl->values + i;
+
+      if (ds->ds[i].type == DS_TYPE_GAUGE)
+        row[i] = curr->gauge;
+      else if (ds->ds[i].type == DS_TYPE_COUNTER)
+        row[i] = ((gauge_t) counter_diff (prev->counter, curr->counter))
+          / interval;
+      else if (ds->ds[i].type == DS_TYPE_DERIVE)
+        row[i] = ((gauge_t) (curr->derive - prev->derive)) / interval;
+      else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+        row[i] = ((gauge_t) curr->absolute) / interval;
+      else
+        row[i] = NAN;
+    }
+
+    e->ring_pos = (e->ring_pos + 1) % d->ring_size;
+    if (e->ring_num < d->ring_size)
+      e->ring_num++;
+  }
+
+  values = e->vl.values;
+  meta = e->vl.meta;
+
+  memcpy (&e->vl, vl, sizeof (e->vl));
+  e->vl.values = values;
+  memcpy (e->vl.values, vl->values, vl->values_len * sizeof (*values));
+  e->vl.time = t;
+
+  meta_data_destroy (meta);
+  e->vl.meta = NULL;
+  if (vl->meta != NULL)
+    e->vl.meta = meta_data_clone (vl->meta);
+
+  e->updated = 1;
+  e->idle = 0;
+} /* }}} void ds_entry_update */
+
+static void ds_entry_dispatch_summary (downsample_t *d, /* {{{ */
+    ds_entry_t *e, data_set_t const *ds)
+{
+  value_t values[5];
+  value_list_t vl = VALUE_LIST_INIT;
+  int i;
+
+  vl.values = values;
+  vl.values_len = STATIC_ARRAY_SIZE (values);
+  vl.time = e->vl.time;
+  vl.interval = d->interval;
+  sstrncpy (vl.host, e->vl.host, sizeof (vl.host));
+  sstrncpy (vl.plugin, e->vl.plugin, sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, e->vl.plugin_instance,
+      sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, "sample_summary", sizeof (vl.type));
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    gauge_t sum = 0.0;
+    gauge_t last = NAN;
+    size_t num = 0;
+    size_t j;
+
+    for (j = 0; j < e->ring_num; j++)
+    {
+      size_t row = (e->ring_pos + d->ring_size - e->ring_num + j)
+        % d->ring_size;
+      gauge_t v = e->ring[(row * e->vl.values_len) + i];
+
+      if (isnan (v))
+        continue;
+
+      d->sorted[num] = v;
+      sum += v;
+      last = v;
+      num++;
+    }
+
+    if (num == 0)
+      continue;
+
+    qsort (d->sorted, num, sizeof (*d->sorted), gauge_compare);
+
+    values[0].gauge = d->sorted[0];
+    values[1].gauge = d->sorted[num - 1];
+    values[2].gauge = sum / ((gauge_t) num);
+    values[3].gauge = last;
+    values[4].gauge = d->sorted[((size_t) ceil (0.99 * ((double) num))) - 1];
+
+    /* The type instance is made up of the original type, type instance
+     * and, for types with more than one data source, its name. */
+    if (e->vl.type_instance[0] != 0)
+      ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%s-%s",
+          e->vl.type, e->vl.type_instance);
+    else
+      sstrncpy (vl.type_instance, e->vl.type, sizeof (vl.type_instance));
+
+    if (ds->ds_num > 1)
+    {
+      size_t len = strlen (vl.type_instance);
+      ssnprintf (vl.type_instance + len, sizeof (vl.type_instance) - len,
+          "-%s", ds->ds[i].name);
+    }
+
+    plugin_dispatch_values (&vl);
+  }
+} /* }}} void ds_entry_dispatch_summary */
+
+downsample_t *downsample_create (cdtime_t interval, /* {{{ */
+    cdtime_t sample_interval)
+{
+  downsample_t *d;
+
+  if ((interval == 0) || (sample_interval == 0))
+    return (NULL);
+
+  d = malloc (sizeof (*d));
+  if (d == NULL)
+    return (NULL);
+  memset (d, 0, sizeof (*d));
+
+  d->interval = interval;
+
+  /* Leave room for a sample or two more than expected, in case reads are
+   * delayed. */
+  d->ring_size = (size_t) ((interval + sample_interval - 1) / sample_interval);
+  d->ring_size += 2;
+  if (d->ring_size > DOWNSAMPLE_MAX_SAMPLES)
+    d->ring_size = DOWNSAMPLE_MAX_SAMPLES;
+
+  d->sorted = calloc (d->ring_size, sizeof (*d->sorted));
+  d->entries = c_avl_create ((void *) strcmp);
+  if ((d->sorted == NULL) || (d->entries == NULL))
+  {
+    downsample_destroy (d);
+    return (NULL);
+  }
+
+  pthread_mutex_init (&d->lock, /* attr = */ NULL);
+
+  return (d);
+} /* }}} downsample_t *downsample_create */
+
+void downsample_destroy (downsample_t *d) /* {{{ */
+{
+  char *name;
+  ds_entry_t *e;
+
+  if (d == NULL)
+    return;
+
+  if (d->entries != NULL)
+  {
+    while (c_avl_pick (d->entries, (void *) &name, (void *) &e) == 0)
+      ds_entry_free (e);
+    c_avl_destroy (d->entries);
+    pthread_mutex_destroy (&d->lock);
+  }
+
+  sfree (d->sorted);
+  sfree (d);
+} /* }}} void downsample_destroy */
+
+int downsample_add (downsample_t *d, value_list_t const *vl) /* {{{ */
+{
+  data_set_t const *ds;
+  ds_entry_t *e;
+  char name[6 * DATA_MAX_NAME_LEN];
+  cdtime_t t;
+  int status;
+
+  if ((d == NULL) || (vl == NULL))
+    return (EINVAL);
+
+  ds = plugin_get_ds (vl->type);
+  if (ds == NULL)
+    return (ENOENT);
+
+  if (ds->ds_num != vl->values_len)
+  {
+    ERROR ("downsample_add: ds->type = %s: (ds->ds_num = %i) != "
+        "(vl->values_len = %i)",
+        ds->type, ds->ds_num, vl->values_len);
+    return (EINVAL);
+  }
+
+  FORMAT_VL (name, sizeof (name), vl);
+  t = (vl->time != 0) ? vl->time : cdtime ();
+
+  pthread_mutex_lock (&d->lock);
+
+  if (c_avl_get (d->entries, name, (void *) &e) != 0)
+  {
+    e = ds_entry_create (d, name, vl);
+    if (e == NULL)
+    {
+      pthread_mutex_unlock (&d->lock);
+      ERROR ("downsample_add: ds_entry_create failed.");
+      return (ENOMEM);
+    }
+
+    status = c_avl_insert (d->entries, e->name, e);
+    if (status != 0)
+    {
+      pthread_mutex_unlock (&d->lock);
+      ERROR ("downsample_add: c_avl_insert failed.");
+      ds_entry_free (e);
+      return (-1);
+    }
+  }
+  else if (e->vl.values_len != vl->values_len)
+  {
+    pthread_mutex_unlock (&d->lock);
+    ERROR ("downsample_add: Number of values for \"%s\" changed from %i "
+        "to %i.", name, e->vl.values_len, vl->values_len);
+    return (EINVAL);
+  }
+
+  ds_entry_update (d, e, ds, vl, t);
+
+  pthread_mutex_unlock (&d->lock);
+  return (0);
+} /* }}} int downsample_add */
+
+int downsample_flush (downsample_t *d) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char *name;
+  ds_entry_t *e;
+
+  char **idle_list = NULL;
+  size_t idle_list_len = 0;
+  size_t i;
+
+  if (d == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&d->lock);
+
+  iter = c_avl_get_iterator (d->entries);
+  while (c_avl_iterator_next (iter, (void *) &name, (void *) &e) == 0)
+  {
+    data_set_t const *ds;
+
+    if (!e->updated)
+    {
+      e->idle++;
+      if (e->idle >= DOWNSAMPLE_MAX_IDLE)
+      {
+        char **tmp;
+
+        tmp = realloc (idle_list, (idle_list_len + 1) * sizeof (*idle_list));
+        if (tmp == NULL)
+          continue;
+        idle_list = tmp;
+        idle_list[idle_list_len] = name;
+        idle_list_len++;
+      }
+      continue;
+    }
+
+    /* The most recent value is dispatched as if the read function had been
+     * called at the normal interval. */
+    e->vl.interval = d->interval;
+    plugin_dispatch_values (&e->vl);
+
+    ds = plugin_get_ds (e->vl.type);
+    if ((ds != NULL) && (e->ring_num > 0))
+      ds_entry_dispatch_summary (d, e, ds);
+
+    e->updated = 0;
+    e->ring_pos = 0;
+    e->ring_num = 0;
+  }
+  c_avl_iterator_destroy (iter);
+
+  for (i = 0; i < idle_list_len; i++)
+  {
+    if (c_avl_remove (d->entries, idle_list[i],
+          (void *) &name, (void *) &e) == 0)
+      ds_entry_free (e);
+  }
+  sfree (idle_list);
+
+  pthread_mutex_unlock (&d->lock);
+  return (0);
+} /* }}} int downsample_flush */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
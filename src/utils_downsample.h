@@ -0,0 +1,52 @@
+/**
+ * collectd - src/utils_downsample.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_DOWNSAMPLE_H
+#define UTILS_DOWNSAMPLE_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/*
+ * Buffer for the values of a read function which is called more often than
+ * its values are dispatched. For every identifier the rates (or, for gauges,
+ * the values) of the samples are kept in a ring buffer. When flushed, the
+ * most recent value list is dispatched unchanged and, for every data source,
+ * a "sample_summary" value with the minimum, maximum, average, last and 99th
+ * percentile of the buffered samples.
+ */
+struct downsample_s;
+typedef struct downsample_s downsample_t;
+
+/* "interval" is the interval at which the buffer is flushed and
+ * "sample_interval" the interval at which samples are added. */
+downsample_t *downsample_create (cdtime_t interval, cdtime_t sample_interval);
+void downsample_destroy (downsample_t *d);
+
+int downsample_add (downsample_t *d, value_list_t const *vl);
+
+/* Dispatches the buffered values using plugin_dispatch_values(). Must not be
+ * called from a context in which values are added to "d". */
+int downsample_flush (downsample_t *d);
+
+#endif /* UTILS_DOWNSAMPLE_H */
+
+/* vim: set sw=2 sts=2 et : */
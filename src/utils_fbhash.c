@@ -23,51 +23,118 @@
 #include "plugin.h"
 
 #include <pthread.h>
+#include <libgen.h>
+
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "utils_fbhash.h"
-#include "utils_avltree.h"
+
+/* Check for changes of the file at most this often. */
+#define FBH_CHECK_INTERVAL TIME_T_TO_CDTIME_T (1)
+
+struct fbh_entry_s;
+typedef struct fbh_entry_s fbh_entry_t;
+struct fbh_entry_s
+{
+  char *key;
+  char *value;
+  void *data;
+  uint32_t hash;
+
+  fbh_entry_t *next;
+};
 
 struct fbhash_s
 {
   char *filename;
+  char *basename;
   time_t mtime;
+  cdtime_t next_check;
+  int inotify_fd;
+  _Bool reload_failed;
+
+  fbh_data_create_t data_create;
+  fbh_data_free_t data_free;
 
   pthread_mutex_t lock;
-  c_avl_tree_t *tree;
+  fbh_entry_t **buckets;
+  size_t buckets_num; /* always a power of two */
 };
 
 /* 
  * Private functions
  */
-static void fbh_free_tree (c_avl_tree_t *tree) /* {{{ */
+/* 32 bit FNV-1a */
+static uint32_t fbh_hash (const char *key) /* {{{ */
 {
-  int status;
+  uint32_t hash = 2166136261U;
+
+  for (; *key != 0; key++)
+  {
+    hash ^= (uint8_t) *key;
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t fbh_hash */
+
+static void fbh_free_buckets (fbhash_t *h, /* {{{ */
+    fbh_entry_t **buckets, size_t buckets_num)
+{
+  size_t i;
 
-  if (tree == NULL)
+  if (buckets == NULL)
     return;
 
-  while (42)
+  for (i = 0; i < buckets_num; i++)
   {
-    char *key = NULL;
-    char *value = NULL;
+    fbh_entry_t *e = buckets[i];
 
-    status = c_avl_pick (tree, (void *) &key, (void *) &value);
-    if (status != 0)
-      break;
+    while (e != NULL)
+    {
+      fbh_entry_t *next = e->next;
 
-    free (key);
-    free (value);
+      if ((e->data != NULL) && (h->data_free != NULL))
+        h->data_free (e->data);
+      free (e->key);
+      free (e->value);
+      free (e);
+
+      e = next;
+    }
   }
 
-  c_avl_destroy (tree);
-} /* }}} void fbh_free_tree */
+  free (buckets);
+} /* }}} void fbh_free_buckets */
+
+static fbh_entry_t *fbh_lookup (fbhash_t *h, const char *key) /* {{{ */
+{
+  uint32_t hash;
+  fbh_entry_t *e;
+
+  if (h->buckets == NULL)
+    return (NULL);
+
+  hash = fbh_hash (key);
+  for (e = h->buckets[hash & (h->buckets_num - 1)]; e != NULL; e = e->next)
+    if ((e->hash == hash) && (strcmp (e->key, key) == 0))
+      return (e);
+
+  return (NULL);
+} /* }}} fbh_entry_t *fbh_lookup */
 
 static int fbh_read_file (fbhash_t *h) /* {{{ */
 {
   FILE *fh;
   char buffer[4096];
   struct flock fl;
-  c_avl_tree_t *tree;
+  fbh_entry_t *list = NULL;
+  fbh_entry_t **list_tail = &list;
+  size_t list_len = 0;
+  fbh_entry_t **buckets;
+  size_t buckets_num;
   int status;
 
   fh = fopen (h->filename, "r");
@@ -88,22 +155,14 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
     return (-1);
   }
 
-  tree = c_avl_create ((void *) strcmp);
-  if (tree == NULL)
-  {
-    fclose (fh);
-    return (-1);
-  }
-
-  /* Read `fh' into `tree' */
+  /* Read `fh' into `list' */
   while (fgets (buffer, sizeof (buffer), fh) != NULL) /* {{{ */
   {
     size_t len;
     char *key;
     char *value;
 
-    char *key_copy;
-    char *value_copy;
+    fbh_entry_t *e;
 
     buffer[sizeof (buffer) - 1] = 0;
     len = strlen (buffer);
@@ -142,23 +201,24 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
     if (value[0] == 0)
       continue;
 
-    key_copy = strdup (key);
-    value_copy = strdup (value);
-
-    if ((key_copy == NULL) || (value_copy == NULL))
-    {
-      free (key_copy);
-      free (value_copy);
+    e = calloc (1, sizeof (*e));
+    if (e == NULL)
       continue;
-    }
 
-    status = c_avl_insert (tree, key_copy, value_copy);
-    if (status != 0)
+    e->key = strdup (key);
+    e->value = strdup (value);
+    if ((e->key == NULL) || (e->value == NULL))
     {
-      free (key_copy);
-      free (value_copy);
+      free (e->key);
+      free (e->value);
+      free (e);
       continue;
     }
+    e->hash = fbh_hash (e->key);
+
+    *list_tail = e;
+    list_tail = &e->next;
+    list_len++;
 
     DEBUG ("utils_fbhash: fbh_read_file: key = %s; value = %s;",
         key, value);
@@ -166,17 +226,144 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
 
   fclose (fh);
 
-  fbh_free_tree (h->tree);
-  h->tree = tree;
+  /* Keep the load factor at or below 0.5. */
+  buckets_num = 16;
+  while (buckets_num < 2 * list_len)
+    buckets_num *= 2;
+
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+  {
+    while (list != NULL)
+    {
+      fbh_entry_t *next = list->next;
+      free (list->key);
+      free (list->value);
+      free (list);
+      list = next;
+    }
+    return (-1);
+  }
+
+  while (list != NULL)
+  {
+    fbh_entry_t *e = list;
+    fbh_entry_t **bucket = buckets + (e->hash & (buckets_num - 1));
+    fbh_entry_t *dup;
+
+    list = e->next;
+
+    /* The first occurrence of a key wins. */
+    for (dup = *bucket; dup != NULL; dup = dup->next)
+      if ((dup->hash == e->hash) && (strcmp (dup->key, e->key) == 0))
+        break;
+    if (dup != NULL)
+    {
+      free (e->key);
+      free (e->value);
+      free (e);
+      continue;
+    }
+
+    e->next = *bucket;
+    *bucket = e;
+  }
+
+  fbh_free_buckets (h, h->buckets, h->buckets_num);
+  h->buckets = buckets;
+  h->buckets_num = buckets_num;
 
   return (0);
 } /* }}} int fbh_read_file */
 
+#if HAVE_SYS_INOTIFY_H
+/* Watches the directory rather than the file itself, so that replacing the
+ * file with rename(2), as most editors do, is noticed, too. */
+static int fbh_inotify_init (fbhash_t *h) /* {{{ */
+{
+  char *dir_copy;
+  int status;
+
+  h->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (h->inotify_fd < 0)
+    return (-1);
+
+  dir_copy = strdup (h->filename);
+  if (dir_copy == NULL)
+  {
+    close (h->inotify_fd);
+    h->inotify_fd = -1;
+    return (-1);
+  }
+
+  status = inotify_add_watch (h->inotify_fd, dirname (dir_copy),
+      IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+  free (dir_copy);
+  if (status < 0)
+  {
+    close (h->inotify_fd);
+    h->inotify_fd = -1;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int fbh_inotify_init */
+
+/* Reads all pending events. Returns true if one of them concerns our file. */
+static _Bool fbh_inotify_changed (fbhash_t *h) /* {{{ */
+{
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  _Bool changed = 0;
+
+  while (42)
+  {
+    ssize_t status;
+    char *ptr;
+
+    status = read (h->inotify_fd, buffer, sizeof (buffer));
+    if (status <= 0)
+      break;
+
+    for (ptr = buffer; ptr < buffer + status; )
+    {
+      struct inotify_event *ev = (struct inotify_event *) ptr;
+
+      if (((ev->mask & IN_Q_OVERFLOW) != 0)
+          || ((ev->len > 0) && (strcmp (ev->name, h->basename) == 0)))
+        changed = 1;
+
+      ptr += sizeof (*ev) + ev->len;
+    }
+  }
+
+  return (changed);
+} /* }}} _Bool fbh_inotify_changed */
+#endif /* HAVE_SYS_INOTIFY_H */
+
 static int fbh_check_file (fbhash_t *h) /* {{{ */
 {
   struct stat statbuf;
+  cdtime_t now;
   int status;
 
+  now = cdtime ();
+  if (now < h->next_check)
+    return (0);
+  h->next_check = now + FBH_CHECK_INTERVAL;
+
+#if HAVE_SYS_INOTIFY_H
+  if (h->inotify_fd >= 0)
+  {
+    if (!fbh_inotify_changed (h) && !h->reload_failed)
+      return (0);
+
+    status = fbh_read_file (h);
+    h->reload_failed = (status != 0);
+    return (status);
+  }
+#endif
+
   memset (&statbuf, 0, sizeof (statbuf));
 
   status = stat (h->filename, &statbuf);
@@ -196,9 +383,11 @@ static int fbh_check_file (fbhash_t *h) /* {{{ */
 /* 
  * Public functions
  */
-fbhash_t *fbh_create (const char *file) /* {{{ */
+fbhash_t *fbh_create_data (const char *file, /* {{{ */
+    fbh_data_create_t data_create, fbh_data_free_t data_free)
 {
   fbhash_t *h;
+  char *ptr;
   int status;
 
   if (file == NULL)
@@ -216,10 +405,23 @@ fbhash_t *fbh_create (const char *file) /* {{{ */
     return (NULL);
   }
 
+  ptr = strrchr (h->filename, '/');
+  h->basename = (ptr != NULL) ? ptr + 1 : h->filename;
+
   h->mtime = 0;
+  h->next_check = 0;
+  h->inotify_fd = -1;
+  h->data_create = data_create;
+  h->data_free = data_free;
   pthread_mutex_init (&h->lock, /* attr = */ NULL);
 
-  status = fbh_check_file (h);
+#if HAVE_SYS_INOTIFY_H
+  /* Set up the watch before reading the file, so no change is missed. */
+  if (fbh_inotify_init (h) == 0)
+    status = fbh_read_file (h);
+  else
+#endif
+    status = fbh_check_file (h);
   if (status != 0)
   {
     fbh_destroy (h);
@@ -227,6 +429,11 @@ fbhash_t *fbh_create (const char *file) /* {{{ */
   }
 
   return (h);
+} /* }}} fbhash_t *fbh_create_data */
+
+fbhash_t *fbh_create (const char *file) /* {{{ */
+{
+  return (fbh_create_data (file, /* create = */ NULL, /* free = */ NULL));
 } /* }}} fbhash_t *fbh_create */
 
 void fbh_destroy (fbhash_t *h) /* {{{ */
@@ -234,38 +441,62 @@ void fbh_destroy (fbhash_t *h) /* {{{ */
   if (h == NULL)
     return;
 
+  if (h->inotify_fd >= 0)
+    close (h->inotify_fd);
   pthread_mutex_destroy (&h->lock);
+  fbh_free_buckets (h, h->buckets, h->buckets_num);
   free (h->filename);
-  fbh_free_tree (h->tree);
+  free (h);
 } /* }}} void fbh_destroy */
 
 char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
 {
-  char *value;
+  fbh_entry_t *e;
   char *value_copy;
-  int status;
 
   if ((h == NULL) || (key == NULL))
     return (NULL);
 
-  value = NULL;
   value_copy = NULL;
 
   pthread_mutex_lock (&h->lock);
 
-  /* TODO: Checking this everytime may be a bit much..? */
   fbh_check_file (h);
 
-  status = c_avl_get (h->tree, key, (void *) &value);
-  if (status == 0)
-  {
-    assert (value != NULL);
-    value_copy = strdup (value);
-  }
+  e = fbh_lookup (h, key);
+  if (e != NULL)
+    value_copy = strdup (e->value);
 
   pthread_mutex_unlock (&h->lock);
 
   return (value_copy);
 } /* }}} char *fbh_get */
 
+void *fbh_get_data (fbhash_t *h, const char *key) /* {{{ */
+{
+  fbh_entry_t *e;
+  void *data;
+
+  if ((h == NULL) || (key == NULL))
+    return (NULL);
+
+  data = NULL;
+
+  pthread_mutex_lock (&h->lock);
+
+  fbh_check_file (h);
+
+  e = fbh_lookup (h, key);
+  if (e != NULL)
+  {
+    if ((e->data == NULL) && (h->data_create != NULL))
+      e->data = h->data_create (e->key, e->value);
+    data = e->data;
+  }
+
+  pthread_mutex_unlock (&h->lock);
+
+  return (data);
+} /* }}} void *fbh_get_data */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
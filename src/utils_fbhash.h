@@ -29,7 +29,9 @@
  *   key: value
  * into a hash, which can then be queried. The file is given to `fbh_create',
  * the hash is queried using `fbh_get'. If the file is changed during runtime,
- * it will automatically be re-read.
+ * it will automatically be re-read. Changes are noticed using inotify(7) if
+ * available, by comparing the modification time otherwise, and are checked
+ * for at most once per second.
  */
 
 struct fbhash_s;
@@ -42,6 +44,20 @@ void fbh_destroy (fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get (fbhash_t *h, const char *key);
 
+/* Data derived from an entry's value, for example a key derived from a
+ * password. It is created on first access by `fbh_get_data' and freed when
+ * the file is re-read or the hash is destroyed. */
+typedef void *(*fbh_data_create_t) (const char *key, const char *value);
+typedef void (*fbh_data_free_t) (void *data);
+
+fbhash_t *fbh_create_data (const char *file,
+    fbh_data_create_t data_create, fbh_data_free_t data_free);
+
+/* Returns the data derived from the value of `key' or NULL if there is no
+ * such key. The pointer is owned by the hash and only valid until the next
+ * call to `fbh_get_data' or `fbh_destroy'. */
+void *fbh_get_data (fbhash_t *h, const char *key);
+
 #endif /* UTILS_FBHASH_H */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,666 @@
+/**
+ * collectd - src/utils_iftable.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_iftable.h"
+
+#include <asm/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+/* Large enough for the biggest message the kernel puts into a dump. */
+#define IFTABLE_BUFFER_SIZE 32768
+
+/* Link notifications are only read once per interval, so the socket has to
+ * buffer everything that happens in between. If it overflows, the table is
+ * rebuilt from an RTM_GETLINK dump. */
+#define IFTABLE_EVENT_RCVBUF (1024 * 1024)
+
+#if defined(RTM_GETSTATS) && HAVE_RTNL_LINK_STATS64
+# define IFTABLE_HAVE_GETSTATS 1
+#else
+# define IFTABLE_HAVE_GETSTATS 0
+#endif
+
+struct iftable_entry_s
+{
+  int ifindex;
+  char name[IFNAMSIZ];
+  int flags;
+  uint64_t round;
+};
+typedef struct iftable_entry_s iftable_entry_t;
+
+struct iftable_s
+{
+  int fd;
+  int event_fd;
+  uint32_t seq;
+  uint32_t portid;
+
+  /* Set when the names in the table may be out of date, i.e. before the first
+   * read and after link notifications have been lost. */
+  _Bool resync;
+  _Bool have_getstats;
+
+  uint64_t round;
+  c_avl_tree_t *entries;
+
+  iftable_filter_t filter;
+  void *filter_data;
+
+  char *buffer;
+};
+
+typedef int (*iftable_msg_cb_t) (iftable_t *t, const struct nlmsghdr *nlh,
+    void *user_data);
+
+struct iftable_read_s
+{
+  iftable_callback_t callback;
+  void *user_data;
+};
+typedef struct iftable_read_s iftable_read_t;
+
+static int iftable_compare (const void *a, const void *b) /* {{{ */
+{
+  int ia = *((const int *) a);
+  int ib = *((const int *) b);
+
+  if (ia < ib)
+    return (-1);
+  else if (ia > ib)
+    return (1);
+  return (0);
+} /* }}} int iftable_compare */
+
+static int iftable_open (uint32_t groups, uint32_t *ret_portid) /* {{{ */
+{
+  struct sockaddr_nl sa;
+  socklen_t sa_len;
+  int fd;
+
+  fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (fd < 0)
+    return (-1);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = groups;
+  if (bind (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  sa_len = sizeof (sa);
+  if (getsockname (fd, (struct sockaddr *) &sa, &sa_len) != 0)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  if (ret_portid != NULL)
+    *ret_portid = sa.nl_pid;
+  return (fd);
+} /* }}} int iftable_open */
+
+static void iftable_copy_stats32 (iftable_stats_t *dst, /* {{{ */
+    const struct rtnl_link_stats *src)
+{
+#define IFTABLE_COPY(field) dst->field = (uint64_t) src->field
+  IFTABLE_COPY (rx_packets);
+  IFTABLE_COPY (tx_packets);
+  IFTABLE_COPY (rx_bytes);
+  IFTABLE_COPY (tx_bytes);
+  IFTABLE_COPY (rx_errors);
+  IFTABLE_COPY (tx_errors);
+  IFTABLE_COPY (rx_dropped);
+  IFTABLE_COPY (tx_dropped);
+  IFTABLE_COPY (multicast);
+  IFTABLE_COPY (collisions);
+  IFTABLE_COPY (rx_length_errors);
+  IFTABLE_COPY (rx_over_errors);
+  IFTABLE_COPY (rx_crc_errors);
+  IFTABLE_COPY (rx_frame_errors);
+  IFTABLE_COPY (rx_fifo_errors);
+  IFTABLE_COPY (rx_missed_errors);
+  IFTABLE_COPY (tx_aborted_errors);
+  IFTABLE_COPY (tx_carrier_errors);
+  IFTABLE_COPY (tx_fifo_errors);
+  IFTABLE_COPY (tx_heartbeat_errors);
+  IFTABLE_COPY (tx_window_errors);
+} /* }}} void iftable_copy_stats32 */
+
+#if HAVE_RTNL_LINK_STATS64
+static void iftable_copy_stats64 (iftable_stats_t *dst, /* {{{ */
+    const struct rtnl_link_stats64 *src)
+{
+  IFTABLE_COPY (rx_packets);
+  IFTABLE_COPY (tx_packets);
+  IFTABLE_COPY (rx_bytes);
+  IFTABLE_COPY (tx_bytes);
+  IFTABLE_COPY (rx_errors);
+  IFTABLE_COPY (tx_errors);
+  IFTABLE_COPY (rx_dropped);
+  IFTABLE_COPY (tx_dropped);
+  IFTABLE_COPY (multicast);
+  IFTABLE_COPY (collisions);
+  IFTABLE_COPY (rx_length_errors);
+  IFTABLE_COPY (rx_over_errors);
+  IFTABLE_COPY (rx_crc_errors);
+  IFTABLE_COPY (rx_frame_errors);
+  IFTABLE_COPY (rx_fifo_errors);
+  IFTABLE_COPY (rx_missed_errors);
+  IFTABLE_COPY (tx_aborted_errors);
+  IFTABLE_COPY (tx_carrier_errors);
+  IFTABLE_COPY (tx_fifo_errors);
+  IFTABLE_COPY (tx_heartbeat_errors);
+  IFTABLE_COPY (tx_window_errors);
+} /* }}} void iftable_copy_stats64 */
+#endif /* HAVE_RTNL_LINK_STATS64 */
+#undef IFTABLE_COPY
+
+/* Adds an interface to the table or updates its name. The filter is only
+ * called if the interface is new or has been renamed. */
+static iftable_entry_t *iftable_entry_update (iftable_t *t, /* {{{ */
+    int ifindex, const char *name)
+{
+  iftable_entry_t *e = NULL;
+
+  if (c_avl_get (t->entries, &ifindex, (void *) &e) == 0)
+  {
+    if ((name == NULL) || (strcmp (e->name, name) == 0))
+      return (e);
+    DEBUG ("utils_iftable: Interface %i has been renamed from \"%s\" "
+        "to \"%s\".", ifindex, e->name, name);
+  }
+  else
+  {
+    if (name == NULL)
+      return (NULL);
+
+    e = malloc (sizeof (*e));
+    if (e == NULL)
+      return (NULL);
+    memset (e, 0, sizeof (*e));
+    e->ifindex = ifindex;
+
+    if (c_avl_insert (t->entries, &e->ifindex, e) != 0)
+    {
+      sfree (e);
+      return (NULL);
+    }
+  }
+
+  sstrncpy (e->name, name, sizeof (e->name));
+  if (t->filter != NULL)
+    e->flags = (*t->filter) (e->name, t->filter_data);
+  else
+    e->flags = 1;
+
+  return (e);
+} /* }}} iftable_entry_t *iftable_entry_update */
+
+static void iftable_entry_remove (iftable_t *t, int ifindex) /* {{{ */
+{
+  int *key = NULL;
+  iftable_entry_t *e = NULL;
+
+  if (c_avl_remove (t->entries, &ifindex, (void *) &key, (void *) &e) == 0)
+    sfree (e);
+} /* }}} void iftable_entry_remove */
+
+/* Removes all interfaces which haven't been seen in the last complete dump. */
+static void iftable_prune (iftable_t *t) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  int *stale;
+  int stale_num = 0;
+  int *key;
+  iftable_entry_t *e;
+  int i;
+
+  stale = malloc (c_avl_size (t->entries) * sizeof (*stale));
+  if (stale == NULL)
+    return;
+
+  iter = c_avl_get_iterator (t->entries);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &e) == 0)
+    if (e->round != t->round)
+      stale[stale_num++] = e->ifindex;
+  c_avl_iterator_destroy (iter);
+
+  for (i = 0; i < stale_num; i++)
+    iftable_entry_remove (t, stale[i]);
+
+  sfree (stale);
+} /* }}} void iftable_prune */
+
+/* Parses an RTM_NEWLINK message, which is both the reply to RTM_GETLINK and
+ * the notification sent when a link is added or changed. */
+static iftable_entry_t *iftable_parse_link (iftable_t *t, /* {{{ */
+    const struct nlmsghdr *nlh, iftable_stats_t *stats, _Bool *have_stats)
+{
+  struct ifinfomsg *ifm;
+  struct rtattr *attr;
+  int attr_len;
+  const char *name = NULL;
+
+  if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*ifm)))
+    return (NULL);
+
+  ifm = NLMSG_DATA (nlh);
+  attr = IFLA_RTA (ifm);
+  attr_len = IFLA_PAYLOAD (nlh);
+
+  *have_stats = 0;
+  for (; RTA_OK (attr, attr_len); attr = RTA_NEXT (attr, attr_len))
+  {
+    if (attr->rta_type == IFLA_IFNAME)
+    {
+      if ((RTA_PAYLOAD (attr) < 1)
+          || (((char *) RTA_DATA (attr))[RTA_PAYLOAD (attr) - 1] != 0))
+        continue;
+      name = RTA_DATA (attr);
+    }
+#if HAVE_RTNL_LINK_STATS64
+    else if (attr->rta_type == IFLA_STATS64)
+    {
+      if (RTA_PAYLOAD (attr) < sizeof (struct rtnl_link_stats64))
+        continue;
+      iftable_copy_stats64 (stats, RTA_DATA (attr));
+      *have_stats = 1;
+    }
+#endif
+    else if ((attr->rta_type == IFLA_STATS) && !*have_stats)
+    {
+      if (RTA_PAYLOAD (attr) < sizeof (struct rtnl_link_stats))
+        continue;
+      iftable_copy_stats32 (stats, RTA_DATA (attr));
+      *have_stats = 1;
+    }
+  }
+
+  if (name == NULL)
+    return (NULL);
+
+  return (iftable_entry_update (t, ifm->ifi_index, name));
+} /* }}} iftable_entry_t *iftable_parse_link */
+
+static int iftable_link_cb (iftable_t *t, /* {{{ */
+    const struct nlmsghdr *nlh, void *user_data)
+{
+  iftable_read_t *r = user_data;
+  iftable_entry_t *e;
+  iftable_stats_t stats;
+  _Bool have_stats;
+
+  if (nlh->nlmsg_type != RTM_NEWLINK)
+    return (0);
+
+  e = iftable_parse_link (t, nlh, &stats, &have_stats);
+  if (e == NULL)
+    return (0);
+
+  e->round = t->round;
+  if ((e->flags != 0) && have_stats)
+    (*r->callback) (e->ifindex, e->name, e->flags, &stats, r->user_data);
+
+  return (0);
+} /* }}} int iftable_link_cb */
+
+#if IFTABLE_HAVE_GETSTATS
+static int iftable_stats_cb (iftable_t *t, /* {{{ */
+    const struct nlmsghdr *nlh, void *user_data)
+{
+  iftable_read_t *r = user_data;
+  struct if_stats_msg *ifsm;
+  struct rtattr *attr;
+  int attr_len;
+  iftable_entry_t *e = NULL;
+
+  if (nlh->nlmsg_type != RTM_NEWSTATS)
+    return (0);
+  if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*ifsm)))
+    return (0);
+
+  ifsm = NLMSG_DATA (nlh);
+  if (c_avl_get (t->entries, &ifsm->ifindex, (void *) &e) != 0)
+  {
+    /* The link was created after the notifications have been read. Its name
+     * is picked up by the next read. */
+    return (0);
+  }
+
+  e->round = t->round;
+  if (e->flags == 0)
+    return (0);
+
+  attr = (struct rtattr *) (((char *) ifsm) + NLMSG_ALIGN (sizeof (*ifsm)));
+  attr_len = (int) (nlh->nlmsg_len - NLMSG_LENGTH (sizeof (*ifsm)));
+  for (; RTA_OK (attr, attr_len); attr = RTA_NEXT (attr, attr_len))
+  {
+    iftable_stats_t stats;
+
+    if (attr->rta_type != IFLA_STATS_LINK_64)
+      continue;
+    if (RTA_PAYLOAD (attr) < sizeof (struct rtnl_link_stats64))
+      continue;
+
+    iftable_copy_stats64 (&stats, RTA_DATA (attr));
+    (*r->callback) (e->ifindex, e->name, e->flags, &stats, r->user_data);
+    break;
+  }
+
+  return (0);
+} /* }}} int iftable_stats_cb */
+#endif /* IFTABLE_HAVE_GETSTATS */
+
+/* Sends a dump request and passes all replies to "callback". Returns zero
+ * once the dump is complete and an errno value otherwise. */
+static int iftable_dump (iftable_t *t, struct nlmsghdr *req, /* {{{ */
+    iftable_msg_cb_t callback, void *user_data)
+{
+  struct sockaddr_nl sa;
+  uint32_t seq;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.nl_family = AF_NETLINK;
+
+  seq = ++t->seq;
+  req->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req->nlmsg_seq = seq;
+
+  if (sendto (t->fd, req, req->nlmsg_len, /* flags = */ 0,
+        (struct sockaddr *) &sa, sizeof (sa)) < 0)
+    return (errno);
+
+  while (42)
+  {
+    struct iovec iov = { t->buffer, IFTABLE_BUFFER_SIZE };
+    struct msghdr msg;
+    struct nlmsghdr *nlh;
+    ssize_t len;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = &sa;
+    msg.msg_namelen = sizeof (sa);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    len = recvmsg (t->fd, &msg, /* flags = */ 0);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (errno);
+    }
+    if ((msg.msg_flags & MSG_TRUNC) != 0)
+      return (EMSGSIZE);
+
+    for (nlh = (struct nlmsghdr *) t->buffer;
+        NLMSG_OK (nlh, (size_t) len);
+        nlh = NLMSG_NEXT (nlh, len))
+    {
+      /* Left over from a dump which has been aborted. */
+      if ((nlh->nlmsg_seq != seq) || (nlh->nlmsg_pid != t->portid))
+        continue;
+
+      if (nlh->nlmsg_type == NLMSG_DONE)
+        return (0);
+
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+      {
+        struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+        if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*err)))
+          return (EBADMSG);
+        return ((err->error != 0) ? -err->error : EBADMSG);
+      }
+
+      (*callback) (t, nlh, user_data);
+    }
+  } /* while (42) */
+
+  /* not reached */
+  return (0);
+} /* }}} int iftable_dump */
+
+/* Applies the link notifications received since the last read. */
+static void iftable_read_events (iftable_t *t) /* {{{ */
+{
+  if (t->event_fd < 0)
+  {
+    t->resync = 1;
+    return;
+  }
+
+  while (42)
+  {
+    struct nlmsghdr *nlh;
+    ssize_t len;
+
+    len = recv (t->event_fd, t->buffer, IFTABLE_BUFFER_SIZE, MSG_DONTWAIT);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS)
+      {
+        /* Notifications have been lost. The socket keeps working, but the
+         * table has to be rebuilt. */
+        t->resync = 1;
+        continue;
+      }
+      break;
+    }
+
+    for (nlh = (struct nlmsghdr *) t->buffer;
+        NLMSG_OK (nlh, (size_t) len);
+        nlh = NLMSG_NEXT (nlh, len))
+    {
+      if (nlh->nlmsg_type == RTM_NEWLINK)
+      {
+        iftable_stats_t stats;
+        _Bool have_stats;
+
+        iftable_parse_link (t, nlh, &stats, &have_stats);
+      }
+      else if ((nlh->nlmsg_type == RTM_DELLINK)
+          && (nlh->nlmsg_len >= NLMSG_LENGTH (sizeof (struct ifinfomsg))))
+      {
+        struct ifinfomsg *ifm = NLMSG_DATA (nlh);
+
+        iftable_entry_remove (t, ifm->ifi_index);
+      }
+    }
+  } /* while (42) */
+} /* }}} void iftable_read_events */
+
+static int iftable_read_links (iftable_t *t, iftable_read_t *r) /* {{{ */
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifm;
+  } req;
+  int status;
+
+  memset (&req, 0, sizeof (req));
+  req.nlh.nlmsg_len = NLMSG_LENGTH (sizeof (req.ifm));
+  req.nlh.nlmsg_type = RTM_GETLINK;
+  req.ifm.ifi_family = AF_UNSPEC;
+
+  status = iftable_dump (t, &req.nlh, iftable_link_cb, r);
+  if (status != 0)
+    return (status);
+
+  t->resync = 0;
+  return (0);
+} /* }}} int iftable_read_links */
+
+#if IFTABLE_HAVE_GETSTATS
+static int iftable_read_stats (iftable_t *t, iftable_read_t *r) /* {{{ */
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct if_stats_msg ifsm;
+  } req;
+
+  memset (&req, 0, sizeof (req));
+  req.nlh.nlmsg_len = NLMSG_LENGTH (sizeof (req.ifsm));
+  req.nlh.nlmsg_type = RTM_GETSTATS;
+  req.ifsm.family = AF_UNSPEC;
+  /* Only the 64 bit link counters, not the per-protocol statistics. */
+  req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT (IFLA_STATS_LINK_64);
+
+  return (iftable_dump (t, &req.nlh, iftable_stats_cb, r));
+} /* }}} int iftable_read_stats */
+#endif /* IFTABLE_HAVE_GETSTATS */
+
+iftable_t *iftable_create (iftable_filter_t filter, /* {{{ */
+    void *filter_data)
+{
+  iftable_t *t;
+  int rcvbuf = IFTABLE_EVENT_RCVBUF;
+
+  t = malloc (sizeof (*t));
+  if (t == NULL)
+    return (NULL);
+  memset (t, 0, sizeof (*t));
+
+  t->filter = filter;
+  t->filter_data = filter_data;
+  t->resync = 1;
+#if IFTABLE_HAVE_GETSTATS
+  t->have_getstats = 1;
+#endif
+  t->fd = -1;
+  t->event_fd = -1;
+
+  t->buffer = malloc (IFTABLE_BUFFER_SIZE);
+  t->entries = c_avl_create (iftable_compare);
+  if ((t->buffer == NULL) || (t->entries == NULL))
+  {
+    iftable_destroy (t);
+    return (NULL);
+  }
+
+  t->fd = iftable_open (/* groups = */ 0, &t->portid);
+  if (t->fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_iftable: Opening the netlink socket failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    iftable_destroy (t);
+    return (NULL);
+  }
+
+  /* Without notifications, the names are read using RTM_GETLINK every
+   * time. */
+  t->event_fd = iftable_open (RTMGRP_LINK, /* portid = */ NULL);
+  if (t->event_fd < 0)
+  {
+    char errbuf[1024];
+    WARNING ("utils_iftable: Subscribing to link notifications failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+  else
+    setsockopt (t->event_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+  return (t);
+} /* }}} iftable_t *iftable_create */
+
+void iftable_destroy (iftable_t *t) /* {{{ */
+{
+  if (t == NULL)
+    return;
+
+  if (t->fd >= 0)
+    close (t->fd);
+  if (t->event_fd >= 0)
+    close (t->event_fd);
+
+  if (t->entries != NULL)
+  {
+    int *key;
+    iftable_entry_t *e;
+
+    while (c_avl_pick (t->entries, (void *) &key, (void *) &e) == 0)
+      sfree (e);
+    c_avl_destroy (t->entries);
+  }
+
+  sfree (t->buffer);
+  sfree (t);
+} /* }}} void iftable_destroy */
+
+int iftable_read (iftable_t *t, iftable_callback_t callback, /* {{{ */
+    void *user_data)
+{
+  iftable_read_t r = { callback, user_data };
+  int status;
+
+  if ((t == NULL) || (callback == NULL))
+    return (EINVAL);
+
+  iftable_read_events (t);
+
+  t->round++;
+
+#if IFTABLE_HAVE_GETSTATS
+  if (!t->resync && t->have_getstats)
+  {
+    status = iftable_read_stats (t, &r);
+    if ((status == EOPNOTSUPP) || (status == EINVAL))
+    {
+      INFO ("utils_iftable: The kernel doesn't support RTM_GETSTATS. "
+          "Falling back to RTM_GETLINK.");
+      t->have_getstats = 0;
+    }
+    else if (status != 0)
+      return (status);
+    else
+    {
+      iftable_prune (t);
+      return (0);
+    }
+  }
+#endif /* IFTABLE_HAVE_GETSTATS */
+
+  status = iftable_read_links (t, &r);
+  if (status != 0)
+    return (status);
+
+  iftable_prune (t);
+  return (0);
+} /* }}} int iftable_read */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,88 @@
+/**
+ * collectd - src/utils_iftable.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_IFTABLE_H
+#define UTILS_IFTABLE_H 1
+
+#include "collectd.h"
+
+#include <stdint.h>
+
+/*
+ * Table of the network interfaces of a Linux host, keyed by interface index
+ * and kept up to date using a persistent rtnetlink socket. Link statistics
+ * are requested using RTM_GETSTATS where the kernel supports it, so that only
+ * the 64 bit counters are transferred. Interface names are learned from a
+ * single RTM_GETLINK dump and then from link notifications, so the name of
+ * an interface is only looked up and matched against the configuration when
+ * the interface appears or is renamed.
+ */
+struct iftable_s;
+typedef struct iftable_s iftable_t;
+
+typedef struct iftable_stats_s
+{
+  uint64_t rx_packets;
+  uint64_t tx_packets;
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+  uint64_t rx_errors;
+  uint64_t tx_errors;
+
+  uint64_t rx_dropped;
+  uint64_t tx_dropped;
+  uint64_t multicast;
+  uint64_t collisions;
+
+  uint64_t rx_length_errors;
+  uint64_t rx_over_errors;
+  uint64_t rx_crc_errors;
+  uint64_t rx_frame_errors;
+  uint64_t rx_fifo_errors;
+  uint64_t rx_missed_errors;
+
+  uint64_t tx_aborted_errors;
+  uint64_t tx_carrier_errors;
+  uint64_t tx_fifo_errors;
+  uint64_t tx_heartbeat_errors;
+  uint64_t tx_window_errors;
+} iftable_stats_t;
+
+/* Called once for every new interface and whenever an interface is renamed.
+ * The returned value is stored with the interface and passed to the read
+ * callback; an interface for which zero is returned is ignored altogether.
+ * If no filter is given, all interfaces are reported with a value of one. */
+typedef int (*iftable_filter_t) (const char *dev, void *user_data);
+
+typedef int (*iftable_callback_t) (int ifindex, const char *dev, int flags,
+    const iftable_stats_t *stats, void *user_data);
+
+iftable_t *iftable_create (iftable_filter_t filter, void *filter_data);
+void iftable_destroy (iftable_t *t);
+
+/* Requests the statistics of all interfaces and calls "callback" for every
+ * interface which isn't ignored. Returns zero on success and an errno value
+ * if the statistics could not be read. */
+int iftable_read (iftable_t *t, iftable_callback_t callback, void *user_data);
+
+#endif /* UTILS_IFTABLE_H */
+
+/* vim: set sw=2 sts=2 et : */
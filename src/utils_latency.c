@@ -63,14 +63,20 @@ void latency_counter_destroy (latency_counter_t *lc) /* {{{ */
 } /* }}} void latency_counter_destroy */
 
 void latency_counter_add (latency_counter_t *lc, cdtime_t latency) /* {{{ */
+{
+  latency_counter_add_n (lc, latency, 1);
+} /* }}} void latency_counter_add */
+
+void latency_counter_add_n (latency_counter_t *lc, cdtime_t latency, /* {{{ */
+    size_t num)
 {
   size_t latency_ms;
 
-  if ((lc == NULL) || (latency == 0))
+  if ((lc == NULL) || (latency == 0) || (num == 0))
     return;
 
-  lc->sum += latency;
-  lc->num++;
+  lc->sum += latency * num;
+  lc->num += num;
 
   if ((lc->min == 0) && (lc->max == 0))
     lc->min = lc->max = latency;
@@ -84,8 +90,8 @@ void latency_counter_add (latency_counter_t *lc, cdtime_t latency) /* {{{ */
    * accordingly. */
   latency_ms = (size_t) CDTIME_T_TO_MS (latency - 1);
   if (latency_ms < STATIC_ARRAY_SIZE (lc->histogram))
-    lc->histogram[latency_ms]++;
-} /* }}} void latency_counter_add */
+    lc->histogram[latency_ms] += (int) num;
+} /* }}} void latency_counter_add_n */
 
 void latency_counter_reset (latency_counter_t *lc) /* {{{ */
 {
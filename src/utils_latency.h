@@ -34,6 +34,9 @@ latency_counter_t *latency_counter_create ();
 void latency_counter_destroy (latency_counter_t *lc);
 
 void latency_counter_add (latency_counter_t *lc, cdtime_t latency);
+/* Adds "num" events which all had the given latency. */
+void latency_counter_add_n (latency_counter_t *lc, cdtime_t latency,
+    size_t num);
 void latency_counter_reset (latency_counter_t *lc);
 
 cdtime_t latency_counter_get_min (latency_counter_t *lc);
@@ -24,7 +24,10 @@
 #include "common.h"
 #include "plugin.h"
 
+#include "configfile.h"
+
 #include "utils_match.h"
+#include "utils_regex.h"
 
 #include <regex.h>
 
@@ -42,6 +45,23 @@ struct cu_match_s
   void *user_data;
 };
 
+struct cu_regex_s
+{
+  char *pattern;
+  int flags;
+
+  /* If "dfa" is set, "posix" is only compiled ("have_posix") when sub-matches
+   * may be needed: the DFA engine does not track them. */
+  dfa_regex_t *dfa;
+  regex_t posix;
+  _Bool have_posix;
+
+  /* Set if references to sub-matches in replacements are expanded. This is
+   * only done with the DFA engine, so that existing configurations using the
+   * POSIX engine keep inserting their replacements verbatim. */
+  _Bool replace_refs;
+};
+
 /*
  * Private functions
  */
@@ -366,4 +386,243 @@ void *match_get_user_data (cu_match_t *obj)
   return (obj->user_data);
 } /* void *match_get_user_data */
 
+cu_regex_t *cu_regex_create (const char *pattern, int flags,
+    char *errbuf, size_t errbuf_size)
+{
+  cu_regex_t *re;
+  const char *engine;
+  int status;
+
+  if (pattern == NULL)
+  {
+    sstrncpy (errbuf, "Invalid argument", errbuf_size);
+    return (NULL);
+  }
+
+  re = malloc (sizeof (*re));
+  if (re == NULL)
+  {
+    sstrncpy (errbuf, "malloc failed", errbuf_size);
+    return (NULL);
+  }
+  memset (re, 0, sizeof (*re));
+  re->flags = flags;
+
+  re->pattern = strdup (pattern);
+  if (re->pattern == NULL)
+  {
+    sfree (re);
+    sstrncpy (errbuf, "strdup failed", errbuf_size);
+    return (NULL);
+  }
+
+  engine = global_option_get ("RegexEngine");
+  if ((engine != NULL) && (strcasecmp ("DFA", engine) == 0))
+  {
+    re->replace_refs = 1;
+    re->dfa = dfa_regex_compile (pattern);
+    if ((re->dfa != NULL) && (flags & CU_REGEX_NOSUB))
+      return (re);
+
+    if ((re->dfa == NULL) && (errno != ENOTSUP))
+    {
+      char tmp[256];
+      ssnprintf (errbuf, errbuf_size, "dfa_regex_compile failed: %s",
+          sstrerror (errno, tmp, sizeof (tmp)));
+      sfree (re->pattern);
+      sfree (re);
+      return (NULL);
+    }
+    else if (re->dfa == NULL)
+      DEBUG ("utils_match: cu_regex_create: The pattern `%s' is not "
+          "supported by the DFA engine. Using regexec(3) instead.", pattern);
+  }
+  else if ((engine != NULL) && (strcasecmp ("POSIX", engine) != 0))
+  {
+    WARNING ("utils_match: The value \"%s\" of the `RegexEngine' option is "
+        "invalid. Using the POSIX engine.", engine);
+  }
+
+  status = regcomp (&re->posix, pattern,
+      REG_EXTENDED | ((flags & CU_REGEX_NOSUB) ? REG_NOSUB : 0));
+  if (status != 0)
+  {
+    /* regerror assures null termination. */
+    regerror (status, &re->posix, errbuf, errbuf_size);
+    if (re->dfa != NULL)
+      dfa_regex_destroy (re->dfa);
+    sfree (re->pattern);
+    sfree (re);
+    return (NULL);
+  }
+  re->have_posix = 1;
+
+  return (re);
+} /* cu_regex_t *cu_regex_create */
+
+void cu_regex_destroy (cu_regex_t *re)
+{
+  if (re == NULL)
+    return;
+
+  if (re->dfa != NULL)
+    dfa_regex_destroy (re->dfa);
+  if (re->have_posix)
+    regfree (&re->posix);
+  sfree (re->pattern);
+  sfree (re);
+} /* void cu_regex_destroy */
+
+const char *cu_regex_pattern (const cu_regex_t *re)
+{
+  if (re == NULL)
+    return (NULL);
+  return (re->pattern);
+} /* const char *cu_regex_pattern */
+
+int cu_regex_match (cu_regex_t *re, const char *str)
+{
+  if ((re == NULL) || (str == NULL))
+    return (0);
+
+  if (re->dfa != NULL)
+    return (dfa_regex_match (re->dfa, str));
+
+  return (regexec (&re->posix, str,
+        /* nmatch = */ 0, /* pmatch = */ NULL, /* eflags = */ 0) == 0);
+} /* int cu_regex_match */
+
+/* Appends at most "src_len" bytes of "src" to "dst", truncating at
+ * "dst_size - 1" bytes. */
+static void cu_regex_append (char *dst, size_t dst_size, size_t *dst_len,
+    const char *src, size_t src_len)
+{
+  if (*dst_len + src_len >= dst_size)
+    src_len = dst_size - *dst_len - 1;
+
+  memcpy (dst + *dst_len, src, src_len);
+  *dst_len += src_len;
+  dst[*dst_len] = 0;
+} /* void cu_regex_append */
+
+/* Replaces the match with "replacement", expanding "\0" to "\9" to the
+ * sub-matches in "m" and "\\" to a single backslash. */
+static int cu_regex_replace_refs (char *buffer, size_t buffer_size,
+    const char *replacement, const regmatch_t *m, size_t m_num)
+{
+  char result[buffer_size];
+  size_t result_len = 0;
+  const char *ptr;
+
+  result[0] = 0;
+  cu_regex_append (result, sizeof (result), &result_len,
+      buffer, (size_t) m[0].rm_so);
+
+  for (ptr = replacement; *ptr != 0; ptr++)
+  {
+    size_t n;
+
+    if ((ptr[0] != '\\') || (ptr[1] == 0))
+    {
+      cu_regex_append (result, sizeof (result), &result_len, ptr, 1);
+      continue;
+    }
+
+    ptr++;
+    if ((*ptr < '0') || (*ptr > '9'))
+    {
+      /* "\\" is a backslash, other escapes are copied verbatim. */
+      if (*ptr != '\\')
+        cu_regex_append (result, sizeof (result), &result_len, ptr - 1, 1);
+      cu_regex_append (result, sizeof (result), &result_len, ptr, 1);
+      continue;
+    }
+
+    /* Sub-matches which did not participate in the match are empty. */
+    n = (size_t) (*ptr - '0');
+    if ((n < m_num) && (m[n].rm_so >= 0))
+      cu_regex_append (result, sizeof (result), &result_len,
+          buffer + m[n].rm_so, (size_t) (m[n].rm_eo - m[n].rm_so));
+  }
+
+  cu_regex_append (result, sizeof (result), &result_len,
+      buffer + m[0].rm_eo, strlen (buffer + m[0].rm_eo));
+
+  memcpy (buffer, result, result_len + 1);
+  return (1);
+} /* int cu_regex_replace_refs */
+
+int cu_regex_replace (cu_regex_t *re, char *buffer, size_t buffer_size,
+    const char *replacement)
+{
+  size_t start;
+  size_t end;
+  size_t len;
+  size_t repl_len;
+  size_t tail_len;
+
+  if ((re == NULL) || (buffer == NULL) || (buffer_size < 1)
+      || (replacement == NULL) || (re->flags & CU_REGEX_NOSUB))
+    return (-EINVAL);
+
+  if (re->replace_refs && (strchr (replacement, '\\') != NULL))
+  {
+    regmatch_t m[10];
+    int status;
+
+    /* The DFA engine rejects non-matches in linear time; only the strings
+     * that match are handed to regexec(3) to find the sub-matches. */
+    if ((re->dfa != NULL) && !dfa_regex_match (re->dfa, buffer))
+      return (0);
+
+    status = regexec (&re->posix, buffer, STATIC_ARRAY_SIZE (m), m,
+        /* eflags = */ 0);
+    if (status == REG_NOMATCH)
+      return (0);
+    else if (status != 0)
+      return (-1);
+
+    return (cu_regex_replace_refs (buffer, buffer_size, replacement,
+          m, STATIC_ARRAY_SIZE (m)));
+  }
+
+  if (re->dfa != NULL)
+  {
+    if (dfa_regex_search (re->dfa, buffer, &start, &end) != 0)
+      return (0);
+  }
+  else
+  {
+    regmatch_t m;
+    int status;
+
+    status = regexec (&re->posix, buffer, /* nmatch = */ 1, &m,
+        /* eflags = */ 0);
+    if (status == REG_NOMATCH)
+      return (0);
+    else if (status != 0)
+      return (-1);
+
+    start = (size_t) m.rm_so;
+    end = (size_t) m.rm_eo;
+  }
+
+  /* Move the rest of the string into place, then copy the replacement in
+   * front of it. */
+  len = strlen (buffer);
+  repl_len = strlen (replacement);
+  if (start + repl_len >= buffer_size)
+    repl_len = buffer_size - start - 1;
+
+  tail_len = len - end;
+  if (start + repl_len + tail_len >= buffer_size)
+    tail_len = buffer_size - (start + repl_len) - 1;
+
+  memmove (buffer + start + repl_len, buffer + end, tail_len);
+  memcpy (buffer + start, replacement, repl_len);
+  buffer[start + repl_len + tail_len] = 0;
+
+  return (1);
+} /* int cu_regex_replace */
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -56,6 +56,12 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_regex_s;
+typedef struct cu_regex_s cu_regex_t;
+
+/* Passed to `cu_regex_create' if only `cu_regex_match' will be used. */
+#define CU_REGEX_NOSUB 0x01
+
 struct cu_match_value_s
 {
   int ds_type;
@@ -150,6 +156,64 @@ int match_apply (cu_match_t *obj, const char *str);
  */
 void *match_get_user_data (cu_match_t *obj);
 
+/*
+ * NAME
+ *  cu_regex_create
+ *
+ * DESCRIPTION
+ *  Compiles the POSIX extended regular expression `pattern'. Depending on the
+ *  global `RegexEngine' option, the expression is matched using regexec(3)
+ *  or using the linear-time matcher in `utils_regex.h'. Patterns which the
+ *  latter does not support are matched using regexec(3) in either case.
+ *  On failure, NULL is returned and an error message is stored in `errbuf'.
+ */
+cu_regex_t *cu_regex_create (const char *pattern, int flags,
+    char *errbuf, size_t errbuf_size);
+
+/*
+ * NAME
+ *  cu_regex_destroy
+ *
+ * DESCRIPTION
+ *  Destroys the object and frees all internal resources.
+ */
+void cu_regex_destroy (cu_regex_t *re);
+
+/*
+ * NAME
+ *  cu_regex_pattern
+ *
+ * DESCRIPTION
+ *  Returns the pattern passed to `cu_regex_create'.
+ */
+const char *cu_regex_pattern (const cu_regex_t *re);
+
+/*
+ * NAME
+ *  cu_regex_match
+ *
+ * DESCRIPTION
+ *  Returns non-zero if `str' matches the regular expression.
+ */
+int cu_regex_match (cu_regex_t *re, const char *str);
+
+/*
+ * NAME
+ *  cu_regex_replace
+ *
+ * DESCRIPTION
+ *  Replaces the leftmost-longest match of the regular expression in `buffer'
+ *  with `replacement', in place. If the expression was created with the
+ *  global `RegexEngine' option set to `DFA', \0 in `replacement' stands for
+ *  the match, \1 to \9 for its sub-matches and \\ for a single backslash;
+ *  otherwise `replacement' is inserted verbatim. Like `subst', the result is
+ *  truncated if `buffer_size' is too small. Returns one if
+ *  `buffer' has been modified, zero if it did not match and less than zero on
+ *  failure. Must not be used with objects created with CU_REGEX_NOSUB.
+ */
+int cu_regex_replace (cu_regex_t *re, char *buffer, size_t buffer_size,
+    const char *replacement);
+
 #endif /* UTILS_MATCH_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -0,0 +1,391 @@
+/**
+ * collectd - src/utils_procfile.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_procfile.h"
+
+#include <pthread.h>
+
+#define PROCFILE_BUFFER_SIZE_MIN 4096
+
+struct procfile_s
+{
+  int refs;
+  cdtime_t time;
+
+  /* Keys and values point into this buffer. */
+  char *buffer;
+
+  procfile_entry_t *entries;
+  size_t entries_num;
+
+  /* Entries sorted by key, for procfile_lookup(). */
+  procfile_entry_t **sorted;
+};
+
+/* One per file; holds the file descriptor and the most recent snapshot. */
+struct procfile_cache_s
+{
+  char *path;
+  int fd;
+  size_t buffer_size;
+  procfile_t *current;
+};
+typedef struct procfile_cache_s procfile_cache_t;
+
+static c_avl_tree_t *cache_tree = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int procfile_compare_entries (const void *a, const void *b) /* {{{ */
+{
+  procfile_entry_t const *e0 = *((procfile_entry_t * const *) a);
+  procfile_entry_t const *e1 = *((procfile_entry_t * const *) b);
+  int status;
+
+  /* Keep entries with the same key in file order. */
+  status = strcmp (e0->key, e1->key);
+  if (status != 0)
+    return (status);
+  return ((e0 < e1) ? -1 : (e0 > e1) ? 1 : 0);
+} /* }}} int procfile_compare_entries */
+
+static int procfile_compare_key (const void *key, const void *e) /* {{{ */
+{
+  return (strcmp (key, (*((procfile_entry_t * const *) e))->key));
+} /* }}} int procfile_compare_key */
+
+static void procfile_free (procfile_t *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return;
+
+  sfree (pf->buffer);
+  sfree (pf->entries);
+  sfree (pf->sorted);
+  sfree (pf);
+} /* }}} void procfile_free */
+
+/* Must be called with "cache_lock" held. */
+static void procfile_unref (procfile_t *pf) /* {{{ */
+{
+  assert (pf->refs > 0);
+  pf->refs--;
+  if (pf->refs == 0)
+    procfile_free (pf);
+} /* }}} void procfile_unref */
+
+/* Splits the buffer into lines and the lines into keys and values. */
+static int procfile_parse (procfile_t *pf) /* {{{ */
+{
+  char *line;
+  size_t lines_num = 0;
+  size_t i;
+
+  for (line = pf->buffer; *line != 0; line++)
+    if (*line == '\n')
+      lines_num++;
+  lines_num++;
+
+  pf->entries = calloc (lines_num, sizeof (*pf->entries));
+  if (pf->entries == NULL)
+    return (ENOMEM);
+
+  line = pf->buffer;
+  while ((line != NULL) && (*line != 0))
+  {
+    procfile_entry_t *e = pf->entries + pf->entries_num;
+    char *next;
+    char *key;
+    char *value;
+    char *ptr;
+    char *endptr;
+
+    next = strchr (line, '\n');
+    if (next != NULL)
+    {
+      *next = 0;
+      next++;
+    }
+
+    key = strtok_r (line, " \t", &ptr);
+    value = (key != NULL) ? strtok_r (NULL, " \t", &ptr) : NULL;
+    line = next;
+    if (value == NULL)
+      continue;
+
+    if ((strlen (key) > 1) && (key[strlen (key) - 1] == ':'))
+      key[strlen (key) - 1] = 0;
+
+    e->key = key;
+    e->value = value;
+
+    endptr = NULL;
+    e->derive = (derive_t) strtoll (value, &endptr, 10);
+    e->numeric = (endptr != value);
+    e->gauge = e->numeric ? (gauge_t) strtod (value, NULL) : NAN;
+
+    pf->entries_num++;
+  }
+
+  pf->sorted = calloc (pf->entries_num + 1, sizeof (*pf->sorted));
+  if (pf->sorted == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < pf->entries_num; i++)
+    pf->sorted[i] = pf->entries + i;
+  qsort (pf->sorted, pf->entries_num, sizeof (*pf->sorted),
+      procfile_compare_entries);
+
+  return (0);
+} /* }}} int procfile_parse */
+
+/* Reads a new snapshot. Must be called with "cache_lock" held. Returns NULL
+ * and sets errno on failure. */
+static procfile_t *procfile_read (procfile_cache_t *pc) /* {{{ */
+{
+  procfile_t *pf;
+  size_t size = pc->buffer_size;
+  size_t len = 0;
+  int status;
+
+  if (pc->fd < 0)
+  {
+    pc->fd = open (pc->path, O_RDONLY);
+    if (pc->fd < 0)
+      return (NULL);
+  }
+
+  pf = malloc (sizeof (*pf));
+  if (pf == NULL)
+  {
+    errno = ENOMEM;
+    return (NULL);
+  }
+  memset (pf, 0, sizeof (*pf));
+
+  pf->buffer = malloc (size);
+  if (pf->buffer == NULL)
+  {
+    procfile_free (pf);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  /* The file is kept open and read from the beginning using pread(2). This
+   * works for both, seq_file based files in /proc and sysfs attributes. */
+  while (42)
+  {
+    ssize_t n;
+
+    if ((len + 1) >= size)
+    {
+      char *tmp;
+
+      tmp = realloc (pf->buffer, 2 * size);
+      if (tmp == NULL)
+      {
+        procfile_free (pf);
+        errno = ENOMEM;
+        return (NULL);
+      }
+      pf->buffer = tmp;
+      size *= 2;
+    }
+
+    n = pread (pc->fd, pf->buffer + len, size - len - 1, (off_t) len);
+    if (n < 0)
+    {
+      int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+
+      /* The file may have gone away, e.g. a hot-unplugged NUMA node. Reopen
+       * it with the next call. */
+      close (pc->fd);
+      pc->fd = -1;
+      procfile_free (pf);
+      errno = saved_errno;
+      return (NULL);
+    }
+    else if (n == 0)
+      break;
+
+    len += (size_t) n;
+  }
+  pf->buffer[len] = 0;
+  pc->buffer_size = size;
+
+  status = procfile_parse (pf);
+  if (status != 0)
+  {
+    procfile_free (pf);
+    errno = status;
+    return (NULL);
+  }
+
+  pf->time = cdtime ();
+  return (pf);
+} /* }}} procfile_t *procfile_read */
+
+static cdtime_t procfile_max_age (void) /* {{{ */
+{
+  plugin_ctx_t ctx = plugin_get_ctx ();
+  cdtime_t interval = plugin_get_interval ();
+
+  if ((ctx.sample_interval != 0) && (ctx.sample_interval < interval))
+    interval = ctx.sample_interval;
+
+  if ((interval / 2) < TIME_T_TO_CDTIME_T (1))
+    return (interval / 2);
+  return (TIME_T_TO_CDTIME_T (1));
+} /* }}} cdtime_t procfile_max_age */
+
+procfile_t *procfile_get (char const *path) /* {{{ */
+{
+  procfile_cache_t *pc;
+  procfile_t *pf;
+  cdtime_t max_age;
+
+  if (path == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  max_age = procfile_max_age ();
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (cache_tree == NULL)
+  {
+    cache_tree = c_avl_create ((void *) strcmp);
+    if (cache_tree == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      errno = ENOMEM;
+      return (NULL);
+    }
+  }
+
+  if (c_avl_get (cache_tree, path, (void *) &pc) != 0)
+  {
+    pc = malloc (sizeof (*pc));
+    if (pc == NULL)
+    {
+      pthread_mutex_unlock (&cache_lock);
+      errno = ENOMEM;
+      return (NULL);
+    }
+    memset (pc, 0, sizeof (*pc));
+    pc->fd = -1;
+    pc->buffer_size = PROCFILE_BUFFER_SIZE_MIN;
+    pc->path = strdup (path);
+    if ((pc->path == NULL)
+        || (c_avl_insert (cache_tree, pc->path, pc) != 0))
+    {
+      pthread_mutex_unlock (&cache_lock);
+      sfree (pc->path);
+      sfree (pc);
+      errno = ENOMEM;
+      return (NULL);
+    }
+  }
+
+  if ((pc->current != NULL) && ((cdtime () - pc->current->time) <= max_age))
+  {
+    pf = pc->current;
+    pf->refs++;
+    pthread_mutex_unlock (&cache_lock);
+    return (pf);
+  }
+
+  pf = procfile_read (pc);
+  if (pf == NULL)
+  {
+    int saved_errno = errno;
+    pthread_mutex_unlock (&cache_lock);
+    errno = saved_errno;
+    return (NULL);
+  }
+
+  /* One reference is held by the cache, one by the caller. */
+  if (pc->current != NULL)
+    procfile_unref (pc->current);
+  pc->current = pf;
+  pf->refs = 2;
+
+  pthread_mutex_unlock (&cache_lock);
+  return (pf);
+} /* }}} procfile_t *procfile_get */
+
+void procfile_release (procfile_t *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return;
+
+  pthread_mutex_lock (&cache_lock);
+  procfile_unref (pf);
+  pthread_mutex_unlock (&cache_lock);
+} /* }}} void procfile_release */
+
+cdtime_t procfile_time (procfile_t const *pf) /* {{{ */
+{
+  if (pf == NULL)
+    return (0);
+  return (pf->time);
+} /* }}} cdtime_t procfile_time */
+
+size_t procfile_entries (procfile_t const *pf, /* {{{ */
+    procfile_entry_t const **ret_entries)
+{
+  if (pf == NULL)
+    return (0);
+
+  if (ret_entries != NULL)
+    *ret_entries = pf->entries;
+  return (pf->entries_num);
+} /* }}} size_t procfile_entries */
+
+procfile_entry_t const *procfile_lookup (procfile_t const *pf, /* {{{ */
+    char const *key)
+{
+  procfile_entry_t **e;
+
+  if ((pf == NULL) || (key == NULL) || (pf->entries_num == 0))
+    return (NULL);
+
+  e = bsearch (key, pf->sorted, pf->entries_num, sizeof (*pf->sorted),
+      procfile_compare_key);
+  if (e == NULL)
+    return (NULL);
+
+  /* Return the first of several entries with the same key. */
+  while ((e > pf->sorted) && (strcmp ((*(e - 1))->key, key) == 0))
+    e--;
+
+  return (*e);
+} /* }}} procfile_entry_t const *procfile_lookup */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
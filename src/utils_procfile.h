@@ -0,0 +1,75 @@
+/**
+ * collectd - src/utils_procfile.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_PROCFILE_H
+#define UTILS_PROCFILE_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/*
+ * Shared snapshots of "key value" files such as /proc/meminfo, /proc/vmstat
+ * or /sys/devices/system/node/node<n>/numastat. The daemon keeps the files
+ * open and reads each one at most once per read interval: plugins asking for
+ * the same file during the same interval get the same, already parsed
+ * snapshot.
+ *
+ * Every line is split into a key, with a trailing colon removed, and the
+ * first field after it. Additional fields, e.g. the "kB" unit in
+ * /proc/meminfo, are ignored.
+ */
+struct procfile_s;
+typedef struct procfile_s procfile_t;
+
+struct procfile_entry_s
+{
+  char const *key;
+  char const *value;
+
+  /* Only valid if "numeric" is true. */
+  _Bool numeric;
+  derive_t derive;
+  gauge_t gauge;
+};
+typedef struct procfile_entry_s procfile_entry_t;
+
+/* Returns a snapshot of "path". A snapshot is reused if it is younger than
+ * half the (sample) interval of the calling read function, and at most one
+ * second. The returned snapshot must be released using procfile_release().
+ * Returns NULL and sets errno on failure. */
+procfile_t *procfile_get (char const *path);
+void procfile_release (procfile_t *pf);
+
+/* Time at which the snapshot was read. */
+cdtime_t procfile_time (procfile_t const *pf);
+
+/* Returns the number of entries and stores a pointer to the entries, in the
+ * order in which they appear in the file, in "ret_entries". */
+size_t procfile_entries (procfile_t const *pf,
+    procfile_entry_t const **ret_entries);
+
+/* Returns the (first) entry with the given key or NULL. */
+procfile_entry_t const *procfile_lookup (procfile_t const *pf,
+    char const *key);
+
+#endif /* UTILS_PROCFILE_H */
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,1323 @@
+/**
+ * collectd - src/utils_regex.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_regex.h"
+
+#include <ctype.h>
+
+/* Limits beyond which dfa_regex_compile() fails with ENOTSUP. The program
+ * size also limits the stack usage of dfa_regex_search(). */
+#define DFA_PROG_MAX    1024
+#define DFA_REPEAT_MAX   255
+#define DFA_STATES_MAX   512
+#define DFA_HASH_SIZE   1024
+
+#define CLASS_TEST(c,b) (((c)[(b) / 32] >> ((b) % 32)) & 0x01)
+#define CLASS_SET(c,b)  ((c)[(b) / 32] |= (((uint32_t) 1) << ((b) % 32)))
+
+/*
+ * Syntax tree
+ */
+enum node_type_e
+{
+  NODE_EMPTY,
+  NODE_CLASS,
+  NODE_CAT,
+  NODE_ALT,
+  NODE_REPEAT,
+  NODE_BOL,
+  NODE_EOL
+};
+
+struct node_s
+{
+  enum node_type_e type;
+  int cls;    /* NODE_CLASS */
+  int left;   /* NODE_CAT, NODE_ALT, NODE_REPEAT */
+  int right;  /* NODE_CAT, NODE_ALT */
+  int min;    /* NODE_REPEAT */
+  int max;    /* NODE_REPEAT; -1 means unbounded */
+};
+typedef struct node_s node_t;
+
+/*
+ * Program
+ */
+enum op_e
+{
+  OP_CLASS, /* consume one byte in class `x' */
+  OP_SPLIT, /* continue at `x' and `y' */
+  OP_JMP,   /* continue at `x' */
+  OP_BOL,   /* assert beginning of string */
+  OP_EOL,   /* assert end of string */
+  OP_MATCH
+};
+
+struct inst_s
+{
+  enum op_e op;
+  int x;
+  int y;
+};
+typedef struct inst_s inst_t;
+
+struct dfa_regex_s
+{
+  inst_t *prog;
+  int prog_len;
+
+  uint32_t (*classes)[8];
+  int classes_num;
+
+  /* Set if the pattern is a literal string, optionally anchored. */
+  char *literal;
+  size_t literal_len;
+  _Bool anchor_start;
+  _Bool anchor_end;
+
+  /* Set if all matches start at the beginning of the string. */
+  _Bool anchored;
+
+  /* DFA; NULL if it would have had more than DFA_STATES_MAX states. */
+  int *trans; /* states_num * byte_classes_num */
+  unsigned char byte_class[256];
+  int byte_classes_num;
+  _Bool *accept;
+  _Bool *accept_at_end;
+  int states_num;
+};
+
+/* State used while parsing and compiling. */
+struct compiler_s
+{
+  char const *pattern;
+  char const *ptr;
+
+  node_t *nodes;
+  int nodes_num;
+  int nodes_size;
+
+  dfa_regex_t *re;
+  int prog_size;
+};
+typedef struct compiler_s compiler_t;
+
+/* Sets of program counters, used when building the DFA. */
+struct pc_set_s
+{
+  int *pcs;
+  int num;
+  int *mark; /* generation per pc */
+  int gen;
+};
+typedef struct pc_set_s pc_set_t;
+
+/*
+ * Parser
+ */
+static int node_new (compiler_t *c, enum node_type_e type) /* {{{ */
+{
+  node_t *n;
+
+  if (c->nodes_num >= c->nodes_size)
+  {
+    int new_size = (c->nodes_size > 0) ? 2 * c->nodes_size : 32;
+    node_t *tmp;
+
+    tmp = realloc (c->nodes, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-ENOMEM);
+    c->nodes = tmp;
+    c->nodes_size = new_size;
+  }
+
+  n = c->nodes + c->nodes_num;
+  memset (n, 0, sizeof (*n));
+  n->type = type;
+  n->left = -1;
+  n->right = -1;
+
+  return (c->nodes_num++);
+} /* }}} int node_new */
+
+static int node_new_pair (compiler_t *c, enum node_type_e type, /* {{{ */
+    int left, int right)
+{
+  int n = node_new (c, type);
+
+  if (n < 0)
+    return (n);
+  c->nodes[n].left = left;
+  c->nodes[n].right = right;
+  return (n);
+} /* }}} int node_new_pair */
+
+static int class_new (compiler_t *c) /* {{{ */
+{
+  dfa_regex_t *re = c->re;
+  uint32_t (*tmp)[8];
+
+  tmp = realloc (re->classes, (re->classes_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+    return (-ENOMEM);
+  re->classes = tmp;
+  memset (re->classes[re->classes_num], 0, sizeof (*tmp));
+
+  return (re->classes_num++);
+} /* }}} int class_new */
+
+static int node_new_class (compiler_t *c, int *ret_cls) /* {{{ */
+{
+  int cls;
+  int n;
+
+  cls = class_new (c);
+  if (cls < 0)
+    return (cls);
+
+  n = node_new (c, NODE_CLASS);
+  if (n < 0)
+    return (n);
+  c->nodes[n].cls = cls;
+
+  *ret_cls = cls;
+  return (n);
+} /* }}} int node_new_class */
+
+static int parse_char_class (compiler_t *c, uint32_t *cls) /* {{{ */
+{
+  static struct
+  {
+    char const *name;
+    int (*func) (int);
+  } classes[] = {
+    { "alpha",  isalpha },
+    { "digit",  isdigit },
+    { "alnum",  isalnum },
+    { "upper",  isupper },
+    { "lower",  islower },
+    { "space",  isspace },
+    { "blank",  isblank },
+    { "punct",  ispunct },
+    { "print",  isprint },
+    { "graph",  isgraph },
+    { "cntrl",  iscntrl },
+    { "xdigit", isxdigit }
+  };
+  char const *end;
+  size_t i;
+
+  /* c->ptr points after "[:". */
+  end = strstr (c->ptr, ":]");
+  if (end == NULL)
+    return (-ENOTSUP);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (classes); i++)
+  {
+    int b;
+
+    if ((strlen (classes[i].name) != (size_t) (end - c->ptr))
+        || (strncmp (classes[i].name, c->ptr, end - c->ptr) != 0))
+      continue;
+
+    for (b = 1; b < 256; b++)
+      if (classes[i].func (b))
+        CLASS_SET (cls, b);
+
+    c->ptr = end + 2;
+    return (0);
+  }
+
+  return (-ENOTSUP);
+} /* }}} int parse_char_class */
+
+/* Parses a bracket expression. c->ptr points after the opening bracket. */
+static int parse_bracket (compiler_t *c) /* {{{ */
+{
+  uint32_t *cls;
+  _Bool negate = 0;
+  _Bool first = 1;
+  int cls_idx;
+  int n;
+  int i;
+
+  n = node_new_class (c, &cls_idx);
+  if (n < 0)
+    return (n);
+  cls = c->re->classes[cls_idx];
+
+  if (*c->ptr == '^')
+  {
+    negate = 1;
+    c->ptr++;
+  }
+
+  while (42)
+  {
+    unsigned char lo;
+    unsigned char hi;
+
+    if (*c->ptr == 0)
+      return (-ENOTSUP);
+    if ((*c->ptr == ']') && !first)
+    {
+      c->ptr++;
+      break;
+    }
+    first = 0;
+
+    if ((c->ptr[0] == '[') && (c->ptr[1] == ':'))
+    {
+      int status;
+
+      c->ptr += 2;
+      status = parse_char_class (c, cls);
+      if (status != 0)
+        return (status);
+      continue;
+    }
+    else if ((c->ptr[0] == '[') && ((c->ptr[1] == '.') || (c->ptr[1] == '=')))
+      return (-ENOTSUP);
+
+    lo = (unsigned char) *c->ptr;
+    c->ptr++;
+    hi = lo;
+
+    if ((c->ptr[0] == '-') && (c->ptr[1] != ']') && (c->ptr[1] != 0))
+    {
+      if (c->ptr[1] == '[')
+        return (-ENOTSUP);
+      hi = (unsigned char) c->ptr[1];
+      c->ptr += 2;
+      if (hi < lo)
+        return (-ENOTSUP);
+    }
+
+    for (i = lo; i <= hi; i++)
+      CLASS_SET (cls, i);
+  }
+
+  if (negate)
+    for (i = 0; i < 8; i++)
+      cls[i] = ~cls[i];
+  /* Strings never contain the null byte. */
+  cls[0] &= ~((uint32_t) 1);
+
+  return (n);
+} /* }}} int parse_bracket */
+
+static int parse_number (compiler_t *c, int *ret) /* {{{ */
+{
+  int n = 0;
+
+  if (!isdigit ((unsigned char) *c->ptr))
+    return (-ENOTSUP);
+
+  while (isdigit ((unsigned char) *c->ptr))
+  {
+    n = 10 * n + (*c->ptr - '0');
+    if (n > DFA_REPEAT_MAX)
+      return (-ENOTSUP);
+    c->ptr++;
+  }
+
+  *ret = n;
+  return (0);
+} /* }}} int parse_number */
+
+static int parse_regex (compiler_t *c);
+
+static int parse_atom (compiler_t *c) /* {{{ */
+{
+  int cls_idx;
+  int n;
+
+  switch (*c->ptr)
+  {
+    case '(':
+      c->ptr++;
+      n = parse_regex (c);
+      if (n < 0)
+        return (n);
+      if (*c->ptr != ')')
+        return (-ENOTSUP);
+      c->ptr++;
+      return (n);
+
+    case '[':
+      c->ptr++;
+      return (parse_bracket (c));
+
+    case '.':
+      c->ptr++;
+      n = node_new_class (c, &cls_idx);
+      if (n >= 0)
+      {
+        memset (c->re->classes[cls_idx], 0xff, sizeof (c->re->classes[0]));
+        c->re->classes[cls_idx][0] &= ~((uint32_t) 1);
+      }
+      return (n);
+
+    case '^':
+      c->ptr++;
+      return (node_new (c, NODE_BOL));
+
+    case '$':
+      c->ptr++;
+      return (node_new (c, NODE_EOL));
+
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      /* Repetition without an atom. */
+      return (-ENOTSUP);
+
+    case '\\':
+      c->ptr++;
+      /* Escaped letters and digits are GNU extensions or back
+       * references, as are the word and buffer anchors. */
+      if ((*c->ptr == 0) || isalnum ((unsigned char) *c->ptr)
+          || (strchr ("<>`'", *c->ptr) != NULL))
+        return (-ENOTSUP);
+      /* fall through */
+
+    default:
+      n = node_new_class (c, &cls_idx);
+      if (n >= 0)
+        CLASS_SET (c->re->classes[cls_idx], (unsigned char) *c->ptr);
+      c->ptr++;
+      return (n);
+  }
+} /* }}} int parse_atom */
+
+static int parse_piece (compiler_t *c) /* {{{ */
+{
+  int n;
+
+  n = parse_atom (c);
+  if (n < 0)
+    return (n);
+
+  while ((*c->ptr == '*') || (*c->ptr == '+') || (*c->ptr == '?')
+      || (*c->ptr == '{'))
+  {
+    int min = 0;
+    int max = -1;
+    int r;
+
+    if ((c->nodes[n].type == NODE_BOL) || (c->nodes[n].type == NODE_EOL))
+      return (-ENOTSUP);
+
+    if (*c->ptr == '*')
+      c->ptr++;
+    else if (*c->ptr == '+')
+    {
+      min = 1;
+      c->ptr++;
+    }
+    else if (*c->ptr == '?')
+    {
+      max = 1;
+      c->ptr++;
+    }
+    else /* if (*c->ptr == '{') */
+    {
+      int status;
+
+      c->ptr++;
+      status = parse_number (c, &min);
+      if (status != 0)
+        return (status);
+
+      if (*c->ptr == ',')
+      {
+        c->ptr++;
+        if (*c->ptr != '}')
+        {
+          status = parse_number (c, &max);
+          if (status != 0)
+            return (status);
+          if (max < min)
+            return (-ENOTSUP);
+        }
+      }
+      else
+        max = min;
+
+      if (*c->ptr != '}')
+        return (-ENOTSUP);
+      c->ptr++;
+    }
+
+    r = node_new (c, NODE_REPEAT);
+    if (r < 0)
+      return (r);
+    c->nodes[r].left = n;
+    c->nodes[r].min = min;
+    c->nodes[r].max = max;
+    n = r;
+  }
+
+  return (n);
+} /* }}} int parse_piece */
+
+static int parse_branch (compiler_t *c) /* {{{ */
+{
+  int n = -1;
+
+  while ((*c->ptr != 0) && (*c->ptr != '|') && (*c->ptr != ')'))
+  {
+    int p;
+
+    p = parse_piece (c);
+    if (p < 0)
+      return (p);
+
+    if (n < 0)
+      n = p;
+    else
+    {
+      n = node_new_pair (c, NODE_CAT, n, p);
+      if (n < 0)
+        return (n);
+    }
+  }
+
+  if (n < 0)
+    n = node_new (c, NODE_EMPTY);
+  return (n);
+} /* }}} int parse_branch */
+
+static int parse_regex (compiler_t *c) /* {{{ */
+{
+  int n;
+
+  n = parse_branch (c);
+  while ((n >= 0) && (*c->ptr == '|'))
+  {
+    int b;
+
+    c->ptr++;
+    b = parse_branch (c);
+    if (b < 0)
+      return (b);
+    n = node_new_pair (c, NODE_ALT, n, b);
+  }
+
+  return (n);
+} /* }}} int parse_regex */
+
+/*
+ * Code generation
+ */
+static int emit (compiler_t *c, enum op_e op, int x, int y) /* {{{ */
+{
+  dfa_regex_t *re = c->re;
+
+  if (re->prog_len >= DFA_PROG_MAX)
+    return (-ENOTSUP);
+
+  if (re->prog_len >= c->prog_size)
+  {
+    int new_size = (c->prog_size > 0) ? 2 * c->prog_size : 64;
+    inst_t *tmp;
+
+    tmp = realloc (re->prog, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-ENOMEM);
+    re->prog = tmp;
+    c->prog_size = new_size;
+  }
+
+  re->prog[re->prog_len].op = op;
+  re->prog[re->prog_len].x = x;
+  re->prog[re->prog_len].y = y;
+  return (re->prog_len++);
+} /* }}} int emit */
+
+static int gen (compiler_t *c, int n) /* {{{ */
+{
+  node_t *node = c->nodes + n;
+  inst_t *prog;
+  int status;
+  int split;
+  int jmp;
+  int i;
+
+  switch (node->type)
+  {
+    case NODE_EMPTY:
+      return (0);
+
+    case NODE_CLASS:
+      status = emit (c, OP_CLASS, node->cls, 0);
+      return ((status < 0) ? status : 0);
+
+    case NODE_BOL:
+      status = emit (c, OP_BOL, 0, 0);
+      return ((status < 0) ? status : 0);
+
+    case NODE_EOL:
+      status = emit (c, OP_EOL, 0, 0);
+      return ((status < 0) ? status : 0);
+
+    case NODE_CAT:
+      status = gen (c, node->left);
+      if (status == 0)
+        status = gen (c, node->right);
+      return (status);
+
+    case NODE_ALT:
+      /*     split L1, L2
+       * L1: <left>
+       *     jmp L3
+       * L2: <right>
+       * L3: */
+      split = emit (c, OP_SPLIT, 0, 0);
+      if (split < 0)
+        return (split);
+      status = gen (c, node->left);
+      if (status != 0)
+        return (status);
+      jmp = emit (c, OP_JMP, 0, 0);
+      if (jmp < 0)
+        return (jmp);
+      status = gen (c, node->right);
+      if (status != 0)
+        return (status);
+      prog = c->re->prog;
+      prog[split].x = split + 1;
+      prog[split].y = jmp + 1;
+      prog[jmp].x = c->re->prog_len;
+      return (0);
+
+    case NODE_REPEAT:
+      for (i = 0; i < node->min; i++)
+      {
+        status = gen (c, node->left);
+        if (status != 0)
+          return (status);
+      }
+
+      if (node->max < 0)
+      {
+        /* L1: split L2, L3
+         * L2: <left>
+         *     jmp L1
+         * L3: */
+        split = emit (c, OP_SPLIT, 0, 0);
+        if (split < 0)
+          return (split);
+        status = gen (c, node->left);
+        if (status != 0)
+          return (status);
+        jmp = emit (c, OP_JMP, split, 0);
+        if (jmp < 0)
+          return (jmp);
+        prog = c->re->prog;
+        prog[split].x = split + 1;
+        prog[split].y = jmp + 1;
+        return (0);
+      }
+
+      for (i = node->min; i < node->max; i++)
+      {
+        /*     split L1, L2
+         * L1: <left>
+         * L2: */
+        split = emit (c, OP_SPLIT, 0, 0);
+        if (split < 0)
+          return (split);
+        status = gen (c, node->left);
+        if (status != 0)
+          return (status);
+        prog = c->re->prog;
+        prog[split].x = split + 1;
+        prog[split].y = c->re->prog_len;
+      }
+      return (0);
+  }
+
+  return (-EINVAL);
+} /* }}} int gen */
+
+/* Checks whether the pattern is a literal string, optionally anchored, and
+ * initializes re->literal if so. */
+static int check_literal (compiler_t *c, int n, /* {{{ */
+    char *buffer, size_t *len, _Bool *is_first)
+{
+  node_t *node = c->nodes + n;
+  int status;
+  int b;
+  int found = -1;
+
+  switch (node->type)
+  {
+    case NODE_EMPTY:
+      return (0);
+
+    case NODE_CAT:
+      status = check_literal (c, node->left, buffer, len, is_first);
+      if (status == 0)
+        status = check_literal (c, node->right, buffer, len, is_first);
+      return (status);
+
+    case NODE_BOL:
+      if (!*is_first)
+        return (-1);
+      c->re->anchor_start = 1;
+      *is_first = 0;
+      return (0);
+
+    case NODE_CLASS:
+      if (c->re->anchor_end)
+        return (-1);
+      for (b = 1; b < 256; b++)
+      {
+        if (!CLASS_TEST (c->re->classes[node->cls], b))
+          continue;
+        if (found >= 0)
+          return (-1);
+        found = b;
+      }
+      if (found < 0)
+        return (-1);
+      buffer[(*len)++] = (char) found;
+      *is_first = 0;
+      return (0);
+
+    case NODE_EOL:
+      if (c->re->anchor_end)
+        return (-1);
+      c->re->anchor_end = 1;
+      *is_first = 0;
+      return (0);
+
+    default:
+      return (-1);
+  }
+} /* }}} int check_literal */
+
+/*
+ * DFA construction
+ */
+static void pc_set_clear (pc_set_t *s) /* {{{ */
+{
+  s->num = 0;
+  s->gen++;
+} /* }}} void pc_set_clear */
+
+/* Adds `pc' and all instructions reachable from it without consuming a byte
+ * to `s'. Only instructions which are relevant for the next step or the end
+ * of the string are stored in the set. `stack' must be able to hold
+ * re->prog_len elements. */
+static void pc_set_add (dfa_regex_t const *re, pc_set_t *s, int *stack, /* {{{ */
+    int pc, _Bool at_start)
+{
+  int stack_num = 0;
+
+  stack[stack_num++] = pc;
+  while (stack_num > 0)
+  {
+    inst_t const *inst;
+
+    pc = stack[--stack_num];
+    if (s->mark[pc] == s->gen)
+      continue;
+    s->mark[pc] = s->gen;
+
+    inst = re->prog + pc;
+    switch (inst->op)
+    {
+      case OP_JMP:
+        stack[stack_num++] = inst->x;
+        break;
+      case OP_SPLIT:
+        stack[stack_num++] = inst->y;
+        stack[stack_num++] = inst->x;
+        break;
+      case OP_BOL:
+        if (at_start)
+          stack[stack_num++] = pc + 1;
+        break;
+      case OP_CLASS:
+      case OP_EOL:
+      case OP_MATCH:
+        s->pcs[s->num++] = pc;
+        break;
+    }
+  }
+} /* }}} void pc_set_add */
+
+static int compare_int (void const *a, void const *b) /* {{{ */
+{
+  int ia = *((int const *) a);
+  int ib = *((int const *) b);
+  return ((ia < ib) ? -1 : (ia > ib) ? 1 : 0);
+} /* }}} int compare_int */
+
+static _Bool pc_set_accepts_at_end (dfa_regex_t const *re, /* {{{ */
+    int const *pcs, int pcs_num, pc_set_t *tmp, int *stack)
+{
+  int i;
+
+  pc_set_clear (tmp);
+  for (i = 0; i < pcs_num; i++)
+  {
+    if (re->prog[pcs[i]].op == OP_MATCH)
+      return (1);
+    if (re->prog[pcs[i]].op == OP_EOL)
+      pc_set_add (re, tmp, stack, pcs[i] + 1, /* at_start = */ 0);
+  }
+
+  for (i = 0; i < tmp->num; i++)
+  {
+    if (re->prog[tmp->pcs[i]].op == OP_MATCH)
+      return (1);
+    /* "$$" */
+    if (re->prog[tmp->pcs[i]].op == OP_EOL)
+      pc_set_add (re, tmp, stack, tmp->pcs[i] + 1, /* at_start = */ 0);
+  }
+
+  return (0);
+} /* }}} _Bool pc_set_accepts_at_end */
+
+/* Computes classes of bytes which are treated identically by all
+ * instructions. */
+static void dfa_byte_classes (dfa_regex_t *re) /* {{{ */
+{
+  int b;
+
+  re->byte_classes_num = 0;
+  for (b = 0; b < 256; b++)
+  {
+    int other;
+
+    for (other = 0; other < b; other++)
+    {
+      int i;
+
+      for (i = 0; i < re->classes_num; i++)
+        if (CLASS_TEST (re->classes[i], b)
+            != CLASS_TEST (re->classes[i], other))
+          break;
+      if (i >= re->classes_num)
+        break;
+    }
+
+    if (other < b)
+      re->byte_class[b] = re->byte_class[other];
+    else
+      re->byte_class[b] = (unsigned char) re->byte_classes_num++;
+  }
+} /* }}} void dfa_byte_classes */
+
+static int dfa_build (dfa_regex_t *re) /* {{{ */
+{
+  int const len = re->prog_len;
+  pc_set_t set = { NULL, 0, NULL, 0 };
+  pc_set_t tmp = { NULL, 0, NULL, 0 };
+  int *stack = NULL;
+  int *restart = NULL;
+  int restart_num;
+
+  /* States are stored as sorted lists of program counters. */
+  int *state_pcs = NULL;
+  int *state_offset = NULL;
+  int *state_num = NULL;
+  int state_pcs_num = 0;
+  int hash[DFA_HASH_SIZE];
+  int *hash_next = NULL;
+  int rep[256];
+  int states_num = 0;
+  int status = 0;
+  int s;
+  int b;
+
+  dfa_byte_classes (re);
+  for (b = 255; b >= 0; b--)
+    rep[re->byte_class[b]] = b;
+
+  set.pcs = calloc (len, sizeof (int));
+  set.mark = calloc (len, sizeof (int));
+  tmp.pcs = calloc (len, sizeof (int));
+  tmp.mark = calloc (len, sizeof (int));
+  stack = calloc (2 * len + 1, sizeof (int));
+  restart = calloc (len, sizeof (int));
+  state_pcs = calloc (DFA_STATES_MAX * len, sizeof (int));
+  state_offset = calloc (DFA_STATES_MAX, sizeof (int));
+  state_num = calloc (DFA_STATES_MAX, sizeof (int));
+  hash_next = calloc (DFA_STATES_MAX, sizeof (int));
+  re->trans = calloc (DFA_STATES_MAX * re->byte_classes_num, sizeof (int));
+  re->accept = calloc (DFA_STATES_MAX, sizeof (_Bool));
+  re->accept_at_end = calloc (DFA_STATES_MAX, sizeof (_Bool));
+  if ((set.pcs == NULL) || (set.mark == NULL) || (tmp.pcs == NULL)
+      || (tmp.mark == NULL) || (stack == NULL) || (restart == NULL)
+      || (state_pcs == NULL) || (state_offset == NULL)
+      || (state_num == NULL) || (hash_next == NULL) || (re->trans == NULL)
+      || (re->accept == NULL) || (re->accept_at_end == NULL))
+  {
+    status = -ENOMEM;
+    goto out;
+  }
+  for (s = 0; s < DFA_HASH_SIZE; s++)
+    hash[s] = -1;
+
+  /* The search is not anchored: at every position the program may be
+   * started again. */
+  pc_set_clear (&set);
+  pc_set_add (re, &set, stack, 0, /* at_start = */ 0);
+  memcpy (restart, set.pcs, set.num * sizeof (int));
+  restart_num = set.num;
+  re->anchored = (restart_num == 0);
+
+  /* The start state, the only one in which "^" matches. */
+  pc_set_clear (&set);
+  pc_set_add (re, &set, stack, 0, /* at_start = */ 1);
+
+  /* Every iteration adds the state in `set', unless it exists already, and
+   * stores its index in trans[s * byte_classes_num + b]. The first iteration
+   * adds the start state. */
+  s = -1;
+  b = 0;
+  while (42)
+  {
+    uint32_t h = 2166136261U;
+    int found;
+    int i;
+
+    qsort (set.pcs, set.num, sizeof (int), compare_int);
+    for (i = 0; i < set.num; i++)
+      h = (h ^ (uint32_t) set.pcs[i]) * 16777619U;
+    h %= DFA_HASH_SIZE;
+
+    for (found = hash[h]; found >= 0; found = hash_next[found])
+      if ((state_num[found] == set.num)
+          && (memcmp (state_pcs + state_offset[found], set.pcs,
+              set.num * sizeof (int)) == 0))
+        break;
+
+    if (found < 0)
+    {
+      if (states_num >= DFA_STATES_MAX)
+      {
+        status = -ENOSPC;
+        goto out;
+      }
+
+      found = states_num++;
+      state_offset[found] = state_pcs_num;
+      state_num[found] = set.num;
+      memcpy (state_pcs + state_pcs_num, set.pcs, set.num * sizeof (int));
+      state_pcs_num += set.num;
+      hash_next[found] = hash[h];
+      hash[h] = found;
+
+      for (i = 0; i < set.num; i++)
+        if (re->prog[set.pcs[i]].op == OP_MATCH)
+          re->accept[found] = 1;
+      re->accept_at_end[found] = pc_set_accepts_at_end (re,
+          state_pcs + state_offset[found], set.num, &tmp, stack);
+    }
+
+    if (s >= 0)
+      re->trans[s * re->byte_classes_num + b] = found;
+
+    /* Next transition to compute. States are processed in the order in
+     * which they have been created, so this terminates once no new states
+     * are found. */
+    if (s < 0)
+      s = 0;
+    else
+      b++;
+    if (b >= re->byte_classes_num)
+    {
+      s++;
+      b = 0;
+    }
+    if (s >= states_num)
+      break;
+
+    pc_set_clear (&set);
+    if (re->accept[s])
+    {
+      /* Once a match has been found, it cannot be lost again. */
+      for (i = 0; i < state_num[s]; i++)
+        pc_set_add (re, &set, stack, state_pcs[state_offset[s] + i], 0);
+      continue;
+    }
+
+    for (i = 0; i < state_num[s]; i++)
+    {
+      inst_t const *inst = re->prog + state_pcs[state_offset[s] + i];
+
+      if ((inst->op == OP_CLASS) && CLASS_TEST (re->classes[inst->x], rep[b]))
+        pc_set_add (re, &set, stack, state_pcs[state_offset[s] + i] + 1, 0);
+    }
+    for (i = 0; i < restart_num; i++)
+      pc_set_add (re, &set, stack, restart[i], 0);
+  }
+
+  re->states_num = states_num;
+
+out:
+  if (status != 0)
+  {
+    sfree (re->trans);
+    sfree (re->accept);
+    sfree (re->accept_at_end);
+  }
+  sfree (set.pcs);
+  sfree (set.mark);
+  sfree (tmp.pcs);
+  sfree (tmp.mark);
+  sfree (stack);
+  sfree (restart);
+  sfree (state_pcs);
+  sfree (state_offset);
+  sfree (state_num);
+  sfree (hash_next);
+
+  return (status);
+} /* }}} int dfa_build */
+
+/*
+ * NFA simulation
+ */
+struct thread_list_s
+{
+  int *pc;
+  size_t *start;
+  int num;
+};
+typedef struct thread_list_s thread_list_t;
+
+struct search_state_s
+{
+  char const *str;
+  size_t len;
+  int *mark;
+  int gen;
+  int *stack;
+
+  _Bool found;
+  size_t match_start;
+  size_t match_end;
+};
+typedef struct search_state_s search_state_t;
+
+/* Adds a thread which started at `start' to `list'. Threads which started
+ * earlier are added first, so if two threads reach the same instruction the
+ * one which started first wins. */
+static void thread_add (dfa_regex_t const *re, search_state_t *st, /* {{{ */
+    thread_list_t *list, int pc, size_t start, size_t pos)
+{
+  int stack_num = 0;
+
+  st->stack[stack_num++] = pc;
+  while (stack_num > 0)
+  {
+    inst_t const *inst;
+
+    pc = st->stack[--stack_num];
+    if (st->mark[pc] == st->gen)
+      continue;
+    st->mark[pc] = st->gen;
+
+    inst = re->prog + pc;
+    switch (inst->op)
+    {
+      case OP_JMP:
+        st->stack[stack_num++] = inst->x;
+        break;
+      case OP_SPLIT:
+        st->stack[stack_num++] = inst->y;
+        st->stack[stack_num++] = inst->x;
+        break;
+      case OP_BOL:
+        if (pos == 0)
+          st->stack[stack_num++] = pc + 1;
+        break;
+      case OP_EOL:
+        if (pos == st->len)
+          st->stack[stack_num++] = pc + 1;
+        break;
+      case OP_CLASS:
+        list->pc[list->num] = pc;
+        list->start[list->num] = start;
+        list->num++;
+        break;
+      case OP_MATCH:
+        /* Leftmost, then longest. */
+        if (!st->found || (start < st->match_start)
+            || ((start == st->match_start) && (pos > st->match_end)))
+        {
+          st->found = 1;
+          st->match_start = start;
+          st->match_end = pos;
+        }
+        break;
+    }
+  }
+} /* }}} void thread_add */
+
+static int nfa_search (dfa_regex_t const *re, char const *str, /* {{{ */
+    size_t *ret_start, size_t *ret_end)
+{
+  int const len = re->prog_len;
+  int pc0[len], pc1[len];
+  size_t start0[len], start1[len];
+  int mark[len];
+  int stack[2 * len + 1];
+  thread_list_t lists[2] = { { pc0, start0, 0 }, { pc1, start1, 0 } };
+  thread_list_t *clist = lists + 0;
+  thread_list_t *nlist = lists + 1;
+  search_state_t st;
+  size_t pos;
+
+  memset (mark, 0, sizeof (mark));
+  memset (&st, 0, sizeof (st));
+  st.str = str;
+  st.len = strlen (str);
+  st.mark = mark;
+  st.stack = stack;
+
+  st.gen++;
+  thread_add (re, &st, clist, 0, 0, 0);
+
+  for (pos = 0; pos < st.len; pos++)
+  {
+    unsigned char c = (unsigned char) str[pos];
+    thread_list_t *tmp;
+    int i;
+
+    if ((st.found || re->anchored) && (clist->num == 0))
+      break;
+
+    st.gen++;
+    nlist->num = 0;
+    for (i = 0; i < clist->num; i++)
+    {
+      inst_t const *inst = re->prog + clist->pc[i];
+
+      /* Threads which started after the match cannot win. */
+      if (st.found && (clist->start[i] > st.match_start))
+        continue;
+      if (CLASS_TEST (re->classes[inst->x], c))
+        thread_add (re, &st, nlist, clist->pc[i] + 1, clist->start[i],
+            pos + 1);
+    }
+    if (!st.found && !re->anchored)
+      thread_add (re, &st, nlist, 0, pos + 1, pos + 1);
+
+    tmp = clist;
+    clist = nlist;
+    nlist = tmp;
+  }
+
+  if (!st.found)
+    return (ENOENT);
+
+  if (ret_start != NULL)
+    *ret_start = st.match_start;
+  if (ret_end != NULL)
+    *ret_end = st.match_end;
+  return (0);
+} /* }}} int nfa_search */
+
+/*
+ * Public functions
+ */
+dfa_regex_t *dfa_regex_compile (char const *pattern) /* {{{ */
+{
+  compiler_t c;
+  dfa_regex_t *re;
+  int root;
+  int status;
+
+  if (pattern == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  re = malloc (sizeof (*re));
+  if (re == NULL)
+  {
+    errno = ENOMEM;
+    return (NULL);
+  }
+  memset (re, 0, sizeof (*re));
+
+  memset (&c, 0, sizeof (c));
+  c.pattern = pattern;
+  c.ptr = pattern;
+  c.re = re;
+
+  root = parse_regex (&c);
+  if ((root >= 0) && (*c.ptr != 0))
+    root = -ENOTSUP; /* unmatched ")" */
+
+  status = (root < 0) ? root : gen (&c, root);
+  if (status == 0)
+    status = emit (&c, OP_MATCH, 0, 0);
+  if (status < 0)
+  {
+    sfree (c.nodes);
+    dfa_regex_destroy (re);
+    errno = -status;
+    return (NULL);
+  }
+
+  re->literal = malloc (strlen (pattern) + 1);
+  if (re->literal != NULL)
+  {
+    _Bool is_first = 1;
+
+    if (check_literal (&c, root, re->literal, &re->literal_len,
+          &is_first) == 0)
+      re->literal[re->literal_len] = 0;
+    else
+    {
+      sfree (re->literal);
+      re->anchor_start = 0;
+      re->anchor_end = 0;
+    }
+  }
+  sfree (c.nodes);
+
+  /* Without a DFA, dfa_regex_match() simulates the NFA, which is slower
+   * but still takes linear time. */
+  if ((re->literal == NULL) && (dfa_build (re) == -ENOMEM))
+  {
+    dfa_regex_destroy (re);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  return (re);
+} /* }}} dfa_regex_t *dfa_regex_compile */
+
+void dfa_regex_destroy (dfa_regex_t *re) /* {{{ */
+{
+  if (re == NULL)
+    return;
+
+  sfree (re->prog);
+  sfree (re->classes);
+  sfree (re->literal);
+  sfree (re->trans);
+  sfree (re->accept);
+  sfree (re->accept_at_end);
+  sfree (re);
+} /* }}} void dfa_regex_destroy */
+
+static int literal_search (dfa_regex_t const *re, char const *str, /* {{{ */
+    size_t *ret_start, size_t *ret_end)
+{
+  size_t len = strlen (str);
+  size_t start;
+
+  if (len < re->literal_len)
+    return (ENOENT);
+
+  if (re->anchor_start && re->anchor_end)
+  {
+    if ((len != re->literal_len) || (strcmp (str, re->literal) != 0))
+      return (ENOENT);
+    start = 0;
+  }
+  else if (re->anchor_start)
+  {
+    if (strncmp (str, re->literal, re->literal_len) != 0)
+      return (ENOENT);
+    start = 0;
+  }
+  else if (re->anchor_end)
+  {
+    start = len - re->literal_len;
+    if (strcmp (str + start, re->literal) != 0)
+      return (ENOENT);
+  }
+  else
+  {
+    char const *ptr = strstr (str, re->literal);
+    if (ptr == NULL)
+      return (ENOENT);
+    start = (size_t) (ptr - str);
+  }
+
+  if (ret_start != NULL)
+    *ret_start = start;
+  if (ret_end != NULL)
+    *ret_end = start + re->literal_len;
+  return (0);
+} /* }}} int literal_search */
+
+int dfa_regex_match (dfa_regex_t const *re, char const *str) /* {{{ */
+{
+  unsigned char const *ptr;
+  int s = 0;
+
+  if ((re == NULL) || (str == NULL))
+    return (0);
+
+  if (re->literal != NULL)
+    return (literal_search (re, str, NULL, NULL) == 0);
+
+  if (re->trans == NULL)
+    return (nfa_search (re, str, NULL, NULL) == 0);
+
+  for (ptr = (unsigned char const *) str; *ptr != 0; ptr++)
+  {
+    if (re->accept[s])
+      return (1);
+    s = re->trans[s * re->byte_classes_num + re->byte_class[*ptr]];
+  }
+
+  /* In the empty string, "^" and "$" match at the same position, which the
+   * DFA does not account for. */
+  if ((str[0] == 0) && !re->accept[s] && !re->accept_at_end[s])
+    return (nfa_search (re, str, NULL, NULL) == 0);
+
+  return (re->accept[s] || re->accept_at_end[s]);
+} /* }}} int dfa_regex_match */
+
+int dfa_regex_search (dfa_regex_t const *re, char const *str, /* {{{ */
+    size_t *ret_start, size_t *ret_end)
+{
+  if ((re == NULL) || (str == NULL))
+    return (EINVAL);
+
+  if (re->literal != NULL)
+    return (literal_search (re, str, ret_start, ret_end));
+
+  /* Rule out strings which do not match using the DFA. */
+  if ((re->trans != NULL) && !dfa_regex_match (re, str))
+    return (ENOENT);
+
+  return (nfa_search (re, str, ret_start, ret_end));
+} /* }}} int dfa_regex_search */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
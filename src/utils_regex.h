@@ -0,0 +1,59 @@
+/**
+ * collectd - src/utils_regex.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_REGEX_H
+#define UTILS_REGEX_H 1
+
+#include <stddef.h>
+
+/*
+ * Linear-time matcher for POSIX extended regular expressions. Patterns are
+ * compiled into a DFA, which is used to check whether a string matches. The
+ * position of a match is determined by simulating the NFA, which also takes
+ * time linear in the length of the string. Like regexec(3), the leftmost and,
+ * of those, the longest match is found. Strings are matched byte by byte,
+ * i.e. like regexec(3) in the "C" locale.
+ *
+ * Back references, collating elements, equivalence classes and the GNU
+ * extensions (\w, \b, ...) are not supported. dfa_regex_compile() fails with
+ * ENOTSUP for such patterns, so the caller can fall back to regcomp(3).
+ * Sub-matches are not reported; callers which need them use regexec(3) on
+ * the strings the DFA has found to match.
+ */
+struct dfa_regex_s;
+typedef struct dfa_regex_s dfa_regex_t;
+
+/* Returns NULL and sets errno on failure. */
+dfa_regex_t *dfa_regex_compile (char const *pattern);
+void dfa_regex_destroy (dfa_regex_t *re);
+
+/* Returns non-zero if `str' matches. */
+int dfa_regex_match (dfa_regex_t const *re, char const *str);
+
+/* Stores the offsets of the first byte of the match and of the first byte
+ * after the match. Returns zero on success and ENOENT if `str' does not
+ * match. */
+int dfa_regex_search (dfa_regex_t const *re, char const *str,
+    size_t *ret_start, size_t *ret_end);
+
+#endif /* UTILS_REGEX_H */
+
+/* vim: set sw=2 sts=2 et : */
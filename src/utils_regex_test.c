@@ -0,0 +1,184 @@
+/**
+ * collectd - src/utils_regex_test.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Compares the linear-time matcher with regexec(3): for every pattern of the
+ * corpus, whether a string matches and the span of the match must be the
+ * same for a fixed set of strings and for random strings made of the
+ * characters used in the patterns. Patterns which dfa_regex_compile()
+ * rejects with ENOTSUP must not be accepted, those which regcomp(3) rejects
+ * must be rejected. Usage: utils_regex_test [seed]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_regex.h"
+
+#include <regex.h>
+
+#define RANDOM_STRINGS 2000
+#define RANDOM_LENGTH_MAX 12
+
+static char const *patterns[] =
+{
+  /* literals and anchors */
+  "mysql", "^mysql$", "^mysql", "mysql$", "^$", "^", "$", "a^", "$a",
+  "^^a", "a$$", "(^a|b$)", "x(^a)", "(a$)x",
+  /* dot and bracket classes */
+  "^[^\\.]*$", "a.c", "^.$", "[abc]", "[^abc]", "[a-c0-1]+", "[]a]",
+  "[^]a]", "[a-]", "[-a]", "[.]", "[\\]", "^[[:digit:]]+$",
+  "[[:alpha:]_][[:alnum:]_]*", "[[:space:][:punct:]]", "[^[:lower:]]",
+  "[[:upper:]]", "[[:xdigit:]]{2}",
+  /* alternation and groups */
+  "^(cpu|memory|df|disk|interface)$", "a|b|c", "ab|a", "a|ab", "(a|ab)(c|bcd)",
+  "(a|b)*c", "((a)|b)+", "(|a)b", "(a|)+b", "x(a|b|)y", "((ab)|(a))((c)|(bc))",
+  /* repetition */
+  "a*", "a+", "a?", "a*b*c*", "(ab)*", "(a*)*", "(a*)+", "(a+|b)*",
+  "a{2}", "a{2,}", "a{1,3}", "a{0,2}b", "(ab){1,2}", "^a{3}$", "(a|b){2,3}c",
+  "[0-9]{1,3}\\.[0-9]{1,3}", "a{0}b", "(a{2}){2}",
+  /* escapes and special characters */
+  "\\.", "a\\*", "\\^a", "a\\$", "\\(a\\)", "\\[", "a\\|b", "\\{",
+  /* typical chain definitions */
+  "^eth[0-9]+$", "^(lo|bond[0-9]+)$", "^if_(octets|packets|errors)$",
+  "^cpu-[0-9]+$", "^df-(boot|root)$", "^host[0-9]*\\.example\\.(com|org)$",
+  "^(rx|tx)_.*", ".*-(idle|wait)$", "^[a-z]+\\.[a-z]+$",
+  /* not supported: back references, GNU extensions, collating elements */
+  "(a)\\1", "\\w+", "a\\b", "[[.a.]]", "[[=a=]]",
+  /* invalid: rejected with ENOTSUP, so that regcomp(3) reports the error */
+  "(a", "a)", "[a", "a{2,1}", "*a",
+};
+
+static char const *strings[] =
+{
+  "", "a", "b", "c", "ab", "abc", "abcd", "aaa", "aaaa", "abab", "ababc",
+  "bcd", "abcabc", "mysql", "xmysqly", "my.sql", ".", "-", "]", "[", "\\",
+  "x^ay", "a$b", "*", "a*", "^a", "a|b", "(a)", "{", "0", "12", "123.45",
+  "1.2", "ff", "xF0", " ", "\t", "A", "_abc1", "cpu", "memory", "disk",
+  "interface", "eth0", "eth12", "lo", "bond0", "if_octets", "if_errorsx",
+  "cpu-0", "cpu-", "df-root", "host1.example.com", "host.example.org",
+  "rx_bytes", "tx", "cpu-idle", "cpu-wait-", "foo.bar", "foo.bar.baz",
+  "xay", "xy", "xby", "xaay",
+};
+
+/* Characters used for the random strings. */
+static char const alphabet[] = "abcxy0129.-_[]^$\\ AF";
+
+static int errors = 0;
+
+static void compare (char const *pattern, regex_t *posix, /* {{{ */
+    dfa_regex_t *dfa, char const *str)
+{
+  regmatch_t m;
+  size_t start = 0;
+  size_t end = 0;
+  int posix_match;
+  int dfa_match;
+  int status;
+
+  posix_match = (regexec (posix, str, 1, &m, /* eflags = */ 0) == 0);
+  dfa_match = dfa_regex_match (dfa, str) ? 1 : 0;
+  status = dfa_regex_search (dfa, str, &start, &end);
+
+  if ((posix_match != dfa_match) || (posix_match != (status == 0)))
+  {
+    if (errors++ < 20)
+      printf ("\"%s\" =~ /%s/: regexec: %i, dfa_regex_match: %i, "
+          "dfa_regex_search: %i\n", str, pattern, posix_match, dfa_match,
+          status);
+    return;
+  }
+
+  if (posix_match && ((start != (size_t) m.rm_so) || (end != (size_t) m.rm_eo)))
+  {
+    if (errors++ < 20)
+      printf ("\"%s\" =~ /%s/: regexec: [%i, %i), dfa_regex_search: "
+          "[%zu, %zu)\n", str, pattern, (int) m.rm_so, (int) m.rm_eo,
+          start, end);
+  }
+} /* }}} void compare */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t compared = 0;
+  size_t unsupported = 0;
+  size_t i;
+
+  srand ((argc > 1) ? (unsigned int) atoi (argv[1]) : 42);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (patterns); i++)
+  {
+    regex_t posix;
+    dfa_regex_t *dfa;
+    int posix_status;
+    size_t j;
+
+    posix_status = regcomp (&posix, patterns[i], REG_EXTENDED);
+    dfa = dfa_regex_compile (patterns[i]);
+
+    if ((dfa == NULL) && (errno == ENOTSUP))
+    {
+      unsupported++;
+      if (posix_status == 0)
+        regfree (&posix);
+      continue;
+    }
+    else if ((posix_status != 0) || (dfa == NULL))
+    {
+      if ((posix_status != 0) != (dfa == NULL))
+      {
+        printf ("/%s/: regcomp: %i, dfa_regex_compile: %s\n", patterns[i],
+            posix_status, (dfa == NULL) ? "failed" : "succeeded");
+        errors++;
+      }
+      if (posix_status == 0)
+        regfree (&posix);
+      if (dfa != NULL)
+        dfa_regex_destroy (dfa);
+      continue;
+    }
+
+    for (j = 0; j < STATIC_ARRAY_SIZE (strings); j++)
+      compare (patterns[i], &posix, dfa, strings[j]);
+
+    for (j = 0; j < RANDOM_STRINGS; j++)
+    {
+      char str[RANDOM_LENGTH_MAX + 1];
+      size_t len = (size_t) rand () % (RANDOM_LENGTH_MAX + 1);
+      size_t k;
+
+      for (k = 0; k < len; k++)
+        str[k] = alphabet[rand () % (sizeof (alphabet) - 1)];
+      str[len] = 0;
+
+      compare (patterns[i], &posix, dfa, str);
+    }
+
+    compared++;
+    regfree (&posix);
+    dfa_regex_destroy (dfa);
+  }
+
+  printf ("%zu patterns compared, %zu not supported, %i differences.\n",
+      compared, unsupported, errors);
+  return ((errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
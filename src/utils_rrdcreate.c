@@ -21,11 +21,18 @@
 
 #include "collectd.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
 #include <pthread.h>
 #include <rrd.h>
 
+#ifndef RRD_CREATE_THREADS_DEFAULT
+# define RRD_CREATE_THREADS_DEFAULT 4
+#endif
+
+struct srrd_create_args_s;
+typedef struct srrd_create_args_s srrd_create_args_t;
 struct srrd_create_args_s
 {
   char *filename;
@@ -33,15 +40,8 @@ struct srrd_create_args_s
   time_t last_up;
   int argc;
   char **argv;
-};
-typedef struct srrd_create_args_s srrd_create_args_t;
 
-struct async_create_file_s;
-typedef struct async_create_file_s async_create_file_t;
-struct async_create_file_s
-{
-  char *filename;
-  async_create_file_t *next;
+  srrd_create_args_t *next;
 };
 
 /*
@@ -69,8 +69,22 @@ static int rra_types_num = STATIC_ARRAY_SIZE (rra_types);
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
-static async_create_file_t *async_creation_list = NULL;
+/* Files which are queued for creation or are being created right now. Maps
+ * the file name to its srrd_create_args_t. This is used to deduplicate
+ * requests and to tell the rrdtool plugin to hold back updates. */
+static c_avl_tree_t *async_creation_tree = NULL;
+/* FIFO of files waiting for a worker. */
+static srrd_create_args_t *async_creation_head = NULL;
+static srrd_create_args_t *async_creation_tail = NULL;
 static pthread_mutex_t async_creation_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  async_creation_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t      *async_creation_threads = NULL;
+static int             async_creation_threads_num = 0;
+/* Set by cu_rrd_create_shutdown() to stop the workers. */
+static _Bool           async_creation_shutdown = 0;
+/* Rate limit: Earliest time at which the next file may be created. */
+static cdtime_t        async_creation_interval = 0;
+static cdtime_t        async_creation_next = 0;
 
 /*
  * Private functions
@@ -99,6 +113,7 @@ static void srrd_create_args_destroy (srrd_create_args_t *args)
       sfree (args->argv[i]);
     sfree (args->argv);
   }
+  sfree (args);
 } /* void srrd_create_args_destroy */
 
 static srrd_create_args_t *srrd_create_args_create (const char *filename,
@@ -118,6 +133,7 @@ static srrd_create_args_t *srrd_create_args_create (const char *filename,
   args->pdp_step = pdp_step;
   args->last_up = last_up;
   args->argv = NULL;
+  args->next = NULL;
 
   args->filename = strdup (filename);
   if (args->filename == NULL)
@@ -445,115 +461,57 @@ static int srrd_create (const char *filename, /* {{{ */
 } /* }}} int srrd_create */
 #endif /* !HAVE_THREADSAFE_LIBRRD */
 
-static int lock_file (char const *filename) /* {{{ */
+/* Allocates the file's blocks in one go and drops it from the page cache.
+ * Depending on how it was built, librrd may leave parts of a new file sparse,
+ * in which case the blocks would be allocated one by one (and scattered
+ * across the disk) as updates arrive. Newly created files are not read back
+ * any time soon, so there's no point in keeping them cached either. */
+static void srrd_preallocate (const char *filename) /* {{{ */
 {
-  async_create_file_t *ptr;
+#if HAVE_POSIX_FALLOCATE || HAVE_POSIX_FADVISE
   struct stat sb;
-  int status;
+  int fd;
 
-  pthread_mutex_lock (&async_creation_lock);
-
-  for (ptr = async_creation_list; ptr != NULL; ptr = ptr->next)
-    if (strcmp (filename, ptr->filename) == 0)
-      break;
-
-  if (ptr != NULL)
-  {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (EEXIST);
-  }
-
-  status = stat (filename, &sb);
-  if ((status == 0) || (errno != ENOENT))
-  {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (EEXIST);
-  }
-
-  ptr = malloc (sizeof (*ptr));
-  if (ptr == NULL)
-  {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (ENOMEM);
-  }
+  fd = open (filename, O_WRONLY);
+  if (fd < 0)
+    return;
 
-  ptr->filename = strdup (filename);
-  if (ptr->filename == NULL)
+  if (fstat (fd, &sb) != 0)
   {
-    pthread_mutex_unlock (&async_creation_lock);
-    sfree (ptr);
-    return (ENOMEM);
+    close (fd);
+    return;
   }
 
-  ptr->next = async_creation_list;
-  async_creation_list = ptr;
+  /* Both calls are hints only, so failures are ignored. */
+# if HAVE_POSIX_FALLOCATE
+  posix_fallocate (fd, 0, sb.st_size);
+# endif
+# if HAVE_POSIX_FADVISE
+  fdatasync (fd);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+# endif
 
-  pthread_mutex_unlock (&async_creation_lock);
-
-  return (0);
-} /* }}} int lock_file */
+  close (fd);
+#else
+  (void) filename;
+#endif
+} /* }}} void srrd_preallocate */
 
-static int unlock_file (char const *filename) /* {{{ */
+/* Removes a file from the set of pending files and frees "args". */
+static void srrd_create_done (srrd_create_args_t *args) /* {{{ */
 {
-  async_create_file_t *this;
-  async_create_file_t *prev;
-
-
   pthread_mutex_lock (&async_creation_lock);
-
-  prev = NULL;
-  for (this = async_creation_list; this != NULL; this = this->next)
-  {
-    if (strcmp (filename, this->filename) == 0)
-      break;
-    prev = this;
-  }
-
-  if (this == NULL)
-  {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (ENOENT);
-  }
-
-  if (prev == NULL)
-  {
-    assert (this == async_creation_list);
-    async_creation_list = this->next;
-  }
-  else
-  {
-    assert (this == prev->next);
-    prev->next = this->next;
-  }
-  this->next = NULL;
-
+  c_avl_remove (async_creation_tree, args->filename, NULL, NULL);
   pthread_mutex_unlock (&async_creation_lock);
 
-  sfree (this->filename);
-  sfree (this);
-
-  return (0);
-} /* }}} int unlock_file */
+  srrd_create_args_destroy (args);
+} /* }}} void srrd_create_done */
 
-static void *srrd_create_thread (void *targs) /* {{{ */
+static void srrd_create_one (srrd_create_args_t *args) /* {{{ */
 {
-  srrd_create_args_t *args = targs;
   char tmpfile[PATH_MAX];
   int status;
 
-  status = lock_file (args->filename);
-  if (status != 0)
-  {
-    if (status == EEXIST)
-      NOTICE ("srrd_create_thread: File \"%s\" is already being created.",
-          args->filename);
-    else
-      ERROR ("srrd_create_thread: Unable to lock file \"%s\".",
-          args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
-  }
-
   ssnprintf (tmpfile, sizeof (tmpfile), "%s.async", args->filename);
 
   status = srrd_create (tmpfile, args->pdp_step, args->last_up,
@@ -563,11 +521,11 @@ static void *srrd_create_thread (void *targs) /* {{{ */
     WARNING ("srrd_create_thread: srrd_create (%s) returned status %i.",
         args->filename, status);
     unlink (tmpfile);
-    unlock_file (args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
+    return;
   }
 
+  srrd_preallocate (tmpfile);
+
   status = rename (tmpfile, args->filename);
   if (status != 0)
   {
@@ -576,63 +534,189 @@ static void *srrd_create_thread (void *targs) /* {{{ */
         tmpfile, args->filename,
         sstrerror (errno, errbuf, sizeof (errbuf)));
     unlink (tmpfile);
-    unlock_file (args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
+    return;
   }
 
   DEBUG ("srrd_create_thread: Successfully created RRD file \"%s\".",
       args->filename);
+} /* }}} void srrd_create_one */
 
-  unlock_file (args->filename);
-  srrd_create_args_destroy (args);
+static void *srrd_create_thread (void __attribute__((unused)) *data) /* {{{ */
+{
+  pthread_mutex_lock (&async_creation_lock);
+  while (42)
+  {
+    srrd_create_args_t *args;
+    cdtime_t slot;
 
-  return (0);
+    while ((async_creation_head == NULL) && !async_creation_shutdown)
+      pthread_cond_wait (&async_creation_cond, &async_creation_lock);
+
+    if (async_creation_shutdown)
+      break;
+
+    args = async_creation_head;
+    async_creation_head = args->next;
+    if (async_creation_head == NULL)
+      async_creation_tail = NULL;
+    args->next = NULL;
+
+    /* Reserve a slot while holding the lock, so that the configured rate
+     * holds for all workers combined. */
+    slot = cdtime ();
+    if (async_creation_interval > 0)
+    {
+      if (async_creation_next > slot)
+        slot = async_creation_next;
+      async_creation_next = slot + async_creation_interval;
+    }
+
+    /* Wait for the slot, unless the plugin is shut down in the meantime. */
+    while (!async_creation_shutdown && (cdtime () < slot))
+    {
+      struct timespec ts;
+
+      CDTIME_T_TO_TIMESPEC (slot, &ts);
+      pthread_cond_timedwait (&async_creation_cond, &async_creation_lock,
+          &ts);
+    }
+
+    if (async_creation_shutdown)
+    {
+      c_avl_remove (async_creation_tree, args->filename, NULL, NULL);
+      srrd_create_args_destroy (args);
+      break;
+    }
+    pthread_mutex_unlock (&async_creation_lock);
+
+    srrd_create_one (args);
+    srrd_create_done (args);
+
+    pthread_mutex_lock (&async_creation_lock);
+  } /* while (42) */
+  pthread_mutex_unlock (&async_creation_lock);
+
+  return ((void *) 0);
 } /* }}} void *srrd_create_thread */
 
+/* Starts the worker threads. You must hold "async_creation_lock". */
+static int srrd_create_threads_start (const rrdcreate_config_t *cfg) /* {{{ */
+{
+  int threads_num;
+  int status;
+
+  threads_num = cfg->async_threads;
+  if (threads_num <= 0)
+    threads_num = RRD_CREATE_THREADS_DEFAULT;
+
+  if (cfg->creates_per_second > 0.0)
+    async_creation_interval = DOUBLE_TO_CDTIME_T (1.0
+        / cfg->creates_per_second);
+
+  async_creation_threads = calloc ((size_t) threads_num,
+      sizeof (*async_creation_threads));
+  if (async_creation_threads == NULL)
+  {
+    ERROR ("srrd_create_async: calloc failed.");
+    return (-1);
+  }
+
+  while (async_creation_threads_num < threads_num)
+  {
+    status = pthread_create (async_creation_threads
+        + async_creation_threads_num, /* attr = */ NULL,
+        srrd_create_thread, /* arg = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("srrd_create_async: pthread_create failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      break;
+    }
+    async_creation_threads_num++;
+  }
+
+  if (async_creation_threads_num == 0)
+    sfree (async_creation_threads);
+  return ((async_creation_threads_num > 0) ? 0 : -1);
+} /* }}} int srrd_create_threads_start */
+
+/* Queues a file for creation by the worker threads. Returns zero if the file
+ * has been queued or is already queued or being created. */
 static int srrd_create_async (const char *filename, /* {{{ */
     unsigned long pdp_step, time_t last_up,
-    int argc, const char **argv)
+    int argc, const char **argv, const rrdcreate_config_t *cfg)
 {
   srrd_create_args_t *args;
-  pthread_t thread;
-  pthread_attr_t attr;
+  struct stat sb;
   int status;
 
-  DEBUG ("srrd_create_async: Creating \"%s\" in the background.", filename);
-
   args = srrd_create_args_create (filename, pdp_step, last_up, argc, argv);
   if (args == NULL)
     return (-1);
 
-  status = pthread_attr_init (&attr);
-  if (status != 0)
+  pthread_mutex_lock (&async_creation_lock);
+
+  if (async_creation_shutdown)
   {
+    pthread_mutex_unlock (&async_creation_lock);
     srrd_create_args_destroy (args);
     return (-1);
   }
 
-  status = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-  if (status != 0)
+  if (async_creation_tree == NULL)
+  {
+    async_creation_tree = c_avl_create ((void *) strcmp);
+    if (async_creation_tree == NULL)
+    {
+      pthread_mutex_unlock (&async_creation_lock);
+      ERROR ("srrd_create_async: c_avl_create failed.");
+      srrd_create_args_destroy (args);
+      return (-1);
+    }
+  }
+
+  if (async_creation_threads_num == 0)
+  {
+    status = srrd_create_threads_start (cfg);
+    if (status != 0)
+    {
+      pthread_mutex_unlock (&async_creation_lock);
+      srrd_create_args_destroy (args);
+      return (-1);
+    }
+  }
+
+  /* Already queued, being created or, in the meantime, created. */
+  if ((c_avl_get (async_creation_tree, filename, NULL) == 0)
+      || (stat (filename, &sb) == 0) || (errno != ENOENT))
   {
-    pthread_attr_destroy (&attr);
+    pthread_mutex_unlock (&async_creation_lock);
     srrd_create_args_destroy (args);
-    return (-1);
+    return (0);
   }
 
-  status = pthread_create (&thread, &attr, srrd_create_thread, args);
+  status = c_avl_insert (async_creation_tree, args->filename, args);
   if (status != 0)
   {
-    char errbuf[1024];
-    ERROR ("srrd_create_async: pthread_create failed: %s",
-        sstrerror (status, errbuf, sizeof (errbuf)));
-    pthread_attr_destroy (&attr);
+    pthread_mutex_unlock (&async_creation_lock);
+    ERROR ("srrd_create_async: c_avl_insert (%s) failed.", filename);
     srrd_create_args_destroy (args);
-    return (status);
+    return (-1);
   }
 
-  pthread_attr_destroy (&attr);
-  /* args is freed in srrd_create_thread(). */
+  if (async_creation_tail == NULL)
+    async_creation_head = args;
+  else
+    async_creation_tail->next = args;
+  async_creation_tail = args;
+
+  DEBUG ("srrd_create_async: Queued \"%s\" for creation.", filename);
+
+  pthread_cond_signal (&async_creation_cond);
+  pthread_mutex_unlock (&async_creation_lock);
+
+  /* args is freed by the worker thread. */
   return (0);
 } /* }}} int srrd_create_async */
 
@@ -653,6 +737,11 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   time_t last_up;
   unsigned long stepsize;
 
+  /* Values keep coming in while a file is queued, don't build the
+   * definition over and over again. */
+  if (cfg->async && cu_rrd_create_pending (filename))
+    return (0);
+
   if (check_create_dir (filename))
     return (-1);
 
@@ -695,7 +784,7 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   if (cfg->async)
   {
     status = srrd_create_async (filename, stepsize, last_up,
-        argc, (const char **) argv);
+        argc, (const char **) argv, cfg);
     if (status != 0)
       WARNING ("cu_rrd_create_file: srrd_create_async (%s) "
           "returned status %i.",
@@ -725,4 +814,51 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   return (status);
 } /* }}} int cu_rrd_create_file */
 
+_Bool cu_rrd_create_pending (const char *filename) /* {{{ */
+{
+  _Bool pending = 0;
+
+  pthread_mutex_lock (&async_creation_lock);
+  if ((async_creation_tree != NULL)
+      && (c_avl_get (async_creation_tree, filename, NULL) == 0))
+    pending = 1;
+  pthread_mutex_unlock (&async_creation_lock);
+
+  return (pending);
+} /* }}} _Bool cu_rrd_create_pending */
+
+void cu_rrd_create_shutdown (void) /* {{{ */
+{
+  srrd_create_args_t *args;
+  int i;
+
+  pthread_mutex_lock (&async_creation_lock);
+  async_creation_shutdown = 1;
+  pthread_cond_broadcast (&async_creation_cond);
+  pthread_mutex_unlock (&async_creation_lock);
+
+  /* Files which are being created right now are finished. */
+  for (i = 0; i < async_creation_threads_num; i++)
+    pthread_join (async_creation_threads[i], /* retval = */ NULL);
+  sfree (async_creation_threads);
+  async_creation_threads_num = 0;
+
+  /* Files which are still queued are not created. */
+  pthread_mutex_lock (&async_creation_lock);
+  while ((args = async_creation_head) != NULL)
+  {
+    async_creation_head = args->next;
+    c_avl_remove (async_creation_tree, args->filename, NULL, NULL);
+    srrd_create_args_destroy (args);
+  }
+  async_creation_tail = NULL;
+
+  if (async_creation_tree != NULL)
+  {
+    c_avl_destroy (async_creation_tree);
+    async_creation_tree = NULL;
+  }
+  pthread_mutex_unlock (&async_creation_lock);
+} /* }}} void cu_rrd_create_shutdown */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -40,6 +40,11 @@ struct rrdcreate_config_s
   size_t consolidation_functions_num;
 
   _Bool async;
+  /* Number of threads creating files if "async" is set; zero selects the
+   * default. */
+  int async_threads;
+  /* Maximum number of files created per second; zero means no limit. */
+  double creates_per_second;
 };
 typedef struct rrdcreate_config_s rrdcreate_config_t;
 
@@ -47,6 +52,14 @@ int cu_rrd_create_file (const char *filename,
     const data_set_t *ds, const value_list_t *vl,
     const rrdcreate_config_t *cfg);
 
+/* Returns true if the file is queued for asynchronous creation or is being
+ * created right now. Updates for such files should be held back. */
+_Bool cu_rrd_create_pending (const char *filename);
+
+/* Stops the threads creating files asynchronously. Files which are being
+ * created are finished, queued files are dropped. */
+void cu_rrd_create_shutdown (void);
+
 #endif /* UTILS_RRDCREATE_H */
 
 /* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,1306 @@
+/**
+ * collectd - src/utils_rrdmmap.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_rrdmmap.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * On-disk format, see rrd_format.h of RRDtool. Files are stored in the
+ * host's native byte order and structure layout, i.e. these structures have
+ * to match what the compiler does for librrd. The float cookie in the header
+ * is used to reject files written by a different architecture.
+ */
+#define RRDM_COOKIE        "RRD"
+#define RRDM_FLOAT_COOKIE  ((double) 8.642135E130)
+#define RRDM_DS_NAM_SIZE   20
+#define RRDM_DST_SIZE      20
+#define RRDM_CF_NAM_SIZE   20
+#define RRDM_LAST_DS_LEN   30
+#define RRDM_PAR_NUM       10
+
+union rrdm_unival_u
+{
+  unsigned long u_cnt;
+  double        u_val;
+};
+typedef union rrdm_unival_u rrdm_unival_t;
+
+struct rrdm_stat_head_s
+{
+  char          cookie[4];
+  char          version[5];
+  double        float_cookie;
+  unsigned long ds_cnt;
+  unsigned long rra_cnt;
+  unsigned long pdp_step;
+  rrdm_unival_t par[RRDM_PAR_NUM];
+};
+typedef struct rrdm_stat_head_s rrdm_stat_head_t;
+
+struct rrdm_ds_def_s
+{
+  char          ds_nam[RRDM_DS_NAM_SIZE];
+  char          dst[RRDM_DST_SIZE];
+  rrdm_unival_t par[RRDM_PAR_NUM];
+};
+typedef struct rrdm_ds_def_s rrdm_ds_def_t;
+#define DS_mrhb_cnt 0
+#define DS_min_val  1
+#define DS_max_val  2
+
+struct rrdm_rra_def_s
+{
+  char          cf_nam[RRDM_CF_NAM_SIZE];
+  unsigned long row_cnt;
+  unsigned long pdp_cnt;
+  rrdm_unival_t par[RRDM_PAR_NUM];
+};
+typedef struct rrdm_rra_def_s rrdm_rra_def_t;
+#define RRA_cdp_xff_val 0
+
+struct rrdm_live_head_s
+{
+  time_t last_up;
+  long   last_up_usec;
+};
+typedef struct rrdm_live_head_s rrdm_live_head_t;
+
+struct rrdm_pdp_prep_s
+{
+  char          last_ds[RRDM_LAST_DS_LEN];
+  rrdm_unival_t scratch[RRDM_PAR_NUM];
+};
+typedef struct rrdm_pdp_prep_s rrdm_pdp_prep_t;
+#define PDP_unkn_sec_cnt 0
+#define PDP_val          1
+
+struct rrdm_cdp_prep_s
+{
+  rrdm_unival_t scratch[RRDM_PAR_NUM];
+};
+typedef struct rrdm_cdp_prep_s rrdm_cdp_prep_t;
+#define CDP_val            0
+#define CDP_unkn_pdp_cnt   1
+#define CDP_primary_val    8
+#define CDP_secondary_val  9
+
+struct rrdm_rra_ptr_s
+{
+  unsigned long cur_row;
+};
+typedef struct rrdm_rra_ptr_s rrdm_rra_ptr_t;
+
+enum rrdm_dst_e
+{
+  DST_COUNTER,
+  DST_ABSOLUTE,
+  DST_GAUGE,
+  DST_DERIVE
+};
+
+enum rrdm_cf_e
+{
+  CF_AVERAGE,
+  CF_MINIMUM,
+  CF_MAXIMUM,
+  CF_LAST
+};
+
+#define IFDNAN(x,y) (isnan (x) ? (y) : (x))
+
+/*
+ * Private data types
+ */
+struct rrdm_file_s;
+typedef struct rrdm_file_s rrdm_file_t;
+struct rrdm_file_s
+{
+  char  *filename;
+  dev_t  dev;
+  ino_t  ino;
+  off_t  size;
+
+  /* NULL if the file is not supported. The file stays open so that it can be
+   * locked for updates. */
+  void  *map;
+  int    fd;
+
+  _Bool  dirty;
+  _Bool  evicted;
+  int    refs;
+
+  /* LRU list, most recently used first */
+  rrdm_file_t *prev;
+  rrdm_file_t *next;
+
+  rrdm_stat_head_t *stat_head;
+  rrdm_ds_def_t    *ds_def;
+  rrdm_rra_def_t   *rra_def;
+  rrdm_live_head_t *live_head;
+  rrdm_pdp_prep_t  *pdp_prep;
+  rrdm_cdp_prep_t  *cdp_prep;
+  rrdm_rra_ptr_t   *rra_ptr;
+  double           *rra_data;
+
+  int           *dst;
+  int           *cf;
+  double        *pdp_new;
+  double        *pdp_temp;
+  unsigned long *rra_step_cnt;
+
+  /* NaN as written by the librrd which created the file, see
+   * rrdm_file_parse(). */
+  double dnan;
+};
+
+struct rrd_mmap_s
+{
+  c_avl_tree_t *files;
+  rrdm_file_t  *lru_head;
+  rrdm_file_t  *lru_tail;
+  size_t        files_num;
+  size_t        files_max;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+
+  cdtime_t  sync_interval;
+  pthread_t sync_thread;
+  _Bool     sync_thread_running;
+  _Bool     shutdown;
+};
+
+/*
+ * File handling
+ */
+static void rrdm_file_free (rrdm_file_t *f) /* {{{ */
+{
+  if (f == NULL)
+    return;
+
+  if (f->map != NULL)
+    munmap (f->map, (size_t) f->size);
+  if (f->fd >= 0)
+    close (f->fd);
+
+  sfree (f->filename);
+  sfree (f->dst);
+  sfree (f->cf);
+  sfree (f->pdp_new);
+  sfree (f->pdp_temp);
+  sfree (f->rra_step_cnt);
+  sfree (f);
+} /* }}} void rrdm_file_free */
+
+static int rrdm_dst_parse (const char *dst) /* {{{ */
+{
+  if (strcmp ("COUNTER", dst) == 0)
+    return (DST_COUNTER);
+  else if (strcmp ("ABSOLUTE", dst) == 0)
+    return (DST_ABSOLUTE);
+  else if (strcmp ("GAUGE", dst) == 0)
+    return (DST_GAUGE);
+  else if (strcmp ("DERIVE", dst) == 0)
+    return (DST_DERIVE);
+  return (-1);
+} /* }}} int rrdm_dst_parse */
+
+static int rrdm_cf_parse (const char *cf) /* {{{ */
+{
+  if (strcmp ("AVERAGE", cf) == 0)
+    return (CF_AVERAGE);
+  else if (strcmp ("MIN", cf) == 0)
+    return (CF_MINIMUM);
+  else if (strcmp ("MAX", cf) == 0)
+    return (CF_MAXIMUM);
+  else if (strcmp ("LAST", cf) == 0)
+    return (CF_LAST);
+  return (-1);
+} /* }}} int rrdm_cf_parse */
+
+/* Checks the header of a freshly mapped file and sets up the pointers into
+ * the mapping. Returns ENOTSUP if the file uses anything this updater can't
+ * handle. */
+static int rrdm_file_parse (rrdm_file_t *f) /* {{{ */
+{
+  char *ptr = f->map;
+  size_t expected_size;
+  size_t rows_num = 0;
+  volatile double zero = 0.0;
+  unsigned long i;
+
+  if ((size_t) f->size < sizeof (*f->stat_head))
+    return (ENOTSUP);
+
+  f->stat_head = (void *) ptr;
+  if ((memcmp (f->stat_head->cookie, RRDM_COOKIE, sizeof (RRDM_COOKIE)) != 0)
+      || ((strcmp (f->stat_head->version, "0003") != 0)
+        && (strcmp (f->stat_head->version, "0004") != 0))
+      || (f->stat_head->float_cookie != RRDM_FLOAT_COOKIE)
+      || (f->stat_head->ds_cnt < 1)
+      || (f->stat_head->rra_cnt < 1)
+      || (f->stat_head->pdp_step < 1))
+    return (ENOTSUP);
+
+  /* Refuse absurd counts before doing any arithmetic with them. */
+  if ((f->stat_head->ds_cnt > (size_t) f->size)
+      || (f->stat_head->rra_cnt > (size_t) f->size))
+    return (ENOTSUP);
+
+  expected_size = sizeof (rrdm_stat_head_t)
+    + f->stat_head->ds_cnt * sizeof (rrdm_ds_def_t)
+    + f->stat_head->rra_cnt * sizeof (rrdm_rra_def_t)
+    + sizeof (rrdm_live_head_t)
+    + f->stat_head->ds_cnt * sizeof (rrdm_pdp_prep_t)
+    + f->stat_head->rra_cnt * f->stat_head->ds_cnt * sizeof (rrdm_cdp_prep_t)
+    + f->stat_head->rra_cnt * sizeof (rrdm_rra_ptr_t);
+  if (expected_size > (size_t) f->size)
+    return (ENOTSUP);
+
+  ptr += sizeof (rrdm_stat_head_t);
+  f->ds_def = (void *) ptr;
+  ptr += f->stat_head->ds_cnt * sizeof (rrdm_ds_def_t);
+  f->rra_def = (void *) ptr;
+  ptr += f->stat_head->rra_cnt * sizeof (rrdm_rra_def_t);
+  f->live_head = (void *) ptr;
+  ptr += sizeof (rrdm_live_head_t);
+  f->pdp_prep = (void *) ptr;
+  ptr += f->stat_head->ds_cnt * sizeof (rrdm_pdp_prep_t);
+  f->cdp_prep = (void *) ptr;
+  ptr += f->stat_head->rra_cnt * f->stat_head->ds_cnt
+    * sizeof (rrdm_cdp_prep_t);
+  f->rra_ptr = (void *) ptr;
+  ptr += f->stat_head->rra_cnt * sizeof (rrdm_rra_ptr_t);
+  f->rra_data = (void *) ptr;
+
+  /* Sub-second time stamps are not implemented. */
+  if (f->live_head->last_up_usec != 0)
+    return (ENOTSUP);
+
+  f->dst = calloc (f->stat_head->ds_cnt, sizeof (*f->dst));
+  f->cf = calloc (f->stat_head->rra_cnt, sizeof (*f->cf));
+  f->pdp_new = calloc (f->stat_head->ds_cnt, sizeof (*f->pdp_new));
+  f->pdp_temp = calloc (f->stat_head->ds_cnt, sizeof (*f->pdp_temp));
+  f->rra_step_cnt = calloc (f->stat_head->rra_cnt,
+      sizeof (*f->rra_step_cnt));
+  if ((f->dst == NULL) || (f->cf == NULL) || (f->pdp_new == NULL)
+      || (f->pdp_temp == NULL) || (f->rra_step_cnt == NULL))
+    return (ENOMEM);
+
+  /* librrd stores "U" as minimum or maximum as NaN. Use that value so that
+   * the bit pattern is the same as librrd's. Otherwise compute NaN the same
+   * way librrd does. */
+  f->dnan = zero / zero;
+  for (i = 0; i < f->stat_head->ds_cnt; i++)
+  {
+    rrdm_ds_def_t *ds = f->ds_def + i;
+
+    if (memchr (ds->dst, 0, sizeof (ds->dst)) == NULL)
+      return (ENOTSUP);
+    f->dst[i] = rrdm_dst_parse (ds->dst);
+    if (f->dst[i] < 0)
+      return (ENOTSUP);
+
+    if (isnan (ds->par[DS_min_val].u_val))
+      f->dnan = ds->par[DS_min_val].u_val;
+    else if (isnan (ds->par[DS_max_val].u_val))
+      f->dnan = ds->par[DS_max_val].u_val;
+
+    if (memchr (f->pdp_prep[i].last_ds, 0, RRDM_LAST_DS_LEN) == NULL)
+      return (ENOTSUP);
+  }
+
+  for (i = 0; i < f->stat_head->rra_cnt; i++)
+  {
+    rrdm_rra_def_t *rra = f->rra_def + i;
+
+    if (memchr (rra->cf_nam, 0, sizeof (rra->cf_nam)) == NULL)
+      return (ENOTSUP);
+    f->cf[i] = rrdm_cf_parse (rra->cf_nam);
+    if ((f->cf[i] < 0) || (rra->row_cnt < 1) || (rra->pdp_cnt < 1)
+        || (rra->row_cnt > (size_t) f->size)
+        || (f->rra_ptr[i].cur_row >= rra->row_cnt))
+      return (ENOTSUP);
+
+    rows_num += rra->row_cnt;
+    if (rows_num > (size_t) f->size)
+      return (ENOTSUP);
+  }
+
+  expected_size += rows_num * f->stat_head->ds_cnt * sizeof (double);
+  if (expected_size != (size_t) f->size)
+    return (ENOTSUP);
+
+  return (0);
+} /* }}} int rrdm_file_parse */
+
+static rrdm_file_t *rrdm_file_open (const char *filename, /* {{{ */
+    const struct stat *sb)
+{
+  rrdm_file_t *f;
+  int fd;
+  int status;
+
+  f = calloc (1, sizeof (*f));
+  if (f == NULL)
+    return (NULL);
+  f->fd = -1;
+
+  f->filename = strdup (filename);
+  if (f->filename == NULL)
+  {
+    sfree (f);
+    return (NULL);
+  }
+  f->dev = sb->st_dev;
+  f->ino = sb->st_ino;
+  f->size = sb->st_size;
+
+  if (f->size < 1)
+    return (f);
+
+  fd = open (filename, O_RDWR);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    WARNING ("rrd_mmap: open (%s) failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (f);
+  }
+
+  f->map = mmap (/* addr = */ NULL, (size_t) f->size,
+      PROT_READ | PROT_WRITE, MAP_SHARED, fd, /* offset = */ 0);
+  if (f->map == MAP_FAILED)
+  {
+    char errbuf[1024];
+    WARNING ("rrd_mmap: mmap (%s) failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    f->map = NULL;
+    return (f);
+  }
+
+  /* Updates touch a handful of pages spread over the file. */
+  madvise (f->map, (size_t) f->size, MADV_RANDOM);
+
+  status = rrdm_file_parse (f);
+  if (status != 0)
+  {
+    if (status == ENOTSUP)
+      INFO ("rrd_mmap: %s uses features not supported by the native "
+          "updater and will be updated using librrd.", filename);
+    munmap (f->map, (size_t) f->size);
+    f->map = NULL;
+    close (fd);
+    return (f);
+  }
+
+  f->fd = fd;
+  return (f);
+} /* }}} rrdm_file_t *rrdm_file_open */
+
+/* Takes the same write lock as librrd's rrd_lock(), so that files are not
+ * modified concurrently by "rrdtool" or "rrdcached". Like librrd, this does
+ * not wait for the lock. */
+static int rrdm_file_lock (rrdm_file_t *f, short type) /* {{{ */
+{
+  struct flock lock;
+
+  memset (&lock, 0, sizeof (lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0; /* whole file */
+
+  return (fcntl (f->fd, F_SETLK, &lock));
+} /* }}} int rrdm_file_lock */
+
+/*
+ * The update algorithm. This follows rrd_update.c of RRDtool step by step;
+ * the order of floating point operations matters for the result to be
+ * identical.
+ */
+
+/* Computes the rate times the interval for one data source, like
+ * update_pdp_prep() does. "value" is null terminated. */
+static double rrdm_pdp_new (rrdm_file_t *f, unsigned long ds_idx, /* {{{ */
+    const char *value, double interval)
+{
+  rrdm_ds_def_t *ds = f->ds_def + ds_idx;
+  const char *last_ds = f->pdp_prep[ds_idx].last_ds;
+  double pdp_new;
+  double rate;
+
+  if ((value[0] == 'U')
+      || ((double) ds->par[DS_mrhb_cnt].u_cnt < interval))
+    return (f->dnan);
+
+  switch (f->dst[ds_idx])
+  {
+    case DST_COUNTER:
+    case DST_DERIVE:
+      if (last_ds[0] == 'U')
+        return (f->dnan);
+      else
+      {
+        /* Same as rrd_diff(): Both numbers are decimal integers of at most
+         * 20 digits, see rrdm_check_integer(). */
+        _Bool a_neg = (value[0] == '-');
+        _Bool b_neg = (last_ds[0] == '-');
+        uint64_t a = (uint64_t) strtoull (value + a_neg, NULL, 10);
+        uint64_t b = (uint64_t) strtoull (last_ds + b_neg, NULL, 10);
+
+        if (a_neg != b_neg)
+          return (f->dnan);
+
+        if (a >= b)
+          pdp_new = (double) (a - b);
+        else
+          pdp_new = -((double) (b - a));
+        if (a_neg)
+          pdp_new = -pdp_new;
+      }
+
+      if (f->dst[ds_idx] == DST_COUNTER)
+      {
+        if (pdp_new < (double) 0.0)
+          pdp_new += (double) 4294967296.0; /* 2^32 */
+        if (pdp_new < (double) 0.0)
+          pdp_new += (double) 18446744069414584320.0; /* 2^64-2^32 */
+      }
+      rate = pdp_new / interval;
+      break;
+
+    case DST_ABSOLUTE:
+      pdp_new = strtod (value, NULL);
+      rate = pdp_new / interval;
+      break;
+
+    case DST_GAUGE:
+    default:
+      pdp_new = strtod (value, NULL) * interval;
+      rate = pdp_new / interval;
+      break;
+  }
+
+  if (!isnan (rate)
+      && ((!isnan (ds->par[DS_max_val].u_val)
+          && (rate > ds->par[DS_max_val].u_val))
+        || (!isnan (ds->par[DS_min_val].u_val)
+          && (rate < ds->par[DS_min_val].u_val))))
+    return (f->dnan);
+
+  return (pdp_new);
+} /* }}} double rrdm_pdp_new */
+
+/* simple_update(): No PDP boundary has been crossed. */
+static void rrdm_simple_update (rrdm_file_t *f, double interval) /* {{{ */
+{
+  unsigned long i;
+
+  for (i = 0; i < f->stat_head->ds_cnt; i++)
+  {
+    rrdm_unival_t *scratch = f->pdp_prep[i].scratch;
+
+    if (isnan (f->pdp_new[i]))
+      scratch[PDP_unkn_sec_cnt].u_cnt += floor (interval);
+    else if (isnan (scratch[PDP_val].u_val))
+      scratch[PDP_val].u_val = f->pdp_new[i];
+    else
+      scratch[PDP_val].u_val += f->pdp_new[i];
+  }
+} /* }}} void rrdm_simple_update */
+
+/* process_pdp_st(): Computes the primary data point ending at the last PDP
+ * boundary and starts the next one. */
+static void rrdm_process_pdp_st (rrdm_file_t *f, /* {{{ */
+    unsigned long ds_idx, double interval, double pre_int, double post_int,
+    unsigned long diff_pdp_st)
+{
+  rrdm_unival_t *scratch = f->pdp_prep[ds_idx].scratch;
+  unsigned long mrhb = f->ds_def[ds_idx].par[DS_mrhb_cnt].u_cnt;
+  double pdp_new = f->pdp_new[ds_idx];
+  double pre_unknown = 0.0;
+
+  if (isnan (pdp_new))
+    pre_unknown = pre_int;
+  else
+  {
+    if (isnan (scratch[PDP_val].u_val))
+      scratch[PDP_val].u_val = 0;
+    scratch[PDP_val].u_val += pdp_new / interval * pre_int;
+  }
+
+  if ((interval > mrhb)
+      || (f->stat_head->pdp_step / 2.0
+        < (signed) scratch[PDP_unkn_sec_cnt].u_cnt))
+    f->pdp_temp[ds_idx] = f->dnan;
+  else
+    f->pdp_temp[ds_idx] = scratch[PDP_val].u_val
+      / ((double) (diff_pdp_st - scratch[PDP_unkn_sec_cnt].u_cnt)
+          - pre_unknown);
+
+  if (isnan (pdp_new))
+  {
+    scratch[PDP_unkn_sec_cnt].u_cnt = floor (post_int);
+    scratch[PDP_val].u_val = f->dnan;
+  }
+  else
+  {
+    scratch[PDP_unkn_sec_cnt].u_cnt = 0;
+    scratch[PDP_val].u_val = pdp_new / interval * post_int;
+  }
+} /* }}} void rrdm_process_pdp_st */
+
+/* initialize_cdp_val() */
+static void rrdm_initialize_cdp_val (rrdm_unival_t *scratch, /* {{{ */
+    int cf, double pdp_temp_val, unsigned long start_pdp_offset,
+    unsigned long pdp_cnt)
+{
+  double cum_val;
+  double cur_val;
+
+  switch (cf)
+  {
+    case CF_AVERAGE:
+      cum_val = IFDNAN (scratch[CDP_val].u_val, 0.0);
+      cur_val = IFDNAN (pdp_temp_val, 0.0);
+      scratch[CDP_primary_val].u_val =
+        (cum_val + cur_val * start_pdp_offset)
+        / (pdp_cnt - scratch[CDP_unkn_pdp_cnt].u_cnt);
+      break;
+
+    case CF_MAXIMUM:
+      cum_val = IFDNAN (scratch[CDP_val].u_val, -INFINITY);
+      cur_val = IFDNAN (pdp_temp_val, -INFINITY);
+      if (cur_val > cum_val)
+        scratch[CDP_primary_val].u_val = cur_val;
+      else
+        scratch[CDP_primary_val].u_val = cum_val;
+      break;
+
+    case CF_MINIMUM:
+      cum_val = IFDNAN (scratch[CDP_val].u_val, INFINITY);
+      cur_val = IFDNAN (pdp_temp_val, INFINITY);
+      if (cur_val < cum_val)
+        scratch[CDP_primary_val].u_val = cur_val;
+      else
+        scratch[CDP_primary_val].u_val = cum_val;
+      break;
+
+    case CF_LAST:
+    default:
+      scratch[CDP_primary_val].u_val = pdp_temp_val;
+      break;
+  }
+} /* }}} void rrdm_initialize_cdp_val */
+
+/* initialize_carry_over() */
+static double rrdm_initialize_carry_over (const rrdm_file_t *f, /* {{{ */
+    double pdp_temp_val, int cf, unsigned long elapsed_pdp_st,
+    unsigned long start_pdp_offset, unsigned long pdp_cnt)
+{
+  unsigned long pdp_into_cdp_cnt = (elapsed_pdp_st - start_pdp_offset)
+    % pdp_cnt;
+
+  if ((pdp_into_cdp_cnt == 0) || isnan (pdp_temp_val))
+  {
+    switch (cf)
+    {
+      case CF_MAXIMUM:
+        return (-INFINITY);
+      case CF_MINIMUM:
+        return (INFINITY);
+      case CF_AVERAGE:
+        return (0);
+      default:
+        return (f->dnan);
+    }
+  }
+
+  if (cf == CF_AVERAGE)
+    return (pdp_temp_val * pdp_into_cdp_cnt);
+  return (pdp_temp_val);
+} /* }}} double rrdm_initialize_carry_over */
+
+/* calculate_cdp_val() */
+static double rrdm_calculate_cdp_val (double cdp_val, /* {{{ */
+    double pdp_temp_val, unsigned long elapsed_pdp_st, int cf)
+{
+  if (isnan (cdp_val))
+  {
+    if (cf == CF_AVERAGE)
+      pdp_temp_val *= elapsed_pdp_st;
+    return (pdp_temp_val);
+  }
+
+  if (cf == CF_AVERAGE)
+    return (cdp_val + pdp_temp_val * elapsed_pdp_st);
+  if (cf == CF_MINIMUM)
+    return ((pdp_temp_val < cdp_val) ? pdp_temp_val : cdp_val);
+  if (cf == CF_MAXIMUM)
+    return ((pdp_temp_val > cdp_val) ? pdp_temp_val : cdp_val);
+
+  return (pdp_temp_val);
+} /* }}} double rrdm_calculate_cdp_val */
+
+/* update_cdp() */
+static void rrdm_update_cdp (const rrdm_file_t *f, /* {{{ */
+    rrdm_unival_t *scratch, int cf, double pdp_temp_val,
+    unsigned long rra_step_cnt, unsigned long elapsed_pdp_st,
+    unsigned long start_pdp_offset, unsigned long pdp_cnt, double xff)
+{
+  double *cdp_val = &scratch[CDP_val].u_val;
+  double *cdp_primary_val = &scratch[CDP_primary_val].u_val;
+  double *cdp_secondary_val = &scratch[CDP_secondary_val].u_val;
+  unsigned long *cdp_unkn_pdp_cnt = &scratch[CDP_unkn_pdp_cnt].u_cnt;
+
+  if (rra_step_cnt)
+  {
+    if (isnan (pdp_temp_val))
+    {
+      *cdp_unkn_pdp_cnt += start_pdp_offset;
+      *cdp_secondary_val = f->dnan;
+    }
+    else
+    {
+      *cdp_secondary_val = pdp_temp_val;
+    }
+
+    if (*cdp_unkn_pdp_cnt > pdp_cnt * xff)
+      *cdp_primary_val = f->dnan;
+    else
+      rrdm_initialize_cdp_val (scratch, cf, pdp_temp_val,
+          start_pdp_offset, pdp_cnt);
+
+    *cdp_val = rrdm_initialize_carry_over (f, pdp_temp_val, cf,
+        elapsed_pdp_st, start_pdp_offset, pdp_cnt);
+
+    if (isnan (pdp_temp_val))
+      *cdp_unkn_pdp_cnt = (elapsed_pdp_st - start_pdp_offset) % pdp_cnt;
+    else
+      *cdp_unkn_pdp_cnt = 0;
+  }
+  else /* if (rra_step_cnt == 0) */
+  {
+    if (isnan (pdp_temp_val))
+      *cdp_unkn_pdp_cnt += elapsed_pdp_st;
+    else
+      *cdp_val = rrdm_calculate_cdp_val (*cdp_val, pdp_temp_val,
+          elapsed_pdp_st, cf);
+  }
+} /* }}} void rrdm_update_cdp */
+
+/* update_all_cdp_prep() */
+static void rrdm_update_all_cdp_prep (rrdm_file_t *f, /* {{{ */
+    unsigned long elapsed_pdp_st, unsigned long proc_pdp_cnt)
+{
+  unsigned long ds_cnt = f->stat_head->ds_cnt;
+  unsigned long rra_idx;
+
+  for (rra_idx = 0; rra_idx < f->stat_head->rra_cnt; rra_idx++)
+  {
+    rrdm_rra_def_t *rra = f->rra_def + rra_idx;
+    unsigned long start_pdp_offset;
+    unsigned long ds_idx;
+
+    start_pdp_offset = rra->pdp_cnt - proc_pdp_cnt % rra->pdp_cnt;
+    if (start_pdp_offset <= elapsed_pdp_st)
+      f->rra_step_cnt[rra_idx] = (elapsed_pdp_st - start_pdp_offset)
+        / rra->pdp_cnt + 1;
+    else
+      f->rra_step_cnt[rra_idx] = 0;
+
+    for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+    {
+      rrdm_unival_t *scratch = f->cdp_prep[rra_idx * ds_cnt + ds_idx].scratch;
+
+      if (rra->pdp_cnt > 1)
+      {
+        rrdm_update_cdp (f, scratch, f->cf[rra_idx], f->pdp_temp[ds_idx],
+            f->rra_step_cnt[rra_idx], elapsed_pdp_st, start_pdp_offset,
+            rra->pdp_cnt, rra->par[RRA_cdp_xff_val].u_val);
+      }
+      else
+      {
+        /* Nothing to consolidate. librrd sets the secondary value only if
+         * it is going to be used, see reset_cdp() and
+         * update_aberrant_cdps(). */
+        scratch[CDP_primary_val].u_val = f->pdp_temp[ds_idx];
+        if (elapsed_pdp_st > 1)
+          scratch[CDP_secondary_val].u_val = f->pdp_temp[ds_idx];
+      }
+    }
+  }
+} /* }}} void rrdm_update_all_cdp_prep */
+
+/* write_to_rras() */
+static void rrdm_write_to_rras (rrdm_file_t *f) /* {{{ */
+{
+  unsigned long ds_cnt = f->stat_head->ds_cnt;
+  double *rra_start = f->rra_data;
+  unsigned long rra_idx;
+
+  for (rra_idx = 0; rra_idx < f->stat_head->rra_cnt; rra_idx++)
+  {
+    rrdm_rra_def_t *rra = f->rra_def + rra_idx;
+    rrdm_rra_ptr_t *rra_ptr = f->rra_ptr + rra_idx;
+    int scratch_idx = CDP_primary_val;
+    unsigned long step;
+
+    for (step = 0; step < f->rra_step_cnt[rra_idx]; step++)
+    {
+      double *row;
+      unsigned long ds_idx;
+
+      rra_ptr->cur_row++;
+      if (rra_ptr->cur_row >= rra->row_cnt)
+        rra_ptr->cur_row = 0;
+
+      row = rra_start + rra_ptr->cur_row * ds_cnt;
+      for (ds_idx = 0; ds_idx < ds_cnt; ds_idx++)
+        row[ds_idx] = f->cdp_prep[rra_idx * ds_cnt + ds_idx]
+          .scratch[scratch_idx].u_val;
+
+      scratch_idx = CDP_secondary_val;
+    }
+
+    rra_start += rra->row_cnt * ds_cnt;
+  }
+} /* }}} void rrdm_write_to_rras */
+
+/* Splits an update into the time and one null terminated string per data
+ * source, stored in "buffer". */
+static int rrdm_split_update (const rrdm_file_t *f, /* {{{ */
+    const char *update, time_t *ret_time,
+    char *buffer, size_t buffer_size, char **values)
+{
+  unsigned long long t;
+  char *endptr = NULL;
+  unsigned long i;
+
+  if (!isdigit ((int) update[0]))
+    return (ENOTSUP);
+
+  errno = 0;
+  t = strtoull (update, &endptr, 10);
+  if ((errno != 0) || (endptr == NULL) || (*endptr != ':')
+      || (t > (unsigned long long) INT32_MAX))
+    return (ENOTSUP);
+  *ret_time = (time_t) t;
+
+  if (strlen (endptr + 1) >= buffer_size)
+    return (ENOTSUP);
+  sstrncpy (buffer, endptr + 1, buffer_size);
+
+  for (i = 0; i < f->stat_head->ds_cnt; i++)
+  {
+    values[i] = buffer;
+    while ((*buffer != ':') && (*buffer != 0))
+      buffer++;
+
+    if (*buffer == ':')
+    {
+      if (i == (f->stat_head->ds_cnt - 1))
+        return (ENOTSUP);
+      *buffer = 0;
+      buffer++;
+    }
+    else if (i != (f->stat_head->ds_cnt - 1))
+      return (ENOTSUP);
+  }
+
+  return (0);
+} /* }}} int rrdm_split_update */
+
+/* Accepts what rrd_diff() handles: an optional minus sign and 1 to 20
+ * digits which fit into 64 bits. */
+static _Bool rrdm_check_integer (const char *str) /* {{{ */
+{
+  char *endptr = NULL;
+
+  if (str[0] == '-')
+    str++;
+  if (!isdigit ((int) str[0]) || (strlen (str) > 20))
+    return (0);
+
+  errno = 0;
+  strtoull (str, &endptr, 10);
+  return ((errno == 0) && (endptr != NULL) && (*endptr == 0));
+} /* }}} _Bool rrdm_check_integer */
+
+static int rrdm_check_value (const rrdm_file_t *f, /* {{{ */
+    unsigned long ds_idx, const char *value, const char *last_ds)
+{
+  char *endptr = NULL;
+
+  if (strcmp ("U", value) == 0)
+    return (0);
+
+  switch (f->dst[ds_idx])
+  {
+    case DST_COUNTER:
+    case DST_DERIVE:
+      if (!rrdm_check_integer (value))
+        return (ENOTSUP);
+      if ((last_ds[0] != 'U') && !rrdm_check_integer (last_ds))
+        return (ENOTSUP);
+      break;
+
+    case DST_ABSOLUTE:
+    case DST_GAUGE:
+      errno = 0;
+      strtod (value, &endptr);
+      if ((errno != 0) || (endptr == value) || (*endptr != 0))
+        return (ENOTSUP);
+      break;
+  }
+
+  return (0);
+} /* }}} int rrdm_check_value */
+
+/* Checks all updates before the file is touched, so that either all or
+ * none of them are applied. Anything librrd would complain about is left
+ * to librrd, so that the usual error message is logged. */
+static int rrdm_check_updates (rrdm_file_t *f, /* {{{ */
+    int argc, const char **argv, char *buffer, size_t buffer_size,
+    char **values)
+{
+  time_t last_up = f->live_head->last_up;
+  int i;
+
+  for (i = 0; i < argc; i++)
+  {
+    time_t t;
+    unsigned long ds_idx;
+    int status;
+
+    status = rrdm_split_update (f, argv[i], &t, buffer, buffer_size, values);
+    if (status != 0)
+      return (status);
+
+    if (t <= last_up)
+      return (ENOTSUP);
+    last_up = t;
+
+    for (ds_idx = 0; ds_idx < f->stat_head->ds_cnt; ds_idx++)
+    {
+      const char *last_ds = f->pdp_prep[ds_idx].last_ds;
+
+      /* After the first update, "last_ds" is the previous update's
+       * value, which has been checked already. */
+      if (i > 0)
+        last_ds = "U";
+
+      status = rrdm_check_value (f, ds_idx, values[ds_idx], last_ds);
+      if (status != 0)
+        return (status);
+    }
+  }
+
+  return (0);
+} /* }}} int rrdm_check_updates */
+
+static void rrdm_apply_update (rrdm_file_t *f, /* {{{ */
+    time_t current_time, char **values)
+{
+  unsigned long pdp_step = f->stat_head->pdp_step;
+  unsigned long proc_pdp_age;
+  unsigned long proc_pdp_st;
+  unsigned long occu_pdp_age;
+  unsigned long occu_pdp_st;
+  unsigned long elapsed_pdp_st;
+  unsigned long proc_pdp_cnt;
+  double interval;
+  double pre_int;
+  double post_int;
+  unsigned long i;
+
+  interval = (double) (current_time - f->live_head->last_up);
+
+  /* update_pdp_prep() */
+  for (i = 0; i < f->stat_head->ds_cnt; i++)
+  {
+    size_t len;
+
+    f->pdp_new[i] = rrdm_pdp_new (f, i, values[i], interval);
+
+    /* strncpy (last_ds, value, LAST_DS_LEN - 1) */
+    len = strlen (values[i]);
+    if (len > (RRDM_LAST_DS_LEN - 1))
+      len = RRDM_LAST_DS_LEN - 1;
+    memset (f->pdp_prep[i].last_ds, 0, RRDM_LAST_DS_LEN);
+    memcpy (f->pdp_prep[i].last_ds, values[i], len);
+  }
+
+  /* calculate_elapsed_steps() */
+  proc_pdp_age = f->live_head->last_up % pdp_step;
+  proc_pdp_st = f->live_head->last_up - proc_pdp_age;
+
+  occu_pdp_age = current_time % pdp_step;
+  occu_pdp_st = current_time - occu_pdp_age;
+
+  if (occu_pdp_st > proc_pdp_st)
+  {
+    pre_int = (long) occu_pdp_st - f->live_head->last_up;
+    pre_int -= ((double) f->live_head->last_up_usec) / 1e6f;
+    post_int = occu_pdp_age;
+  }
+  else
+  {
+    pre_int = interval;
+    post_int = 0;
+  }
+
+  proc_pdp_cnt = proc_pdp_st / pdp_step;
+  elapsed_pdp_st = (occu_pdp_st - proc_pdp_st) / pdp_step;
+
+  if (elapsed_pdp_st == 0)
+  {
+    rrdm_simple_update (f, interval);
+  }
+  else
+  {
+    for (i = 0; i < f->stat_head->ds_cnt; i++)
+      rrdm_process_pdp_st (f, i, interval, pre_int, post_int,
+          elapsed_pdp_st * pdp_step);
+
+    rrdm_update_all_cdp_prep (f, elapsed_pdp_st, proc_pdp_cnt);
+    rrdm_write_to_rras (f);
+  }
+
+  f->live_head->last_up = current_time;
+  f->live_head->last_up_usec = 0;
+} /* }}} void rrdm_apply_update */
+
+static int rrdm_file_update (rrdm_file_t *f, /* {{{ */
+    int argc, const char **argv)
+{
+  char buffer[4096];
+  char **values;
+  int status;
+  int i;
+
+  values = calloc (f->stat_head->ds_cnt, sizeof (*values));
+  if (values == NULL)
+    return (ENOMEM);
+
+  status = rrdm_check_updates (f, argc, argv, buffer, sizeof (buffer),
+      values);
+  if (status != 0)
+  {
+    sfree (values);
+    return (status);
+  }
+
+  for (i = 0; i < argc; i++)
+  {
+    time_t t = 0;
+
+    rrdm_split_update (f, argv[i], &t, buffer, sizeof (buffer), values);
+    rrdm_apply_update (f, t, values);
+  }
+
+  sfree (values);
+  return (0);
+} /* }}} int rrdm_file_update */
+
+/*
+ * Cache handling. You must hold "rm->lock" when calling these functions.
+ */
+static void rrdm_lru_unlink (rrd_mmap_t *rm, rrdm_file_t *f) /* {{{ */
+{
+  if (f->prev != NULL)
+    f->prev->next = f->next;
+  else
+    rm->lru_head = f->next;
+
+  if (f->next != NULL)
+    f->next->prev = f->prev;
+  else
+    rm->lru_tail = f->prev;
+
+  f->prev = f->next = NULL;
+} /* }}} void rrdm_lru_unlink */
+
+static void rrdm_lru_push (rrd_mmap_t *rm, rrdm_file_t *f) /* {{{ */
+{
+  f->prev = NULL;
+  f->next = rm->lru_head;
+  if (rm->lru_head != NULL)
+    rm->lru_head->prev = f;
+  rm->lru_head = f;
+  if (rm->lru_tail == NULL)
+    rm->lru_tail = f;
+} /* }}} void rrdm_lru_push */
+
+/* Removes a file from the cache. It is unmapped as soon as nobody is using
+ * it anymore. */
+static void rrdm_evict (rrd_mmap_t *rm, rrdm_file_t *f) /* {{{ */
+{
+  c_avl_remove (rm->files, f->filename, NULL, NULL);
+  rrdm_lru_unlink (rm, f);
+  rm->files_num--;
+
+  if (f->refs > 0)
+    f->evicted = 1;
+  else
+    rrdm_file_free (f);
+} /* }}} void rrdm_evict */
+
+static void rrdm_release (rrdm_file_t *f) /* {{{ */
+{
+  assert (f->refs > 0);
+  f->refs--;
+  if ((f->refs == 0) && f->evicted)
+    rrdm_file_free (f);
+} /* }}} void rrdm_release */
+
+/* Returns the cache entry for "filename", opening the file if necessary.
+ * A reference is held on the returned entry. */
+static rrdm_file_t *rrdm_acquire (rrd_mmap_t *rm, /* {{{ */
+    const char *filename, const struct stat *sb)
+{
+  rrdm_file_t *f = NULL;
+
+  if (c_avl_get (rm->files, filename, (void *) &f) == 0)
+  {
+    if ((f->dev == sb->st_dev) && (f->ino == sb->st_ino)
+        && (f->size == sb->st_size))
+    {
+      rrdm_lru_unlink (rm, f);
+      rrdm_lru_push (rm, f);
+      f->refs++;
+      return (f);
+    }
+
+    /* The file has been replaced or resized. */
+    rrdm_evict (rm, f);
+  }
+
+  while ((rm->files_num >= rm->files_max) && (rm->lru_tail != NULL))
+    rrdm_evict (rm, rm->lru_tail);
+
+  f = rrdm_file_open (filename, sb);
+  if (f == NULL)
+    return (NULL);
+
+  if (c_avl_insert (rm->files, f->filename, f) != 0)
+  {
+    rrdm_file_free (f);
+    return (NULL);
+  }
+  rrdm_lru_push (rm, f);
+  rm->files_num++;
+
+  f->refs++;
+  return (f);
+} /* }}} rrdm_file_t *rrdm_acquire */
+
+/* Writes modified files back to disk. */
+static void rrdm_sync_all (rrd_mmap_t *rm) /* {{{ */
+{
+  rrdm_file_t *f;
+
+  pthread_mutex_lock (&rm->lock);
+  f = rm->lru_head;
+  while (f != NULL)
+  {
+    rrdm_file_t *next;
+
+    if (!f->dirty || (f->map == NULL))
+    {
+      f = f->next;
+      continue;
+    }
+
+    f->dirty = 0;
+    f->refs++;
+    pthread_mutex_unlock (&rm->lock);
+
+    if (msync (f->map, (size_t) f->size, MS_SYNC) != 0)
+    {
+      char errbuf[1024];
+      WARNING ("rrd_mmap: msync (%s) failed: %s", f->filename,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+
+    pthread_mutex_lock (&rm->lock);
+    /* If the file has been evicted in the meantime, continuing with its
+     * successor would walk a list it's no longer part of. Start over;
+     * entries which have been written are no longer dirty. */
+    next = f->evicted ? rm->lru_head : f->next;
+    rrdm_release (f);
+    f = next;
+  }
+  pthread_mutex_unlock (&rm->lock);
+} /* }}} void rrdm_sync_all */
+
+static void *rrdm_sync_thread (void *arg) /* {{{ */
+{
+  rrd_mmap_t *rm = arg;
+
+  pthread_mutex_lock (&rm->lock);
+  while (!rm->shutdown)
+  {
+    struct timespec ts;
+
+    CDTIME_T_TO_TIMESPEC (cdtime () + rm->sync_interval, &ts);
+    pthread_cond_timedwait (&rm->cond, &rm->lock, &ts);
+    if (rm->shutdown)
+      break;
+
+    pthread_mutex_unlock (&rm->lock);
+    rrdm_sync_all (rm);
+    pthread_mutex_lock (&rm->lock);
+  }
+  pthread_mutex_unlock (&rm->lock);
+
+  return ((void *) 0);
+} /* }}} void *rrdm_sync_thread */
+
+/*
+ * Public functions
+ */
+rrd_mmap_t *rrd_mmap_create (size_t max_files, /* {{{ */
+    cdtime_t sync_interval)
+{
+  rrd_mmap_t *rm;
+  int status;
+
+  if (max_files < 1)
+    return (NULL);
+
+  rm = calloc (1, sizeof (*rm));
+  if (rm == NULL)
+    return (NULL);
+
+  rm->files = c_avl_create ((void *) strcmp);
+  if (rm->files == NULL)
+  {
+    sfree (rm);
+    return (NULL);
+  }
+  rm->files_max = max_files;
+  rm->sync_interval = sync_interval;
+  pthread_mutex_init (&rm->lock, /* attr = */ NULL);
+  pthread_cond_init (&rm->cond, /* attr = */ NULL);
+
+  if (sync_interval > 0)
+  {
+    status = plugin_thread_create (&rm->sync_thread, /* attr = */ NULL,
+        rrdm_sync_thread, rm);
+    if (status != 0)
+    {
+      ERROR ("rrd_mmap: Starting the sync thread failed.");
+      rrd_mmap_destroy (rm);
+      return (NULL);
+    }
+    rm->sync_thread_running = 1;
+  }
+
+  return (rm);
+} /* }}} rrd_mmap_t *rrd_mmap_create */
+
+void rrd_mmap_destroy (rrd_mmap_t *rm) /* {{{ */
+{
+  if (rm == NULL)
+    return;
+
+  if (rm->sync_thread_running)
+  {
+    pthread_mutex_lock (&rm->lock);
+    rm->shutdown = 1;
+    pthread_cond_signal (&rm->cond);
+    pthread_mutex_unlock (&rm->lock);
+
+    pthread_join (rm->sync_thread, NULL);
+    rm->sync_thread_running = 0;
+  }
+
+  rrdm_sync_all (rm);
+
+  pthread_mutex_lock (&rm->lock);
+  while (rm->lru_head != NULL)
+    rrdm_evict (rm, rm->lru_head);
+  pthread_mutex_unlock (&rm->lock);
+
+  c_avl_destroy (rm->files);
+  pthread_mutex_destroy (&rm->lock);
+  pthread_cond_destroy (&rm->cond);
+  sfree (rm);
+} /* }}} void rrd_mmap_destroy */
+
+int rrd_mmap_update (rrd_mmap_t *rm, const char *filename, /* {{{ */
+    int argc, const char **argv)
+{
+  rrdm_file_t *f;
+  struct stat sb;
+  int status;
+
+  if ((rm == NULL) || (filename == NULL) || (argc < 1))
+    return (ENOTSUP);
+
+  /* Also catches files which have been replaced, e.g. by "rrdtool
+   * restore". */
+  if ((stat (filename, &sb) != 0) || !S_ISREG (sb.st_mode))
+    return (ENOTSUP);
+
+  pthread_mutex_lock (&rm->lock);
+  f = rrdm_acquire (rm, filename, &sb);
+  if ((f != NULL) && (f->map != NULL))
+    f->dirty = 1;
+  pthread_mutex_unlock (&rm->lock);
+
+  if (f == NULL)
+    return (ENOTSUP);
+
+  if (f->map == NULL)
+    status = ENOTSUP;
+  else if (rrdm_file_lock (f, F_WRLCK) != 0)
+  {
+    /* librrd reports the conflict, if it still exists. */
+    DEBUG ("rrd_mmap: %s is locked by another process.", filename);
+    status = ENOTSUP;
+  }
+  else
+  {
+    status = rrdm_file_update (f, argc, argv);
+    rrdm_file_lock (f, F_UNLCK);
+  }
+
+  pthread_mutex_lock (&rm->lock);
+  rrdm_release (f);
+  pthread_mutex_unlock (&rm->lock);
+
+  if ((status != 0) && (status != ENOTSUP))
+    status = ENOTSUP;
+
+  return (status);
+} /* }}} int rrd_mmap_update */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,58 @@
+/**
+ * collectd - src/utils_rrdmmap.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_RRDMMAP_H
+#define UTILS_RRDMMAP_H 1
+
+#include "collectd.h"
+#include "utils_time.h"
+
+/*
+ * Native updater for RRD files. Up to "max_files" files are kept mapped into
+ * memory and are updated in place, so that the file doesn't have to be
+ * opened and its header parsed for every update. The result is meant to be
+ * identical to what rrd_update(3) writes; files using features which aren't
+ * implemented here (Holt-Winters RRAs, COMPUTE data sources, ...) are left
+ * to librrd.
+ */
+struct rrd_mmap_s;
+typedef struct rrd_mmap_s rrd_mmap_t;
+
+/* If "sync_interval" is greater than zero, a thread is started which writes
+ * modified files back to disk at that interval. Otherwise this is left to
+ * the operating system. */
+rrd_mmap_t *rrd_mmap_create (size_t max_files, cdtime_t sync_interval);
+
+/* Writes all modified files back to disk and unmaps them. */
+void rrd_mmap_destroy (rrd_mmap_t *rm);
+
+/* Takes the same arguments as rrd_update_r(3), i.e. updates in the
+ * "<time>:<value>[:<value>...]" format. Returns zero on success and ENOTSUP
+ * if the file or any of the updates can't be handled or if another process
+ * holds the file's lock. In this case nothing has been written and the
+ * caller should pass the updates to librrd. Must not be called concurrently
+ * for the same file. */
+int rrd_mmap_update (rrd_mmap_t *rm, const char *filename,
+    int argc, const char **argv);
+
+#endif /* UTILS_RRDMMAP_H */
+
+/* vim: set sw=2 sts=2 et : */
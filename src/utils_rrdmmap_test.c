@@ -0,0 +1,417 @@
+/**
+ * collectd - src/utils_rrdmmap_test.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Creates random RRD files using librrd and applies the same random updates
+ * using rrd_update_r(3) to one copy and using the native updater to another.
+ * The files, including the header, PDP and CDP areas, must be identical byte
+ * for byte after each batch of updates, and the native updater must not
+ * leave any of these updates to librrd. Also checks that files locked by
+ * another process are left to librrd. The files are created in a temporary
+ * directory which is removed if all tests pass.
+ */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+#include "utils_rrdmmap.h"
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <rrd.h>
+
+#define TEST_FILES    200
+#define TEST_BATCHES  50
+#define TEST_DS_MAX   4
+#define TEST_RRA_MAX  6
+
+static const char *ds_types[] = { "GAUGE", "COUNTER", "DERIVE", "ABSOLUTE" };
+static const char *cf_names[] = { "AVERAGE", "MIN", "MAX", "LAST" };
+
+/* Stubs for the functions of the daemon used by the code under test. */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  printf ("[severity %i] ", level);
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+  printf ("\n");
+} /* }}} void plugin_log */
+
+char *sstrerror (int errnum, char *buf, size_t buflen) /* {{{ */
+{
+  snprintf (buf, buflen, "%s", strerror (errnum));
+  return (buf);
+} /* }}} char *sstrerror */
+
+char *sstrncpy (char *dest, const char *src, size_t n) /* {{{ */
+{
+  strncpy (dest, src, n);
+  dest[n - 1] = 0;
+  return (dest);
+} /* }}} char *sstrncpy */
+
+int plugin_thread_create (pthread_t *thread, /* {{{ */
+    const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg)
+{
+  return (pthread_create (thread, attr, start_routine, arg));
+} /* }}} int plugin_thread_create */
+
+static void read_file (const char *filename, /* {{{ */
+    char **ret_buffer, size_t *ret_size)
+{
+  struct stat sb;
+  FILE *fh;
+
+  assert (stat (filename, &sb) == 0);
+  *ret_size = (size_t) sb.st_size;
+  *ret_buffer = malloc (*ret_size);
+  assert (*ret_buffer != NULL);
+
+  fh = fopen (filename, "r");
+  assert (fh != NULL);
+  assert (fread (*ret_buffer, 1, *ret_size, fh) == *ret_size);
+  fclose (fh);
+} /* }}} void read_file */
+
+static void copy_file (const char *src, const char *dst) /* {{{ */
+{
+  char *buffer;
+  size_t size;
+  FILE *fh;
+
+  read_file (src, &buffer, &size);
+
+  fh = fopen (dst, "w");
+  assert (fh != NULL);
+  assert (fwrite (buffer, 1, size, fh) == size);
+  fclose (fh);
+
+  free (buffer);
+} /* }}} void copy_file */
+
+static int compare_files (const char *a, const char *b) /* {{{ */
+{
+  char *buffer_a;
+  char *buffer_b;
+  size_t size_a;
+  size_t size_b;
+  int status = 0;
+
+  read_file (a, &buffer_a, &size_a);
+  read_file (b, &buffer_b, &size_b);
+
+  if (size_a != size_b)
+    status = -1;
+  else if (memcmp (buffer_a, buffer_b, size_a) != 0)
+  {
+    size_t i;
+
+    for (i = 0; i < size_a; i++)
+      if (buffer_a[i] != buffer_b[i])
+        break;
+    printf ("%s and %s differ at offset %zu.\n", a, b, i);
+    status = -1;
+  }
+
+  free (buffer_a);
+  free (buffer_b);
+  return (status);
+} /* }}} int compare_files */
+
+static void random_value (char *buffer, size_t buffer_size, /* {{{ */
+    const char *type, long long *counter)
+{
+  if ((rand () % 20) == 0)
+  {
+    snprintf (buffer, buffer_size, "U");
+    return;
+  }
+
+  if (strcmp ("GAUGE", type) == 0)
+    snprintf (buffer, buffer_size, "%.15g",
+        ((double) rand () / RAND_MAX) * 200.0 - 50.0);
+  else if (strcmp ("ABSOLUTE", type) == 0)
+    snprintf (buffer, buffer_size, "%i", rand () % 1000);
+  else
+  {
+    /* Mostly increasing, with the occasional reset or wrap-around. */
+    if ((rand () % 50) == 0)
+      *counter = (strcmp ("COUNTER", type) == 0) ? 0 : -(rand () % 1000);
+    else if ((rand () % 100) == 0)
+      *counter = 4294967295LL - (rand () % 100);
+    else
+      *counter += rand () % 10000;
+    snprintf (buffer, buffer_size, "%lli", *counter);
+  }
+} /* }}} void random_value */
+
+static int test_file (rrd_mmap_t *rm, int index) /* {{{ */
+{
+  char file_librrd[64];
+  char file_native[64];
+  char *create_argv[TEST_DS_MAX + TEST_RRA_MAX];
+  int create_argc = 0;
+  const char *types[TEST_DS_MAX];
+  long long counters[TEST_DS_MAX];
+  unsigned long step = 1 + (rand () % 60);
+  time_t t = 1000000000 + (rand () % 100000);
+  int ds_num = 1 + (rand () % TEST_DS_MAX);
+  int rra_num = 1 + (rand () % TEST_RRA_MAX);
+  int status;
+  int i;
+
+  snprintf (file_librrd, sizeof (file_librrd), "rrdmmap_test_%i.librrd.rrd",
+      index);
+  snprintf (file_native, sizeof (file_native), "rrdmmap_test_%i.native.rrd",
+      index);
+
+  for (i = 0; i < ds_num; i++)
+  {
+    char buffer[128];
+    char min[32] = "U";
+    char max[32] = "U";
+
+    types[i] = ds_types[rand () % STATIC_ARRAY_SIZE (ds_types)];
+    counters[i] = rand () % 1000;
+    if ((rand () % 3) == 0)
+      snprintf (min, sizeof (min), "%i", (rand () % 20) - 10);
+    if ((rand () % 3) == 0)
+      snprintf (max, sizeof (max), "%i", 50 + (rand () % 1000));
+
+    snprintf (buffer, sizeof (buffer), "DS:ds%i:%s:%lu:%s:%s", i, types[i],
+        step * (1 + (rand () % 4)), min, max);
+    create_argv[create_argc++] = strdup (buffer);
+  }
+
+  for (i = 0; i < rra_num; i++)
+  {
+    char buffer[128];
+
+    snprintf (buffer, sizeof (buffer), "RRA:%s:%.2f:%i:%i",
+        cf_names[rand () % STATIC_ARRAY_SIZE (cf_names)],
+        (double) (rand () % 100) / 100.0,
+        (i == 0) ? 1 : 1 + (rand () % 10),
+        1 + (rand () % 50));
+    create_argv[create_argc++] = strdup (buffer);
+  }
+
+  unlink (file_librrd);
+  status = rrd_create_r (file_librrd, step, t - 1, create_argc,
+      (const char **) create_argv);
+  if (status != 0)
+  {
+    printf ("rrd_create_r (%s) failed: %s\n", file_librrd, rrd_get_error ());
+    rrd_clear_error ();
+    return (-1);
+  }
+  copy_file (file_librrd, file_native);
+
+  for (i = 0; i < TEST_BATCHES; i++)
+  {
+    char *update_argv[8];
+    int update_argc = 1 + (rand () % STATIC_ARRAY_SIZE (update_argv));
+    int j;
+
+    for (j = 0; j < update_argc; j++)
+    {
+      char buffer[512];
+      size_t buffer_len;
+      int k;
+
+      /* Mostly regular intervals, sometimes longer than the heartbeat. */
+      if ((rand () % 10) == 0)
+        t += 1 + (rand () % (10 * step));
+      else
+        t += step;
+
+      buffer_len = (size_t) snprintf (buffer, sizeof (buffer), "%lu",
+          (unsigned long) t);
+      for (k = 0; k < ds_num; k++)
+      {
+        char value[64];
+
+        random_value (value, sizeof (value), types[k], &counters[k]);
+        buffer_len += (size_t) snprintf (buffer + buffer_len,
+            sizeof (buffer) - buffer_len, ":%s", value);
+      }
+      update_argv[j] = strdup (buffer);
+    }
+
+    status = rrd_update_r (file_librrd, /* template = */ NULL, update_argc,
+        (const char **) update_argv);
+    if (status != 0)
+    {
+      printf ("rrd_update_r (%s) failed: %s\n", file_librrd,
+          rrd_get_error ());
+      rrd_clear_error ();
+    }
+    else
+    {
+      /* The updates only use features the native updater implements, so
+       * falling back to librrd here would hide a broken mmap path. */
+      status = rrd_mmap_update (rm, file_native, update_argc,
+          (const char **) update_argv);
+      if (status != 0)
+        printf ("rrd_mmap_update (%s) returned %i.\n", file_native, status);
+    }
+
+    for (j = 0; j < update_argc; j++)
+      free (update_argv[j]);
+
+    if (status != 0)
+    {
+      printf ("File %i, batch %i: Update failed.\n", index, i);
+      return (-1);
+    }
+
+    /* The mapping is shared, so the file is up to date without msync. */
+    if (compare_files (file_librrd, file_native) != 0)
+    {
+      printf ("File %i, batch %i: Files differ.\n", index, i);
+      for (j = 0; j < create_argc; j++)
+        printf ("  %s\n", create_argv[j]);
+      return (-1);
+    }
+  }
+
+  for (i = 0; i < create_argc; i++)
+    free (create_argv[i]);
+
+  unlink (file_librrd);
+  unlink (file_native);
+  return (0);
+} /* }}} int test_file */
+
+/* Locks the file in a child process, like "rrdtool update" does, and makes
+ * sure that the native updater doesn't touch it in the meantime. */
+static int test_lock (rrd_mmap_t *rm) /* {{{ */
+{
+  const char *filename = "rrdmmap_test_lock.rrd";
+  const char *create_argv[] = { "DS:ds0:GAUGE:20:U:U", "RRA:AVERAGE:0.5:1:10" };
+  const char *update_argv[] = { "1000000010:1" };
+  char *before;
+  char *after;
+  size_t before_size;
+  size_t after_size;
+  int to_parent[2];
+  int to_child[2];
+  pid_t pid;
+  char c = 0;
+  int failures = 0;
+  int status;
+
+  unlink (filename);
+  assert (rrd_create_r (filename, 10, 1000000000, 2, create_argv) == 0);
+  assert ((pipe (to_parent) == 0) && (pipe (to_child) == 0));
+
+  pid = fork ();
+  assert (pid >= 0);
+  if (pid == 0)
+  {
+    struct flock lock;
+    int fd;
+
+    memset (&lock, 0, sizeof (lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+
+    fd = open (filename, O_RDWR);
+    assert ((fd >= 0) && (fcntl (fd, F_SETLKW, &lock) == 0));
+    assert (write (to_parent[1], &c, 1) == 1);
+    assert (read (to_child[0], &c, 1) == 1);
+    _exit (0);
+  }
+
+  assert (read (to_parent[0], &c, 1) == 1);
+  read_file (filename, &before, &before_size);
+  status = rrd_mmap_update (rm, filename, 1, update_argv);
+  read_file (filename, &after, &after_size);
+  if ((status != ENOTSUP) || (before_size != after_size)
+      || (memcmp (before, after, before_size) != 0))
+  {
+    printf ("Locked file: rrd_mmap_update returned %i and the file has %s.\n",
+        status, (memcmp (before, after, before_size) != 0)
+        ? "been modified" : "not been modified");
+    failures++;
+  }
+  free (before);
+  free (after);
+
+  assert (write (to_child[1], &c, 1) == 1);
+  waitpid (pid, /* status = */ NULL, /* options = */ 0);
+
+  status = rrd_mmap_update (rm, filename, 1, update_argv);
+  if (status != 0)
+  {
+    printf ("Unlocked file: rrd_mmap_update returned %i.\n", status);
+    failures++;
+  }
+
+  close (to_parent[0]);
+  close (to_parent[1]);
+  close (to_child[0]);
+  close (to_child[1]);
+  unlink (filename);
+  return (failures);
+} /* }}} int test_lock */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  char tmpdir[] = "utils_rrdmmap_test.XXXXXX";
+  rrd_mmap_t *rm;
+  int failures = 0;
+  int i;
+
+  srand ((argc > 1) ? (unsigned int) atoi (argv[1]) : 42);
+
+  if ((mkdtemp (tmpdir) == NULL) || (chdir (tmpdir) != 0))
+  {
+    perror (tmpdir);
+    return (EXIT_FAILURE);
+  }
+
+  /* Fewer slots than files, so that eviction is tested, too. */
+  rm = rrd_mmap_create (/* max_files = */ 8, TIME_T_TO_CDTIME_T (1));
+  assert (rm != NULL);
+
+  for (i = 0; i < TEST_FILES; i++)
+    if (test_file (rm, i) != 0)
+      failures++;
+  printf ("%i of %i files differ.\n", failures, TEST_FILES);
+
+  if (test_lock (rm) != 0)
+    failures++;
+
+  rrd_mmap_destroy (rm);
+
+  /* Keep the files of failed tests around for inspection. */
+  if ((chdir ("..") == 0) && (failures == 0))
+    rmdir (tmpdir);
+  else if (failures != 0)
+    printf ("The files have been left in %s.\n", tmpdir);
+
+  return ((failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,815 @@
+/**
+ * collectd - src/utils_spool.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_complain.h"
+#include "utils_spool.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * On-disk format
+ *
+ * The spool directory contains the segments, named "segment-<id>", and the
+ * file "cursor", holding the id of the segment being read and the offset of
+ * the next record in that segment. Segments are created with increasing ids
+ * and removed once all records have been replayed. Each segment starts with
+ * a spool_segment_header_t and is followed by the records, aligned to eight
+ * bytes. A record consists of a spool_record_header_t and the data. The
+ * remainder of a segment is zero, so a record size of zero marks the end.
+ */
+#define SPOOL_MAGIC "CDSPOOL1"
+#define SPOOL_SEGMENT_PREFIX "segment-"
+#define SPOOL_CURSOR_FILE "cursor"
+
+#define SPOOL_SEGMENT_SIZE_MIN (64 * 1024)
+#define SPOOL_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+struct spool_segment_header_s
+{
+  char magic[8];
+  uint64_t id;
+  /* Offset after the last record. Set once the segment is full, zero while
+   * records are appended. */
+  uint64_t end;
+  uint64_t reserved;
+};
+typedef struct spool_segment_header_s spool_segment_header_t;
+
+struct spool_record_header_s
+{
+  uint32_t size;
+  /* CRC-32 of the data */
+  uint32_t crc;
+};
+typedef struct spool_record_header_s spool_record_header_t;
+
+struct spool_cursor_s
+{
+  uint64_t id;
+  uint64_t offset;
+};
+typedef struct spool_cursor_s spool_cursor_t;
+
+struct spool_segment_s
+{
+  uint64_t id;
+  int fd;
+  char *map;
+  size_t size;
+  /* Offset after the last record. */
+  size_t end;
+};
+typedef struct spool_segment_s spool_segment_t;
+
+struct spool_s
+{
+  char *directory;
+  size_t segment_size;
+  uint64_t size_limit;
+  uint64_t replay_rate;
+
+  /* Records are appended to "write". The segments from "read" up to "write"
+   * exist on disk. If both are the same segment, "read.map" is NULL and
+   * "write" is used for reading. */
+  spool_segment_t write;
+  spool_segment_t read;
+  size_t read_offset;
+
+  int cursor_fd;
+
+  /* Size of the records not yet replayed. */
+  uint64_t pending;
+
+  /* Token bucket implementing "replay_rate". */
+  double tokens;
+  cdtime_t last_replay;
+
+  /* Reports dropped data until the spool has been emptied. */
+  c_complain_t dropped;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void spool_crc_init (void) /* {{{ */
+{
+  uint32_t i;
+
+  for (i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    int j;
+
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    crc_table[i] = c;
+  }
+} /* }}} void spool_crc_init */
+
+static uint32_t spool_crc (void const *data, size_t size) /* {{{ */
+{
+  unsigned char const *ptr = data;
+  uint32_t crc = 0xFFFFFFFF;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    crc = crc_table[(crc ^ ptr[i]) & 0xFF] ^ (crc >> 8);
+
+  return (crc ^ 0xFFFFFFFF);
+} /* }}} uint32_t spool_crc */
+
+static void spool_segment_path (spool_t const *s, uint64_t id, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  ssnprintf (buffer, buffer_size, "%s/" SPOOL_SEGMENT_PREFIX "%020"PRIu64,
+      s->directory, id);
+} /* }}} void spool_segment_path */
+
+/* Returns the offset after the last valid record. */
+static size_t spool_segment_scan (spool_segment_t const *seg) /* {{{ */
+{
+  size_t offset = sizeof (spool_segment_header_t);
+
+  while ((offset + sizeof (spool_record_header_t)) <= seg->size)
+  {
+    spool_record_header_t rh;
+
+    memcpy (&rh, seg->map + offset, sizeof (rh));
+    if ((rh.size == 0)
+        || (rh.size > (seg->size - offset - sizeof (rh)))
+        || (rh.crc != spool_crc (seg->map + offset + sizeof (rh), rh.size)))
+      break;
+
+    offset += SPOOL_ALIGN (sizeof (rh) + rh.size);
+  }
+
+  return (offset);
+} /* }}} size_t spool_segment_scan */
+
+static void spool_segment_unmap (spool_segment_t *seg, int sync_flags) /* {{{ */
+{
+  if (seg->map != NULL)
+  {
+    if (sync_flags != 0)
+      msync (seg->map, seg->size, sync_flags);
+    munmap (seg->map, seg->size);
+  }
+  if (seg->fd >= 0)
+    close (seg->fd);
+
+  seg->map = NULL;
+  seg->size = 0;
+  seg->end = 0;
+  seg->fd = -1;
+} /* }}} void spool_segment_unmap */
+
+/* Allocates the blocks of a new segment. Segments are written through a
+ * shared mapping, and writing to a hole raises SIGBUS if the file system is
+ * full, so running out of space must be detected here. */
+static int spool_segment_allocate (int fd, size_t size) /* {{{ */
+{
+  char buffer[4096];
+  size_t offset;
+
+#if HAVE_POSIX_FALLOCATE
+  int status = posix_fallocate (fd, /* offset = */ 0, (off_t) size);
+  if ((status != EINVAL) && (status != EOPNOTSUPP))
+    return (status);
+  /* Not supported by the file system: write zeros instead. */
+#endif
+
+  memset (buffer, 0, sizeof (buffer));
+  for (offset = 0; offset < size; offset += sizeof (buffer))
+  {
+    size_t len = size - offset;
+    ssize_t written;
+
+    if (len > sizeof (buffer))
+      len = sizeof (buffer);
+
+    written = pwrite (fd, buffer, len, (off_t) offset);
+    if (written < 0)
+      return (errno);
+    else if ((size_t) written != len)
+      return (ENOSPC);
+  }
+
+  return (0);
+} /* }}} int spool_segment_allocate */
+
+/* Maps an existing segment or, if "size" is non-zero, creates a new one.
+ * Fails with ENOSPC if there is not enough space for a new segment. */
+static int spool_segment_map (spool_t const *s, spool_segment_t *seg, /* {{{ */
+    uint64_t id, size_t size)
+{
+  char path[PATH_MAX];
+  spool_segment_header_t *hdr;
+  _Bool create = (size != 0);
+  int status;
+
+  memset (seg, 0, sizeof (*seg));
+  seg->id = id;
+  seg->fd = -1;
+
+  spool_segment_path (s, id, path, sizeof (path));
+
+  if (create)
+  {
+    seg->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (seg->fd < 0)
+      return (errno);
+
+    status = spool_segment_allocate (seg->fd, size);
+    if (status != 0)
+    {
+      spool_segment_unmap (seg, /* sync_flags = */ 0);
+      unlink (path);
+      return (status);
+    }
+  }
+  else
+  {
+    struct stat statbuf;
+
+    seg->fd = open (path, O_RDWR);
+    if (seg->fd < 0)
+      return (errno);
+
+    if (fstat (seg->fd, &statbuf) != 0)
+    {
+      status = errno;
+      spool_segment_unmap (seg, /* sync_flags = */ 0);
+      return (status);
+    }
+    size = (size_t) statbuf.st_size;
+
+    if (size < sizeof (*hdr))
+    {
+      spool_segment_unmap (seg, /* sync_flags = */ 0);
+      return (EINVAL);
+    }
+  }
+
+  seg->map = mmap (/* addr = */ NULL, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, seg->fd, /* offset = */ 0);
+  if (seg->map == MAP_FAILED)
+  {
+    status = errno;
+    seg->map = NULL;
+    spool_segment_unmap (seg, /* sync_flags = */ 0);
+    return (status);
+  }
+  seg->size = size;
+
+  hdr = (spool_segment_header_t *) seg->map;
+  if (create)
+  {
+    memcpy (hdr->magic, SPOOL_MAGIC, sizeof (hdr->magic));
+    hdr->id = id;
+    hdr->end = 0;
+    seg->end = sizeof (*hdr);
+    return (0);
+  }
+
+  if ((memcmp (hdr->magic, SPOOL_MAGIC, sizeof (hdr->magic)) != 0)
+      || (hdr->id != id))
+  {
+    spool_segment_unmap (seg, /* sync_flags = */ 0);
+    return (EINVAL);
+  }
+
+  if ((hdr->end >= sizeof (*hdr)) && (hdr->end <= seg->size))
+    seg->end = (size_t) hdr->end;
+  else
+    seg->end = spool_segment_scan (seg);
+
+  return (0);
+} /* }}} int spool_segment_map */
+
+static void spool_segment_remove (spool_t const *s, /* {{{ */
+    spool_segment_t *seg)
+{
+  char path[PATH_MAX];
+
+  spool_segment_unmap (seg, /* sync_flags = */ 0);
+
+  spool_segment_path (s, seg->id, path, sizeof (path));
+  if ((unlink (path) != 0) && (errno != ENOENT))
+  {
+    char errbuf[1024];
+    WARNING ("spool: unlink (%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+} /* }}} void spool_segment_remove */
+
+static void spool_segment_remove_id (spool_t const *s, uint64_t id) /* {{{ */
+{
+  spool_segment_t seg;
+
+  memset (&seg, 0, sizeof (seg));
+  seg.id = id;
+  seg.fd = -1;
+  spool_segment_remove (s, &seg);
+} /* }}} void spool_segment_remove_id */
+
+static int spool_cursor_write (spool_t *s) /* {{{ */
+{
+  spool_cursor_t cursor;
+
+  memset (&cursor, 0, sizeof (cursor));
+  cursor.id = s->read.id;
+  cursor.offset = (uint64_t) s->read_offset;
+
+  if (pwrite (s->cursor_fd, &cursor, sizeof (cursor), 0)
+      != (ssize_t) sizeof (cursor))
+    return (errno);
+
+  return (0);
+} /* }}} int spool_cursor_write */
+
+/* Removes the segment being read and continues with the next one. */
+static void spool_read_next (spool_t *s) /* {{{ */
+{
+  uint64_t id;
+
+  assert (s->read.map != NULL);
+
+  if (s->read.end > s->read_offset)
+    s->pending -= (uint64_t) (s->read.end - s->read_offset);
+
+  id = s->read.id;
+  spool_segment_remove (s, &s->read);
+
+  /* Segments may have been removed by the user. */
+  for (id++; id < s->write.id; id++)
+  {
+    if (spool_segment_map (s, &s->read, id, /* size = */ 0) == 0)
+    {
+      s->read_offset = sizeof (spool_segment_header_t);
+      return;
+    }
+  }
+
+  memset (&s->read, 0, sizeof (s->read));
+  s->read.id = s->write.id;
+  s->read.fd = -1;
+  s->read_offset = sizeof (spool_segment_header_t);
+} /* }}} void spool_read_next */
+
+/* Closes the current segment and appends to a new one, which is large enough
+ * for a record of "record_size" bytes. */
+static int spool_rotate (spool_t *s, size_t record_size) /* {{{ */
+{
+  spool_segment_t seg;
+  size_t size;
+  int status;
+
+  size = s->segment_size;
+  if (size < (sizeof (spool_segment_header_t) + record_size))
+    size = sizeof (spool_segment_header_t) + record_size;
+
+  status = spool_segment_map (s, &seg, s->write.id + 1, size);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("spool: Creating segment %"PRIu64" in \"%s\" failed: %s",
+        s->write.id + 1, s->directory,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  ((spool_segment_header_t *) s->write.map)->end = (uint64_t) s->write.end;
+  msync (s->write.map, s->write.size, MS_ASYNC);
+
+  /* The full segment is still being read: hand it over to the reader. */
+  if (s->read.map == NULL)
+    memcpy (&s->read, &s->write, sizeof (s->read));
+  else
+    spool_segment_unmap (&s->write, /* sync_flags = */ 0);
+
+  memcpy (&s->write, &seg, sizeof (s->write));
+
+  if (s->size_limit == 0)
+    return (0);
+
+  while ((s->read.map != NULL)
+      && (((s->write.id - s->read.id + 1) * s->segment_size)
+        > s->size_limit))
+  {
+    c_complain (LOG_WARNING, &s->dropped, "spool: The size of \"%s\" "
+        "exceeds %"PRIu64" bytes. Dropping the oldest data.",
+        s->directory, s->size_limit);
+    spool_read_next (s);
+  }
+
+  return (0);
+} /* }}} int spool_rotate */
+
+/* Determines the range of segment ids in the spool directory. Returns
+ * ENOENT if there are no segments. */
+static int spool_scan_directory (spool_t const *s, /* {{{ */
+    uint64_t *ret_first, uint64_t *ret_last)
+{
+  DIR *dh;
+  struct dirent *de;
+  _Bool found = 0;
+
+  dh = opendir (s->directory);
+  if (dh == NULL)
+    return (errno);
+
+  while ((de = readdir (dh)) != NULL)
+  {
+    char *endptr = NULL;
+    uint64_t id;
+
+    if (strncmp (de->d_name, SPOOL_SEGMENT_PREFIX,
+          strlen (SPOOL_SEGMENT_PREFIX)) != 0)
+      continue;
+
+    errno = 0;
+    id = (uint64_t) strtoull (de->d_name + strlen (SPOOL_SEGMENT_PREFIX),
+        &endptr, 10);
+    if ((errno != 0) || (endptr == NULL) || (*endptr != 0) || (id == 0))
+      continue;
+
+    if (!found || (id < *ret_first))
+      *ret_first = id;
+    if (!found || (id > *ret_last))
+      *ret_last = id;
+    found = 1;
+  }
+
+  closedir (dh);
+  return (found ? 0 : ENOENT);
+} /* }}} int spool_scan_directory */
+
+/* Opens the existing segments, starting at the read position stored in the
+ * cursor file. */
+static int spool_recover (spool_t *s, uint64_t first, uint64_t last) /* {{{ */
+{
+  spool_cursor_t cursor;
+  uint64_t id;
+
+  memset (&cursor, 0, sizeof (cursor));
+  if (pread (s->cursor_fd, &cursor, sizeof (cursor), 0)
+      != (ssize_t) sizeof (cursor))
+    memset (&cursor, 0, sizeof (cursor));
+
+  if ((cursor.id < first) || (cursor.id > last))
+  {
+    cursor.id = first;
+    cursor.offset = sizeof (spool_segment_header_t);
+  }
+
+  /* remove segments which have been replayed completely */
+  for (id = first; id < cursor.id; id++)
+    spool_segment_remove_id (s, id);
+
+  /* New records are appended to a new segment. */
+  s->write.id = last + 1;
+
+  for (id = cursor.id; id <= last; id++)
+  {
+    spool_segment_t seg;
+    int status;
+
+    /* Segments without records are removed when the spool is opened. */
+    status = spool_segment_map (s, &seg, id, /* size = */ 0);
+    if (status == ENOENT)
+      continue;
+    else if (status != 0)
+    {
+      WARNING ("spool: Ignoring invalid segment %"PRIu64" in \"%s\".",
+          id, s->directory);
+      continue;
+    }
+
+    /* The last segment was being appended to. The end is determined by
+     * checking the records and the segment is closed. */
+    if (id == last)
+    {
+      seg.end = spool_segment_scan (&seg);
+      ((spool_segment_header_t *) seg.map)->end = (uint64_t) seg.end;
+
+      /* Nothing has been appended since the last start. */
+      if ((seg.end == sizeof (spool_segment_header_t))
+          && (s->read.map != NULL))
+      {
+        spool_segment_remove (s, &seg);
+        continue;
+      }
+    }
+
+    if (s->read.map == NULL)
+    {
+      memcpy (&s->read, &seg, sizeof (s->read));
+
+      s->read_offset = sizeof (spool_segment_header_t);
+      if ((id == cursor.id) && (cursor.offset > s->read_offset))
+        s->read_offset = (cursor.offset < s->read.end)
+          ? (size_t) cursor.offset : s->read.end;
+
+      s->pending += (uint64_t) (s->read.end - s->read_offset);
+    }
+    else
+    {
+      s->pending += (uint64_t) (seg.end - sizeof (spool_segment_header_t));
+      spool_segment_unmap (&seg, /* sync_flags = */ MS_ASYNC);
+    }
+  }
+
+  /* Everything has been replayed: remove all segments, so that every start
+   * does not leave another segment behind. */
+  if (s->pending == 0)
+  {
+    spool_segment_unmap (&s->read, /* sync_flags = */ 0);
+    for (id = cursor.id; id <= last; id++)
+      spool_segment_remove_id (s, id);
+  }
+
+  if (s->read.map == NULL)
+  {
+    s->read.id = s->write.id;
+    s->read_offset = sizeof (spool_segment_header_t);
+  }
+
+  return (0);
+} /* }}} int spool_recover */
+
+spool_t *spool_open (char const *directory, size_t segment_size, /* {{{ */
+    uint64_t size_limit, uint64_t replay_rate)
+{
+  spool_t *s;
+  char path[PATH_MAX];
+  uint64_t first = 0;
+  uint64_t last = 0;
+  int status;
+
+  if (directory == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  pthread_once (&crc_table_once, spool_crc_init);
+
+  s = malloc (sizeof (*s));
+  if (s == NULL)
+  {
+    errno = ENOMEM;
+    return (NULL);
+  }
+  memset (s, 0, sizeof (*s));
+  s->write.fd = -1;
+  s->read.fd = -1;
+  s->cursor_fd = -1;
+  C_COMPLAIN_INIT (&s->dropped);
+
+  s->directory = strdup (directory);
+  s->segment_size = (segment_size != 0)
+    ? SPOOL_ALIGN (segment_size) : SPOOL_SEGMENT_SIZE_DEFAULT;
+  /* With the default size, use at least four segments so that dropping the
+   * oldest one does not discard a large part of the spool. */
+  if ((segment_size == 0) && (size_limit != 0)
+      && (size_limit < (4 * (uint64_t) s->segment_size)))
+  {
+    s->segment_size = SPOOL_ALIGN ((size_t) (size_limit / 4));
+    if (s->segment_size < SPOOL_SEGMENT_SIZE_MIN)
+      s->segment_size = SPOOL_SEGMENT_SIZE_MIN;
+  }
+  s->size_limit = size_limit;
+  if ((s->size_limit != 0) && (s->size_limit < (2 * s->segment_size)))
+    s->size_limit = 2 * s->segment_size;
+  s->replay_rate = replay_rate;
+  s->tokens = (double) replay_rate;
+  s->last_replay = cdtime ();
+
+  if (s->directory == NULL)
+  {
+    spool_close (s);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  ssnprintf (path, sizeof (path), "%s/" SPOOL_CURSOR_FILE, directory);
+  status = check_create_dir (path);
+  if (status == 0)
+  {
+    s->cursor_fd = open (path, O_RDWR | O_CREAT, 0600);
+    if (s->cursor_fd < 0)
+      status = errno;
+  }
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("spool: Opening \"%s\" failed: %s", path,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    spool_close (s);
+    errno = status;
+    return (NULL);
+  }
+
+  status = spool_scan_directory (s, &first, &last);
+  if (status == 0)
+    status = spool_recover (s, first, last);
+  else if (status == ENOENT)
+  {
+    s->write.id = 1;
+    s->read.id = 1;
+    s->read_offset = sizeof (spool_segment_header_t);
+    status = 0;
+  }
+
+  if (status == 0)
+  {
+    status = spool_segment_map (s, &s->write, s->write.id, s->segment_size);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("spool: Creating segment %"PRIu64" in \"%s\" failed: %s",
+          s->write.id, directory,
+          sstrerror (status, errbuf, sizeof (errbuf)));
+    }
+  }
+
+  if (status != 0)
+  {
+    spool_close (s);
+    errno = status;
+    return (NULL);
+  }
+
+  spool_cursor_write (s);
+
+  if (s->pending > 0)
+    INFO ("spool: \"%s\" contains %"PRIu64" bytes of data to be replayed.",
+        directory, s->pending);
+
+  return (s);
+} /* }}} spool_t *spool_open */
+
+void spool_close (spool_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  if (s->cursor_fd >= 0)
+  {
+    spool_cursor_write (s);
+    fsync (s->cursor_fd);
+    close (s->cursor_fd);
+  }
+
+  spool_segment_unmap (&s->read, MS_SYNC);
+  spool_segment_unmap (&s->write, MS_SYNC);
+
+  sfree (s->directory);
+  sfree (s);
+} /* }}} void spool_close */
+
+int spool_append (spool_t *s, void const *data, size_t data_size) /* {{{ */
+{
+  spool_record_header_t rh;
+  size_t record_size;
+  char *ptr;
+
+  if ((s == NULL) || (data == NULL) || (data_size == 0)
+      || (data_size > UINT32_MAX))
+    return (EINVAL);
+
+  record_size = SPOOL_ALIGN (sizeof (rh) + data_size);
+  if ((s->write.end + record_size) > s->write.size)
+  {
+    int status = spool_rotate (s, record_size);
+    if (status != 0)
+      return (status);
+  }
+
+  ptr = s->write.map + s->write.end;
+  memcpy (ptr + sizeof (rh), data, data_size);
+
+  /* The header is written last: until then, the record ends the segment. */
+  rh.size = (uint32_t) data_size;
+  rh.crc = spool_crc (data, data_size);
+  memcpy (ptr, &rh, sizeof (rh));
+
+  s->write.end += record_size;
+  s->pending += (uint64_t) record_size;
+  return (0);
+} /* }}} int spool_append */
+
+ssize_t spool_replay (spool_t *s, spool_replay_cb callback, /* {{{ */
+    void *user_data)
+{
+  ssize_t replayed = 0;
+
+  if ((s == NULL) || (callback == NULL))
+    return (-EINVAL);
+
+  if (s->replay_rate != 0)
+  {
+    cdtime_t now = cdtime ();
+
+    s->tokens += CDTIME_T_TO_DOUBLE (now - s->last_replay)
+      * (double) s->replay_rate;
+    if (s->tokens > (double) s->replay_rate)
+      s->tokens = (double) s->replay_rate;
+    s->last_replay = now;
+  }
+
+  while (s->pending > 0)
+  {
+    spool_segment_t *seg = (s->read.map != NULL) ? &s->read : &s->write;
+    spool_record_header_t rh;
+    size_t record_size;
+    int status;
+
+    if ((s->replay_rate != 0) && (s->tokens <= 0.0))
+      break;
+
+    if ((s->read_offset + sizeof (rh)) > seg->end)
+    {
+      if (seg == &s->write)
+        break;
+
+      spool_read_next (s);
+      continue;
+    }
+
+    memcpy (&rh, seg->map + s->read_offset, sizeof (rh));
+    record_size = SPOOL_ALIGN (sizeof (rh) + rh.size);
+    if ((rh.size == 0) || (record_size > (seg->end - s->read_offset))
+        || (rh.crc != spool_crc (seg->map + s->read_offset + sizeof (rh),
+            rh.size)))
+    {
+      WARNING ("spool: Segment %"PRIu64" in \"%s\" is corrupted at offset "
+          "%zu. Skipping %zu bytes.", seg->id, s->directory, s->read_offset,
+          seg->end - s->read_offset);
+      s->pending -= (uint64_t) (seg->end - s->read_offset);
+      s->read_offset = seg->end;
+      continue;
+    }
+
+    status = (*callback) (seg->map + s->read_offset + sizeof (rh),
+        (size_t) rh.size, user_data);
+    if (status != 0)
+      break;
+
+    s->read_offset += record_size;
+    s->pending -= (uint64_t) record_size;
+    s->tokens -= (double) record_size;
+    replayed += (ssize_t) record_size;
+  }
+
+  if (replayed > 0)
+    spool_cursor_write (s);
+  if (s->pending == 0)
+    c_release (LOG_INFO, &s->dropped, "spool: \"%s\" has been emptied.",
+        s->directory);
+
+  return (replayed);
+} /* }}} ssize_t spool_replay */
+
+uint64_t spool_pending (spool_t const *s) /* {{{ */
+{
+  if (s == NULL)
+    return (0);
+  return (s->pending);
+} /* }}} uint64_t spool_pending */
+
+int spool_sync (spool_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return (EINVAL);
+
+  if (s->write.map != NULL)
+    msync (s->write.map, s->write.size, MS_ASYNC);
+
+  return (spool_cursor_write (s));
+} /* }}} int spool_sync */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,80 @@
+/**
+ * collectd - src/utils_spool.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_SPOOL_H
+#define UTILS_SPOOL_H 1
+
+#include "collectd.h"
+#include "utils_time.h"
+
+/*
+ * Append-only queue on disk for data which could not be sent to its
+ * destination. Records are appended to segment files which are mapped into
+ * memory and written sequentially. Every record carries a checksum, so that
+ * a record which has only been partly written, e.g. because the daemon was
+ * killed, is ignored when the spool is opened again. The read position is
+ * stored in the spool directory as well, so records which have not been
+ * replayed survive a restart. Records may be replayed twice after a crash.
+ *
+ * If the segments take up more than "size_limit" bytes, the oldest segment
+ * is removed. Spools are not thread-safe; callers need to serialize access.
+ */
+struct spool_s;
+typedef struct spool_s spool_t;
+
+#define SPOOL_SEGMENT_SIZE_DEFAULT (8 * 1024 * 1024)
+
+/* Opens the spool in "directory", creating the directory if required. If
+ * "segment_size" is zero, the default size is used, reduced to a quarter of
+ * "size_limit" if that is smaller. "size_limit" is at least two segments;
+ * zero means no limit. spool_replay() passes at most "replay_rate" bytes per
+ * second to its callback; zero means no limit. Returns NULL and sets errno
+ * on failure. */
+spool_t *spool_open (char const *directory, size_t segment_size,
+    uint64_t size_limit, uint64_t replay_rate);
+
+/* Writes the read position and all segments to disk and closes the spool. */
+void spool_close (spool_t *s);
+
+/* Appends a record. Returns zero on success and an errno value otherwise,
+ * e.g. ENOSPC if a new segment could not be allocated. */
+int spool_append (spool_t *s, void const *data, size_t data_size);
+
+/* Called by spool_replay() for each record. If it returns non-zero, replaying
+ * stops and the record will be passed again by the next spool_replay()
+ * call. */
+typedef int (*spool_replay_cb) (void const *data, size_t data_size,
+    void *user_data);
+
+/* Passes records to "callback", oldest first, until the spool is empty, the
+ * replay rate has been reached or the callback fails. Returns the number of
+ * bytes replayed or a negative errno value. */
+ssize_t spool_replay (spool_t *s, spool_replay_cb callback, void *user_data);
+
+/* Returns the number of bytes which have not been replayed yet. */
+uint64_t spool_pending (spool_t const *s);
+
+/* Writes the read position and the current segment to disk. */
+int spool_sync (spool_t *s);
+
+#endif /* UTILS_SPOOL_H */
+
+/* vim: set sw=2 sts=2 et : */
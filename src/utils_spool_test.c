@@ -0,0 +1,441 @@
+/**
+ * collectd - src/utils_spool_test.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Checks that records survive closing and reopening the spool, that
+ * reopening does not accumulate segments, that partly written records are
+ * dropped and that the size limit is enforced. If a directory is given,
+ * the tests run there and then the throughput of spilling and replaying
+ * records of the size used by write_graphite is measured; otherwise a
+ * temporary directory is used. Usage: utils_spool_test [directory]
+ */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+#include "utils_spool.h"
+
+#define TEST_RECORDS 20000
+#define BENCH_RECORD_SIZE 1428
+#define BENCH_BYTES (512 * 1024 * 1024)
+
+/* Stubs for the functions of the daemon used by the code under test. */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  printf ("[severity %i] ", level);
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+  printf ("\n");
+} /* }}} void plugin_log */
+
+char *sstrerror (int errnum, char *buf, size_t buflen) /* {{{ */
+{
+  snprintf (buf, buflen, "%s", strerror (errnum));
+  return (buf);
+} /* }}} char *sstrerror */
+
+int ssnprintf (char *dest, size_t n, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+  int status;
+
+  va_start (ap, format);
+  status = vsnprintf (dest, n, format, ap);
+  va_end (ap);
+
+  if (n > 0)
+    dest[n - 1] = 0;
+  return (status);
+} /* }}} int ssnprintf */
+
+cdtime_t plugin_get_interval (void) /* {{{ */
+{
+  return (TIME_T_TO_CDTIME_T (10));
+} /* }}} cdtime_t plugin_get_interval */
+
+/* Like the real function, creates the directory containing "file". */
+int check_create_dir (const char *file) /* {{{ */
+{
+  char dir[PATH_MAX];
+  char *slash;
+
+  ssnprintf (dir, sizeof (dir), "%s", file);
+  slash = strrchr (dir, '/');
+  if (slash == NULL)
+    return (0);
+  *slash = 0;
+
+  if ((mkdir (dir, 0755) != 0) && (errno != EEXIST))
+    return (-1);
+  return (0);
+} /* }}} int check_create_dir */
+
+/* Record "seq" consists of its sequence number followed by a pattern, with
+ * a size depending on the sequence number. */
+static size_t make_record (char *buffer, uint32_t seq) /* {{{ */
+{
+  size_t size = sizeof (seq) + (seq * 7) % 3000;
+  size_t i;
+
+  memcpy (buffer, &seq, sizeof (seq));
+  for (i = sizeof (seq); i < size; i++)
+    buffer[i] = (char) (seq + i);
+  return (size);
+} /* }}} size_t make_record */
+
+struct check_state_s
+{
+  uint32_t next;
+  uint32_t stop;
+  int errors;
+};
+typedef struct check_state_s check_state_t;
+
+static int check_record (void const *data, size_t size, /* {{{ */
+    void *user_data)
+{
+  check_state_t *cs = user_data;
+  char expected[4096];
+  size_t expected_size;
+  uint32_t seq;
+
+  if (cs->next >= cs->stop)
+    return (-1);
+
+  memcpy (&seq, data, sizeof (seq));
+  expected_size = make_record (expected, cs->next);
+  if ((seq != cs->next) || (size != expected_size)
+      || (memcmp (data, expected, size) != 0))
+  {
+    if (cs->errors == 0)
+      printf ("Expected record %"PRIu32", got %"PRIu32" (%zu bytes).\n",
+          cs->next, seq, size);
+    cs->errors++;
+  }
+
+  cs->next = seq + 1;
+  return (0);
+} /* }}} int check_record */
+
+static int count_record (void const *data, size_t size, /* {{{ */
+    void *user_data)
+{
+  *((uint64_t *) user_data) += size;
+  return (0);
+} /* }}} int count_record */
+
+static void remove_spool (char const *dir) /* {{{ */
+{
+  DIR *dh;
+  struct dirent *de;
+  char path[PATH_MAX];
+
+  dh = opendir (dir);
+  if (dh == NULL)
+    return;
+  while ((de = readdir (dh)) != NULL)
+  {
+    if (de->d_name[0] == '.')
+      continue;
+    ssnprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+    unlink (path);
+  }
+  closedir (dh);
+  rmdir (dir);
+} /* }}} void remove_spool */
+
+static int test_reopen (char const *dir) /* {{{ */
+{
+  spool_t *s;
+  check_state_t cs;
+  char buffer[4096];
+  uint32_t i;
+
+  remove_spool (dir);
+  memset (&cs, 0, sizeof (cs));
+
+  s = spool_open (dir, /* segment_size = */ 1024 * 1024,
+      /* size_limit = */ 0, /* replay_rate = */ 0);
+  assert (s != NULL);
+  for (i = 0; i < TEST_RECORDS; i++)
+    assert (spool_append (s, buffer, make_record (buffer, i)) == 0);
+
+  /* replay the first third */
+  cs.stop = TEST_RECORDS / 3;
+  spool_replay (s, check_record, &cs);
+  spool_close (s);
+
+  /* replay another third after reopening, then add more records */
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  cs.stop = 2 * TEST_RECORDS / 3;
+  spool_replay (s, check_record, &cs);
+  for (i = TEST_RECORDS; i < 2 * TEST_RECORDS; i++)
+    assert (spool_append (s, buffer, make_record (buffer, i)) == 0);
+  spool_close (s);
+
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  cs.stop = 2 * TEST_RECORDS;
+  spool_replay (s, check_record, &cs);
+  if (spool_pending (s) != 0)
+  {
+    printf ("%"PRIu64" bytes left in the spool.\n", spool_pending (s));
+    cs.errors++;
+  }
+  spool_close (s);
+
+  if (cs.next != 2 * TEST_RECORDS)
+  {
+    printf ("Replayed %"PRIu32" of %i records.\n", cs.next, 2 * TEST_RECORDS);
+    cs.errors++;
+  }
+
+  printf ("reopen: %s\n", (cs.errors == 0) ? "ok" : "FAILED");
+  return (cs.errors);
+} /* }}} int test_reopen */
+
+static int count_segments (char const *dir) /* {{{ */
+{
+  DIR *dh;
+  struct dirent *de;
+  int num = 0;
+
+  dh = opendir (dir);
+  if (dh == NULL)
+    return (-1);
+  while ((de = readdir (dh)) != NULL)
+    if (strncmp (de->d_name, "segment-", strlen ("segment-")) == 0)
+      num++;
+  closedir (dh);
+  return (num);
+} /* }}} int count_segments */
+
+/* Every start creates a segment to append to. Segments without records must
+ * not be left behind. */
+static int test_reopen_segments (char const *dir) /* {{{ */
+{
+  spool_t *s;
+  check_state_t cs;
+  char buffer[4096];
+  uint32_t i;
+  int num;
+
+  remove_spool (dir);
+  memset (&cs, 0, sizeof (cs));
+
+  for (i = 0; i < 5; i++)
+  {
+    s = spool_open (dir, 1024 * 1024, 0, 0);
+    assert (s != NULL);
+    spool_close (s);
+  }
+  num = count_segments (dir);
+  if (num != 1)
+  {
+    printf ("%i segments after reopening an empty spool.\n", num);
+    cs.errors++;
+  }
+
+  /* pending records, but nothing appended after reopening */
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  for (i = 0; i < 100; i++)
+    assert (spool_append (s, buffer, make_record (buffer, i)) == 0);
+  spool_close (s);
+  for (i = 0; i < 5; i++)
+  {
+    s = spool_open (dir, 1024 * 1024, 0, 0);
+    assert (s != NULL);
+    spool_close (s);
+  }
+  num = count_segments (dir);
+  if (num != 2)
+  {
+    printf ("%i segments after reopening a spool with records.\n", num);
+    cs.errors++;
+  }
+
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  cs.stop = 100;
+  spool_replay (s, check_record, &cs);
+  spool_close (s);
+  if (cs.next != 100)
+  {
+    printf ("Replayed %"PRIu32" of 100 records.\n", cs.next);
+    cs.errors++;
+  }
+
+  printf ("reopen segments: %s\n", (cs.errors == 0) ? "ok" : "FAILED");
+  return (cs.errors);
+} /* }}} int test_reopen_segments */
+
+/* Simulates a crash while the last record was written by corrupting it. */
+static int test_torn_record (char const *dir) /* {{{ */
+{
+  spool_t *s;
+  check_state_t cs;
+  char buffer[4096];
+  char path[PATH_MAX];
+  size_t offset = 32;
+  int fd;
+  uint32_t i;
+
+  remove_spool (dir);
+  memset (&cs, 0, sizeof (cs));
+
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  for (i = 0; i < 100; i++)
+  {
+    size_t size = make_record (buffer, i);
+
+    assert (spool_append (s, buffer, size) == 0);
+    if (i < 99)
+      offset += (8 + size + 7) & ~((size_t) 7);
+  }
+  spool_close (s);
+
+  ssnprintf (path, sizeof (path), "%s/segment-%020i", dir, 1);
+  fd = open (path, O_RDWR);
+  assert (fd >= 0);
+  assert (pwrite (fd, "garbage", 7, (off_t) (offset + 16)) == 7);
+  close (fd);
+
+  s = spool_open (dir, 1024 * 1024, 0, 0);
+  assert (s != NULL);
+  cs.stop = 100;
+  spool_replay (s, check_record, &cs);
+
+  /* new records are appended after the torn one */
+  assert (spool_append (s, buffer, make_record (buffer, 99)) == 0);
+  spool_replay (s, check_record, &cs);
+  spool_close (s);
+
+  if (cs.next != 100)
+  {
+    printf ("Replayed %"PRIu32" of 100 records.\n", cs.next);
+    cs.errors++;
+  }
+
+  printf ("torn record: %s\n", (cs.errors == 0) ? "ok" : "FAILED");
+  return (cs.errors);
+} /* }}} int test_torn_record */
+
+static int test_size_limit (char const *dir) /* {{{ */
+{
+  spool_t *s;
+  char buffer[4096];
+  uint32_t i;
+  int errors = 0;
+
+  remove_spool (dir);
+
+  s = spool_open (dir, /* segment_size = */ 64 * 1024,
+      /* size_limit = */ 4 * 64 * 1024, 0);
+  assert (s != NULL);
+  for (i = 0; i < TEST_RECORDS; i++)
+    assert (spool_append (s, buffer, make_record (buffer, i)) == 0);
+
+  if (spool_pending (s) > 4 * 64 * 1024)
+  {
+    printf ("%"PRIu64" bytes in the spool.\n", spool_pending (s));
+    errors++;
+  }
+  spool_close (s);
+
+  printf ("size limit: %s\n", (errors == 0) ? "ok" : "FAILED");
+  return (errors);
+} /* }}} int test_size_limit */
+
+static void benchmark (char const *dir) /* {{{ */
+{
+  spool_t *s;
+  char buffer[BENCH_RECORD_SIZE];
+  uint64_t replayed = 0;
+  cdtime_t start;
+  double duration;
+  size_t records = BENCH_BYTES / sizeof (buffer);
+  size_t i;
+
+  remove_spool (dir);
+  memset (buffer, 'x', sizeof (buffer));
+
+  s = spool_open (dir, SPOOL_SEGMENT_SIZE_DEFAULT, 0, 0);
+  assert (s != NULL);
+
+  start = cdtime ();
+  for (i = 0; i < records; i++)
+    assert (spool_append (s, buffer, sizeof (buffer)) == 0);
+  spool_sync (s);
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  printf ("spill:  %zu records of %zu bytes in %.3f s: %.0f records/s, "
+      "%.1f MB/s\n", records, sizeof (buffer), duration,
+      records / duration, BENCH_BYTES / duration / 1e6);
+
+  start = cdtime ();
+  spool_replay (s, count_record, &replayed);
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  printf ("replay: %zu records of %zu bytes in %.3f s: %.0f records/s, "
+      "%.1f MB/s\n", records, sizeof (buffer), duration,
+      records / duration, replayed / duration / 1e6);
+
+  spool_close (s);
+  remove_spool (dir);
+} /* }}} void benchmark */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  char tmpdir[] = "utils_spool_test.XXXXXX";
+  char const *dir;
+  int errors = 0;
+
+  if (argc > 2)
+  {
+    fprintf (stderr, "Usage: %s [directory]\n", argv[0]);
+    return (EXIT_FAILURE);
+  }
+
+  if (argc == 2)
+    dir = argv[1];
+  else if ((dir = mkdtemp (tmpdir)) == NULL)
+  {
+    perror ("mkdtemp");
+    return (EXIT_FAILURE);
+  }
+
+  errors += test_reopen (dir);
+  errors += test_reopen_segments (dir);
+  errors += test_torn_record (dir);
+  errors += test_size_limit (dir);
+
+  if ((errors == 0) && (argc == 2))
+    benchmark (dir);
+
+  remove_spool (dir);
+  return ((errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
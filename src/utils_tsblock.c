@@ -0,0 +1,1560 @@
+/**
+ * collectd - src/utils_tsblock.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_tsblock.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * On-disk format
+ *
+ * "series" holds one line per series: "<number>\t<types>\t<identifier>".
+ * "<types>" has one character per column: 'g' (gauge), 'c' (counter), 'd'
+ * (derive) or 'a' (absolute).
+ *
+ * "<partition>/data" holds the blocks, one after another. A block contains
+ * the points of one series; each point is the encoded timestamp followed by
+ * the encoded value of each column. The first timestamp is stored in the
+ * index entry.
+ *
+ * "<partition>/index" holds one run of entries per flush. A run starts with
+ * a tsb_run_header_t, followed by "count" tsb_index_entry_t, sorted by
+ * series number and time.
+ */
+#define TSB_SERIES_FILE "series"
+#define TSB_DATA_FILE   "data"
+#define TSB_INDEX_FILE  "index"
+
+#define TSB_RUN_MAGIC 0x31425354 /* "TSB1" */
+
+/* Limits the length of the lines in the series file. */
+#define TSB_COLUMNS_MAX 1024
+#define TSB_SERIES_LINE_MAX (6 * DATA_MAX_NAME_LEN + TSB_COLUMNS_MAX + 32)
+
+/* Blocks are limited by the size of tsb_index_entry_t.points. */
+#define TSB_BLOCK_POINTS_MAX UINT16_MAX
+/* Limited by tsb_index_entry_t.duration. */
+#define TSB_PARTITION_LENGTH_MAX TIME_T_TO_CDTIME_T (24 * 86400)
+
+#define TSB_WRITE_BUFFER_SIZE (1024 * 1024)
+
+struct tsb_run_header_s
+{
+  uint32_t magic;
+  uint32_t count;
+};
+typedef struct tsb_run_header_s tsb_run_header_t;
+
+struct tsb_index_entry_s
+{
+  uint32_t series;
+  uint16_t points;
+  uint16_t columns;
+  uint32_t size;
+  /* last_ms - first_ms */
+  uint32_t duration;
+  uint64_t offset;
+  int64_t first_ms;
+};
+typedef struct tsb_index_entry_s tsb_index_entry_t;
+
+/*
+ * In-memory data
+ */
+struct tsb_column_s
+{
+  /* bits of the previous gauge or the previous integer */
+  uint64_t prev;
+  /* integers: previous difference, modulo 2^64 */
+  uint64_t delta;
+  /* gauges: 0xff until the first XOR with significant bits has been
+   * stored */
+  uint8_t leading;
+  uint8_t trailing;
+};
+typedef struct tsb_column_s tsb_column_t;
+
+struct tsb_block_s;
+typedef struct tsb_block_s tsb_block_t;
+struct tsb_block_s
+{
+  tsb_block_t *next;
+
+  uint32_t series;
+  uint16_t points;
+  uint16_t columns;
+  int64_t partition_ms;
+
+  int64_t first_ms;
+  int64_t last_ms;
+  int64_t last_delta;
+
+  uint8_t *data;
+  size_t size;
+  size_t alloc;
+  /* bits used in data[size - 1] */
+  int bits_used;
+
+  tsb_column_t column[];
+};
+
+struct tsb_series_s
+{
+  uint32_t id;
+  uint16_t columns;
+  _Bool active;
+  int64_t last_ms;
+
+  /* NULL if there are no points since the last flush */
+  tsb_block_t *block;
+
+  /* DS_TYPE_* of each column; allocated together with the series and never
+   * changed, so queries may use it without holding the lock. */
+  int *types;
+  char *name;
+};
+typedef struct tsb_series_s tsb_series_t;
+
+struct tsb_store_s
+{
+  char *directory;
+  int64_t partition_ms;
+
+  /* Protects everything below. */
+  pthread_mutex_t lock;
+
+  c_avl_tree_t *series;
+  uint32_t next_id;
+  FILE *series_fh;
+
+  /* Series which have a block. */
+  tsb_series_t **active;
+  size_t active_num;
+  size_t active_alloc;
+
+  /* Blocks which have been replaced because they were full or because a
+   * new partition began. */
+  tsb_block_t *detached;
+
+  /* Serializes tsb_flush(). */
+  pthread_mutex_t flush_lock;
+};
+
+/*
+ * Bit streams
+ */
+static void tsb_bits_write (tsb_block_t *b, uint64_t value, int bits) /* {{{ */
+{
+  while (bits > 0)
+  {
+    int free_bits;
+    int n;
+
+    if (b->bits_used == 8)
+    {
+      b->data[b->size++] = 0;
+      b->bits_used = 0;
+    }
+
+    free_bits = 8 - b->bits_used;
+    n = (bits < free_bits) ? bits : free_bits;
+    b->data[b->size - 1] |= (uint8_t) (((value >> (bits - n))
+          & ((1u << n) - 1)) << (free_bits - n));
+    b->bits_used += n;
+    bits -= n;
+  }
+} /* }}} void tsb_bits_write */
+
+struct tsb_reader_s
+{
+  uint8_t const *data;
+  size_t size;
+  /* position in bits */
+  size_t pos;
+};
+typedef struct tsb_reader_s tsb_reader_t;
+
+static int tsb_bits_read (tsb_reader_t *r, int bits, /* {{{ */
+    uint64_t *ret_value)
+{
+  uint64_t value = 0;
+
+  if (r->pos + (size_t) bits > 8 * r->size)
+    return (-1);
+
+  while (bits > 0)
+  {
+    int offset = (int) (r->pos % 8);
+    int avail = 8 - offset;
+    int n = (bits < avail) ? bits : avail;
+    uint8_t byte = r->data[r->pos / 8];
+
+    value = (value << n)
+      | ((byte >> (avail - n)) & ((1u << n) - 1));
+    r->pos += (size_t) n;
+    bits -= n;
+  }
+
+  *ret_value = value;
+  return (0);
+} /* }}} int tsb_bits_read */
+
+static int64_t tsb_sign_extend (uint64_t value, int bits) /* {{{ */
+{
+  uint64_t sign = UINT64_C (1) << (bits - 1);
+
+  if (bits == 64)
+    return ((int64_t) value);
+  return ((int64_t) ((value ^ sign) - sign));
+} /* }}} int64_t tsb_sign_extend */
+
+/*
+ * Encoding
+ */
+/* Difference of consecutive differences:
+ *   '0'                   same difference
+ *   '10'   +  7 bits      -64 ... 63
+ *   '110'  +  9 bits      -256 ... 255
+ *   '1110' + 12 bits      -2048 ... 2047
+ *   '1111' + 64 bits      anything else */
+static void tsb_encode_dod (tsb_block_t *b, int64_t dod) /* {{{ */
+{
+  if (dod == 0)
+    tsb_bits_write (b, 0, 1);
+  else if ((dod >= -64) && (dod <= 63))
+  {
+    tsb_bits_write (b, 2, 2);
+    tsb_bits_write (b, (uint64_t) dod, 7);
+  }
+  else if ((dod >= -256) && (dod <= 255))
+  {
+    tsb_bits_write (b, 6, 3);
+    tsb_bits_write (b, (uint64_t) dod, 9);
+  }
+  else if ((dod >= -2048) && (dod <= 2047))
+  {
+    tsb_bits_write (b, 14, 4);
+    tsb_bits_write (b, (uint64_t) dod, 12);
+  }
+  else
+  {
+    tsb_bits_write (b, 15, 4);
+    tsb_bits_write (b, (uint64_t) dod, 64);
+  }
+} /* }}} void tsb_encode_dod */
+
+static int tsb_decode_dod (tsb_reader_t *r, int64_t *ret_dod) /* {{{ */
+{
+  uint64_t tmp;
+  int prefix;
+  int bits = 0;
+
+  /* Count the one bits of the prefix, up to four. */
+  for (prefix = 0; prefix < 4; prefix++)
+  {
+    if (tsb_bits_read (r, 1, &tmp) != 0)
+      return (-1);
+    if (tmp == 0)
+      break;
+  }
+
+  switch (prefix)
+  {
+    case 0: bits = 0; break;
+    case 1: bits = 7; break;
+    case 2: bits = 9; break;
+    case 3: bits = 12; break;
+    default: bits = 64; break;
+  }
+
+  *ret_dod = 0;
+  if (bits > 0)
+  {
+    if (tsb_bits_read (r, bits, &tmp) != 0)
+      return (-1);
+    *ret_dod = tsb_sign_extend (tmp, bits);
+  }
+  return (0);
+} /* }}} int tsb_decode_dod */
+
+/* Timestamps: difference of consecutive differences in milliseconds. */
+static void tsb_encode_time (tsb_block_t *b, int64_t ms) /* {{{ */
+{
+  int64_t delta;
+
+  if (b->points == 0)
+  {
+    b->first_ms = ms;
+    b->last_ms = ms;
+    b->last_delta = 0;
+    return;
+  }
+
+  delta = ms - b->last_ms;
+  tsb_encode_dod (b, delta - b->last_delta);
+
+  b->last_delta = delta;
+  b->last_ms = ms;
+} /* }}} void tsb_encode_time */
+
+/* Counters, derives and absolutes: the 64-bit integer, then the difference
+ * of consecutive differences. The arithmetic is modulo 2^64, so every value,
+ * including wrap-arounds and resets, is stored exactly; a steadily growing
+ * counter needs one bit per point. */
+static void tsb_encode_integer (tsb_block_t *b, tsb_column_t *c, /* {{{ */
+    uint64_t value)
+{
+  uint64_t delta;
+
+  if (b->points == 0)
+  {
+    tsb_bits_write (b, value, 64);
+    c->prev = value;
+    c->delta = 0;
+    return;
+  }
+
+  delta = value - c->prev;
+  tsb_encode_dod (b, (int64_t) (delta - c->delta));
+  c->prev = value;
+  c->delta = delta;
+} /* }}} void tsb_encode_integer */
+
+/* Gauges: XOR with the previous value of the column.
+ *   '0'                                   same value
+ *   '10' + bits                           significant bits fit into the
+ *                                         window of the previous value
+ *   '11' + 5 bits leading zeros
+ *        + 6 bits significant bits - 1
+ *        + bits                           new window */
+static void tsb_encode_gauge (tsb_block_t *b, tsb_column_t *c, /* {{{ */
+    double value)
+{
+  uint64_t bits;
+  uint64_t xor;
+  int leading;
+  int trailing;
+
+  memcpy (&bits, &value, sizeof (bits));
+
+  if (b->points == 0)
+  {
+    tsb_bits_write (b, bits, 64);
+    c->prev = bits;
+    c->leading = 0xff;
+    c->trailing = 0;
+    return;
+  }
+
+  xor = bits ^ c->prev;
+  c->prev = bits;
+
+  if (xor == 0)
+  {
+    tsb_bits_write (b, 0, 1);
+    return;
+  }
+
+  leading = __builtin_clzll (xor);
+  trailing = __builtin_ctzll (xor);
+  if (leading > 31)
+    leading = 31;
+
+  if ((c->leading != 0xff)
+      && (leading >= c->leading) && (trailing >= c->trailing))
+  {
+    tsb_bits_write (b, 2, 2);
+    tsb_bits_write (b, xor >> c->trailing, 64 - c->leading - c->trailing);
+  }
+  else
+  {
+    int significant = 64 - leading - trailing;
+
+    tsb_bits_write (b, 3, 2);
+    tsb_bits_write (b, (uint64_t) leading, 5);
+    tsb_bits_write (b, (uint64_t) (significant - 1), 6);
+    tsb_bits_write (b, xor >> trailing, significant);
+    c->leading = (uint8_t) leading;
+    c->trailing = (uint8_t) trailing;
+  }
+} /* }}} void tsb_encode_gauge */
+
+/* Maximum size of one encoded point. */
+static size_t tsb_point_size_max (size_t columns) /* {{{ */
+{
+  return ((4 + 64 + columns * (2 + 5 + 6 + 64)) / 8 + 2);
+} /* }}} size_t tsb_point_size_max */
+
+static tsb_block_t *tsb_block_create (uint32_t series, /* {{{ */
+    uint16_t columns, int64_t partition_ms)
+{
+  tsb_block_t *b;
+
+  b = calloc (1, sizeof (*b) + columns * sizeof (b->column[0]));
+  if (b == NULL)
+    return (NULL);
+
+  b->series = series;
+  b->columns = columns;
+  b->partition_ms = partition_ms;
+  b->bits_used = 8;
+
+  b->alloc = 4 * tsb_point_size_max (columns);
+  b->data = malloc (b->alloc);
+  if (b->data == NULL)
+  {
+    sfree (b);
+    return (NULL);
+  }
+
+  return (b);
+} /* }}} tsb_block_t *tsb_block_create */
+
+static void tsb_block_destroy (tsb_block_t *b) /* {{{ */
+{
+  while (b != NULL)
+  {
+    tsb_block_t *next = b->next;
+
+    sfree (b->data);
+    sfree (b);
+    b = next;
+  }
+} /* }}} void tsb_block_destroy */
+
+static uint64_t tsb_value_to_integer (int type, value_t value) /* {{{ */
+{
+  if (type == DS_TYPE_COUNTER)
+    return ((uint64_t) value.counter);
+  else if (type == DS_TYPE_DERIVE)
+    return ((uint64_t) value.derive);
+  return ((uint64_t) value.absolute);
+} /* }}} uint64_t tsb_value_to_integer */
+
+static value_t tsb_integer_to_value (int type, uint64_t integer) /* {{{ */
+{
+  value_t value;
+
+  if (type == DS_TYPE_COUNTER)
+    value.counter = (counter_t) integer;
+  else if (type == DS_TYPE_DERIVE)
+    value.derive = (derive_t) integer;
+  else
+    value.absolute = (absolute_t) integer;
+  return (value);
+} /* }}} value_t tsb_integer_to_value */
+
+static int tsb_block_append (tsb_block_t *b, int64_t ms, /* {{{ */
+    int const *types, value_t const *values)
+{
+  size_t need = b->size + tsb_point_size_max (b->columns);
+  size_t i;
+
+  /* Make sure the encoders cannot run out of space. */
+  if (need > b->alloc)
+  {
+    size_t alloc = 2 * b->alloc;
+    uint8_t *tmp;
+
+    while (alloc < need)
+      alloc *= 2;
+    tmp = realloc (b->data, alloc);
+    if (tmp == NULL)
+      return (ENOMEM);
+    b->data = tmp;
+    b->alloc = alloc;
+  }
+
+  tsb_encode_time (b, ms);
+  for (i = 0; i < b->columns; i++)
+  {
+    if (types[i] == DS_TYPE_GAUGE)
+      tsb_encode_gauge (b, b->column + i, values[i].gauge);
+    else
+      tsb_encode_integer (b, b->column + i,
+          tsb_value_to_integer (types[i], values[i]));
+  }
+  b->points++;
+
+  return (0);
+} /* }}} int tsb_block_append */
+
+/* Decodes the block described by "e" and passes the points between "start"
+ * and "end" (in milliseconds) to "callback". Returns the number of points
+ * passed or -1 if the block is invalid or the callback failed. */
+static int tsb_block_decode (tsb_index_entry_t const *e, /* {{{ */
+    uint8_t const *data, int64_t start, int64_t end, int const *types,
+    value_t *values, tsb_column_t *columns,
+    tsb_query_cb callback, void *user_data)
+{
+  tsb_reader_t r = { data, e->size, 0 };
+  int64_t ms = e->first_ms;
+  int64_t delta = 0;
+  int num = 0;
+  size_t i;
+  uint32_t p;
+
+  for (p = 0; p < e->points; p++)
+  {
+    uint64_t tmp;
+
+    if (p > 0)
+    {
+      int64_t dod;
+
+      if (tsb_decode_dod (&r, &dod) != 0)
+        return (-1);
+      delta += dod;
+      ms += delta;
+    }
+
+    for (i = 0; i < e->columns; i++)
+    {
+      tsb_column_t *c = columns + i;
+      uint64_t xor;
+
+      if (p == 0)
+      {
+        if (tsb_bits_read (&r, 64, &c->prev) != 0)
+          return (-1);
+        c->delta = 0;
+        c->leading = 0xff;
+      }
+      else if (types[i] != DS_TYPE_GAUGE)
+      {
+        int64_t dod;
+
+        if (tsb_decode_dod (&r, &dod) != 0)
+          return (-1);
+        c->delta += (uint64_t) dod;
+        c->prev += c->delta;
+      }
+      else
+      {
+        if (tsb_bits_read (&r, 1, &tmp) != 0)
+          return (-1);
+        if (tmp != 0)
+        {
+          if (tsb_bits_read (&r, 1, &tmp) != 0)
+            return (-1);
+          if (tmp != 0)
+          {
+            uint64_t leading, significant;
+
+            if ((tsb_bits_read (&r, 5, &leading) != 0)
+                || (tsb_bits_read (&r, 6, &significant) != 0))
+              return (-1);
+            significant++;
+            if (leading + significant > 64)
+              return (-1);
+            c->leading = (uint8_t) leading;
+            c->trailing = (uint8_t) (64 - leading - significant);
+          }
+          else if (c->leading == 0xff)
+            return (-1);
+
+          if (tsb_bits_read (&r, 64 - c->leading - c->trailing, &xor) != 0)
+            return (-1);
+          c->prev ^= xor << c->trailing;
+        }
+      }
+
+      if (types[i] == DS_TYPE_GAUGE)
+        memcpy (&values[i].gauge, &c->prev, sizeof (values[i].gauge));
+      else
+        values[i] = tsb_integer_to_value (types[i], c->prev);
+    }
+
+    if (ms > end)
+      break;
+    if (ms < start)
+      continue;
+
+    if (callback (MS_TO_CDTIME_T (ms), types, values, e->columns,
+          user_data) != 0)
+      return (-1);
+    num++;
+  }
+
+  return (num);
+} /* }}} int tsb_block_decode */
+
+/*
+ * Series
+ */
+static int tsb_series_compare (void const *a, void const *b) /* {{{ */
+{
+  return (strcmp (a, b));
+} /* }}} int tsb_series_compare */
+
+static char const tsb_type_chars[] = "cgda";
+
+static int tsb_type_from_char (char c) /* {{{ */
+{
+  char const *ptr = strchr (tsb_type_chars, c);
+
+  if ((c == 0) || (ptr == NULL))
+    return (-1);
+  /* Same order as the DS_TYPE_* constants. */
+  return ((int) (ptr - tsb_type_chars));
+} /* }}} int tsb_type_from_char */
+
+static tsb_series_t *tsb_series_insert (tsb_store_t *s, /* {{{ */
+    uint32_t id, int const *types, uint16_t columns, char const *name)
+{
+  tsb_series_t *series;
+  size_t name_len = strlen (name);
+
+  series = calloc (1, sizeof (*series) + columns * sizeof (*series->types)
+      + name_len + 1);
+  if (series == NULL)
+    return (NULL);
+  series->id = id;
+  series->columns = columns;
+  series->types = (int *) (series + 1);
+  memcpy (series->types, types, columns * sizeof (*series->types));
+  series->name = (char *) (series->types + columns);
+  memcpy (series->name, name, name_len + 1);
+
+  if (c_avl_insert (s->series, series->name, series) != 0)
+  {
+    sfree (series);
+    return (NULL);
+  }
+
+  if (id >= s->next_id)
+    s->next_id = id + 1;
+  return (series);
+} /* }}} tsb_series_t *tsb_series_insert */
+
+/* Reads the series file. A line which has only been partly written is
+ * removed. */
+static int tsb_series_load (tsb_store_t *s) /* {{{ */
+{
+  char line[TSB_SERIES_LINE_MAX];
+  int types[TSB_COLUMNS_MAX];
+  off_t valid = 0;
+
+  rewind (s->series_fh);
+  while (fgets (line, sizeof (line), s->series_fh) != NULL)
+  {
+    size_t len = strlen (line);
+    char *columns;
+    char *name;
+    char *endptr;
+    unsigned long id;
+    size_t num;
+
+    if ((len == 0) || (line[len - 1] != '\n'))
+      break;
+    line[len - 1] = 0;
+
+    columns = strchr (line, '\t');
+    if (columns == NULL)
+      break;
+    *columns++ = 0;
+    name = strchr (columns, '\t');
+    if (name == NULL)
+      break;
+    *name++ = 0;
+
+    errno = 0;
+    id = strtoul (line, &endptr, 10);
+    if ((errno != 0) || (*endptr != 0) || (id > UINT32_MAX))
+      break;
+
+    for (num = 0; (columns[num] != 0) && (num < TSB_COLUMNS_MAX); num++)
+    {
+      types[num] = tsb_type_from_char (columns[num]);
+      if (types[num] < 0)
+        break;
+    }
+    if ((num < 1) || (columns[num] != 0))
+      break;
+
+    if (tsb_series_insert (s, (uint32_t) id, types, (uint16_t) num,
+          name) == NULL)
+    {
+      ERROR ("utils_tsblock: Loading series \"%s\" failed.", name);
+      return (-1);
+    }
+    valid += (off_t) len;
+  }
+
+  if (ftruncate (fileno (s->series_fh), valid) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsblock: ftruncate (%s/" TSB_SERIES_FILE ") failed: %s",
+        s->directory, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  fseeko (s->series_fh, valid, SEEK_SET);
+
+  return (0);
+} /* }}} int tsb_series_load */
+
+static tsb_series_t *tsb_series_create (tsb_store_t *s, /* {{{ */
+    char const *name, int const *types, size_t columns)
+{
+  tsb_series_t *series;
+  char chars[TSB_COLUMNS_MAX + 1];
+  size_t i;
+
+  /* The line must fit into the buffer of tsb_series_load(). */
+  if ((columns < 1) || (columns > TSB_COLUMNS_MAX)
+      || (strlen (name) > 6 * DATA_MAX_NAME_LEN)
+      || (strchr (name, '\n') != NULL))
+    return (NULL);
+
+  for (i = 0; i < columns; i++)
+  {
+    if ((types[i] < 0)
+        || ((size_t) types[i] >= sizeof (tsb_type_chars) - 1))
+      return (NULL);
+    chars[i] = tsb_type_chars[types[i]];
+  }
+  chars[columns] = 0;
+
+  series = tsb_series_insert (s, s->next_id, types, (uint16_t) columns, name);
+  if (series == NULL)
+    return (NULL);
+
+  /* Written to disk by tsb_flush(), before the first block of the
+   * series. */
+  fprintf (s->series_fh, "%"PRIu32"\t%s\t%s\n", series->id, chars, name);
+  return (series);
+} /* }}} tsb_series_t *tsb_series_create */
+
+/*
+ * Partitions
+ */
+static int tsb_partition_path (tsb_store_t *s, int64_t partition_ms, /* {{{ */
+    char const *file, char *buffer, size_t buffer_size)
+{
+  int status;
+
+  status = ssnprintf (buffer, buffer_size, "%s/%"PRIi64"/%s", s->directory,
+      partition_ms / 1000, file);
+  if ((status < 0) || ((size_t) status >= buffer_size))
+    return (ENAMETOOLONG);
+  return (0);
+} /* }}} int tsb_partition_path */
+
+/* Returns the size of the valid runs at the beginning of an index file. */
+static off_t tsb_index_valid_size (uint8_t const *map, size_t size) /* {{{ */
+{
+  size_t pos = 0;
+
+  while (pos + sizeof (tsb_run_header_t) <= size)
+  {
+    tsb_run_header_t hdr;
+    size_t run_size;
+
+    memcpy (&hdr, map + pos, sizeof (hdr));
+    run_size = sizeof (hdr) + hdr.count * sizeof (tsb_index_entry_t);
+    if ((hdr.magic != TSB_RUN_MAGIC) || (run_size > size - pos))
+      break;
+    pos += run_size;
+  }
+
+  return ((off_t) pos);
+} /* }}} off_t tsb_index_valid_size */
+
+/* Removes a run which has only been partly written from the index. */
+static int tsb_index_repair (int fd) /* {{{ */
+{
+  struct stat statbuf;
+  void *map;
+  off_t valid;
+
+  if (fstat (fd, &statbuf) != 0)
+    return (errno);
+  if (statbuf.st_size == 0)
+    return (0);
+
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return (errno);
+  valid = tsb_index_valid_size (map, (size_t) statbuf.st_size);
+  munmap (map, (size_t) statbuf.st_size);
+
+  if (valid == statbuf.st_size)
+    return (0);
+
+  WARNING ("utils_tsblock: Removing %"PRIi64" bytes of an incomplete index "
+      "run.", (int64_t) (statbuf.st_size - valid));
+  if (ftruncate (fd, valid) != 0)
+    return (errno);
+  return (0);
+} /* }}} int tsb_index_repair */
+
+static int tsb_write_all (int fd, void const *data, size_t size) /* {{{ */
+{
+  char const *ptr = data;
+
+  while (size > 0)
+  {
+    ssize_t status = write (fd, ptr, size);
+
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (errno);
+    }
+    ptr += status;
+    size -= (size_t) status;
+  }
+
+  return (0);
+} /* }}} int tsb_write_all */
+
+/* Appends the blocks, which all belong to the same partition and are sorted
+ * by series, to the partition's data file and adds an index run. */
+static int tsb_partition_write (tsb_store_t *s, /* {{{ */
+    tsb_block_t **blocks, size_t blocks_num)
+{
+  char path[PATH_MAX];
+  tsb_index_entry_t *entries = NULL;
+  tsb_run_header_t *hdr;
+  char *buffer = NULL;
+  size_t buffer_len = 0;
+  int data_fd = -1;
+  int index_fd = -1;
+  off_t offset;
+  size_t i;
+  int status;
+
+  status = tsb_partition_path (s, blocks[0]->partition_ms, TSB_DATA_FILE,
+      path, sizeof (path));
+  if (status != 0)
+    return (status);
+  if (check_create_dir (path) != 0)
+    return (EIO);
+
+  data_fd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (data_fd < 0)
+    return (errno);
+
+  buffer = malloc (TSB_WRITE_BUFFER_SIZE);
+  hdr = malloc (sizeof (*hdr) + blocks_num * sizeof (*entries));
+  if ((buffer == NULL) || (hdr == NULL))
+  {
+    status = ENOMEM;
+    goto out;
+  }
+  entries = (tsb_index_entry_t *) (hdr + 1);
+
+  /* A previous flush may have failed after writing part of its blocks. */
+  offset = lseek (data_fd, 0, SEEK_END);
+  if (offset < 0)
+  {
+    status = errno;
+    goto out;
+  }
+
+  for (i = 0; i < blocks_num; i++)
+  {
+    tsb_block_t *b = blocks[i];
+
+    entries[i].series = b->series;
+    entries[i].points = b->points;
+    entries[i].columns = b->columns;
+    entries[i].size = (uint32_t) b->size;
+    entries[i].duration = (uint32_t) (b->last_ms - b->first_ms);
+    entries[i].offset = (uint64_t) offset;
+    entries[i].first_ms = b->first_ms;
+    offset += (off_t) b->size;
+
+    if (buffer_len + b->size > TSB_WRITE_BUFFER_SIZE)
+    {
+      status = tsb_write_all (data_fd, buffer, buffer_len);
+      if (status != 0)
+        goto out;
+      buffer_len = 0;
+    }
+
+    if (b->size > TSB_WRITE_BUFFER_SIZE)
+      status = tsb_write_all (data_fd, b->data, b->size);
+    else
+    {
+      memcpy (buffer + buffer_len, b->data, b->size);
+      buffer_len += b->size;
+    }
+    if (status != 0)
+      goto out;
+  }
+
+  status = tsb_write_all (data_fd, buffer, buffer_len);
+  if (status != 0)
+    goto out;
+
+  /* The index must not point to data which is not on disk. */
+  if (fdatasync (data_fd) != 0)
+  {
+    status = errno;
+    goto out;
+  }
+
+  tsb_partition_path (s, blocks[0]->partition_ms, TSB_INDEX_FILE,
+      path, sizeof (path));
+  index_fd = open (path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (index_fd < 0)
+  {
+    status = errno;
+    goto out;
+  }
+
+  status = tsb_index_repair (index_fd);
+  if (status != 0)
+    goto out;
+
+  hdr->magic = TSB_RUN_MAGIC;
+  hdr->count = (uint32_t) blocks_num;
+  status = tsb_write_all (index_fd, hdr,
+      sizeof (*hdr) + blocks_num * sizeof (*entries));
+
+out:
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_tsblock: Writing %zu blocks to %s failed: %s", blocks_num,
+        path, sstrerror (status, errbuf, sizeof (errbuf)));
+  }
+  if (index_fd >= 0)
+    close (index_fd);
+  close (data_fd);
+  sfree (hdr);
+  sfree (buffer);
+  return (status);
+} /* }}} int tsb_partition_write */
+
+static int tsb_block_compare (void const *a, void const *b) /* {{{ */
+{
+  tsb_block_t const *x = *((tsb_block_t * const *) a);
+  tsb_block_t const *y = *((tsb_block_t * const *) b);
+
+  if (x->partition_ms != y->partition_ms)
+    return ((x->partition_ms < y->partition_ms) ? -1 : 1);
+  if (x->series != y->series)
+    return ((x->series < y->series) ? -1 : 1);
+  if (x->first_ms != y->first_ms)
+    return ((x->first_ms < y->first_ms) ? -1 : 1);
+  return (0);
+} /* }}} int tsb_block_compare */
+
+/* Restores the time of the last point of each series from the newest
+ * partition, so points written before a restart are not written again. */
+static void tsb_restore_last (tsb_store_t *s) /* {{{ */
+{
+  DIR *dh;
+  struct dirent *de;
+  int64_t newest = -1;
+  char path[PATH_MAX];
+  tsb_series_t **by_id;
+  c_avl_iterator_t *iter;
+  tsb_series_t *series;
+  char *name;
+  struct stat statbuf;
+  uint8_t *map;
+  size_t pos = 0;
+  int fd;
+
+  dh = opendir (s->directory);
+  if (dh == NULL)
+    return;
+  while ((de = readdir (dh)) != NULL)
+  {
+    char *endptr;
+    long long tmp;
+
+    errno = 0;
+    tmp = strtoll (de->d_name, &endptr, 10);
+    if ((errno == 0) && (endptr != de->d_name) && (*endptr == 0)
+        && (tmp > newest))
+      newest = (int64_t) tmp;
+  }
+  closedir (dh);
+  if (newest < 0)
+    return;
+
+  by_id = calloc (s->next_id, sizeof (*by_id));
+  if (by_id == NULL)
+    return;
+  iter = c_avl_get_iterator (s->series);
+  while (c_avl_iterator_next (iter, (void *) &name, (void *) &series) == 0)
+    by_id[series->id] = series;
+  c_avl_iterator_destroy (iter);
+
+  tsb_partition_path (s, 1000 * newest, TSB_INDEX_FILE, path, sizeof (path));
+  fd = open (path, O_RDONLY);
+  if ((fd < 0) || (fstat (fd, &statbuf) != 0) || (statbuf.st_size == 0))
+  {
+    if (fd >= 0)
+      close (fd);
+    sfree (by_id);
+    return;
+  }
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    sfree (by_id);
+    return;
+  }
+
+  while (pos < (size_t) tsb_index_valid_size (map, (size_t) statbuf.st_size))
+  {
+    tsb_run_header_t hdr;
+    uint32_t i;
+
+    memcpy (&hdr, map + pos, sizeof (hdr));
+    pos += sizeof (hdr);
+    for (i = 0; i < hdr.count; i++)
+    {
+      tsb_index_entry_t e;
+
+      memcpy (&e, map + pos, sizeof (e));
+      pos += sizeof (e);
+      if ((e.series < s->next_id) && (by_id[e.series] != NULL)
+          && (by_id[e.series]->last_ms < e.first_ms + e.duration))
+        by_id[e.series]->last_ms = e.first_ms + e.duration;
+    }
+  }
+
+  munmap (map, (size_t) statbuf.st_size);
+  sfree (by_id);
+} /* }}} void tsb_restore_last */
+
+/*
+ * Public functions
+ */
+tsb_store_t *tsb_open (char const *directory, /* {{{ */
+    cdtime_t partition_length)
+{
+  tsb_store_t *s;
+  char path[PATH_MAX];
+  int fd;
+
+  if ((directory == NULL) || (partition_length < TIME_T_TO_CDTIME_T (1))
+      || (partition_length > TSB_PARTITION_LENGTH_MAX))
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  ssnprintf (path, sizeof (path), "%s/" TSB_SERIES_FILE, directory);
+  if (check_create_dir (path) != 0)
+  {
+    errno = EIO;
+    return (NULL);
+  }
+
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
+    return (NULL);
+  pthread_mutex_init (&s->lock, /* attr = */ NULL);
+  pthread_mutex_init (&s->flush_lock, /* attr = */ NULL);
+  s->partition_ms = (int64_t) CDTIME_T_TO_MS (partition_length);
+
+  s->directory = strdup (directory);
+  s->series = c_avl_create (tsb_series_compare);
+  if ((s->directory == NULL) || (s->series == NULL))
+  {
+    tsb_close (s);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  fd = open (path, O_RDWR | O_CREAT, 0644);
+  if (fd >= 0)
+    s->series_fh = fdopen (fd, "r+");
+  if (s->series_fh == NULL)
+  {
+    int status = errno;
+    char errbuf[1024];
+    ERROR ("utils_tsblock: Opening %s failed: %s", path,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    if (fd >= 0)
+      close (fd);
+    tsb_close (s);
+    errno = status;
+    return (NULL);
+  }
+
+  if (tsb_series_load (s) != 0)
+  {
+    tsb_close (s);
+    errno = EIO;
+    return (NULL);
+  }
+  tsb_restore_last (s);
+
+  return (s);
+} /* }}} tsb_store_t *tsb_open */
+
+void tsb_close (tsb_store_t *s) /* {{{ */
+{
+  char *name;
+  tsb_series_t *series;
+  size_t i;
+
+  if (s == NULL)
+    return;
+
+  if (s->series_fh != NULL)
+  {
+    tsb_flush (s);
+    fclose (s->series_fh);
+  }
+
+  for (i = 0; i < s->active_num; i++)
+    tsb_block_destroy (s->active[i]->block);
+  sfree (s->active);
+  tsb_block_destroy (s->detached);
+
+  if (s->series != NULL)
+  {
+    while (c_avl_pick (s->series, (void *) &name, (void *) &series) == 0)
+      sfree (series);
+    c_avl_destroy (s->series);
+  }
+
+  pthread_mutex_destroy (&s->lock);
+  pthread_mutex_destroy (&s->flush_lock);
+  sfree (s->directory);
+  sfree (s);
+} /* }}} void tsb_close */
+
+int tsb_append (tsb_store_t *s, char const *identifier, /* {{{ */
+    int const *types, value_t const *values, size_t values_num,
+    cdtime_t time)
+{
+  tsb_series_t *series = NULL;
+  tsb_block_t *b;
+  int64_t ms = (int64_t) CDTIME_T_TO_MS (time);
+  int64_t partition_ms = ms - (ms % s->partition_ms);
+  int status;
+
+  pthread_mutex_lock (&s->lock);
+
+  if (c_avl_get (s->series, identifier, (void *) &series) != 0)
+  {
+    series = tsb_series_create (s, identifier, types, values_num);
+    if (series == NULL)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return (EINVAL);
+    }
+  }
+
+  if ((series->columns != values_num)
+      || (memcmp (series->types, types, values_num * sizeof (*types)) != 0))
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (EINVAL);
+  }
+  if (ms <= series->last_ms)
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (EEXIST);
+  }
+
+  b = series->block;
+  if ((b != NULL) && ((b->partition_ms != partition_ms)
+        || (b->points >= TSB_BLOCK_POINTS_MAX)))
+  {
+    b->next = s->detached;
+    s->detached = b;
+    series->block = b = NULL;
+  }
+
+  if (b == NULL)
+  {
+    if (!series->active && (s->active_num >= s->active_alloc))
+    {
+      size_t alloc = (s->active_alloc == 0) ? 1024 : 2 * s->active_alloc;
+      tsb_series_t **tmp;
+
+      tmp = realloc (s->active, alloc * sizeof (*tmp));
+      if (tmp == NULL)
+      {
+        pthread_mutex_unlock (&s->lock);
+        return (ENOMEM);
+      }
+      s->active = tmp;
+      s->active_alloc = alloc;
+    }
+
+    b = tsb_block_create (series->id, series->columns, partition_ms);
+    if (b == NULL)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return (ENOMEM);
+    }
+    series->block = b;
+
+    if (!series->active)
+    {
+      s->active[s->active_num++] = series;
+      series->active = 1;
+    }
+  }
+
+  status = tsb_block_append (b, ms, series->types, values);
+  if (status == 0)
+    series->last_ms = ms;
+
+  pthread_mutex_unlock (&s->lock);
+  return (status);
+} /* }}} int tsb_append */
+
+int tsb_flush (tsb_store_t *s) /* {{{ */
+{
+  tsb_block_t *list;
+  tsb_block_t *b;
+  tsb_block_t **blocks;
+  size_t blocks_num = 0;
+  size_t i;
+  size_t first;
+  int status = 0;
+
+  pthread_mutex_lock (&s->flush_lock);
+
+  /* Detach all blocks; the series file is written before the blocks
+   * referring to new series. */
+  pthread_mutex_lock (&s->lock);
+  list = s->detached;
+  s->detached = NULL;
+  for (i = 0; i < s->active_num; i++)
+  {
+    tsb_series_t *series = s->active[i];
+
+    if (series->block != NULL)
+    {
+      series->block->next = list;
+      list = series->block;
+      series->block = NULL;
+    }
+    series->active = 0;
+  }
+  s->active_num = 0;
+
+  if ((fflush (s->series_fh) != 0)
+      || (fdatasync (fileno (s->series_fh)) != 0))
+    status = errno;
+  pthread_mutex_unlock (&s->lock);
+
+  for (b = list; b != NULL; b = b->next)
+    blocks_num++;
+  if ((status != 0) || (blocks_num == 0))
+  {
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("utils_tsblock: Writing %s/" TSB_SERIES_FILE " failed: %s",
+          s->directory, sstrerror (status, errbuf, sizeof (errbuf)));
+    }
+    tsb_block_destroy (list);
+    pthread_mutex_unlock (&s->flush_lock);
+    return (status);
+  }
+
+  blocks = malloc (blocks_num * sizeof (*blocks));
+  if (blocks == NULL)
+  {
+    tsb_block_destroy (list);
+    pthread_mutex_unlock (&s->flush_lock);
+    return (ENOMEM);
+  }
+  i = 0;
+  for (b = list; b != NULL; b = b->next)
+    blocks[i++] = b;
+  qsort (blocks, blocks_num, sizeof (*blocks), tsb_block_compare);
+
+  first = 0;
+  for (i = 1; i <= blocks_num; i++)
+  {
+    int tmp;
+
+    if ((i < blocks_num)
+        && (blocks[i]->partition_ms == blocks[first]->partition_ms))
+      continue;
+
+    tmp = tsb_partition_write (s, blocks + first, i - first);
+    if (tmp != 0)
+      status = tmp;
+    first = i;
+  }
+
+  sfree (blocks);
+  tsb_block_destroy (list);
+  pthread_mutex_unlock (&s->flush_lock);
+  return (status);
+} /* }}} int tsb_flush */
+
+static int tsb_compare_int64 (void const *a, void const *b) /* {{{ */
+{
+  int64_t x = *((int64_t const *) a);
+  int64_t y = *((int64_t const *) b);
+
+  return ((x < y) ? -1 : (x > y) ? 1 : 0);
+} /* }}} int tsb_compare_int64 */
+
+/* Returns the start times of the partitions overlapping [start, end], in
+ * milliseconds and in chronological order. */
+static int tsb_partitions_list (tsb_store_t *s, /* {{{ */
+    int64_t start, int64_t end, int64_t **ret, size_t *ret_num)
+{
+  DIR *dh;
+  struct dirent *de;
+  int64_t *list = NULL;
+  size_t list_num = 0;
+  size_t list_alloc = 0;
+
+  dh = opendir (s->directory);
+  if (dh == NULL)
+    return (errno);
+
+  while ((de = readdir (dh)) != NULL)
+  {
+    char *endptr;
+    long long tmp;
+    int64_t partition_ms;
+
+    errno = 0;
+    tmp = strtoll (de->d_name, &endptr, 10);
+    if ((errno != 0) || (endptr == de->d_name) || (*endptr != 0)
+        || (tmp < 0))
+      continue;
+
+    partition_ms = 1000 * (int64_t) tmp;
+    if ((partition_ms > end) || (partition_ms + s->partition_ms <= start))
+      continue;
+
+    if (list_num >= list_alloc)
+    {
+      size_t alloc = (list_alloc == 0) ? 16 : 2 * list_alloc;
+      int64_t *ptr = realloc (list, alloc * sizeof (*list));
+
+      if (ptr == NULL)
+      {
+        closedir (dh);
+        sfree (list);
+        return (ENOMEM);
+      }
+      list = ptr;
+      list_alloc = alloc;
+    }
+    list[list_num++] = partition_ms;
+  }
+  closedir (dh);
+
+  qsort (list, list_num, sizeof (*list), tsb_compare_int64);
+  *ret = list;
+  *ret_num = list_num;
+  return (0);
+} /* }}} int tsb_partitions_list */
+
+static void *tsb_map_file (char const *path, size_t *ret_size) /* {{{ */
+{
+  struct stat statbuf;
+  void *map;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return (NULL);
+  if ((fstat (fd, &statbuf) != 0) || (statbuf.st_size == 0))
+  {
+    close (fd);
+    return (NULL);
+  }
+
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return (NULL);
+
+  *ret_size = (size_t) statbuf.st_size;
+  return (map);
+} /* }}} void *tsb_map_file */
+
+/* Queries one partition. Returns the number of points or -1 on error. */
+static int tsb_partition_query (tsb_store_t *s, int64_t partition_ms, /* {{{ */
+    uint32_t id, uint16_t columns_num, int const *types,
+    int64_t start, int64_t end, value_t *values, tsb_column_t *columns,
+    tsb_query_cb callback, void *user_data)
+{
+  char path[PATH_MAX];
+  uint8_t *index;
+  size_t index_size = 0;
+  uint8_t *data;
+  size_t data_size = 0;
+  size_t valid;
+  size_t pos = 0;
+  int num = 0;
+
+  tsb_partition_path (s, partition_ms, TSB_INDEX_FILE, path, sizeof (path));
+  index = tsb_map_file (path, &index_size);
+  if (index == NULL)
+    return (0);
+  tsb_partition_path (s, partition_ms, TSB_DATA_FILE, path, sizeof (path));
+  data = tsb_map_file (path, &data_size);
+  if (data == NULL)
+  {
+    munmap (index, index_size);
+    return (0);
+  }
+
+  valid = (size_t) tsb_index_valid_size (index, index_size);
+  while ((num >= 0) && (pos < valid))
+  {
+    tsb_run_header_t hdr;
+    tsb_index_entry_t const *entries;
+    size_t lo, hi;
+
+    memcpy (&hdr, index + pos, sizeof (hdr));
+    entries = (tsb_index_entry_t const *) (index + pos + sizeof (hdr));
+    pos += sizeof (hdr) + hdr.count * sizeof (*entries);
+
+    /* first entry of the series */
+    lo = 0;
+    hi = hdr.count;
+    while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (entries[mid].series < id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    for (; (lo < hdr.count) && (entries[lo].series == id); lo++)
+    {
+      tsb_index_entry_t const *e = entries + lo;
+      int status;
+
+      if ((e->first_ms > end) || (e->first_ms + e->duration < start))
+        continue;
+      if ((e->offset > data_size) || (e->size > data_size - e->offset)
+          || (e->columns != columns_num))
+      {
+        WARNING ("utils_tsblock: Ignoring invalid index entry in "
+            "partition %"PRIi64".", partition_ms / 1000);
+        continue;
+      }
+
+      status = tsb_block_decode (e, data + e->offset, start, end,
+          types, values, columns, callback, user_data);
+      if (status < 0)
+      {
+        num = -1;
+        break;
+      }
+      num += status;
+    }
+  }
+
+  munmap (data, data_size);
+  munmap (index, index_size);
+  return (num);
+} /* }}} int tsb_partition_query */
+
+int tsb_query (tsb_store_t *s, char const *identifier, /* {{{ */
+    cdtime_t start, cdtime_t end, tsb_query_cb callback, void *user_data)
+{
+  tsb_series_t *series = NULL;
+  uint32_t id;
+  uint16_t columns_num;
+  int const *types;
+  value_t *values;
+  tsb_column_t *columns;
+  int64_t start_ms = (int64_t) CDTIME_T_TO_MS (start);
+  int64_t end_ms = (int64_t) CDTIME_T_TO_MS (end);
+  int64_t *partitions = NULL;
+  size_t partitions_num = 0;
+  size_t i;
+  int num = 0;
+  int status;
+
+  pthread_mutex_lock (&s->lock);
+  if (c_avl_get (s->series, identifier, (void *) &series) != 0)
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (-ENOENT);
+  }
+  id = series->id;
+  columns_num = series->columns;
+  types = series->types;
+  pthread_mutex_unlock (&s->lock);
+
+  status = tsb_partitions_list (s, start_ms, end_ms,
+      &partitions, &partitions_num);
+  if (status != 0)
+    return (-status);
+
+  values = calloc (columns_num, sizeof (*values));
+  columns = calloc (columns_num, sizeof (*columns));
+  if ((values == NULL) || (columns == NULL))
+  {
+    sfree (values);
+    sfree (columns);
+    sfree (partitions);
+    return (-ENOMEM);
+  }
+
+  for (i = 0; i < partitions_num; i++)
+  {
+    status = tsb_partition_query (s, partitions[i], id, columns_num, types,
+        start_ms, end_ms, values, columns, callback, user_data);
+    if (status < 0)
+    {
+      num = -EIO;
+      break;
+    }
+    num += status;
+  }
+
+  sfree (values);
+  sfree (columns);
+  sfree (partitions);
+  return (num);
+} /* }}} int tsb_query */
+
+size_t tsb_series_num (tsb_store_t *s) /* {{{ */
+{
+  size_t num;
+
+  pthread_mutex_lock (&s->lock);
+  num = (size_t) c_avl_size (s->series);
+  pthread_mutex_unlock (&s->lock);
+
+  return (num);
+} /* }}} size_t tsb_series_num */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
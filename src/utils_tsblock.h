@@ -0,0 +1,95 @@
+/**
+ * collectd - src/utils_tsblock.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_TSBLOCK_H
+#define UTILS_TSBLOCK_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_time.h"
+
+/*
+ * Time series storage in append-only block files.
+ *
+ * Every identifier ("series") gets a number, which is stored together with
+ * the identifier and the data source types of its values in the file
+ * "series" in the storage directory. Points are accumulated in memory, in
+ * one block per series: timestamps, in milliseconds, are encoded as the
+ * difference of consecutive differences and gauges as the XOR with the
+ * previous value of the same column, with only the significant bits stored
+ * ("Gorilla" encoding). Counters, derives and absolutes are kept as 64-bit
+ * integers and encoded like timestamps, so they are stored exactly. Time is divided into partitions of "partition_length"; each
+ * has its own directory named after its start time in seconds.
+ *
+ * tsb_flush() detaches all blocks and appends them to the file "data" of
+ * their partition in one sequential write, followed by a run of index
+ * entries, sorted by series number, appended to the file "index". Queries
+ * map the index into memory and look up the series in each run using a
+ * binary search, so reading one series does not depend on the number of
+ * series stored. Data which has only been partly written when the daemon
+ * was killed is ignored.
+ *
+ * Points which are not newer than the last point of their series are
+ * dropped. All functions are thread-safe.
+ */
+struct tsb_store_s;
+typedef struct tsb_store_s tsb_store_t;
+
+#define TSB_PARTITION_LENGTH_DEFAULT TIME_T_TO_CDTIME_T (7200)
+
+/* Opens the store in "directory", creating the directory if required.
+ * Returns NULL and sets errno on failure. */
+tsb_store_t *tsb_open (char const *directory, cdtime_t partition_length);
+
+/* Flushes all points and closes the store. */
+void tsb_close (tsb_store_t *s);
+
+/* Appends a point to the series "identifier", which is created if
+ * required. "types" holds the DS_TYPE_* of each value. Returns zero on
+ * success, EEXIST if the point is not newer than the last point of the
+ * series and EINVAL if "values_num" or "types" differ from those the series
+ * was created with. */
+int tsb_append (tsb_store_t *s, char const *identifier,
+    int const *types, value_t const *values, size_t values_num,
+    cdtime_t time);
+
+/* Writes all points accumulated in memory to disk. Returns zero on success.
+ * Data of concurrent tsb_append() calls is written by the next call. */
+int tsb_flush (tsb_store_t *s);
+
+/* Called by tsb_query() for each point, in chronological order. If it
+ * returns non-zero, the query stops. */
+typedef int (*tsb_query_cb) (cdtime_t time, int const *types,
+    value_t const *values, size_t values_num, void *user_data);
+
+/* Passes all points of "identifier" with start <= time <= end, which have
+ * been written by tsb_flush(), to "callback". Returns the number of points,
+ * -ENOENT if the series does not exist or another negative errno value on
+ * failure. */
+int tsb_query (tsb_store_t *s, char const *identifier,
+    cdtime_t start, cdtime_t end, tsb_query_cb callback, void *user_data);
+
+/* Returns the number of series in the store. */
+size_t tsb_series_num (tsb_store_t *s);
+
+#endif /* UTILS_TSBLOCK_H */
+
+/* vim: set sw=2 sts=2 et : */
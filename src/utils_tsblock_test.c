@@ -0,0 +1,443 @@
+/**
+ * collectd - src/utils_tsblock_test.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Checks that points survive encoding, flushing and reopening the store,
+ * across partitions and with irregular timestamps and special values, that
+ * counters and derives beyond 2^53 are stored exactly and that incomplete
+ * index runs are ignored. If a directory is given, the tests run there and
+ * then ingest, flush and query performance is measured with "series" series
+ * of two values (default: one million), and, for comparison, appending the
+ * same values to one CSV file per series, as the csv plugin does; otherwise
+ * a temporary directory is used.
+ * Usage: utils_tsblock_test [directory [series]]
+ */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+#include "utils_tsblock.h"
+
+#include <math.h>
+
+#define TEST_SERIES 50
+#define TEST_POINTS 5000
+#define BENCH_POINTS 10
+#define BENCH_QUERIES 10000
+#define BENCH_CSV_UPDATES 20000
+
+static int const test_types[] =
+{
+  DS_TYPE_GAUGE, DS_TYPE_COUNTER, DS_TYPE_GAUGE, DS_TYPE_DERIVE
+};
+#define TEST_COLUMNS STATIC_ARRAY_SIZE (test_types)
+
+/* Stubs for the functions of the daemon used by the code under test. */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+
+  printf ("[severity %i] ", level);
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+  printf ("\n");
+} /* }}} void plugin_log */
+
+char *sstrerror (int errnum, char *buf, size_t buflen) /* {{{ */
+{
+  snprintf (buf, buflen, "%s", strerror (errnum));
+  return (buf);
+} /* }}} char *sstrerror */
+
+int ssnprintf (char *dest, size_t n, const char *format, ...) /* {{{ */
+{
+  va_list ap;
+  int status;
+
+  va_start (ap, format);
+  status = vsnprintf (dest, n, format, ap);
+  va_end (ap);
+
+  if (n > 0)
+    dest[n - 1] = 0;
+  return (status);
+} /* }}} int ssnprintf */
+
+/* Like the real function, creates the directories containing "file". */
+int check_create_dir (const char *file) /* {{{ */
+{
+  char dir[PATH_MAX];
+  char *slash;
+
+  ssnprintf (dir, sizeof (dir), "%s", file);
+  for (slash = strchr (dir + 1, '/'); slash != NULL;
+      slash = strchr (slash + 1, '/'))
+  {
+    *slash = 0;
+    if ((mkdir (dir, 0755) != 0) && (errno != EEXIST))
+      return (-1);
+    *slash = '/';
+  }
+  return (0);
+} /* }}} int check_create_dir */
+
+static void remove_store (char const *dir) /* {{{ */
+{
+  char cmd[PATH_MAX + 16];
+
+  ssnprintf (cmd, sizeof (cmd), "rm -rf '%s'", dir);
+  if (system (cmd) != 0)
+    fprintf (stderr, "Removing %s failed.\n", dir);
+} /* }}} void remove_store */
+
+/* Point "i" of series "series": the time is spaced irregularly, crossing
+ * partitions of ten minutes, and the values contain repetitions, random
+ * noise, NaN and infinity, a counter wrapping around 2^64 and a derive
+ * jumping between large negative and positive values. */
+static cdtime_t test_time (int series, int i) /* {{{ */
+{
+  return (TIME_T_TO_CDTIME_T (1380000000) + MS_TO_CDTIME_T (
+        (int64_t) i * 10000 + ((i * 7919 + series) % 5 == 0 ? 0 : 3)
+        + (int64_t) 86400000 * ((i + 1) / 1000)));
+} /* }}} cdtime_t test_time */
+
+static void test_values (int series, int i, value_t *values) /* {{{ */
+{
+  values[0].gauge = (double) (i / 10) + 0.25 * series;
+  values[1].counter = (counter_t) (UINT64_MAX - UINT64_C (2000000000)
+      + (uint64_t) i * 1000003 + (uint64_t) series);
+  values[2].gauge = (i % 97 == 0) ? NAN
+    : (i % 89 == 0) ? -INFINITY
+    : sin (i * 0.1) * (1 + (series % 7)) + (double) (rand () % 3);
+  values[3].derive = (i % 50 == 0) ? INT64_MIN
+    : (i % 3 == 0) ? ((derive_t) 1 << 60) + i
+    : (derive_t) (((uint64_t) rand () << 32) | (uint64_t) rand ());
+} /* }}} void test_values */
+
+struct check_state_s
+{
+  int series;
+  int next;
+  int errors;
+  /* values of the points as stored */
+  value_t (*expected)[TEST_COLUMNS];
+};
+typedef struct check_state_s check_state_t;
+
+static int check_point (cdtime_t time, int const *types, /* {{{ */
+    value_t const *values, size_t values_num, void *user_data)
+{
+  check_state_t *cs = user_data;
+  value_t const *expected = cs->expected[cs->next];
+  size_t i;
+
+  if (CDTIME_T_TO_MS (time) != CDTIME_T_TO_MS (test_time (cs->series, cs->next)))
+  {
+    if (cs->errors++ == 0)
+      printf ("series %i, point %i: time %.3f, expected %.3f\n", cs->series,
+          cs->next, CDTIME_T_TO_DOUBLE (time),
+          CDTIME_T_TO_DOUBLE (test_time (cs->series, cs->next)));
+  }
+  for (i = 0; i < values_num; i++)
+  {
+    if (types[i] != test_types[i])
+    {
+      if (cs->errors++ == 0)
+        printf ("series %i, point %i, value %zu: type %i, expected %i\n",
+            cs->series, cs->next, i, types[i], test_types[i]);
+    }
+    else if (types[i] == DS_TYPE_GAUGE)
+    {
+      if ((memcmp (&values[i].gauge, &expected[i].gauge,
+              sizeof (values[i].gauge)) != 0) && (cs->errors++ == 0))
+        printf ("series %i, point %i, value %zu: %g, expected %g\n",
+            cs->series, cs->next, i, values[i].gauge, expected[i].gauge);
+    }
+    else if ((values[i].derive != expected[i].derive)
+        && (cs->errors++ == 0))
+      printf ("series %i, point %i, value %zu: %"PRIi64", expected %"PRIi64
+          "\n", cs->series, cs->next, i, values[i].derive,
+          expected[i].derive);
+  }
+
+  cs->next++;
+  return (0);
+} /* }}} int check_point */
+
+static int check_all (tsb_store_t *s, /* {{{ */
+    value_t (*expected)[TEST_POINTS][TEST_COLUMNS], int points)
+{
+  int errors = 0;
+  int j;
+
+  for (j = 0; j < TEST_SERIES; j++)
+  {
+    check_state_t cs = { j, 0, 0, expected[j] };
+    char name[64];
+    int status;
+
+    ssnprintf (name, sizeof (name), "host/test-%i/gauge", j);
+    status = tsb_query (s, name, 0, TIME_T_TO_CDTIME_T (4000000000LL),
+        check_point, &cs);
+    if (status != points)
+    {
+      printf ("%s: got %i points, expected %i\n", name, status, points);
+      cs.errors++;
+    }
+    errors += cs.errors;
+  }
+
+  return (errors);
+} /* }}} int check_all */
+
+static int test_roundtrip (char const *dir) /* {{{ */
+{
+  static value_t expected[TEST_SERIES][TEST_POINTS][TEST_COLUMNS];
+  int other_types[TEST_COLUMNS];
+  tsb_store_t *s;
+  check_state_t cs;
+  char path[PATH_MAX];
+  char name[64];
+  int errors = 0;
+  int fd;
+  int i, j;
+
+  remove_store (dir);
+  s = tsb_open (dir, TIME_T_TO_CDTIME_T (600));
+  assert (s != NULL);
+
+  /* The first half is flushed several times, the second half written by
+   * tsb_close(). */
+  for (i = 0; i < TEST_POINTS; i++)
+  {
+    for (j = 0; j < TEST_SERIES; j++)
+    {
+      ssnprintf (name, sizeof (name), "host/test-%i/gauge", j);
+      test_values (j, i, expected[j][i]);
+      assert (tsb_append (s, name, test_types, expected[j][i], TEST_COLUMNS,
+            test_time (j, i)) == 0);
+    }
+    if ((i < TEST_POINTS / 2) && (i % 300 == 299))
+      assert (tsb_flush (s) == 0);
+  }
+
+  ssnprintf (name, sizeof (name), "host/test-%i/gauge", 0);
+  memcpy (other_types, test_types, sizeof (other_types));
+  other_types[1] = DS_TYPE_GAUGE;
+  if ((tsb_append (s, name, test_types, expected[0][0], TEST_COLUMNS,
+          test_time (0, 1)) != EEXIST)
+      || (tsb_append (s, name, test_types, expected[0][0], 2,
+          test_time (0, TEST_POINTS)) != EINVAL)
+      || (tsb_append (s, name, other_types, expected[0][0], TEST_COLUMNS,
+          test_time (0, TEST_POINTS)) != EINVAL))
+  {
+    printf ("Invalid points have not been rejected.\n");
+    errors++;
+  }
+
+  assert (tsb_flush (s) == 0);
+  errors += check_all (s, expected, TEST_POINTS);
+
+  /* a range in the middle */
+  memset (&cs, 0, sizeof (cs));
+  cs.next = 1000;
+  cs.expected = expected[0];
+  if ((tsb_query (s, name, test_time (0, 1000), test_time (0, 1999),
+          check_point, &cs) != 1000) || (cs.errors != 0))
+  {
+    printf ("Range query failed.\n");
+    errors++;
+  }
+  tsb_close (s);
+
+  /* Reopen and simulate a crash while writing an index run. */
+  s = tsb_open (dir, TIME_T_TO_CDTIME_T (600));
+  assert (s != NULL);
+  if (tsb_append (s, name, test_types, expected[0][0], TEST_COLUMNS,
+        test_time (0, 10)) != EEXIST)
+  {
+    printf ("The last point has not been restored.\n");
+    errors++;
+  }
+  errors += check_all (s, expected, TEST_POINTS);
+
+  ssnprintf (path, sizeof (path), "%s/%"PRIi64"/index", dir,
+      (int64_t) CDTIME_T_TO_TIME_T (test_time (0, TEST_POINTS - 1))
+      / 600 * 600);
+  fd = open (path, O_WRONLY | O_APPEND);
+  assert (fd >= 0);
+  assert (write (fd, "TSB1\xff\xff\0\0garbage", 15) == 15);
+  close (fd);
+  errors += check_all (s, expected, TEST_POINTS);
+  tsb_close (s);
+
+  printf ("roundtrip: %s\n", (errors == 0) ? "ok" : "FAILED");
+  return (errors);
+} /* }}} int test_roundtrip */
+
+static int count_point (cdtime_t __attribute__((unused)) time, /* {{{ */
+    int const __attribute__((unused)) *types,
+    value_t const __attribute__((unused)) *values,
+    size_t __attribute__((unused)) values_num, void *user_data)
+{
+  (*((uint64_t *) user_data))++;
+  return (0);
+} /* }}} int count_point */
+
+static uint64_t directory_size (char const *dir) /* {{{ */
+{
+  char cmd[PATH_MAX + 32];
+  unsigned long long size = 0;
+  FILE *fh;
+
+  ssnprintf (cmd, sizeof (cmd), "du -sk '%s'", dir);
+  fh = popen (cmd, "r");
+  if (fh == NULL)
+    return (0);
+  if (fscanf (fh, "%llu", &size) != 1)
+    size = 0;
+  pclose (fh);
+  return (1024 * (uint64_t) size);
+} /* }}} uint64_t directory_size */
+
+static void benchmark (char const *dir, int series_num) /* {{{ */
+{
+  tsb_store_t *s;
+  static int const types[] = { DS_TYPE_DERIVE, DS_TYPE_DERIVE };
+  char name[128];
+  value_t values[2];
+  cdtime_t start;
+  cdtime_t t0 = TIME_T_TO_CDTIME_T (1380000000);
+  double duration;
+  uint64_t points = 0;
+  uint64_t bytes;
+  int i, j;
+
+  remove_store (dir);
+  s = tsb_open (dir, TSB_PARTITION_LENGTH_DEFAULT);
+  assert (s != NULL);
+
+  start = cdtime ();
+  for (i = 0; i < BENCH_POINTS; i++)
+  {
+    for (j = 0; j < series_num; j++)
+    {
+      cdtime_t t = t0 + TIME_T_TO_CDTIME_T (10 * i)
+        + MS_TO_CDTIME_T (j % 1000);
+
+      ssnprintf (name, sizeof (name), "host%i/interface-eth%i/if_octets",
+          j / 100, j % 100);
+      values[0].derive = (derive_t) (1000 * i * (j % 13));
+      values[1].derive = (derive_t) (i * 1500 + rand () % 100);
+      assert (tsb_append (s, name, types, values, 2, t) == 0);
+    }
+  }
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  printf ("ingest: %i series x %i points in %.3f s: %.0f points/s\n",
+      series_num, BENCH_POINTS, duration,
+      series_num * BENCH_POINTS / duration);
+
+  start = cdtime ();
+  tsb_flush (s);
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  sync ();
+  bytes = directory_size (dir);
+  printf ("flush:  %.3f s; %.1f MB on disk, %.1f bytes per point\n",
+      duration, bytes / 1e6,
+      (double) bytes / ((double) series_num * BENCH_POINTS));
+
+  start = cdtime ();
+  for (i = 0; i < BENCH_QUERIES; i++)
+  {
+    j = rand () % series_num;
+    ssnprintf (name, sizeof (name), "host%i/interface-eth%i/if_octets",
+        j / 100, j % 100);
+    tsb_query (s, name, t0, t0 + TIME_T_TO_CDTIME_T (3600),
+        count_point, &points);
+  }
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  printf ("query:  %i queries of random series in %.3f s: %.1f us per "
+      "query, %"PRIu64" points\n", BENCH_QUERIES, duration,
+      1e6 * duration / BENCH_QUERIES, points);
+  tsb_close (s);
+
+  /* For comparison: one open/append/close per update, as the csv plugin
+   * does, spread over all series. */
+  remove_store (dir);
+  start = cdtime ();
+  for (i = 0; i < BENCH_CSV_UPDATES; i++)
+  {
+    char path[PATH_MAX];
+    FILE *fh;
+
+    j = (int) (((int64_t) i * 7919) % series_num);
+    ssnprintf (path, sizeof (path), "%s/host%i/interface-eth%i/if_octets",
+        dir, j / 100, j % 100);
+    if (i < series_num)
+      check_create_dir (path);
+    fh = fopen (path, "a");
+    assert (fh != NULL);
+    fprintf (fh, "%.3f,%f,%f\n", 1380000000.0 + i, (double) i, (double) j);
+    fclose (fh);
+  }
+  duration = CDTIME_T_TO_DOUBLE (cdtime () - start);
+  printf ("csv:    %i updates in %.3f s: %.0f updates/s\n",
+      BENCH_CSV_UPDATES, duration, BENCH_CSV_UPDATES / duration);
+
+  remove_store (dir);
+} /* }}} void benchmark */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  char tmpdir[] = "utils_tsblock_test.XXXXXX";
+  char const *dir;
+  int series_num = 1000000;
+  int errors = 0;
+
+  if (argc > 3)
+  {
+    fprintf (stderr, "Usage: %s [directory [series]]\n", argv[0]);
+    return (EXIT_FAILURE);
+  }
+
+  if (argc >= 2)
+    dir = argv[1];
+  else if ((dir = mkdtemp (tmpdir)) == NULL)
+  {
+    perror ("mkdtemp");
+    return (EXIT_FAILURE);
+  }
+  if (argc == 3)
+    series_num = atoi (argv[2]);
+  else if (argc < 2)
+    series_num = 0;
+
+  errors += test_roundtrip (dir);
+
+  if ((errors == 0) && (series_num > 0))
+    benchmark (dir, series_num);
+
+  remove_store (dir);
+  return ((errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
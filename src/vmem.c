@@ -24,6 +24,8 @@
 #include "plugin.h"
 
 #if KERNEL_LINUX
+# include "utils_procfile.h"
+
 static const char *config_keys[] =
 {
   "Verbose"
@@ -105,41 +107,28 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  procfile_t *pf;
+  procfile_entry_t const *entries;
+  size_t entries_num;
+  size_t i;
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  pf = procfile_get ("/proc/vmstat");
+  if (pf == NULL)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
+    ERROR ("vmem plugin: Reading /proc/vmstat failed: %s",
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  entries_num = procfile_entries (pf, &entries);
+  for (i = 0; i < entries_num; i++)
   {
-    char *fields[4];
-    int fields_num;
-    char *key;
-    char *endptr;
-    derive_t counter;
-    gauge_t gauge;
-
-    fields_num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
-    if (fields_num != 2)
-      continue;
-
-    key = fields[0];
-
-    endptr = NULL;
-    counter = strtoll (fields[1], &endptr, 10);
-    if (fields[1] == endptr)
-      continue;
+    char const *key = entries[i].key;
+    derive_t counter = entries[i].derive;
+    gauge_t gauge = entries[i].gauge;
 
-    endptr = NULL;
-    gauge = strtod (fields[1], &endptr);
-    if (fields[1] == endptr)
+    if (!entries[i].numeric)
       continue;
 
     /* 
@@ -149,7 +138,7 @@ static int vmem_read (void)
      */
     if (strncmp ("nr_", key, strlen ("nr_")) == 0)
     {
-      char *inst = key + strlen ("nr_");
+      char const *inst = key + strlen ("nr_");
       value_t value = { .gauge = gauge };
       submit_one (NULL, "vmpage_number", inst, value);
     }
@@ -204,31 +193,31 @@ static int vmem_read (void)
      */
     else if (strncmp ("pgalloc_", key, strlen ("pgalloc_")) == 0)
     {
-      char *inst = key + strlen ("pgalloc_");
+      char const *inst = key + strlen ("pgalloc_");
       value_t value  = { .derive = counter };
       submit_one (inst, "vmpage_action", "alloc", value);
     }
     else if (strncmp ("pgrefill_", key, strlen ("pgrefill_")) == 0)
     {
-      char *inst = key + strlen ("pgrefill_");
+      char const *inst = key + strlen ("pgrefill_");
       value_t value  = { .derive = counter };
       submit_one (inst, "vmpage_action", "refill", value);
     }
     else if (strncmp ("pgsteal_", key, strlen ("pgsteal_")) == 0)
     {
-      char *inst = key + strlen ("pgsteal_");
+      char const *inst = key + strlen ("pgsteal_");
       value_t value  = { .derive = counter };
       submit_one (inst, "vmpage_action", "steal", value);
     }
     else if (strncmp ("pgscan_kswapd_", key, strlen ("pgscan_kswapd_")) == 0)
     {
-      char *inst = key + strlen ("pgscan_kswapd_");
+      char const *inst = key + strlen ("pgscan_kswapd_");
       value_t value  = { .derive = counter };
       submit_one (inst, "vmpage_action", "scan_kswapd", value);
     }
     else if (strncmp ("pgscan_direct_", key, strlen ("pgscan_direct_")) == 0)
     {
-      char *inst = key + strlen ("pgscan_direct_");
+      char const *inst = key + strlen ("pgscan_direct_");
       value_t value  = { .derive = counter };
       submit_one (inst, "vmpage_action", "scan_direct", value);
     }
@@ -254,10 +243,10 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
+  } /* for (i = 0; i < entries_num; i++) */
 
-  fclose (fh);
-  fh = NULL;
+  procfile_release (pf);
+  pf = NULL;
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
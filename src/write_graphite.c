@@ -51,6 +51,7 @@
 #include "utils_complain.h"
 #include "utils_parse_option.h"
 #include "utils_format_graphite.h"
+#include "utils_spool.h"
 
 /* Folks without pthread will need to disable this plugin. */
 #include <pthread.h>
@@ -83,6 +84,16 @@
 # define WG_SEND_BUF_SIZE 1428
 #endif
 
+#ifndef WG_DEFAULT_SPOOL_SIZE_LIMIT
+# define WG_DEFAULT_SPOOL_SIZE_LIMIT 1024 /* MB */
+#endif
+
+/* Maximum number of bytes replayed from the spool per sent buffer, so that
+ * writing a large backlog does not block the write threads. */
+#ifndef WG_SPOOL_REPLAY_SIZE
+# define WG_SPOOL_REPLAY_SIZE (64 * WG_SEND_BUF_SIZE)
+#endif
+
 /*
  * Private variables
  */
@@ -107,6 +118,12 @@ struct wg_callback
     size_t   send_buf_fill;
     cdtime_t send_buf_init_time;
 
+    char    *spool_dir;
+    int      spool_size_limit;
+    int      spool_replay_rate;
+    spool_t *spool;
+    size_t   spool_replay_budget;
+
     pthread_mutex_t send_lock;
     c_complain_t init_complaint;
 };
@@ -123,11 +140,11 @@ static void wg_reset_buffer (struct wg_callback *cb)
     cb->send_buf_init_time = cdtime ();
 }
 
-static int wg_send_buffer (struct wg_callback *cb)
+static int wg_send_data (struct wg_callback *cb, void const *data, size_t size)
 {
     ssize_t status = 0;
 
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
+    status = swrite (cb->sock_fd, data, size);
     if (status < 0)
     {
         const char *protocol = cb->protocol ? cb->protocol : WG_DEFAULT_PROTOCOL;
@@ -149,6 +166,61 @@ static int wg_send_buffer (struct wg_callback *cb)
     return (0);
 }
 
+static int wg_spool_replay_cb (void const *data, size_t size, void *user_data)
+{
+    struct wg_callback *cb = user_data;
+
+    if (size > cb->spool_replay_budget)
+        return (-1);
+    if (wg_send_data (cb, data, size) != 0)
+        return (-1);
+
+    cb->spool_replay_budget -= size;
+    return (0);
+}
+
+/* Sends data from the spool, if any. Returns zero if the spool has been
+ * emptied. */
+static int wg_spool_replay (struct wg_callback *cb)
+{
+    if ((cb->spool == NULL) || (spool_pending (cb->spool) == 0))
+        return (0);
+    if (cb->sock_fd < 0)
+        return (-1);
+
+    cb->spool_replay_budget = WG_SPOOL_REPLAY_SIZE;
+    spool_replay (cb->spool, wg_spool_replay_cb, cb);
+
+    return ((spool_pending (cb->spool) == 0) ? 0 : -1);
+}
+
+static int wg_send_buffer (struct wg_callback *cb)
+{
+    int status;
+
+    if (cb->spool == NULL)
+        return (wg_send_data (cb, cb->send_buf, cb->send_buf_fill));
+
+    /* Send older data first. If the destination is unreachable or the spool
+     * could not be emptied, append the buffer to the spool so that the order
+     * of the data is retained. */
+    if ((cb->sock_fd >= 0) && (wg_spool_replay (cb) == 0)
+            && (wg_send_data (cb, cb->send_buf, cb->send_buf_fill) == 0))
+        return (0);
+
+    status = spool_append (cb->spool, cb->send_buf, cb->send_buf_fill);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: Appending %zu bytes to the spool "
+                "\"%s\" failed: %s", cb->send_buf_fill, cb->spool_dir,
+                sstrerror (status, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    return (0);
+}
+
 /* NOTE: You must hold cb->send_lock when calling this function! */
 static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
 {
@@ -172,6 +244,7 @@ static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
     if (cb->send_buf_fill <= 0)
     {
         cb->send_buf_init_time = cdtime ();
+        wg_spool_replay (cb);
         return (0);
     }
 
@@ -253,8 +326,6 @@ static int wg_callback_init (struct wg_callback *cb)
                 node, service, protocol);
     }
 
-    wg_reset_buffer (cb);
-
     return (0);
 }
 
@@ -284,6 +355,10 @@ static void wg_callback_free (void *data)
     sfree(cb->prefix);
     sfree(cb->postfix);
 
+    if (cb->spool != NULL)
+        spool_close (cb->spool);
+    sfree(cb->spool_dir);
+
     pthread_mutex_destroy (&cb->send_lock);
 
     sfree(cb);
@@ -306,7 +381,7 @@ static int wg_flush (cdtime_t timeout,
     if (cb->sock_fd < 0)
     {
         status = wg_callback_init (cb);
-        if (status != 0)
+        if ((status != 0) && (cb->spool == NULL))
         {
             /* An error message has already been printed. */
             pthread_mutex_unlock (&cb->send_lock);
@@ -329,10 +404,12 @@ static int wg_send_message (char const *message, struct wg_callback *cb)
 
     pthread_mutex_lock (&cb->send_lock);
 
+    /* If a spool is configured, messages are buffered and spooled while the
+     * destination is unreachable. */
     if (cb->sock_fd < 0)
     {
         status = wg_callback_init (cb);
-        if (status != 0)
+        if ((status != 0) && (cb->spool == NULL))
         {
             /* An error message has already been printed. */
             pthread_mutex_unlock (&cb->send_lock);
@@ -472,6 +549,8 @@ static int wg_config_node (oconfig_item_t *ci)
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->format_flags = GRAPHITE_STORE_RATES;
+    cb->spool_size_limit = WG_DEFAULT_SPOOL_SIZE_LIMIT;
+    wg_reset_buffer (cb);
 
     /* FIXME: Legacy configuration syntax. */
     if (strcasecmp ("Carbon", ci->key) != 0)
@@ -524,6 +603,12 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("SpoolDirectory", child->key) == 0)
+            cf_util_get_string (child, &cb->spool_dir);
+        else if (strcasecmp ("SpoolSizeLimit", child->key) == 0)
+            cf_util_get_int (child, &cb->spool_size_limit);
+        else if (strcasecmp ("SpoolReplayRate", child->key) == 0)
+            cf_util_get_int (child, &cb->spool_replay_rate);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -541,6 +626,22 @@ static int wg_config_node (oconfig_item_t *ci)
         return (status);
     }
 
+    if (cb->spool_dir != NULL)
+    {
+        cb->spool = spool_open (cb->spool_dir, /* segment_size = */ 0,
+                (uint64_t) (cb->spool_size_limit > 0 ? cb->spool_size_limit : 0)
+                * 1024 * 1024,
+                (uint64_t) (cb->spool_replay_rate > 0 ? cb->spool_replay_rate : 0));
+        if (cb->spool == NULL)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: Opening the spool \"%s\" failed: %s",
+                    cb->spool_dir, sstrerror (errno, errbuf, sizeof (errbuf)));
+            wg_callback_free (cb);
+            return (-1);
+        }
+    }
+
     /* FIXME: Legacy configuration syntax. */
     if (cb->name == NULL)
         ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s/%s",
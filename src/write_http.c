@@ -26,9 +26,11 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "configfile.h"
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 #include "utils_format_json.h"
+#include "utils_spool.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -36,6 +38,16 @@
 
 #include <curl/curl.h>
 
+#ifndef WH_DEFAULT_SPOOL_SIZE_LIMIT
+# define WH_DEFAULT_SPOOL_SIZE_LIMIT 1024 /* MB */
+#endif
+
+/* Maximum number of bytes replayed from the spool per sent buffer, so that
+ * posting a large backlog does not block the write threads. */
+#ifndef WH_SPOOL_REPLAY_SIZE
+# define WH_SPOOL_REPLAY_SIZE (64 * 4096)
+#endif
+
 /*
  * Private variables
  */
@@ -63,6 +75,12 @@ struct wh_callback_s
         size_t send_buffer_fill;
         cdtime_t send_buffer_init_time;
 
+        char    *spool_dir;
+        int      spool_size_limit;
+        int      spool_replay_rate;
+        spool_t *spool;
+        size_t   spool_replay_budget;
+
         pthread_mutex_t send_lock;
 };
 typedef struct wh_callback_s wh_callback_t;
@@ -82,11 +100,13 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
         }
 } /* }}} wh_reset_buffer */
 
-static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+static int wh_post (wh_callback_t *cb, /* {{{ */
+                void const *data, size_t size)
 {
         int status = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, data);
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE, (long) size);
         status = curl_easy_perform (cb->curl);
         if (status != CURLE_OK)
         {
@@ -95,6 +115,61 @@ static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
                                 status, cb->curl_errbuf);
         }
         return (status);
+} /* }}} int wh_post */
+
+static int wh_spool_replay_cb (void const *data, size_t size, /* {{{ */
+                void *user_data)
+{
+        wh_callback_t *cb = user_data;
+
+        if (size > cb->spool_replay_budget)
+                return (-1);
+        if (wh_post (cb, data, size) != CURLE_OK)
+                return (-1);
+
+        cb->spool_replay_budget -= size;
+        return (0);
+} /* }}} int wh_spool_replay_cb */
+
+/* Posts data from the spool, if any. Returns zero if the spool has been
+ * emptied. */
+static int wh_spool_replay (wh_callback_t *cb) /* {{{ */
+{
+        if ((cb->spool == NULL) || (spool_pending (cb->spool) == 0))
+                return (0);
+
+        cb->spool_replay_budget = WH_SPOOL_REPLAY_SIZE;
+        spool_replay (cb->spool, wh_spool_replay_cb, cb);
+
+        return ((spool_pending (cb->spool) == 0) ? 0 : -1);
+} /* }}} int wh_spool_replay */
+
+static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+{
+        size_t size = strlen (cb->send_buffer);
+        int status;
+
+        if (cb->spool == NULL)
+                return (wh_post (cb, cb->send_buffer, size));
+
+        /* Post older data first. If the server is unreachable or the spool
+         * could not be emptied, append the buffer to the spool so that the
+         * order of the data is retained. */
+        if ((wh_spool_replay (cb) == 0)
+                        && (wh_post (cb, cb->send_buffer, size) == CURLE_OK))
+                return (0);
+
+        status = spool_append (cb->spool, cb->send_buffer, size);
+        if (status != 0)
+        {
+                char errbuf[1024];
+                ERROR ("write_http plugin: Appending %zu bytes to the spool "
+                                "\"%s\" failed: %s", size, cb->spool_dir,
+                                sstrerror (status, errbuf, sizeof (errbuf)));
+                return (-1);
+        }
+
+        return (0);
 } /* }}} wh_send_buffer */
 
 static int wh_callback_init (wh_callback_t *cb) /* {{{ */
@@ -182,6 +257,7 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 if (cb->send_buffer_fill <= 0)
                 {
                         cb->send_buffer_init_time = cdtime ();
+                        wh_spool_replay (cb);
                         return (0);
                 }
 
@@ -193,6 +269,7 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 if (cb->send_buffer_fill <= 2)
                 {
                         cb->send_buffer_init_time = cdtime ();
+                        wh_spool_replay (cb);
                         return (0);
                 }
 
@@ -270,6 +347,10 @@ static void wh_callback_free (void *data) /* {{{ */
         sfree (cb->credentials);
         sfree (cb->cacert);
 
+        if (cb->spool != NULL)
+                spool_close (cb->spool);
+        sfree (cb->spool_dir);
+
         sfree (cb);
 } /* }}} void wh_callback_free */
 
@@ -524,6 +605,7 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
         cb->cacert = NULL;
         cb->format = WH_FORMAT_COMMAND;
         cb->curl = NULL;
+        cb->spool_size_limit = WH_DEFAULT_SPOOL_SIZE_LIMIT;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
 
@@ -549,6 +631,12 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                         config_set_format (cb, child);
                 else if (strcasecmp ("StoreRates", child->key) == 0)
                         config_set_boolean (&cb->store_rates, child);
+                else if (strcasecmp ("SpoolDirectory", child->key) == 0)
+                        config_set_string (&cb->spool_dir, child);
+                else if (strcasecmp ("SpoolSizeLimit", child->key) == 0)
+                        cf_util_get_int (child, &cb->spool_size_limit);
+                else if (strcasecmp ("SpoolReplayRate", child->key) == 0)
+                        cf_util_get_int (child, &cb->spool_replay_rate);
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -556,6 +644,24 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                 }
         }
 
+        if (cb->spool_dir != NULL)
+        {
+                cb->spool = spool_open (cb->spool_dir, /* segment_size = */ 0,
+                                (uint64_t) ((cb->spool_size_limit > 0)
+                                        ? cb->spool_size_limit : 0) * 1024 * 1024,
+                                (uint64_t) ((cb->spool_replay_rate > 0)
+                                        ? cb->spool_replay_rate : 0));
+                if (cb->spool == NULL)
+                {
+                        char errbuf[1024];
+                        ERROR ("write_http plugin: Opening the spool \"%s\" "
+                                        "failed: %s", cb->spool_dir,
+                                        sstrerror (errno, errbuf, sizeof (errbuf)));
+                        wh_callback_free (cb);
+                        return (-1);
+                }
+        }
+
         DEBUG ("write_http: Registering write callback with URL %s",
                         cb->location);
 